@@ -0,0 +1,388 @@
+/*
+GDEM : C++ wrapper over GDAL for working with DEM data.
+Copyright (C) 2024  Pritam Halder
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <https://www.gnu.org/licenses/>.
+
+Author : Pritam Halder
+Email : pritamhalder.portfolio@gmail.com
+*/
+
+#pragma once
+
+
+#include <algorithm>
+#include <atomic>
+#include <cstdint>
+#include <filesystem>
+#include <mutex>
+#include <string>
+#include <system_error>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+
+#include <gdal/cpl_string.h>
+#include <gdal/cpl_vsi.h>
+#include <gdal/gdal_priv.h>
+#include <gdal/gdal_utils.h>
+
+#include "GDEM/Type.hpp"
+
+
+
+namespace GDEM {
+
+struct Window {
+    size_t row;
+    size_t column;
+    size_t rows;
+    size_t columns;
+
+    size_t size() const {
+        return this->rows * this->columns;
+    }
+};
+
+
+
+// File backing the dataset, empty for datasets without one (in-memory, VRT)
+static std::filesystem::path SourcePath(GDALDataset* dataset) {
+    const char *description = dataset->GetDescription();
+
+    if (description != nullptr && description[0] != '\0' && std::filesystem::exists(description)) {
+        return std::filesystem::path(description);
+    }
+
+    return std::filesystem::path();
+}
+
+
+
+// Name of a new `/vsimem/` file, unique within the process (`inline` so that every translation unit shares the counter)
+inline std::string MemoryPath(const std::string& prefix, const std::string& extension) {
+    static std::atomic<uint64_t> counter(0);
+    return "/vsimem/" + prefix + "_" + std::to_string(counter++) + extension;
+}
+
+
+
+// Mosaic of DEM files (later files take priority where they overlap) as a VRT in a `/vsimem/` file, which every
+// thread can open its own handle of (see `BandReader`). The file is removed with the mosaic.
+class Mosaic {
+private:
+    std::string path;
+    GDALDataset *dataset;
+
+public:
+    Mosaic(const std::vector<std::string>& source_filepaths)
+        : path(MemoryPath("gdem_mosaic", ".vrt")),
+        dataset(nullptr)
+    {
+        if (source_filepaths.empty()) {
+            throw std::runtime_error("no input file paths provided");
+        }
+
+        for (const std::string& source : source_filepaths) {
+            if (!std::filesystem::exists(source)) {
+                throw std::runtime_error("one or more of source files doesn't exists");
+            }
+        }
+
+        GDALRegister_GTiff();
+
+        std::vector<const char*> paths;
+        for (const std::string& source : source_filepaths) {
+            paths.push_back(source.c_str());
+        }
+
+        GDALDatasetH mosaic = GDALBuildVRT(this->path.c_str(), static_cast<int>(paths.size()), nullptr, paths.data(), nullptr, nullptr);
+        if (mosaic == nullptr) {
+            VSIUnlink(this->path.c_str());
+            throw std::runtime_error("failed to create mosaic");
+        }
+
+        this->dataset = GDALDataset::FromHandle(mosaic);
+        this->dataset->FlushCache();
+    }
+
+    Mosaic(const Mosaic& o) = delete;
+    Mosaic& operator=(const Mosaic& o) = delete;
+    Mosaic(Mosaic&& o) noexcept = delete;
+    Mosaic& operator=(Mosaic&& o) noexcept = delete;
+
+    ~Mosaic() {
+        if (this->dataset != nullptr) {
+            GDALClose(this->dataset);
+        }
+        VSIUnlink(this->path.c_str());
+    }
+
+    GDALDataset* get_dataset() const {
+        return this->dataset;
+    }
+};
+
+
+
+// Splits the band into windows following its natural (on-disk) block layout. Strip layouts
+// (blocks spanning the whole width) are coalesced until a window holds at least `minimum_size` values.
+static std::vector<Window> Blocks(GDALRasterBand* band, size_t minimum_size = 1 << 18) {
+    int block_x_size, block_y_size;
+    band->GetBlockSize(&block_x_size, &block_y_size);
+
+    size_t rows = band->GetYSize();
+    size_t columns = band->GetXSize();
+    size_t block_rows = std::max(1, block_y_size);
+    size_t block_columns = std::max(1, block_x_size);
+
+    if (block_columns >= columns) {
+        block_columns = columns;
+        block_rows *= std::max<size_t>(1, minimum_size / (block_rows * block_columns));
+    }
+
+    std::vector<Window> windows;
+    for (size_t row = 0; row < rows; row += block_rows) {
+        for (size_t column = 0; column < columns; column += block_columns) {
+            windows.push_back({
+                row,
+                column,
+                std::min(block_rows, rows - row),
+                std::min(block_columns, columns - column)
+            });
+        }
+    }
+
+    return windows;
+}
+
+
+
+// Splits the band into full width strips aligned to its natural block rows, each holding at least
+// `minimum_size` values (for row-wise processing which needs whole rows, like neighbourhood operations).
+static std::vector<Window> Strips(GDALRasterBand* band, size_t minimum_size = 1 << 18) {
+    int block_x_size, block_y_size;
+    band->GetBlockSize(&block_x_size, &block_y_size);
+
+    size_t rows = band->GetYSize();
+    size_t columns = std::max(1, band->GetXSize());
+    size_t block_rows = std::max(1, block_y_size);
+    size_t strip_rows = block_rows * std::max<size_t>(1, (minimum_size + block_rows * columns - 1) / (block_rows * columns));
+
+    std::vector<Window> windows;
+    for (size_t row = 0; row < rows; row += strip_rows) {
+        windows.push_back({row, 0, std::min(strip_rows, rows - row), columns});
+    }
+
+    return windows;
+}
+
+
+
+// Reads raster windows concurrently. GDAL dataset handles must not be shared between threads, so
+// every thread gets its own handle of the dataset's file; datasets without a file (in-memory, VRT)
+// fall back to serialized reads over the shared handle.
+template <ValidDataType DataType, uint16_t raster_number = 1>
+class BandReader {
+private:
+    GDALDataset *dataset;
+    std::string file_path;
+    std::mutex mutex;
+    std::mutex shared_mutex;
+    std::unordered_map<std::thread::id, GDALDataset*> handles;
+
+    GDALRasterBand* band() {
+        if (this->file_path.empty()) {
+            return nullptr;
+        }
+
+        std::lock_guard<std::mutex> lock(this->mutex);
+
+        auto it = this->handles.find(std::this_thread::get_id());
+        if (it != this->handles.end()) {
+            return it->second != nullptr ? it->second->GetRasterBand(raster_number) : nullptr;
+        }
+
+        GDALDataset *handle = static_cast<GDALDataset*>(GDALOpen(this->file_path.c_str(), GA_ReadOnly));
+        this->handles[std::this_thread::get_id()] = handle;
+
+        return handle != nullptr ? handle->GetRasterBand(raster_number) : nullptr;
+    }
+
+public:
+    BandReader(GDALDataset* dataset)
+        : dataset(dataset)
+    {
+        if (dataset == nullptr) {
+            throw std::runtime_error("dataset provided is NULL");
+        }
+
+        if (raster_number > dataset->GetRasterCount()) {
+            throw std::runtime_error("invalid raster band " + std::to_string(raster_number));
+        }
+
+        // in-memory files (e.g. `/vsimem/` VRTs) can be opened by every thread as well
+        const char *description = dataset->GetDescription();
+        VSIStatBufL stat;
+        if (STARTS_WITH(description, "/vsimem/") && VSIStatL(description, &stat) == 0) {
+            this->file_path = description;
+        } else {
+            this->file_path = SourcePath(dataset).string();
+        }
+    }
+
+    BandReader(const BandReader& o) = delete;
+    BandReader& operator=(const BandReader& o) = delete;
+    BandReader(BandReader&& o) noexcept = delete;
+    BandReader& operator=(BandReader&& o) noexcept = delete;
+
+    ~BandReader() {
+        for (auto& [id, handle] : this->handles) {
+            if (handle != nullptr) GDALClose(handle);
+        }
+    }
+
+    size_t rows() const {
+        return this->dataset->GetRasterYSize();
+    }
+
+    size_t columns() const {
+        return this->dataset->GetRasterXSize();
+    }
+
+    GDALRasterBand* shared() const {
+        return this->dataset->GetRasterBand(raster_number);
+    }
+
+    // reads the window into a `buffer_rows` x `buffer_columns` buffer, decimating (or replicating) as needed
+    void read(const Window& window, DataType* buffer, size_t buffer_rows, size_t buffer_columns) {
+        GDALRasterBand *own = this->band();
+
+        CPLErr status;
+        if (own != nullptr) {
+            status = own->RasterIO(
+                GF_Read, window.column, window.row, window.columns, window.rows,
+                buffer, buffer_columns, buffer_rows, BufferType<DataType>(), 0, 0
+            );
+        } else {
+            std::lock_guard<std::mutex> lock(this->shared_mutex);
+
+            status = this->shared()->RasterIO(
+                GF_Read, window.column, window.row, window.columns, window.rows,
+                buffer, buffer_columns, buffer_rows, BufferType<DataType>(), 0, 0
+            );
+        }
+
+        if (status != CE_None) {
+            throw std::runtime_error("failed to read raster data");
+        }
+    }
+
+    void read(const Window& window, DataType* buffer) {
+        this->read(window, buffer, window.rows, window.columns);
+    }
+
+    std::vector<DataType> read(const Window& window) {
+        std::vector<DataType> buffer(window.size());
+        this->read(window, buffer.data());
+        return buffer;
+    }
+};
+
+
+
+// Creates a tiled GeoTiff of `rows` x `columns` with the given georeferencing, for block wise outputs
+static GDALDataset* Create(
+    const std::filesystem::path& destination_filepath, size_t rows, size_t columns,
+    const double* geotransform, const std::string& projection, GDALDataType data_type, double nodata_value
+) {
+    GDALRegister_GTiff();
+
+    CPLStringList options;
+    options.SetNameValue("TILED", "YES");
+    options.SetNameValue("BIGTIFF", "IF_SAFER");
+
+    GDALDriver *driver = GetGDALDriverManager()->GetDriverByName("GTiff");
+    GDALDataset *output_dataset = driver->Create(
+        destination_filepath.string().c_str(),
+        columns,
+        rows,
+        1,
+        data_type,
+        options.List()
+    );
+
+    if (output_dataset == nullptr) {
+        throw std::runtime_error("failed to create output dataset");
+    }
+
+    if (geotransform != nullptr) {
+        output_dataset->SetGeoTransform(const_cast<double*>(geotransform));
+    }
+    output_dataset->SetProjection(projection.c_str());
+    output_dataset->GetRasterBand(1)->SetNoDataValue(nodata_value);
+
+    return output_dataset;
+}
+
+
+// Creates a tiled GeoTiff of the same size & georeferencing as the source dataset, for block wise outputs
+static GDALDataset* Create(const std::filesystem::path& destination_filepath, GDALDataset* source_dataset, GDALDataType data_type, double nodata_value) {
+    double geotransform[6];
+    bool georeferenced = source_dataset->GetGeoTransform(geotransform) == CE_None;
+
+    return Create(
+        destination_filepath,
+        source_dataset->GetRasterYSize(),
+        source_dataset->GetRasterXSize(),
+        georeferenced ? geotransform : nullptr,
+        source_dataset->GetProjectionRef(),
+        data_type,
+        nodata_value
+    );
+}
+
+
+
+// Writes raster windows from concurrent threads, serialized over the dataset's single handle
+template <typename DataType> requires std::is_arithmetic_v<DataType>
+class BandWriter {
+private:
+    GDALRasterBand *band;
+    std::mutex mutex;
+
+public:
+    BandWriter(GDALDataset* dataset)
+        : band(dataset->GetRasterBand(1))
+    {}
+
+    BandWriter(const BandWriter& o) = delete;
+    BandWriter& operator=(const BandWriter& o) = delete;
+    BandWriter(BandWriter&& o) noexcept = delete;
+    BandWriter& operator=(BandWriter&& o) noexcept = delete;
+    ~BandWriter() = default;
+
+    void write(const Window& window, const DataType* buffer) {
+        std::lock_guard<std::mutex> lock(this->mutex);
+
+        if (this->band->RasterIO(
+            GF_Write, window.column, window.row, window.columns, window.rows,
+            const_cast<DataType*>(buffer), window.columns, window.rows, BufferType<DataType>(), 0, 0
+        ) != CE_None) {
+            throw std::runtime_error("failed to write raster data");
+        }
+    }
+};
+
+}
@@ -0,0 +1,807 @@
+/*
+GDEM : C++ wrapper over GDAL for working with DEM data.
+Copyright (C) 2024  Pritam Halder
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <https://www.gnu.org/licenses/>.
+
+Author : Pritam Halder
+Email : pritamhalder.portfolio@gmail.com
+*/
+
+#pragma once
+
+
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <bit>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <filesystem>
+#include <fstream>
+#include <functional>
+#include <limits>
+#include <list>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <system_error>
+#include <thread>
+#include <unordered_map>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+#include <gdal/gdal_priv.h>
+
+#include "GDEM/Block.hpp"
+#include "GDEM/Type.hpp"
+#include "GDEM/Uring.hpp"
+
+
+
+namespace GDEM {
+
+namespace detail {
+
+// FNV-1a, stable across runs & platforms (names of the disk cache's directories)
+static uint64_t Hash(const std::string& text) {
+    uint64_t hash = 0xcbf29ce484222325;
+    for (unsigned char c : text) {
+        hash = (hash ^ c) * 0x100000001b3;
+    }
+    return hash;
+}
+
+
+// Integer key of a value, so that nearby values have nearby keys (floats through their ordered bit patterns)
+template <ValidDataType DataType>
+static uint64_t Key(DataType value) {
+    if constexpr (std::is_floating_point_v<DataType>) {
+        using Bits = std::conditional_t<sizeof(DataType) == 4, int32_t, int64_t>;
+        Bits bits = std::bit_cast<Bits>(value);
+        bits ^= (bits >> (sizeof(Bits) * 8 - 1)) & std::numeric_limits<Bits>::max();
+        return static_cast<uint64_t>(static_cast<int64_t>(bits));
+    } else {
+        return static_cast<uint64_t>(value);
+    }
+}
+
+
+template <ValidDataType DataType>
+static DataType Value(uint64_t key) {
+    if constexpr (std::is_floating_point_v<DataType>) {
+        using Bits = std::conditional_t<sizeof(DataType) == 4, int32_t, int64_t>;
+        Bits bits = static_cast<Bits>(static_cast<int64_t>(key));
+        bits ^= (bits >> (sizeof(Bits) * 8 - 1)) & std::numeric_limits<Bits>::max();
+        return std::bit_cast<DataType>(bits);
+    } else {
+        return static_cast<DataType>(key);
+    }
+}
+
+
+// planar prediction (left + above - above left) of key `i` of a block `columns` wide, wrapping arithmetic
+static uint64_t Predict(const uint64_t* keys, size_t i, size_t columns) {
+    size_t r = i / columns, c = i % columns;
+    if (r == 0) return c == 0 ? 0 : keys[i - 1];
+    if (c == 0) return keys[i - columns];
+    return keys[i - 1] + keys[i - columns] - keys[i - columns - 1];
+}
+
+
+// Lossless DEM block codec : every value's key minus its planar prediction, zigzag encoded, bit packed by groups
+// of 64 values with the group's bit width in a leading byte. Smooth terrain leaves a few bits per value.
+template <ValidDataType DataType>
+static std::vector<uint8_t> Encode(const std::vector<DataType>& values, size_t columns) {
+    size_t count = values.size();
+    std::vector<uint64_t> keys(count);
+    for (size_t i = 0; i < count; i++) {
+        keys[i] = Key(values[i]);
+    }
+
+    std::vector<uint8_t> encoded;
+    encoded.reserve(count * sizeof(DataType) / 2);
+
+    uint64_t accumulator = 0;
+    size_t filled = 0;
+    auto put = [&] (uint64_t value, size_t width) {
+        accumulator |= value << filled;
+        filled += width;
+        while (filled >= 8) {
+            encoded.push_back(static_cast<uint8_t>(accumulator));
+            accumulator >>= 8;
+            filled -= 8;
+        }
+    };
+
+    std::array<uint64_t, 64> group;
+    for (size_t start = 0; start < count; start += 64) {
+        size_t n = std::min<size_t>(64, count - start);
+        uint64_t bits = 0;
+        for (size_t k = 0; k < n; k++) {
+            uint64_t residual = keys[start + k] - Predict(keys.data(), start + k, columns);
+            group[k] = (residual << 1) ^ static_cast<uint64_t>(static_cast<int64_t>(residual) >> 63);
+            bits |= group[k];
+        }
+
+        size_t width = std::bit_width(bits);
+        encoded.push_back(static_cast<uint8_t>(width));
+        for (size_t k = 0; k < n; k++) {
+            if (width > 32) {
+                put(group[k] & 0xffffffff, 32);
+                put(group[k] >> 32, width - 32);
+            } else {
+                put(group[k], width);
+            }
+        }
+        if (filled > 0) {
+            put(0, 8 - filled);
+        }
+    }
+
+    encoded.shrink_to_fit();
+    return encoded;
+}
+
+
+template <ValidDataType DataType>
+static std::vector<DataType> Decode(const std::vector<uint8_t>& encoded, size_t count, size_t columns) {
+    std::vector<uint64_t> keys(count);
+
+    size_t position = 0;
+    uint64_t accumulator = 0;
+    size_t filled = 0;
+    auto get = [&] (size_t width) {
+        while (filled < width) {
+            accumulator |= static_cast<uint64_t>(encoded[position++]) << filled;
+            filled += 8;
+        }
+        uint64_t value = width == 0 ? 0 : accumulator & (~uint64_t(0) >> (64 - width));
+        accumulator = width == 64 ? 0 : accumulator >> width;
+        filled -= width;
+        return value;
+    };
+
+    for (size_t start = 0; start < count; start += 64) {
+        size_t n = std::min<size_t>(64, count - start);
+        size_t width = encoded[position++];
+        for (size_t k = 0; k < n; k++) {
+            // wide values in two reads, low bits first (sequenced, operands of `|` aren't)
+            uint64_t zigzag;
+            if (width > 32) {
+                uint64_t low = get(32);
+                uint64_t high = get(width - 32);
+                zigzag = low | (high << 32);
+            } else {
+                zigzag = get(width);
+            }
+            uint64_t residual = (zigzag >> 1) ^ (~(zigzag & 1) + 1);
+            keys[start + k] = residual + Predict(keys.data(), start + k, columns);
+        }
+        accumulator = 0;
+        filled = 0;
+    }
+
+    std::vector<DataType> values(count);
+    for (size_t i = 0; i < count; i++) {
+        values[i] = Value<DataType>(keys[i]);
+    }
+    return values;
+}
+
+}
+
+
+
+// Thread safe LRU cache of a band's decoded blocks (the windows of `Blocks`), bounded to `capacity` bytes.
+// Blocks are handed out as shared pointers, so evicted blocks stay valid for as long as they are in use.
+// Misses are read outside the lock, concurrent misses of the same block may read it twice (one is kept).
+// An optional compressed tier (`compressed_capacity` bytes) keeps the blocks evicted from the decoded tier
+// encoded with the lossless `detail::Encode` codec, and decodes them back on demand instead of reading them again,
+// and an optional disk tier (`set_disk_cache`) keeps decoded blocks across runs.
+template <ValidDataType DataType, uint16_t raster_number = 1>
+class BlockCache {
+public:
+    using Block = std::shared_ptr<const std::vector<DataType>>;
+
+    // statistics of a tier : `hits` are requests it served, `misses` requests it passed on (to the compressed
+    // tier or to the dataset), `bytes` its size and `decoded_bytes` the size of its blocks decoded
+    struct Tier {
+        uint64_t hits;
+        uint64_t misses;
+        uint64_t evictions;
+        size_t blocks;
+        size_t bytes;
+        size_t decoded_bytes;
+    };
+
+private:
+    using Packed = std::shared_ptr<const std::vector<uint8_t>>;
+
+    BandReader<DataType, raster_number> reader;
+    std::vector<Window> windows;
+    size_t block_rows;
+    size_t block_columns;
+    size_t grid_columns;
+
+    size_t capacity;
+    size_t used;
+    std::list<size_t> order;    // most recently used first
+    std::unordered_map<size_t, std::pair<Block, std::list<size_t>::iterator>> blocks;
+
+    size_t compressed_capacity;
+    size_t compressed_used;
+    size_t compressed_decoded;
+    std::list<size_t> compressed_order;
+    std::unordered_map<size_t, std::pair<Packed, std::list<size_t>::iterator>> compressed;
+
+    std::filesystem::path disk_root;
+    std::filesystem::path disk_directory;   // this dataset's blocks, empty for no disk tier
+    size_t disk_capacity;
+    size_t disk_used;                       // of the whole `disk_root`
+    size_t disk_blocks;
+    mutable std::mutex disk_mutex;
+
+    mutable std::mutex mutex;
+
+    std::atomic<uint64_t> hit_count;
+    std::atomic<uint64_t> miss_count;
+    std::atomic<uint64_t> eviction_count;
+    std::atomic<uint64_t> compressed_hit_count;
+    std::atomic<uint64_t> compressed_miss_count;
+    std::atomic<uint64_t> compressed_eviction_count;
+    std::atomic<uint64_t> disk_hit_count;
+    std::atomic<uint64_t> disk_miss_count;
+    std::atomic<uint64_t> disk_eviction_count;
+
+#ifdef GDEM_WITH_IO_URING
+    std::unique_ptr<detail::Uring> uring;
+    std::string native_path;                // file whose blocks are read raw, empty to read them through GDAL
+    size_t native_rows;                     // its (TIFF) block size
+    size_t native_columns;
+    size_t native_per_row;
+    std::vector<std::pair<uint64_t, uint64_t>> native_blocks;   // offset & size of every TIFF block
+
+    // reads the block's window straight from the TIFF blocks it covers, false where GDAL must read it
+    bool read_native(size_t index, std::vector<DataType>& values) {
+        const Window& w = this->windows[index];
+        size_t first_row = w.row / this->native_rows, last_row = (w.row + w.rows - 1) / this->native_rows;
+        size_t first_column = w.column / this->native_columns, last_column = (w.column + w.columns - 1) / this->native_columns;
+
+        std::vector<std::vector<DataType>> parts;
+        std::vector<detail::Segment> segments;
+        parts.reserve((last_row - first_row + 1) * (last_column - first_column + 1));
+
+        for (size_t r = first_row; r <= last_row; r++) {
+            for (size_t c = first_column; c <= last_column; c++) {
+                auto [offset, size] = this->native_blocks[r * this->native_per_row + c];
+                if (offset == 0 || size == 0) return false;     // sparse
+
+                parts.emplace_back(size / sizeof(DataType));
+                segments.push_back({offset, parts.back().size() * sizeof(DataType), parts.back().data()});
+            }
+        }
+
+        if (!this->uring->read(this->native_path, std::move(segments), true).get()) {
+            return false;
+        }
+
+        values.resize(w.size());
+        size_t k = 0;
+        for (size_t r = first_row; r <= last_row; r++) {
+            for (size_t c = first_column; c <= last_column; c++) {
+                const std::vector<DataType>& part = parts[k++];
+                size_t block_row = r * this->native_rows, block_column = c * this->native_columns;
+
+                size_t row_begin = std::max(w.row, block_row), row_end = std::min(w.row + w.rows, block_row + this->native_rows);
+                size_t column_begin = std::max(w.column, block_column), column_end = std::min(w.column + w.columns, block_column + this->native_columns);
+
+                // the last strip can be shorter
+                if ((row_end - block_row) * this->native_columns > part.size()) return false;
+
+                for (size_t y = row_begin; y < row_end; y++) {
+                    std::copy_n(
+                        part.begin() + (y - block_row) * this->native_columns + (column_begin - block_column),
+                        column_end - column_begin,
+                        values.begin() + (y - w.row) * w.columns + (column_begin - w.column)
+                    );
+                }
+            }
+        }
+
+        return true;
+    }
+#endif
+
+    // block read from the dataset
+    std::vector<DataType> read(size_t index) {
+#ifdef GDEM_WITH_IO_URING
+        std::vector<DataType> values;
+        if (!this->native_path.empty() && this->read_native(index, values)) {
+            return values;
+        }
+#endif
+        return this->reader.read(this->windows[index]);
+    }
+
+    std::filesystem::path block_path(size_t index) const {
+        return this->disk_directory / (std::to_string(index) + ".block");
+    }
+
+    // block from the disk tier, `nullptr` when it isn't there
+    Block load(size_t index) {
+        std::filesystem::path path = this->block_path(index);
+        std::vector<DataType> values(this->windows[index].size());
+
+#ifdef GDEM_WITH_IO_URING
+        if (this->uring != nullptr) {
+            if (!this->uring->read(path.string(), {{0, values.size() * sizeof(DataType), values.data()}}).get()) {
+                return nullptr;
+            }
+        } else
+#endif
+        {
+            std::ifstream file(path, std::ios::binary);
+            file.read(reinterpret_cast<char*>(values.data()), values.size() * sizeof(DataType));
+            if (!file || file.peek() != std::char_traits<char>::eof()) {
+                return nullptr;
+            }
+        }
+
+        // least recently used by modification time
+        std::error_code error;
+        std::filesystem::last_write_time(path, std::filesystem::file_time_type::clock::now(), error);
+
+        return std::make_shared<const std::vector<DataType>>(std::move(values));
+    }
+
+    // writes a block to the disk tier (through a temporary file, so readers never see a partial block)
+    void store(size_t index, const Block& block) {
+        std::filesystem::path path = this->block_path(index);
+        std::filesystem::path temporary = path;
+        temporary += "." + std::to_string(std::hash<std::thread::id>()(std::this_thread::get_id())) + ".tmp";
+
+        std::error_code error;
+        {
+            std::ofstream file(temporary, std::ios::binary);
+            file.write(reinterpret_cast<const char*>(block->data()), block->size() * sizeof(DataType));
+            if (!file) {
+                file.close();
+                std::filesystem::remove(temporary, error);
+                return;
+            }
+        }
+
+        // a replaced block only counts its size difference (renamed under the lock, so concurrent stores count it once)
+        std::lock_guard<std::mutex> lock(this->disk_mutex);
+        uintmax_t replaced = std::filesystem::file_size(path, error);
+        bool added = static_cast<bool>(error);
+
+        std::filesystem::rename(temporary, path, error);
+        if (error) {
+            std::filesystem::remove(temporary, error);
+            return;
+        }
+
+        this->disk_used += block->size() * sizeof(DataType);
+        if (added) {
+            this->disk_blocks++;
+        } else {
+            this->disk_used -= std::min<size_t>(this->disk_used, replaced);
+        }
+        if (this->disk_used > this->disk_capacity) {
+            this->trim(this->disk_capacity / 10 * 9);
+        }
+    }
+
+    // evicts the least recently used blocks of the whole disk cache directory, down to `limit` bytes
+    void trim(size_t limit) {
+        std::vector<std::pair<std::filesystem::file_time_type, std::filesystem::path>> files;
+        size_t total = 0;
+
+        std::error_code error;
+        for (auto it = std::filesystem::recursive_directory_iterator(this->disk_root, error); !error && it != std::filesystem::recursive_directory_iterator(); it.increment(error)) {
+            if (it->is_regular_file(error) && it->path().extension() == ".block") {
+                files.emplace_back(it->last_write_time(error), it->path());
+                total += it->file_size(error);
+            }
+        }
+        std::sort(files.begin(), files.end());
+
+        for (const auto& [time, path] : files) {
+            if (total <= limit) break;
+
+            size_t size = std::filesystem::file_size(path, error);
+            if (!error && std::filesystem::remove(path, error)) {
+                total -= size;
+                this->disk_eviction_count++;
+                if (path.parent_path() == this->disk_directory && this->disk_blocks > 0) {
+                    this->disk_blocks--;
+                }
+            }
+        }
+
+        this->disk_used = total;
+    }
+
+    // encodes a block evicted from the decoded tier into the compressed tier (unless it's there already)
+    void keep(size_t index, const Block& block) {
+        {
+            std::lock_guard<std::mutex> lock(this->mutex);
+            if (this->compressed.contains(index)) return;
+        }
+
+        Packed packed = std::make_shared<const std::vector<uint8_t>>(detail::Encode(*block, this->windows[index].columns));
+        size_t size = packed->size();
+
+        std::lock_guard<std::mutex> lock(this->mutex);
+        if (this->compressed.contains(index) || size > this->compressed_capacity) return;
+
+        while (!this->compressed_order.empty() && this->compressed_used + size > this->compressed_capacity) {
+            auto evicted = this->compressed.find(this->compressed_order.back());
+            this->compressed_used -= evicted->second.first->size();
+            this->compressed_decoded -= this->windows[evicted->first].size() * sizeof(DataType);
+            this->compressed.erase(evicted);
+            this->compressed_order.pop_back();
+            this->compressed_eviction_count++;
+        }
+
+        this->compressed_order.push_front(index);
+        this->compressed.emplace(index, std::make_pair(packed, this->compressed_order.begin()));
+        this->compressed_used += size;
+        this->compressed_decoded += block->size() * sizeof(DataType);
+    }
+
+    // block through the tiers, `counted` in the decoded tier's hits & misses (prefetches aren't)
+    Block fetch(size_t index, bool counted) {
+        Packed packed;
+        {
+            std::lock_guard<std::mutex> lock(this->mutex);
+
+            auto it = this->blocks.find(index);
+            if (it != this->blocks.end()) {
+                this->order.splice(this->order.begin(), this->order, it->second.second);
+                if (counted) {
+                    this->hit_count++;
+                }
+                return it->second.first;
+            }
+
+            auto c = this->compressed.find(index);
+            if (c != this->compressed.end()) {
+                this->compressed_order.splice(this->compressed_order.begin(), this->compressed_order, c->second.second);
+                packed = c->second.first;
+            }
+        }
+
+        if (counted) {
+            this->miss_count++;
+        }
+        Block loaded;
+        if (packed != nullptr) {
+            this->compressed_hit_count++;
+            loaded = std::make_shared<const std::vector<DataType>>(detail::Decode<DataType>(*packed, this->windows[index].size(), this->windows[index].columns));
+        } else {
+            if (this->compressed_capacity > 0) {
+                this->compressed_miss_count++;
+            }
+
+            if (!this->disk_directory.empty() && (loaded = this->load(index)) != nullptr) {
+                this->disk_hit_count++;
+            } else {
+                loaded = std::make_shared<const std::vector<DataType>>(this->read(index));
+                if (!this->disk_directory.empty()) {
+                    this->disk_miss_count++;
+                    this->store(index, loaded);
+                }
+            }
+        }
+        size_t size = loaded->size() * sizeof(DataType);
+
+        std::vector<std::pair<size_t, Block>> evicted_blocks;
+        {
+            std::lock_guard<std::mutex> lock(this->mutex);
+
+            auto it = this->blocks.find(index);
+            if (it != this->blocks.end()) {
+                return it->second.first;
+            }
+
+            while (!this->order.empty() && this->used + size > this->capacity) {
+                auto evicted = this->blocks.find(this->order.back());
+                this->used -= evicted->second.first->size() * sizeof(DataType);
+                if (this->compressed_capacity > 0) {
+                    evicted_blocks.emplace_back(evicted->first, evicted->second.first);
+                }
+                this->blocks.erase(evicted);
+                this->order.pop_back();
+                this->eviction_count++;
+            }
+
+            this->order.push_front(index);
+            this->blocks.emplace(index, std::make_pair(loaded, this->order.begin()));
+            this->used += size;
+        }
+
+        for (const auto& [evicted, block] : evicted_blocks) {
+            this->keep(evicted, block);
+        }
+
+        return loaded;
+    }
+
+public:
+    // `capacity` in bytes of decoded blocks, `compressed_capacity` in bytes of encoded blocks (0 for no such tier)
+    BlockCache(GDALDataset* dataset, size_t capacity = size_t(256) << 20, size_t compressed_capacity = 0)
+        : reader(dataset),
+        windows(Blocks(reader.shared())),
+        block_rows(windows[0].rows),
+        block_columns(windows[0].columns),
+        grid_columns((reader.columns() + windows[0].columns - 1) / windows[0].columns),
+        capacity(capacity),
+        used(0),
+        compressed_capacity(compressed_capacity),
+        compressed_used(0),
+        compressed_decoded(0),
+        disk_capacity(0),
+        disk_used(0),
+        disk_blocks(0),
+        hit_count(0),
+        miss_count(0),
+        eviction_count(0),
+        compressed_hit_count(0),
+        compressed_miss_count(0),
+        compressed_eviction_count(0),
+        disk_hit_count(0),
+        disk_miss_count(0),
+        disk_eviction_count(0)
+    {}
+
+    BlockCache(const BlockCache& o) = delete;
+    BlockCache& operator=(const BlockCache& o) = delete;
+    BlockCache(BlockCache&& o) noexcept = delete;
+    BlockCache& operator=(BlockCache&& o) noexcept = delete;
+    ~BlockCache() = default;
+
+    // Adds a disk tier : blocks read from the dataset are also kept as raw files under `directory` (one per block,
+    // `DataType` values row major in native byte order), in a subdirectory per dataset identity (path, size,
+    // modification time, band, type & block layout), so that later caches of the same dataset (e.g. after a
+    // restart) read them back instead of decoding the dataset again. The whole `directory` (shareable between
+    // datasets) is bounded to `capacity` bytes, least recently used blocks evicted first. Only file backed datasets
+    // can have one, and it must be set before the cache is in use.
+    void set_disk_cache(const std::filesystem::path& directory, size_t capacity) {
+        std::filesystem::path source = SourcePath(this->reader.shared()->GetDataset());
+        if (source.empty()) {
+            throw std::runtime_error("disk cache requires a file backed dataset");
+        }
+
+        std::error_code error;
+        source = std::filesystem::canonical(source, error);
+        uintmax_t size = std::filesystem::file_size(source, error);
+        auto modified = std::filesystem::last_write_time(source, error).time_since_epoch().count();
+        if (error) {
+            throw std::runtime_error("failed to read '" + source.string() + "' attributes");
+        }
+
+        std::string identity = source.string() + "\n" + std::to_string(size) + "\n" + std::to_string(modified) + "\n"
+            + std::to_string(raster_number) + "\n" + std::to_string(sizeof(DataType)) + (std::is_floating_point_v<DataType> ? "f" : std::is_signed_v<DataType> ? "i" : "u") + "\n"
+            + std::to_string(this->block_rows) + "x" + std::to_string(this->block_columns) + "\n";
+
+        char name[17];
+        std::snprintf(name, sizeof(name), "%016llx", static_cast<unsigned long long>(detail::Hash(identity)));
+        std::filesystem::path own = directory / name;
+
+        std::filesystem::create_directories(own, error);
+        if (error) {
+            throw std::runtime_error("failed to create directory '" + own.string() + "'");
+        }
+
+        // a (hash colliding) different dataset's blocks are dropped
+        std::ifstream existing(own / "identity", std::ios::binary);
+        std::string stored((std::istreambuf_iterator<char>(existing)), std::istreambuf_iterator<char>());
+        existing.close();
+        if (stored != identity) {
+            for (const auto& entry : std::filesystem::directory_iterator(own, error)) {
+                std::filesystem::remove(entry.path(), error);
+            }
+            std::ofstream(own / "identity", std::ios::binary) << identity;
+        }
+
+        std::lock_guard<std::mutex> lock(this->disk_mutex);
+        this->disk_root = directory;
+        this->disk_directory = own;
+        this->disk_capacity = capacity;
+        this->disk_blocks = 0;
+        for (const auto& entry : std::filesystem::directory_iterator(own, error)) {
+            this->disk_blocks += entry.path().extension() == ".block";
+        }
+
+        this->trim(capacity);
+    }
+
+#ifdef GDEM_WITH_IO_URING
+    // Reads misses through io_uring (`entries` reads in flight at most), with O_DIRECT when `direct`: concurrent
+    // misses are submitted together as one batch, and every query waits for its own reads only. This covers the
+    // disk tier's block files, and the dataset's own blocks when it's an uncompressed, band interleaved GeoTIFF of
+    // `DataType` values in native byte order, read straight from the file instead of through GDAL (other datasets,
+    // and sparse blocks, are still read through GDAL). It must be set before the cache is in use.
+    void set_io_uring(unsigned entries = 256, bool direct = false) {
+        this->uring = std::make_unique<detail::Uring>(entries, direct);
+        this->native_path.clear();
+        this->native_blocks.clear();
+
+        GDALRasterBand *band = this->reader.shared();
+        GDALDataset *dataset = band->GetDataset();
+        std::filesystem::path source = SourcePath(dataset);
+        GDALDriver *driver = dataset->GetDriver();
+        if (source.empty() || driver == nullptr || std::string(driver->GetDescription()) != "GTiff") return;
+
+        const char *compression = dataset->GetMetadataItem("COMPRESSION", "IMAGE_STRUCTURE");
+        const char *interleave = dataset->GetMetadataItem("INTERLEAVE", "IMAGE_STRUCTURE");
+        if (
+            (compression != nullptr && std::string(compression) != "NONE")
+            || (dataset->GetRasterCount() > 1 && (interleave == nullptr || std::string(interleave) != "BAND"))
+            || band->GetMetadataItem("NBITS", "IMAGE_STRUCTURE") != nullptr
+            || band->GetRasterDataType() != BufferType<DataType>()
+        ) {
+            return;
+        }
+
+        char order[2] = {0, 0};
+        std::ifstream(source, std::ios::binary).read(order, 2);
+        char native = std::endian::native == std::endian::little ? 'I' : 'M';
+        if (order[0] != native || order[1] != native) return;
+
+        int block_columns, block_rows;
+        band->GetBlockSize(&block_columns, &block_rows);
+        this->native_rows = std::max(1, block_rows);
+        this->native_columns = std::max(1, block_columns);
+        this->native_per_row = (this->reader.columns() + this->native_columns - 1) / this->native_columns;
+        size_t per_column = (this->reader.rows() + this->native_rows - 1) / this->native_rows;
+
+        std::vector<std::pair<uint64_t, uint64_t>> blocks;
+        blocks.reserve(this->native_per_row * per_column);
+        for (size_t r = 0; r < per_column; r++) {
+            for (size_t c = 0; c < this->native_per_row; c++) {
+                std::string suffix = std::to_string(c) + "_" + std::to_string(r);
+                const char *offset = band->GetMetadataItem(("BLOCK_OFFSET_" + suffix).c_str(), "TIFF");
+                const char *size = band->GetMetadataItem(("BLOCK_SIZE_" + suffix).c_str(), "TIFF");
+                if (offset == nullptr || size == nullptr) return;
+
+                blocks.emplace_back(std::strtoull(offset, nullptr, 10), std::strtoull(size, nullptr, 10));
+            }
+        }
+
+        this->native_blocks = std::move(blocks);
+        this->native_path = source.string();
+    }
+
+    // whether dataset misses are read straight from the file (see `set_io_uring`)
+    bool native_reads() const {
+        return !this->native_path.empty();
+    }
+#endif
+
+    size_t rows() const {
+        return this->reader.rows();
+    }
+
+    size_t columns() const {
+        return this->reader.columns();
+    }
+
+    size_t count() const {
+        return this->windows.size();
+    }
+
+    size_t block_of(size_t row, size_t column) const {
+        return (row / this->block_rows) * this->grid_columns + column / this->block_columns;
+    }
+
+    const Window& window(size_t index) const {
+        return this->windows[index];
+    }
+
+    Block block(size_t index) {
+        return this->fetch(index, true);
+    }
+
+    // loads a block ahead of its use (see `Prefetcher`), without counting it as a hit or a miss
+    void prefetch(size_t index) {
+        this->fetch(index, false);
+    }
+
+    // whether a block is in the decoded tier
+    bool contains(size_t index) const {
+        std::lock_guard<std::mutex> lock(this->mutex);
+        return this->blocks.contains(index);
+    }
+
+    DataType value(size_t row, size_t column) {
+        size_t index = this->block_of(row, column);
+        const Window& w = this->windows[index];
+        return (*this->block(index))[(row - w.row) * w.columns + (column - w.column)];
+    }
+
+    uint64_t hits() const {
+        return this->hit_count;
+    }
+
+    uint64_t misses() const {
+        return this->miss_count;
+    }
+
+    uint64_t evictions() const {
+        return this->eviction_count;
+    }
+
+    Tier decoded_tier() const {
+        std::lock_guard<std::mutex> lock(this->mutex);
+        return {this->hit_count, this->miss_count, this->eviction_count, this->blocks.size(), this->used, this->used};
+    }
+
+    Tier disk_tier() const {
+        std::lock_guard<std::mutex> lock(this->disk_mutex);
+        return {this->disk_hit_count, this->disk_miss_count, this->disk_eviction_count, this->disk_blocks, this->disk_used, this->disk_used};
+    }
+
+    Tier compressed_tier() const {
+        std::lock_guard<std::mutex> lock(this->mutex);
+        return {
+            this->compressed_hit_count, this->compressed_miss_count, this->compressed_eviction_count,
+            this->compressed.size(), this->compressed_used, this->compressed_decoded
+        };
+    }
+};
+
+
+
+// The last `slots` blocks of a `BlockCache` in use by one walk across the DEM (a path search, a profile), so that
+// most of its lookups skip the cache's lock. Not thread safe, every thread walks with its own.
+template <ValidDataType DataType, uint16_t raster_number = 1, size_t slots = 8>
+class RecentBlocks {
+private:
+    using Block = typename BlockCache<DataType, raster_number>::Block;
+
+    BlockCache<DataType, raster_number>& cache;
+    std::array<std::pair<size_t, Block>, slots> recent;
+
+public:
+    RecentBlocks(BlockCache<DataType, raster_number>& cache)
+        : cache(cache)
+    {
+        this->recent.fill({std::numeric_limits<size_t>::max(), nullptr});
+    }
+
+    RecentBlocks(const RecentBlocks& o) = default;
+    RecentBlocks& operator=(const RecentBlocks& o) = delete;
+    RecentBlocks(RecentBlocks&& o) noexcept = default;
+    RecentBlocks& operator=(RecentBlocks&& o) noexcept = delete;
+    ~RecentBlocks() = default;
+
+    DataType value(size_t row, size_t column) {
+        size_t index = this->cache.block_of(row, column);
+        auto& slot = this->recent[index % slots];
+        if (slot.first != index) {
+            slot = {index, this->cache.block(index)};
+        }
+
+        const Window& w = this->cache.window(index);
+        return (*slot.second)[(row - w.row) * w.columns + (column - w.column)];
+    }
+};
+
+}
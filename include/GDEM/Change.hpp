@@ -0,0 +1,369 @@
+/*
+GDEM : C++ wrapper over GDAL for working with DEM data.
+Copyright (C) 2024  Pritam Halder
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <https://www.gnu.org/licenses/>.
+
+Author : Pritam Halder
+Email : pritamhalder.portfolio@gmail.com
+*/
+
+#pragma once
+
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <filesystem>
+#include <limits>
+#include <memory>
+#include <ostream>
+#include <string>
+#include <vector>
+
+#include <gdal/cpl_string.h>
+#include <gdal/cpl_vsi.h>
+#include <gdal/gdal_priv.h>
+#include <gdal/gdal_utils.h>
+
+#include "GDEM/Block.hpp"
+#include "GDEM/DEM.hpp"
+#include "GDEM/Parallel.hpp"
+#include "GDEM/Statistics.hpp"
+
+
+
+namespace GDEM {
+namespace Change {
+
+// rasters written while comparing, empty paths are skipped
+struct Outputs {
+    std::filesystem::path difference;           // Float32 `after - before`, -9999 for NODATA
+    std::filesystem::path absolute_difference;  // Float32 `|after - before|`, -9999 for NODATA
+    std::filesystem::path mask;                 // Byte, 1 where `|after - before| > threshold` else 0, 255 for NODATA
+};
+
+
+
+struct Report {
+    uint64_t count;     // no. of cells valid in both DEMs
+    uint64_t changed;   // no. of cells with `|after - before| > threshold`
+    double minimum;     // smallest `after - before`
+    double maximum;     // largest `after - before`
+    double bias;        // mean `after - before`
+    double mae;         // mean absolute difference
+    double rmse;        // root mean square difference
+
+    Report()
+        : count(0),
+        changed(0),
+        minimum(std::numeric_limits<double>::quiet_NaN()),
+        maximum(std::numeric_limits<double>::quiet_NaN()),
+        bias(std::numeric_limits<double>::quiet_NaN()),
+        mae(std::numeric_limits<double>::quiet_NaN()),
+        rmse(std::numeric_limits<double>::quiet_NaN())
+    {};
+
+    Report(const Report& o) = default;
+    Report& operator=(const Report& o) = default;
+    Report(Report&& o) noexcept = default;
+    Report& operator=(Report&& o) noexcept = default;
+    ~Report() = default;
+
+    friend std::ostream& operator<<(std::ostream& os, const Report& o) {
+        os
+            << "Count : " << o.count << "\n"
+            << "Changed : " << o.changed << "\n"
+            << "Minimum : " << o.minimum << "\n"
+            << "Maximum : " << o.maximum << "\n"
+            << "Bias : " << o.bias << "\n"
+            << "MAE : " << o.mae << "\n"
+            << "RMSE : " << o.rmse;
+
+        return os;
+    }
+};
+
+
+
+namespace detail {
+
+// sums of a block's differences, merged across blocks
+struct Sums {
+    uint64_t count = 0;
+    uint64_t changed = 0;
+    double sum = 0;
+    double absolute_sum = 0;
+    double squared_sum = 0;
+    double minimum = std::numeric_limits<double>::infinity();
+    double maximum = -std::numeric_limits<double>::infinity();
+
+    void merge(const Sums& o) {
+        this->count += o.count;
+        this->changed += o.changed;
+        this->sum += o.sum;
+        this->absolute_sum += o.absolute_sum;
+        this->squared_sum += o.squared_sum;
+        this->minimum = std::min(this->minimum, o.minimum);
+        this->maximum = std::max(this->maximum, o.maximum);
+    }
+};
+
+
+// Differences of a block into the output buffers, with the block's sums. The loop is branchless over
+// independent lanes so that the compiler vectorizes it (as `Statistics::detail::Reduce`).
+template <ValidDataType Before, ValidDataType After>
+static Sums Difference(
+    const Before* before, Before before_nodata, const After* after, After after_nodata, size_t size, double threshold,
+    float* difference, float* absolute_difference, uint8_t* mask
+) {
+    constexpr size_t lanes = 8;
+
+    uint64_t counts[lanes] = {}, changes[lanes] = {};
+    double sums[lanes] = {}, absolute_sums[lanes] = {}, squared_sums[lanes] = {};
+    double minimums[lanes], maximums[lanes];
+    std::fill(minimums, minimums + lanes, std::numeric_limits<double>::infinity());
+    std::fill(maximums, maximums + lanes, -std::numeric_limits<double>::infinity());
+
+    auto cell = [&] (size_t i, size_t l) {
+        bool valid = Statistics::detail::valid(before[i], before_nodata) && Statistics::detail::valid(after[i], after_nodata);
+        double d = valid ? static_cast<double>(after[i]) - static_cast<double>(before[i]) : 0.0;
+        double a = std::abs(d);
+        bool change = valid && a > threshold;
+
+        counts[l] += valid;
+        changes[l] += change;
+        sums[l] += d;
+        absolute_sums[l] += a;
+        squared_sums[l] += d * d;
+        minimums[l] = valid ? std::min(minimums[l], d) : minimums[l];
+        maximums[l] = valid ? std::max(maximums[l], d) : maximums[l];
+
+        if (difference != nullptr) difference[i] = valid ? static_cast<float>(d) : -9999.0f;
+        if (absolute_difference != nullptr) absolute_difference[i] = valid ? static_cast<float>(a) : -9999.0f;
+        if (mask != nullptr) mask[i] = valid ? change : 255;
+    };
+
+    size_t vectorized = size - size % lanes;
+    for (size_t i = 0; i < vectorized; i += lanes) {
+        for (size_t l = 0; l < lanes; l++) {
+            cell(i + l, l);
+        }
+    }
+    for (size_t i = vectorized; i < size; i++) {
+        cell(i, 0);
+    }
+
+    Sums block;
+    for (size_t l = 0; l < lanes; l++) {
+        block.count += counts[l];
+        block.changed += changes[l];
+        block.sum += sums[l];
+        block.absolute_sum += absolute_sums[l];
+        block.squared_sum += squared_sums[l];
+        block.minimum = std::min(block.minimum, minimums[l]);
+        block.maximum = std::max(block.maximum, maximums[l]);
+    }
+
+    return block;
+}
+
+
+// whether both datasets share the same grid (size, transformations & coordinate system)
+static bool Aligned(GDALDataset* a, GDALDataset* b) {
+    if (a->GetRasterXSize() != b->GetRasterXSize() || a->GetRasterYSize() != b->GetRasterYSize()) {
+        return false;
+    }
+
+    double ga[6], gb[6];
+    if (a->GetGeoTransform(ga) != CE_None || b->GetGeoTransform(gb) != CE_None) {
+        return false;
+    }
+
+    for (int i = 0; i < 6; i++) {
+        double tolerance = 1e-9 * std::max({1.0, std::abs(ga[i]), std::abs(gb[i])});
+        if (std::abs(ga[i] - gb[i]) > tolerance) return false;
+    }
+
+    const OGRSpatialReference *sa = a->GetSpatialRef(), *sb = b->GetSpatialRef();
+    return sa == sb || (sa != nullptr && sb != nullptr && sa->IsSame(sb));
+}
+
+
+// Lazily warps the dataset onto the reference's grid (bilinear) into a `/vsimem/` VRT, so every thread can
+// open its own handle of it. The VRT is removed when the returned dataset is released.
+static std::shared_ptr<GDALDataset> Align(GDALDataset* dataset, GDALDataset* reference, double nodata_value) {
+    double geotransform[6];
+    if (reference->GetGeoTransform(geotransform) != CE_None) {
+        throw std::runtime_error("failed to read dataset transformations");
+    }
+
+    size_t columns = reference->GetRasterXSize(), rows = reference->GetRasterYSize();
+    double x0 = geotransform[0], y0 = geotransform[3];
+    double x1 = x0 + columns * geotransform[1], y1 = y0 + rows * geotransform[5];
+
+    CPLStringList arguments;
+    arguments.AddString("-of");
+    arguments.AddString("VRT");
+    arguments.AddString("-t_srs");
+    arguments.AddString(reference->GetProjectionRef());
+    arguments.AddString("-te");
+    arguments.AddString(CPLSPrintf("%.17g", std::min(x0, x1)));
+    arguments.AddString(CPLSPrintf("%.17g", std::min(y0, y1)));
+    arguments.AddString(CPLSPrintf("%.17g", std::max(x0, x1)));
+    arguments.AddString(CPLSPrintf("%.17g", std::max(y0, y1)));
+    arguments.AddString("-ts");
+    arguments.AddString(std::to_string(columns).c_str());
+    arguments.AddString(std::to_string(rows).c_str());
+    arguments.AddString("-r");
+    arguments.AddString("bilinear");
+    arguments.AddString("-dstnodata");
+    arguments.AddString(CPLSPrintf("%.17g", nodata_value));
+
+    std::string aligned_path = MemoryPath("gdem_change", ".vrt");
+
+    GDALWarpAppOptions *options = GDALWarpAppOptionsNew(arguments.List(), nullptr);
+    GDALDatasetH source = GDALDataset::ToHandle(dataset);
+    GDALDatasetH output = GDALWarp(aligned_path.c_str(), nullptr, 1, &source, options, nullptr);
+    GDALWarpAppOptionsFree(options);
+
+    if (output == nullptr) {
+        throw std::runtime_error("failed to align datasets");
+    }
+    GDALDataset::FromHandle(output)->FlushCache();
+
+    return std::shared_ptr<GDALDataset>(GDALDataset::FromHandle(output), [aligned_path] (GDALDataset* d) {
+        GDALClose(d);
+        VSIUnlink(aligned_path.c_str());
+    });
+}
+
+}
+
+
+
+// Compares 2 DEMs (`after - before`) block by block, writing the requested difference, absolute difference &
+// change mask rasters on `before`'s grid and returning the difference statistics, all in a single pass.
+// `after` is read directly when on the same grid, otherwise it is resampled (bilinear) onto `before`'s grid on
+// the fly. Output blocks are processed in parallel (`threads` = 0 uses all hardware threads), only the blocks
+// in flight are held in memory.
+template <
+    ValidDataType Before, uint16_t before_raster, Before before_fallback,
+    ValidDataType After, uint16_t after_raster, After after_fallback
+>
+static Report Compare(
+    const DEM<Before, before_raster, before_fallback>& before,
+    const DEM<After, after_raster, after_fallback>& after,
+    const Outputs& outputs = Outputs(),
+    double threshold = 0,
+    size_t threads = 0
+) {
+    GDALDataset *reference = before.get_dataset();
+
+    std::shared_ptr<GDALDataset> aligned;
+    GDALDataset *compared = after.get_dataset();
+    if (!detail::Aligned(reference, compared)) {
+        aligned = detail::Align(compared, reference, after.type.nodata);
+        compared = aligned.get();
+    }
+
+    BandReader<Before, before_raster> before_reader(reference);
+    BandReader<After, after_raster> after_reader(compared);
+
+    GDALDataset *difference_dataset = nullptr, *absolute_dataset = nullptr, *mask_dataset = nullptr;
+    auto close = [&] () {
+        if (difference_dataset != nullptr) GDALClose(difference_dataset);
+        if (absolute_dataset != nullptr) GDALClose(absolute_dataset);
+        if (mask_dataset != nullptr) GDALClose(mask_dataset);
+    };
+
+    Report report;
+
+    try {
+        if (!outputs.difference.empty()) difference_dataset = Create(outputs.difference, reference, GDT_Float32, -9999);
+        if (!outputs.absolute_difference.empty()) absolute_dataset = Create(outputs.absolute_difference, reference, GDT_Float32, -9999);
+        if (!outputs.mask.empty()) mask_dataset = Create(outputs.mask, reference, GDT_Byte, 255);
+
+        std::unique_ptr<BandWriter<float>> difference_writer, absolute_writer;
+        std::unique_ptr<BandWriter<uint8_t>> mask_writer;
+        if (difference_dataset != nullptr) difference_writer = std::make_unique<BandWriter<float>>(difference_dataset);
+        if (absolute_dataset != nullptr) absolute_writer = std::make_unique<BandWriter<float>>(absolute_dataset);
+        if (mask_dataset != nullptr) mask_writer = std::make_unique<BandWriter<uint8_t>>(mask_dataset);
+
+        // windows follow the outputs' blocks, so every output block is written whole & once
+        GDALDataset *layout = difference_dataset != nullptr ? difference_dataset : absolute_dataset != nullptr ? absolute_dataset : mask_dataset;
+        std::vector<Window> windows = Blocks(layout != nullptr ? layout->GetRasterBand(1) : before_reader.shared());
+
+        ThreadPool pool(threads);
+
+        struct Scratch {
+            std::vector<Before> before;
+            std::vector<After> after;
+            std::vector<float> difference;
+            std::vector<float> absolute_difference;
+            std::vector<uint8_t> mask;
+            detail::Sums sums;
+        };
+        std::vector<Scratch> scratches(pool.size());
+
+        pool.parallel_for(windows.size(), [&] (size_t index, size_t worker) {
+            const Window& window = windows[index];
+            Scratch& scratch = scratches[worker];
+
+            scratch.before.resize(window.size());
+            scratch.after.resize(window.size());
+            before_reader.read(window, scratch.before.data());
+            after_reader.read(window, scratch.after.data());
+
+            if (difference_writer) scratch.difference.resize(window.size());
+            if (absolute_writer) scratch.absolute_difference.resize(window.size());
+            if (mask_writer) scratch.mask.resize(window.size());
+
+            scratch.sums.merge(detail::Difference(
+                scratch.before.data(), before.type.nodata, scratch.after.data(), after.type.nodata, window.size(), threshold,
+                difference_writer ? scratch.difference.data() : nullptr,
+                absolute_writer ? scratch.absolute_difference.data() : nullptr,
+                mask_writer ? scratch.mask.data() : nullptr
+            ));
+
+            if (difference_writer) difference_writer->write(window, scratch.difference.data());
+            if (absolute_writer) absolute_writer->write(window, scratch.absolute_difference.data());
+            if (mask_writer) mask_writer->write(window, scratch.mask.data());
+        });
+
+        detail::Sums total;
+        for (const Scratch& scratch : scratches) {
+            total.merge(scratch.sums);
+        }
+
+        report.count = total.count;
+        report.changed = total.changed;
+        if (total.count > 0) {
+            report.minimum = total.minimum;
+            report.maximum = total.maximum;
+            report.bias = total.sum / total.count;
+            report.mae = total.absolute_sum / total.count;
+            report.rmse = std::sqrt(total.squared_sum / total.count);
+        }
+    } catch (...) {
+        close();
+        throw;
+    }
+
+    close();
+    return report;
+}
+
+}
+}
@@ -0,0 +1,406 @@
+/*
+GDEM : C++ wrapper over GDAL for working with DEM data.
+Copyright (C) 2024  Pritam Halder
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <https://www.gnu.org/licenses/>.
+
+Author : Pritam Halder
+Email : pritamhalder.portfolio@gmail.com
+*/
+
+#pragma once
+
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <filesystem>
+#include <fstream>
+#include <iterator>
+#include <limits>
+#include <map>
+#include <string>
+#include <system_error>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+#include <gdal/gdal_priv.h>
+
+#include "GDEM/Block.hpp"
+#include "GDEM/DEM.hpp"
+#include "GDEM/Parallel.hpp"
+
+
+
+namespace GDEM {
+namespace Contour {
+
+struct Line {
+    double level;                                   // elevation of the contour
+    bool closed;                                    // whether the first & last points are the same
+    std::vector<std::pair<double, double>> points;  // (x, y) in the dataset's coordinate system
+};
+
+
+
+namespace detail {
+
+// contour levels, either every `interval` from `base` or an explicit (sorted) list
+class Levels {
+private:
+    double interval;
+    double base;
+    std::vector<double> levels;
+
+public:
+    explicit Levels(double interval, double base)
+        : interval(interval),
+        base(base)
+    {
+        if (!(interval > 0)) {
+            throw std::runtime_error("contour interval must be positive");
+        }
+    }
+
+    explicit Levels(std::vector<double> levels)
+        : interval(0),
+        base(0),
+        levels(std::move(levels))
+    {
+        std::sort(this->levels.begin(), this->levels.end());
+        this->levels.erase(std::unique(this->levels.begin(), this->levels.end()), this->levels.end());
+    }
+
+    // indices [first, last] of the levels within [low, high], empty if first > last
+    std::pair<long, long> range(double low, double high) const {
+        if (this->levels.empty()) {
+            return {
+                static_cast<long>(std::ceil((low - this->base) / this->interval)),
+                static_cast<long>(std::floor((high - this->base) / this->interval))
+            };
+        }
+
+        auto first = std::lower_bound(this->levels.begin(), this->levels.end(), low);
+        auto last = std::upper_bound(this->levels.begin(), this->levels.end(), high);
+        return {first - this->levels.begin(), (last - this->levels.begin()) - 1};
+    }
+
+    double value(long index) const {
+        return this->levels.empty() ? this->base + index * this->interval : this->levels[index];
+    }
+};
+
+
+// a piece of a contour, every point is identified by the key of the cell edge it lies on
+struct Chain {
+    std::vector<uint64_t> keys;
+    std::vector<std::pair<double, double>> points;
+
+    bool closed() const {
+        return this->keys.size() > 2 && this->keys.front() == this->keys.back();
+    }
+};
+
+
+// Joins pieces sharing end points into the longest possible chains. Every edge key is shared by at most
+// 2 pieces of a level (the 2 cells next to the edge), so the joined chains are unambiguous.
+static std::vector<Chain> Link(std::vector<Chain>& pieces) {
+    std::unordered_map<uint64_t, std::vector<size_t>> ends;
+    for (size_t i = 0; i < pieces.size(); i++) {
+        ends[pieces[i].keys.front()].push_back(i);
+        if (pieces[i].keys.back() != pieces[i].keys.front()) {
+            ends[pieces[i].keys.back()].push_back(i);
+        }
+    }
+
+    std::vector<bool> used(pieces.size(), false);
+
+    auto next = [&] (uint64_t key) -> long {
+        for (size_t i : ends[key]) {
+            if (!used[i]) return static_cast<long>(i);
+        }
+        return -1;
+    };
+
+    std::vector<Chain> chains;
+    for (size_t start = 0; start < pieces.size(); start++) {
+        if (used[start]) continue;
+        used[start] = true;
+
+        Chain chain = std::move(pieces[start]);
+
+        // extend at the back, then at the front
+        for (int side = 0; side < 2 && !chain.closed(); side++) {
+            if (side == 1) {
+                std::reverse(chain.keys.begin(), chain.keys.end());
+                std::reverse(chain.points.begin(), chain.points.end());
+            }
+
+            for (long i = next(chain.keys.back()); i >= 0 && !chain.closed(); i = next(chain.keys.back())) {
+                used[i] = true;
+                Chain& piece = pieces[i];
+
+                if (piece.keys.front() != chain.keys.back()) {
+                    std::reverse(piece.keys.begin(), piece.keys.end());
+                    std::reverse(piece.points.begin(), piece.points.end());
+                }
+
+                chain.keys.insert(chain.keys.end(), piece.keys.begin() + 1, piece.keys.end());
+                chain.points.insert(chain.points.end(), piece.points.begin() + 1, piece.points.end());
+            }
+        }
+
+        chains.push_back(std::move(chain));
+    }
+
+    return chains;
+}
+
+
+// Marching squares over the cells of a strip (cells between pixel centers). `values` holds the strip's
+// rows plus the first row of the next strip, segments are linked into chains per level index.
+template <ValidDataType DataType>
+static std::map<long, std::vector<Chain>> March(
+    const std::vector<DataType>& values, const Window& strip, size_t cell_rows, size_t columns,
+    DataType nodata, const Levels& levels, const double* geotransform
+) {
+    std::map<long, std::vector<Chain>> segments;
+
+    auto valid = [nodata] (double value) { return value == value && value != nodata; };
+
+    for (size_t i = 0; i < cell_rows; i++) {
+        const DataType *top = values.data() + i * columns;
+        const DataType *bottom = top + columns;
+        size_t r = strip.row + i;
+
+        for (size_t c = 0; c + 1 < columns; c++) {
+            double tl = top[c], tr = top[c + 1], bl = bottom[c], br = bottom[c + 1];
+            if (!valid(tl) || !valid(tr) || !valid(bl) || !valid(br)) {
+                continue;
+            }
+
+            auto [first, last] = levels.range(std::min({tl, tr, bl, br}), std::max({tl, tr, bl, br}));
+            for (long k = first; k <= last; k++) {
+                double level = levels.value(k);
+                int index = (tl >= level) << 3 | (tr >= level) << 2 | (br >= level) << 1 | (bl >= level);
+                if (index == 0 || index == 15) continue;
+
+                // crossing point on one of the cell's edges, keyed by the edge
+                auto crossing = [&] (int edge) -> std::pair<uint64_t, std::pair<double, double>> {
+                    double a, b, row, column, t;
+                    uint64_t key;
+                    switch (edge) {
+                        case 0: a = tl; b = tr; key = 2 * (r * columns + c); break;                 // top
+                        case 1: a = tr; b = br; key = 2 * (r * columns + c + 1) + 1; break;         // right
+                        case 2: a = bl; b = br; key = 2 * ((r + 1) * columns + c); break;           // bottom
+                        default: a = tl; b = bl; key = 2 * (r * columns + c) + 1; break;            // left
+                    }
+                    t = (level - a) / (b - a);
+                    row = r + 0.5 + (edge == 2 ? 1 : edge == 1 || edge == 3 ? t : 0);
+                    column = c + 0.5 + (edge == 1 ? 1 : edge == 0 || edge == 2 ? t : 0);
+
+                    double x, y;
+                    GDALApplyGeoTransform(geotransform, column, row, &x, &y);
+                    return {key, {x, y}};
+                };
+
+                auto segment = [&] (int from, int to) {
+                    auto [a_key, a_point] = crossing(from);
+                    auto [b_key, b_point] = crossing(to);
+                    segments[k].push_back({{a_key, b_key}, {a_point, b_point}});
+                };
+
+                bool center = (tl + tr + bl + br) / 4 >= level;
+                switch (index) {
+                    case 1: case 14: segment(3, 2); break;
+                    case 2: case 13: segment(2, 1); break;
+                    case 3: case 12: segment(3, 1); break;
+                    case 4: case 11: segment(0, 1); break;
+                    case 6: case 9: segment(0, 2); break;
+                    case 7: case 8: segment(3, 0); break;
+                    case 5:
+                        if (center) { segment(3, 0); segment(2, 1); }
+                        else { segment(0, 1); segment(3, 2); }
+                        break;
+                    case 10:
+                        if (center) { segment(0, 1); segment(3, 2); }
+                        else { segment(3, 0); segment(2, 1); }
+                        break;
+                }
+            }
+        }
+    }
+
+    std::map<long, std::vector<Chain>> chains;
+    for (auto& [k, pieces] : segments) {
+        chains[k] = Link(pieces);
+    }
+
+    return chains;
+}
+
+
+
+// Traces the contour lines at the given levels with marching squares. Block aligned strips are traced in
+// parallel, then the pieces of lines crossing strip boundaries are stitched together.
+template <ValidDataType DataType, uint16_t raster_number, DataType no_data_fallback>
+static std::vector<Line> Trace(const DEM<DataType, raster_number, no_data_fallback>& dem, const Levels& levels, size_t threads) {
+    GDALDataset *dataset = dem.get_dataset();
+
+    double geotransform[6];
+    if (dataset->GetGeoTransform(geotransform) != CE_None) {
+        throw std::runtime_error("failed to read dataset transformations");
+    }
+
+    BandReader<DataType, raster_number> reader(dataset);
+    std::vector<Window> strips = Strips(reader.shared());
+    size_t rows = reader.rows(), columns = reader.columns();
+    ThreadPool pool(threads);
+
+    std::vector<std::map<long, std::vector<detail::Chain>>> traced(strips.size());
+    pool.parallel_for(strips.size(), [&] (size_t index, size_t) {
+        const Window& strip = strips[index];
+
+        // one extra row for the cells on the strip's last row
+        Window window = strip;
+        window.rows = std::min(strip.rows + 1, rows - strip.row);
+        size_t cell_rows = window.rows - 1;
+        if (cell_rows == 0) return;
+
+        std::vector<DataType> values = reader.read(window);
+        traced[index] = detail::March(values, strip, cell_rows, columns, dem.type.nodata, levels, geotransform);
+    });
+
+    // stitch the pieces of every level across strips
+    std::map<long, std::vector<detail::Chain>> pieces;
+    for (auto& strip : traced) {
+        for (auto& [k, chains] : strip) {
+            for (detail::Chain& chain : chains) {
+                pieces[k].push_back(std::move(chain));
+            }
+        }
+    }
+    traced.clear();
+
+    std::vector<std::pair<long, std::vector<detail::Chain>*>> work;
+    for (auto& [k, chains] : pieces) {
+        work.push_back({k, &chains});
+    }
+
+    std::vector<std::vector<Line>> stitched(work.size());
+    pool.parallel_for(work.size(), [&] (size_t index, size_t) {
+        for (detail::Chain& chain : detail::Link(*work[index].second)) {
+            stitched[index].push_back({levels.value(work[index].first), chain.closed(), std::move(chain.points)});
+        }
+    });
+
+    std::vector<Line> lines;
+    for (std::vector<Line>& level_lines : stitched) {
+        std::move(level_lines.begin(), level_lines.end(), std::back_inserter(lines));
+    }
+
+    return lines;
+}
+
+}
+
+
+
+// Generates contour lines every `interval` (elevation units), at levels `base + k * interval`. Lines break at
+// NODATA values. Strips of the DEM are traced in parallel (`threads` = 0 uses all hardware threads).
+template <ValidDataType DataType, uint16_t raster_number, DataType no_data_fallback>
+static std::vector<Line> Generate(const DEM<DataType, raster_number, no_data_fallback>& dem, double interval, double base = 0, size_t threads = 0) {
+    return detail::Trace(dem, detail::Levels(interval, base), threads);
+}
+
+
+// Generates contour lines at the explicit levels
+template <ValidDataType DataType, uint16_t raster_number, DataType no_data_fallback>
+static std::vector<Line> Generate(const DEM<DataType, raster_number, no_data_fallback>& dem, const std::vector<double>& levels, size_t threads = 0) {
+    return detail::Trace(dem, detail::Levels(levels), threads);
+}
+
+
+// writes the lines as a GeoJSON FeatureCollection of LineStrings with an `elevation` property
+static void WriteGeoJSON(const std::vector<Line>& lines, const std::filesystem::path& destination_filepath) {
+    std::ofstream file(destination_filepath);
+    if (!file) {
+        throw std::runtime_error("failed to create file '" + destination_filepath.string() + "'");
+    }
+
+    file.precision(std::numeric_limits<double>::max_digits10);
+    file << "{\"type\":\"FeatureCollection\",\"features\":[";
+
+    for (size_t i = 0; i < lines.size(); i++) {
+        file << (i > 0 ? "," : "")
+            << "{\"type\":\"Feature\",\"properties\":{\"elevation\":" << lines[i].level << "},"
+            << "\"geometry\":{\"type\":\"LineString\",\"coordinates\":[";
+
+        for (size_t j = 0; j < lines[i].points.size(); j++) {
+            file << (j > 0 ? "," : "") << "[" << lines[i].points[j].first << "," << lines[i].points[j].second << "]";
+        }
+
+        file << "]}}";
+    }
+
+    file << "]}\n";
+}
+
+
+// Writes the lines in a compact binary (little endian) polyline format :
+//     "GDEMCTR1", uint64 line count, then for every line :
+//     float64 level, uint8 closed, uint32 point count, float64 x & y of the first point,
+//     float32 dx & dy of every next point from the previous one
+static void WriteBinary(const std::vector<Line>& lines, const std::filesystem::path& destination_filepath) {
+    std::ofstream file(destination_filepath, std::ios::binary);
+    if (!file) {
+        throw std::runtime_error("failed to create file '" + destination_filepath.string() + "'");
+    }
+
+    auto put = [&file] (const auto& value) {
+        file.write(reinterpret_cast<const char*>(&value), sizeof(value));
+    };
+
+    file.write("GDEMCTR1", 8);
+    put(static_cast<uint64_t>(lines.size()));
+
+    for (const Line& line : lines) {
+        put(line.level);
+        put(static_cast<uint8_t>(line.closed));
+        put(static_cast<uint32_t>(line.points.size()));
+
+        if (line.points.empty()) continue;
+        put(line.points[0].first);
+        put(line.points[0].second);
+
+        // deltas accumulate from the rounded points, so the rounding error doesn't drift along the line
+        double x = line.points[0].first, y = line.points[0].second;
+        for (size_t i = 1; i < line.points.size(); i++) {
+            float dx = static_cast<float>(line.points[i].first - x);
+            float dy = static_cast<float>(line.points[i].second - y);
+            put(dx);
+            put(dy);
+            x += dx;
+            y += dy;
+        }
+    }
+
+    if (!file) {
+        throw std::runtime_error("failed to write file '" + destination_filepath.string() + "'");
+    }
+}
+
+}
+}
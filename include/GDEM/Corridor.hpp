@@ -0,0 +1,302 @@
+/*
+GDEM : C++ wrapper over GDAL for working with DEM data.
+Copyright (C) 2024  Pritam Halder
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <https://www.gnu.org/licenses/>.
+
+Author : Pritam Halder
+Email : pritamhalder.portfolio@gmail.com
+*/
+
+#pragma once
+
+
+#include <algorithm>
+#include <array>
+#include <cmath>
+#include <cstdint>
+#include <limits>
+#include <memory>
+#include <numbers>
+#include <queue>
+#include <string>
+#include <vector>
+
+#include <gdal/gdal_priv.h>
+#include <gdal/ogr_spatialref.h>
+
+#include "GDEM/DEM.hpp"
+#include "GDEM/Parallel.hpp"
+#include "GDEM/Range.hpp"
+#include "GDEM/Transform.hpp"
+
+
+
+namespace GDEM {
+namespace Corridor {
+
+// highest cell of a corridor segment
+struct Peak {
+    float altitude;     // NaN when the corridor has no valid cell
+    size_t row;
+    size_t column;
+    double latitude;    // of the cell's center
+    double longitude;
+};
+
+
+
+namespace detail {
+
+// segment buffered by `buffer` metres, in grid coordinates (cell (r, c) covering [c, c + 1) x [r, r + 1)) scaled
+// by `sx`, `sy` metres per cell
+struct Capsule {
+    double u0, v0, u1, v1;
+    double sx, sy;
+    double buffer;
+
+    // squared distance (metres) of a grid point to the segment
+    double distance2(double u, double v) const {
+        double ax = (u - this->u0) * this->sx, ay = (v - this->v0) * this->sy;
+        double bx = (this->u1 - this->u0) * this->sx, by = (this->v1 - this->v0) * this->sy;
+        double length2 = bx * bx + by * by;
+        double t = length2 > 0 ? std::clamp((ax * bx + ay * by) / length2, 0.0, 1.0) : 0.0;
+        double dx = ax - t * bx, dy = ay - t * by;
+        return dx * dx + dy * dy;
+    }
+
+    bool contains(double u, double v) const {
+        return this->distance2(u, v) <= this->buffer * this->buffer;
+    }
+
+    // whether the segment passes within `distance` metres of the box [u_min, u_max] x [v_min, v_max]
+    bool reaches(double u_min, double v_min, double u_max, double v_max, double distance) const {
+        auto inside = [&] (double u, double v) { return u >= u_min && u <= u_max && v >= v_min && v <= v_max; };
+        if (inside(this->u0, this->v0) || inside(this->u1, this->v1)) {
+            return true;
+        }
+
+        // nearest points are a corner of the box or an endpoint of the segment, unless they cross
+        double limit = distance * distance;
+        for (double u : {u_min, u_max}) {
+            for (double v : {v_min, v_max}) {
+                if (this->distance2(u, v) <= limit) return true;
+            }
+        }
+        for (auto [u, v] : {std::pair{this->u0, this->v0}, std::pair{this->u1, this->v1}}) {
+            double du = std::max({u_min - u, 0.0, u - u_max}) * this->sx, dv = std::max({v_min - v, 0.0, v - v_max}) * this->sy;
+            if (du * du + dv * dv <= limit) return true;
+        }
+
+        // the segment crossing the box's edges
+        auto crosses = [&] (double au, double av, double bu, double bv) {
+            auto side = [&] (double pu, double pv, double qu, double qv, double ru, double rv) {
+                return (qu - pu) * (rv - pv) - (qv - pv) * (ru - pu);
+            };
+            double d1 = side(au, av, bu, bv, this->u0, this->v0), d2 = side(au, av, bu, bv, this->u1, this->v1);
+            double d3 = side(this->u0, this->v0, this->u1, this->v1, au, av), d4 = side(this->u0, this->v0, this->u1, this->v1, bu, bv);
+            return ((d1 > 0) != (d2 > 0)) && ((d3 > 0) != (d4 > 0));
+        };
+        return crosses(u_min, v_min, u_max, v_min) || crosses(u_max, v_min, u_max, v_max)
+            || crosses(u_max, v_max, u_min, v_max) || crosses(u_min, v_max, u_min, v_min);
+    }
+};
+
+
+struct Candidate {
+    float altitude;
+    size_t level;
+    size_t row;
+    size_t column;
+
+    bool operator<(const Candidate& o) const {
+        return this->altitude < o.altitude;
+    }
+};
+
+}
+
+
+
+// Corridor clearance along paths : the highest DEM cell within a lateral buffer of each path segment (cells whose
+// center lies within the buffer, and the cells the segment crosses). Every segment is answered by a best first
+// descent of the max mipmap of a `RangeIndex` : mipmap cells are expanded highest first, dropped when they can't
+// reach the corridor, and the first one lying entirely inside it holds the answer (located through the index), so
+// only the few cells around the corridor's high ground are visited whatever the corridor's length & width.
+class Clearance {
+private:
+    std::shared_ptr<const RangeIndex> index;
+    size_t projection;      // interned coordinate system (`Transform::detail::Intern`)
+    bool projected;
+
+    Peak peak(const detail::Capsule& capsule) const {
+        const RangeIndex& index = *this->index;
+        double rows = index.rows(), columns = index.columns();
+        Peak none{std::numeric_limits<float>::quiet_NaN(), 0, 0, 0, 0};
+
+        // cells whose centers may lie in the corridor
+        double pad_u = capsule.buffer / capsule.sx + 1, pad_v = capsule.buffer / capsule.sy + 1;
+        double u_min = std::min(capsule.u0, capsule.u1) - pad_u, u_max = std::max(capsule.u0, capsule.u1) + pad_u;
+        double v_min = std::min(capsule.v0, capsule.v1) - pad_v, v_max = std::max(capsule.v0, capsule.v1) + pad_v;
+        if (!(u_max >= 0 && v_max >= 0 && u_min < columns && v_min < rows)) {
+            return none;
+        }
+
+        size_t c0 = std::clamp(std::floor(u_min), 0.0, columns - 1), c1 = std::clamp(std::floor(u_max), 0.0, columns - 1);
+        size_t r0 = std::clamp(std::floor(v_min), 0.0, rows - 1), r1 = std::clamp(std::floor(v_max), 0.0, rows - 1);
+
+        size_t level = 0;
+        while ((c1 >> level) - (c0 >> level) > 1 || (r1 >> level) - (r0 >> level) > 1) {
+            level++;
+        }
+
+        std::priority_queue<detail::Candidate> candidates;
+        auto push = [&] (size_t l, size_t r, size_t c) {
+            float altitude = index.maximum_at(l, r, c);
+            if (altitude != altitude) return;
+
+            // level 0 cells under it, either by their centers or by their area
+            double first_u = c << l, first_v = r << l;
+            double last_u = std::min<double>((c + 1) << l, columns), last_v = std::min<double>((r + 1) << l, rows);
+            if (capsule.reaches(first_u + 0.5, first_v + 0.5, last_u - 0.5, last_v - 0.5, capsule.buffer) || capsule.reaches(first_u, first_v, last_u, last_v, 0)) {
+                candidates.push({altitude, l, r, c});
+            }
+        };
+
+        for (size_t r = r0 >> level; r <= r1 >> level; r++) {
+            for (size_t c = c0 >> level; c <= c1 >> level; c++) {
+                push(level, r, c);
+            }
+        }
+
+        while (!candidates.empty()) {
+            detail::Candidate top = candidates.top();
+            candidates.pop();
+
+            size_t first_row = top.row << top.level, first_column = top.column << top.level;
+            size_t last_row = std::min<size_t>((top.row + 1) << top.level, rows) - 1;
+            size_t last_column = std::min<size_t>((top.column + 1) << top.level, columns) - 1;
+
+            // entirely inside (the corridor is convex, so its corner centers are enough)
+            bool inside = capsule.contains(first_column + 0.5, first_row + 0.5) && capsule.contains(last_column + 0.5, first_row + 0.5)
+                && capsule.contains(first_column + 0.5, last_row + 0.5) && capsule.contains(last_column + 0.5, last_row + 0.5);
+
+            if (inside) {
+                RangeIndex::Extreme extreme = index.maximum({first_row, first_column, last_row - first_row + 1, last_column - first_column + 1});
+                return {extreme.value, extreme.row, extreme.column, 0, 0};
+            }
+
+            if (top.level == 0) {
+                if (capsule.contains(top.column + 0.5, top.row + 0.5) || capsule.reaches(top.column, top.row, top.column + 1, top.row + 1, 0)) {
+                    return {top.altitude, top.row, top.column, 0, 0};
+                }
+                continue;
+            }
+
+            for (size_t r = 2 * top.row; r < std::min(2 * top.row + 2, index.rows(top.level - 1)); r++) {
+                for (size_t c = 2 * top.column; c < std::min(2 * top.column + 2, index.columns(top.level - 1)); c++) {
+                    push(top.level - 1, r, c);
+                }
+            }
+        }
+
+        return none;
+    }
+
+    // grid coordinates of a latitude, longitude
+    std::array<double, 2> grid(const Coordinate& coordinate) const {
+        double x = coordinate.longitude, y = coordinate.latitude;
+        if (this->projected) {
+            Transform::detail::Exact(Transform::detail::Get(Transform::detail::WGS84(), this->projection), &x, &y, 1);
+        }
+        const std::array<double, 6>& geotransform = this->index->transform();
+        return {(x - geotransform[0]) / geotransform[1], (y - geotransform[3]) / geotransform[5]};
+    }
+
+    void locate(Peak& peak) const {
+        const std::array<double, 6>& geotransform = this->index->transform();
+        double x = geotransform[0] + (peak.column + 0.5) * geotransform[1];
+        double y = geotransform[3] + (peak.row + 0.5) * geotransform[5];
+        if (this->projected) {
+            Transform::detail::Exact(Transform::detail::Get(this->projection, Transform::detail::WGS84()), &x, &y, 1);
+        }
+        peak.latitude = y;
+        peak.longitude = x;
+    }
+
+public:
+    // `index` built over the DEM (built here when `nullptr`)
+    template <ValidDataType DataType, uint16_t raster_number, DataType no_data_fallback>
+    Clearance(const DEM<DataType, raster_number, no_data_fallback>& dem, std::shared_ptr<const RangeIndex> index = nullptr)
+        : index(index != nullptr ? std::move(index) : std::make_shared<const RangeIndex>(dem)),
+        projection(Transform::detail::Intern(dem.type.projection))
+    {
+        if (this->index->rows() != dem.type.rows || this->index->columns() != dem.type.columns) {
+            throw std::runtime_error("range index doesn't match the DEM");
+        }
+
+        OGRSpatialReference srs;
+        this->projected = !dem.type.projection.empty()
+            && srs.SetFromUserInput(dem.type.projection.c_str()) == OGRERR_NONE
+            && srs.IsProjected();
+    }
+
+    Clearance(const Clearance& o) = default;
+    Clearance& operator=(const Clearance& o) = default;
+    Clearance(Clearance&& o) noexcept = default;
+    Clearance& operator=(Clearance&& o) noexcept = default;
+    ~Clearance() = default;
+
+    // highest cell within `buffer` metres of the segment `a` - `b` (or crossed by it)
+    Peak peak(const Coordinate& a, const Coordinate& b, double buffer) const {
+        if (!(buffer >= 0)) {
+            throw std::runtime_error("corridor buffer must not be negative");
+        }
+
+        std::array<double, 2> p = this->grid(a), q = this->grid(b);
+        const std::array<double, 6>& geotransform = this->index->transform();
+
+        // metres per cell, for geographic DEMs at the segment's mean latitude (WGS84, approximately)
+        double sx = std::abs(geotransform[1]), sy = std::abs(geotransform[5]);
+        if (!this->projected) {
+            double latitude = (a.latitude + b.latitude) / 2.0;
+            sx *= 111320.0 * std::cos(latitude * std::numbers::pi / 180);
+            sy *= 110574.0;
+        }
+
+        Peak peak = this->peak(detail::Capsule{p[0], p[1], q[0], q[1], sx, sy, buffer});
+        if (peak.altitude == peak.altitude) {
+            this->locate(peak);
+        }
+        return peak;
+    }
+
+    // highest cell within `buffer` metres of every segment of the path, segments in parallel (`threads` = 0 uses
+    // all hardware threads)
+    std::vector<Peak> peaks(const std::vector<Coordinate>& path, double buffer, size_t threads = 0) const {
+        if (path.size() < 2) {
+            throw std::runtime_error("at least 2 points are required");
+        }
+
+        std::vector<Peak> peaks(path.size() - 1);
+        ThreadPool pool(threads);
+        pool.parallel_for(peaks.size(), [&] (size_t i, size_t) {
+            peaks[i] = this->peak(path[i], path[i + 1], buffer);
+        });
+        return peaks;
+    }
+};
+
+}
+}
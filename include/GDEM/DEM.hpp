@@ -21,13 +21,19 @@ Email : pritamhalder.portfolio@gmail.com
 
 #pragma once
 
+#include <array>
 #include <cstdint>
 #include <filesystem>
+#include <memory>
 #include <string>
 #include <vector>
 
 #include <gdal/gdal_priv.h>
 
+#include "GDEM/Cache.hpp"
+#include "GDEM/Geoid.hpp"
+#include "GDEM/Prefetch.hpp"
+#include "GDEM/Transform.hpp"
 #include "GDEM/Type.hpp"
 
 
@@ -117,11 +123,45 @@ template <
 class DEM {
 private:
     struct Index {
-        float row;
-        float column;
+        double row;
+        double column;
     };
 
+    // pixel of coordinates (`y`, `x`) in the dataset's coordinate system, from the full precision geotransform (the
+    // float origin of `type` is off by up to a metre at projected northings)
+    Index pixel(double y, double x) {
+        double row = (y - this->geotransform[3]) / this->geotransform[5];
+        double column = (x - this->geotransform[0]) / this->geotransform[1];
+
+        if (row >= 0 && row <= this->type.rows && column >= 0 && column <= this->type.columns) {
+            return {row, column};
+        } else {
+            return {
+                static_cast<double>(this->type.nodata),
+                static_cast<double>(this->type.nodata)
+            };
+        }
+    }
+
     Index index(float latitude, float longitude) {
+        if (this->lookup != nullptr) {
+            double row, column;
+            if (this->lookup->pixel(latitude, longitude, row, column)) {
+                return {row, column};
+            } else {
+                return {
+                    static_cast<double>(this->type.nodata),
+                    static_cast<double>(this->type.nodata)
+                };
+            }
+        }
+
+        if (this->projected) {
+            double x = longitude, y = latitude;
+            Transform::detail::Exact(Transform::detail::Get(Transform::detail::WGS84(), this->projection), &x, &y, 1);
+            return this->pixel(y, x);
+        }
+
         if (this->bounds.within(latitude, longitude)) {
             return {
                 (latitude - this->type.y_max) / this->type.y_resolution,
@@ -129,16 +169,89 @@ private:
             };
         } else {
             return {
-                static_cast<float>(this->type.nodata),
-                static_cast<float>(this->type.nodata)
+                static_cast<double>(this->type.nodata),
+                static_cast<double>(this->type.nodata)
             };
         }
     }
 
+    DataType value(Index rc) {
+        if (rc.row == this->type.nodata || rc.column == this->type.nodata) {
+            return this->type.nodata;
+        }
+
+        size_t r = static_cast<size_t>(std::round(rc.row));
+        size_t c = static_cast<size_t>(std::round(rc.column));
+
+        r = r == this->type.rows ? r - 1 : r;
+        c = c == this->type.columns ? c - 1 : c;
+
+        if (this->cache != nullptr) {
+            if (this->prefetcher != nullptr) {
+                this->prefetcher->observe(r, c);
+            }
+            return this->cache->value(r, c);
+        }
+
+        DataType altitude;
+        if (this->data->RasterIO(GF_Read, c, r, 1, 1, &altitude, 1, 1, this->type.data_type, 0, 0) != CE_None) {
+            return this->type.nodata;
+        } else {
+            return altitude;
+        }
+    }
+
+    float interpolated_value(Index rc) {
+        if (rc.row == this->type.nodata || rc.column == this->type.nodata) {
+            return this->type.nodata;
+        }
+
+        size_t r = static_cast<size_t>(rc.row);
+        size_t c = static_cast<size_t>(rc.column);
+
+        float del_latitude = std::min(rc.row, static_cast<double>(this->type.rows - 1)) - r;
+        float del_longitude = std::min(rc.column, static_cast<double>(this->type.columns - 1)) - c;
+
+        size_t next_r = (r == this->type.rows - 1) ? r : r + 1;
+        size_t next_c = (c == this->type.columns - 1) ? c : c + 1;
+
+        DataType m, n, o, p;
+        if (this->cache != nullptr) {
+            if (this->prefetcher != nullptr) {
+                this->prefetcher->observe(r, c);
+            }
+            m = this->cache->value(r, c);
+            n = this->cache->value(r, next_c);
+            o = this->cache->value(next_r, c);
+            p = this->cache->value(next_r, next_c);
+        } else if (
+            this->data->RasterIO(GF_Read,       c,          r,          1, 1, &m, 1, 1, this->type.data_type, 0, 0) != CE_None
+            || this->data->RasterIO(GF_Read,    next_c,     r,          1, 1, &n, 1, 1, this->type.data_type, 0, 0) != CE_None
+            || this->data->RasterIO(GF_Read,    c,          next_r,     1, 1, &o, 1, 1, this->type.data_type, 0, 0) != CE_None
+            || this->data->RasterIO(GF_Read,    next_c,     next_r,     1, 1, &p, 1, 1, this->type.data_type, 0, 0) != CE_None
+        ) {
+            return this->type.nodata;
+        }
+
+        float altitude =    (1-del_latitude) *  (1-del_longitude) * m +
+                            del_longitude *     (1-del_latitude) *  n +
+                            (1-del_longitude) * del_latitude *      o +
+                            del_latitude *      del_longitude *     p;
+
+        return altitude;
+    }
+
 
     GDALDataset *dataset;
     GDALRasterBand *data;
     std::filesystem::path file_path;
+    std::shared_ptr<const Geoid> geoid;
+    std::shared_ptr<const Transform::Lookup> lookup;
+    std::shared_ptr<BlockCache<DataType, raster_number>> cache;     // (not shared by copies, which open their own dataset)
+    std::unique_ptr<Prefetcher<DataType, raster_number>> prefetcher;
+    std::array<double, 6> geotransform;
+    bool projected;             // whether the dataset is in a projected coordinate system (queried by latitude, longitude)
+    size_t projection;          // the coordinate system's id for cached transformations (`Transform::detail::Intern`)
 
     void initialize(GDALDataset* dataset) {
         if (dataset != nullptr) {
@@ -155,13 +268,51 @@ private:
         this->type = Type<DataType, raster_number, no_data_fallback>(dataset);
 
         this->data = this->dataset->GetRasterBand(raster_number);
+        this->dataset->GetGeoTransform(this->geotransform.data());
+
+        OGRSpatialReference srs;
+        this->projected = !this->type.projection.empty()
+            && srs.SetFromUserInput(this->type.projection.c_str()) == OGRERR_NONE
+            && srs.IsProjected();
+        this->projection = Transform::detail::Intern(this->type.projection);
+
+        if (this->projected) {
+            // bounds of projected datasets are their geographic extent
+            std::array<double, 4> extent = Transform::detail::Extent(this->type.projection, this->geotransform, this->type.rows, this->type.columns);
+
+            this->bounds = Bounds(
+                Coordinate(extent[3], extent[0]),
+                Coordinate(extent[3], extent[2]),
+                Coordinate(extent[1], extent[0]),
+                Coordinate(extent[1], extent[2])
+            );
+        } else {
+            this->bounds = Bounds(
+                Coordinate(this->type.y_max, this->type.x_min),
+                Coordinate(this->type.y_max, this->type.x_max),
+                Coordinate(this->type.y_min, this->type.x_min),
+                Coordinate(this->type.y_min, this->type.x_max)
+            );
+        }
+    }
+
+    GDALDataset* duplicate(GDALDataset* dataset) const {
+        GDALDataset *copy = nullptr;
+
+        if (!this->file_path.empty()) {
+            copy = static_cast<GDALDataset*>(GDALOpen(this->file_path.string().c_str(), GA_ReadOnly));
+        } else {
+            // in-memory (or externally opened) datasets have no file to reopen, so they are copied into memory
+            GDALRegister_MEM();
+            GDALDriver *driver = GetGDALDriverManager()->GetDriverByName("MEM");
+            copy = driver->CreateCopy("", dataset, FALSE, nullptr, nullptr, nullptr);
+        }
+
+        if (copy == nullptr) {
+            throw std::runtime_error("failed to duplicate DEM dataset");
+        }
 
-        this->bounds = Bounds(
-            Coordinate(this->type.y_max, this->type.x_min),
-            Coordinate(this->type.y_max, this->type.x_max),
-            Coordinate(this->type.y_min, this->type.x_min),
-            Coordinate(this->type.y_min, this->type.x_max)
-        );
+        return copy;
     }
 
 public:
@@ -218,16 +369,22 @@ public:
         data(nullptr),
         type(o.type),
         bounds(o.bounds),
-        file_path(o.file_path)
+        file_path(o.file_path),
+        geoid(o.geoid),
+        lookup(o.lookup),
+        geotransform(o.geotransform),
+        projected(o.projected),
+        projection(o.projection)
     {
         if (o.dataset) {
-            this->dataset = static_cast<GDALDataset*>(GDALOpen(this->file_path.string().c_str(), GA_ReadOnly));
+            this->dataset = this->duplicate(o.dataset);
             this->data = this->dataset->GetRasterBand(raster_number);
         }
     }
 
     DEM& operator=(const DEM& o) {
         if (this != &o) {
+            this->prefetcher = nullptr;
             if (this->dataset) {
                 GDALClose(this->dataset);
                 this->dataset = nullptr;
@@ -238,9 +395,15 @@ public:
             this->type = o.type;
             this->bounds = o.bounds;
             this->file_path = o.file_path;
+            this->geoid = o.geoid;
+            this->lookup = o.lookup;
+            this->cache = nullptr;
+            this->geotransform = o.geotransform;
+            this->projected = o.projected;
+            this->projection = o.projection;
 
             if (o.dataset) {
-                this->dataset = static_cast<GDALDataset*>(GDALOpen(this->file_path.string().c_str(), GA_ReadOnly));
+                this->dataset = this->duplicate(o.dataset);
                 this->data = this->dataset->GetRasterBand(raster_number);
             }
         }
@@ -253,7 +416,14 @@ public:
         data(o.data),
         type(std::move(o.type)),
         bounds(std::move(o.bounds)),
-        file_path(std::move(file_path))
+        file_path(std::move(o.file_path)),
+        geoid(std::move(o.geoid)),
+        lookup(std::move(o.lookup)),
+        cache(std::move(o.cache)),
+        prefetcher(std::move(o.prefetcher)),
+        geotransform(o.geotransform),
+        projected(o.projected),
+        projection(o.projection)
     {
         o.dataset = nullptr;
         o.data = nullptr;
@@ -261,6 +431,7 @@ public:
 
     DEM& operator=(DEM&& o) noexcept {
         if (this != &o) {
+            this->prefetcher = nullptr;
             if (this->dataset) {
                 GDALClose(this->dataset);
                 this->dataset = nullptr;
@@ -271,6 +442,13 @@ public:
             this->type = std::move(o.type);
             this->bounds = std::move(o.bounds);
             this->file_path = std::move(o.file_path);
+            this->geoid = std::move(o.geoid);
+            this->lookup = std::move(o.lookup);
+            this->cache = std::move(o.cache);
+            this->prefetcher = std::move(o.prefetcher);
+            this->geotransform = o.geotransform;
+            this->projected = o.projected;
+            this->projection = o.projection;
 
             o.dataset = nullptr;
             o.data = nullptr;
@@ -280,65 +458,145 @@ public:
     }
 
     ~DEM() {
+        // stops its loads of the dataset first
+        this->prefetcher = nullptr;
+
         if (this->dataset != nullptr) {
             GDALClose(this->dataset);
             this->dataset = nullptr;
         }
     }
 
+    GDALDataset* get_dataset() const {
+        return this->dataset;
+    }
+
     DataType altitude(float latitude, float longitude) {
-        Index rc = index(latitude, longitude);
+        return this->value(this->index(latitude, longitude));
+    }
 
-        if (rc.row == this->type.nodata || rc.column == this->type.nodata) {
-            return this->type.nodata;
+    float interpolated_altitude(float latitude, float longitude) {
+        return this->interpolated_value(this->index(latitude, longitude));
+    }
+
+    // Precomputes a latitude, longitude to pixel lookup grid for projected datasets, taking the coordinate transformation
+    // out of `altitude` / `interpolated_altitude` queries. Its pixel error is measured at sample points (within half of
+    // `max_error`), not guaranteed everywhere.
+    void set_lookup(double max_error = 0.125, size_t max_size = 1024) {
+        if (!this->projected) {
+            throw std::runtime_error("lookup grid requires a projected dataset");
         }
 
-        size_t r = static_cast<size_t>(std::round(rc.row));
-        size_t c = static_cast<size_t>(std::round(rc.column));
+        this->lookup = std::make_shared<const Transform::Lookup>(this->type.projection, this->geotransform, this->type.rows, this->type.columns, max_error, max_size);
+    }
 
-        r = r == this->type.rows ? r - 1 : r;
-        c = c == this->type.columns ? c - 1 : c;
+    // back to exact transformations per query
+    void remove_lookup() {
+        this->lookup = nullptr;
+    }
 
-        DataType altitude;
-        if (this->data->RasterIO(GF_Read, c, r, 1, 1, &altitude, 1, 1, this->type.data_type, 0, 0) != CE_None) {
-            return this->type.nodata;
-        } else {
-            return altitude;
-        }
+    // Reads altitudes through a `BlockCache` of `capacity` bytes of decoded blocks (and `compressed_capacity` bytes
+    // of compressed ones) instead of single cell reads, for workloads querying the same areas repeatedly. Its disk
+    // tier is set through `block_cache()`. Copies of the DEM don't share it.
+    void set_block_cache(size_t capacity = size_t(256) << 20, size_t compressed_capacity = 0) {
+        this->prefetcher = nullptr;
+        this->cache = std::make_shared<BlockCache<DataType, raster_number>>(this->dataset, capacity, compressed_capacity);
     }
 
-    float interpolated_altitude(float latitude, float longitude) {
-        Index rc = index(latitude, longitude);
+    void remove_block_cache() {
+        this->prefetcher = nullptr;
+        this->cache = nullptr;
+    }
 
-        if (rc.row == this->type.nodata || rc.column == this->type.nodata) {
-            return this->type.nodata;
+    // the block cache, `nullptr` when none is set
+    BlockCache<DataType, raster_number>* block_cache() const {
+        return this->cache.get();
+    }
+
+    // Loads the blocks ahead of the altitude queries into the block cache in the background, following the
+    // direction & speed of the recent queries and throttled when the predictions stop being reached, see `Prefetcher`
+    void set_prefetcher(const typename Prefetcher<DataType, raster_number>::Options& options = typename Prefetcher<DataType, raster_number>::Options()) {
+        if (this->cache == nullptr) {
+            throw std::runtime_error("prefetching requires a block cache");
         }
 
-        size_t r = static_cast<size_t>(rc.row);
-        size_t c = static_cast<size_t>(rc.column);
+        this->prefetcher = nullptr;
+        this->prefetcher = std::make_unique<Prefetcher<DataType, raster_number>>(this->cache, options);
+    }
 
-        float del_latitude = std::min(rc.row, static_cast<float>(this->type.rows - 1)) - r;
-        float del_longitude = std::min(rc.column, static_cast<float>(this->type.columns - 1)) - c;
+    void remove_prefetcher() {
+        this->prefetcher = nullptr;
+    }
 
-        size_t next_r = (r == this->type.rows - 1) ? r : r + 1;
-        size_t next_c = (c == this->type.columns - 1) ? c : c + 1;
+    // the prefetcher's hit rate, accuracy & lookahead so far
+    typename Prefetcher<DataType, raster_number>::Report prefetch_report() const {
+        if (this->prefetcher == nullptr) {
+            throw std::runtime_error("no prefetcher set");
+        }
 
-        DataType m, n, o, p;
-        if (
-            this->data->RasterIO(GF_Read,       c,          r,          1, 1, &m, 1, 1, this->type.data_type, 0, 0) != CE_None
-            || this->data->RasterIO(GF_Read,    next_c,     r,          1, 1, &n, 1, 1, this->type.data_type, 0, 0) != CE_None
-            || this->data->RasterIO(GF_Read,    c,          next_r,     1, 1, &o, 1, 1, this->type.data_type, 0, 0) != CE_None
-            || this->data->RasterIO(GF_Read,    next_c,     next_r,     1, 1, &p, 1, 1, this->type.data_type, 0, 0) != CE_None
-        ) {
-            return this->type.nodata;
-        } else {
-            float altitude =    (1-del_latitude) *  (1-del_longitude) * m +
-                                del_longitude *     (1-del_latitude) *  n +
-                                (1-del_longitude) * del_latitude *      o +
-                                del_latitude *      del_longitude *     p;
+        return this->prefetcher->report();
+    }
+
+    // attaches a geoid model (shareable between DEMs) for ellipsoidal altitudes, `nullptr` detaches it
+    void set_geoid(std::shared_ptr<const Geoid> geoid) {
+        this->geoid = std::move(geoid);
+    }
+
+    // altitude above the ellipsoid (orthometric altitude + geoid undulation), NODATA stays NODATA
+    double ellipsoidal_altitude(float latitude, float longitude, bool interpolated = false) {
+        if (this->geoid == nullptr) {
+            throw std::runtime_error("no geoid model attached");
+        }
 
+        double altitude = interpolated ? this->interpolated_altitude(latitude, longitude) : this->altitude(latitude, longitude);
+        if (altitude == this->type.nodata) {
             return altitude;
         }
+
+        return this->geoid->ellipsoidal(altitude, latitude, longitude);
+    }
+
+    // ellipsoidal altitudes of a batch of coordinates, with the geoid undulations looked up in one batch
+    std::vector<double> ellipsoidal_altitudes(const std::vector<Coordinate>& coordinates, bool interpolated = false) {
+        if (this->geoid == nullptr) {
+            throw std::runtime_error("no geoid model attached");
+        }
+
+        size_t count = coordinates.size();
+        std::vector<double> altitudes(count), latitudes(count), longitudes(count), undulations(count);
+
+        for (size_t i = 0; i < count; i++) {
+            latitudes[i] = coordinates[i].latitude;
+            longitudes[i] = coordinates[i].longitude;
+            altitudes[i] = interpolated
+                ? this->interpolated_altitude(coordinates[i].latitude, coordinates[i].longitude)
+                : this->altitude(coordinates[i].latitude, coordinates[i].longitude);
+        }
+
+        this->geoid->undulations(latitudes.data(), longitudes.data(), undulations.data(), count);
+
+        for (size_t i = 0; i < count; i++) {
+            altitudes[i] = altitudes[i] == this->type.nodata ? altitudes[i] : altitudes[i] + undulations[i];
+        }
+
+        return altitudes;
+    }
+
+    // altitudes of a batch of points (`xs[i]`, `ys[i]`) given in another coordinate system `srs` (e.g. "EPSG:32643"),
+    // transformed to the DEM's in one call, `tolerance` > 0 (DEM units) allows an approximate transformation
+    std::vector<double> altitudes(std::vector<double> xs, std::vector<double> ys, const std::string& srs, bool interpolated = false, double tolerance = 0) {
+        Transform::Points(srs, this->type.projection, xs, ys, tolerance);
+
+        std::vector<double> altitudes(xs.size());
+        for (size_t i = 0; i < xs.size(); i++) {
+            if (!std::isfinite(xs[i]) || !std::isfinite(ys[i])) {
+                altitudes[i] = this->type.nodata;
+            } else {
+                altitudes[i] = interpolated ? this->interpolated_value(this->pixel(ys[i], xs[i])) : this->value(this->pixel(ys[i], xs[i]));
+            }
+        }
+
+        return altitudes;
     }
 
     friend std::ostream& operator<<(std::ostream& os, const DEM& o) {
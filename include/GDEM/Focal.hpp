@@ -0,0 +1,402 @@
+/*
+GDEM : C++ wrapper over GDAL for working with DEM data.
+Copyright (C) 2024  Pritam Halder
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <https://www.gnu.org/licenses/>.
+
+Author : Pritam Halder
+Email : pritamhalder.portfolio@gmail.com
+*/
+
+#pragma once
+
+
+#include <algorithm>
+#include <cmath>
+#include <concepts>
+#include <cstdint>
+#include <filesystem>
+#include <limits>
+#include <utility>
+#include <vector>
+
+#include <gdal/gdal_priv.h>
+
+#include "GDEM/Block.hpp"
+#include "GDEM/DEM.hpp"
+#include "GDEM/Parallel.hpp"
+#include "GDEM/Statistics.hpp"
+
+
+
+namespace GDEM {
+namespace Focal {
+
+// A kernel computes a whole output row at once from the `size()` (odd) input rows around it : `rows[i][c + j]`,
+// for i, j in [0, size()), is the neighbourhood of output cell `c` in [0, count). NODATA is NaN in the rows and
+// NaN outputs are written as NODATA. Looping over the columns innermost (as the built in kernels do) lets the
+// compiler vectorize it.
+template <typename Kernel>
+concept RowKernel = requires(const Kernel& kernel, const float* const* rows, float* out, size_t count) {
+    { kernel.size() } -> std::convertible_to<size_t>;
+    kernel(rows, out, count);
+};
+
+
+// adapts a per cell function `float(const float* const* rows, size_t c)` (same neighbourhood as above) to a kernel
+template <typename Function>
+class Cell {
+private:
+    size_t n;
+    Function function;
+
+public:
+    Cell(size_t size, Function function)
+        : n(size),
+        function(std::move(function))
+    {}
+
+    size_t size() const {
+        return this->n;
+    }
+
+    void operator()(const float* const* rows, float* out, size_t count) const {
+        for (size_t c = 0; c < count; c++) {
+            out[c] = this->function(rows, c);
+        }
+    }
+};
+
+
+
+// mean of the `size` x `size` window
+class Mean {
+private:
+    size_t n;
+
+public:
+    explicit Mean(size_t size = 3)
+        : n(size)
+    {}
+
+    size_t size() const {
+        return this->n;
+    }
+
+    void operator()(const float* const* rows, float* out, size_t count) const {
+        std::fill(out, out + count, 0.0f);
+        for (size_t i = 0; i < this->n; i++) {
+            for (size_t j = 0; j < this->n; j++) {
+                const float *row = rows[i] + j;
+                for (size_t c = 0; c < count; c++) {
+                    out[c] += row[c];
+                }
+            }
+        }
+
+        float scale = 1.0f / (this->n * this->n);
+        for (size_t c = 0; c < count; c++) {
+            out[c] *= scale;
+        }
+    }
+};
+
+
+// gaussian weighted mean, over a window of 2 * ceil(3 * sigma) + 1 cells (sigma in cells)
+class Gaussian {
+private:
+    size_t n;
+    std::vector<float> weights;
+
+    // window side of `sigma`, validated before anything is sized from it
+    static size_t window(double sigma) {
+        if (!(sigma > 0) || !std::isfinite(sigma)) {
+            throw std::runtime_error("gaussian sigma must be positive");
+        }
+        return 2 * static_cast<size_t>(std::ceil(3 * sigma)) + 1;
+    }
+
+public:
+    explicit Gaussian(double sigma = 1)
+        : n(window(sigma)),
+        weights(n * n)
+    {
+        double total = 0, radius = (this->n - 1) / 2.0;
+        for (size_t i = 0; i < this->n; i++) {
+            for (size_t j = 0; j < this->n; j++) {
+                double di = i - radius, dj = j - radius;
+                total += this->weights[i * this->n + j] = std::exp(-(di * di + dj * dj) / (2 * sigma * sigma));
+            }
+        }
+        for (float& weight : this->weights) {
+            weight /= total;
+        }
+    }
+
+    size_t size() const {
+        return this->n;
+    }
+
+    void operator()(const float* const* rows, float* out, size_t count) const {
+        std::fill(out, out + count, 0.0f);
+        for (size_t i = 0; i < this->n; i++) {
+            for (size_t j = 0; j < this->n; j++) {
+                const float *row = rows[i] + j;
+                float weight = this->weights[i * this->n + j];
+                for (size_t c = 0; c < count; c++) {
+                    out[c] += weight * row[c];
+                }
+            }
+        }
+    }
+};
+
+
+// median of the `size` x `size` window
+class Median {
+private:
+    size_t n;
+
+public:
+    explicit Median(size_t size = 3)
+        : n(size)
+    {}
+
+    size_t size() const {
+        return this->n;
+    }
+
+    void operator()(const float* const* rows, float* out, size_t count) const {
+        std::vector<float> window(this->n * this->n);
+        size_t middle = window.size() / 2;
+
+        for (size_t c = 0; c < count; c++) {
+            bool valid = true;
+            for (size_t i = 0; i < this->n; i++) {
+                for (size_t j = 0; j < this->n; j++) {
+                    float value = rows[i][c + j];
+                    valid = valid && value == value;
+                    window[i * this->n + j] = value;
+                }
+            }
+
+            if (!valid) {
+                out[c] = std::numeric_limits<float>::quiet_NaN();
+                continue;
+            }
+
+            std::nth_element(window.begin(), window.begin() + middle, window.end());
+            out[c] = window[middle];
+        }
+    }
+};
+
+
+// topographic position index : the cell minus the mean of its neighbours in the `size` x `size` window
+class TPI {
+private:
+    size_t n;
+
+public:
+    explicit TPI(size_t size = 3)
+        : n(size)
+    {}
+
+    size_t size() const {
+        return this->n;
+    }
+
+    void operator()(const float* const* rows, float* out, size_t count) const {
+        std::fill(out, out + count, 0.0f);
+        for (size_t i = 0; i < this->n; i++) {
+            for (size_t j = 0; j < this->n; j++) {
+                const float *row = rows[i] + j;
+                for (size_t c = 0; c < count; c++) {
+                    out[c] += row[c];
+                }
+            }
+        }
+
+        size_t radius = this->n / 2;
+        const float *center = rows[radius] + radius;
+        float scale = 1.0f / (this->n * this->n - 1);
+        for (size_t c = 0; c < count; c++) {
+            out[c] = center[c] - (out[c] - center[c]) * scale;
+        }
+    }
+};
+
+
+// terrain ruggedness index (Riley) : square root of the summed squared differences to the 8 neighbours
+class TRI {
+public:
+    size_t size() const {
+        return 3;
+    }
+
+    void operator()(const float* const* rows, float* out, size_t count) const {
+        std::fill(out, out + count, 0.0f);
+        const float *center = rows[1] + 1;
+        for (size_t i = 0; i < 3; i++) {
+            for (size_t j = 0; j < 3; j++) {
+                const float *row = rows[i] + j;
+                for (size_t c = 0; c < count; c++) {
+                    float difference = row[c] - center[c];
+                    out[c] += difference * difference;
+                }
+            }
+        }
+
+        for (size_t c = 0; c < count; c++) {
+            out[c] = std::sqrt(out[c]);
+        }
+    }
+};
+
+
+// roughness : largest minus smallest value of the `size` x `size` window
+class Roughness {
+private:
+    size_t n;
+
+public:
+    explicit Roughness(size_t size = 3)
+        : n(size)
+    {}
+
+    size_t size() const {
+        return this->n;
+    }
+
+    void operator()(const float* const* rows, float* out, size_t count) const {
+        std::vector<float> highest(rows[0], rows[0] + count);
+        std::vector<float> lowest(rows[0], rows[0] + count);
+        std::vector<uint8_t> invalid(count, 0);
+
+        // branchless min / max (NaNs tracked apart, as min / max don't propagate them)
+        for (size_t i = 0; i < this->n; i++) {
+            for (size_t j = 0; j < this->n; j++) {
+                const float *row = rows[i] + j;
+                for (size_t c = 0; c < count; c++) {
+                    float value = row[c];
+                    highest[c] = value > highest[c] ? value : highest[c];
+                    lowest[c] = value < lowest[c] ? value : lowest[c];
+                    invalid[c] |= value != value;
+                }
+            }
+        }
+
+        for (size_t c = 0; c < count; c++) {
+            out[c] = invalid[c] ? std::numeric_limits<float>::quiet_NaN() : highest[c] - lowest[c];
+        }
+    }
+};
+
+
+
+namespace detail {
+
+// Strip's rows with a halo of `radius` rows & columns (edges replicated past the raster), NODATA as NaN
+template <ValidDataType DataType, uint16_t raster_number>
+static std::vector<float> Padded(BandReader<DataType, raster_number>& reader, const Window& strip, size_t radius, DataType nodata) {
+    size_t rows = reader.rows(), columns = reader.columns();
+    size_t first = strip.row >= radius ? strip.row - radius : 0;
+    size_t last = std::min(rows, strip.row + strip.rows + radius);
+
+    Window window{first, 0, last - first, columns};
+    std::vector<DataType> values = reader.read(window);
+
+    size_t stride = columns + 2 * radius;
+    std::vector<float> padded((strip.rows + 2 * radius) * stride);
+
+    for (size_t r = 0; r < strip.rows + 2 * radius; r++) {
+        long source = static_cast<long>(strip.row + r) - static_cast<long>(radius);
+        source = std::clamp<long>(source, 0, rows - 1) - static_cast<long>(first);
+
+        const DataType *in = values.data() + source * columns;
+        float *out = padded.data() + r * stride;
+        for (size_t c = 0; c < columns; c++) {
+            out[radius + c] = Statistics::detail::valid(in[c], nodata) ? static_cast<float>(in[c]) : std::numeric_limits<float>::quiet_NaN();
+        }
+        for (size_t c = 0; c < radius; c++) {
+            out[c] = out[radius];
+            out[radius + columns + c] = out[radius + columns - 1];
+        }
+    }
+
+    return padded;
+}
+
+}
+
+
+
+// Applies a focal kernel over the DEM into a Float32 tiled GeoTiff (NODATA of the DEM). Strips (with halos of
+// the kernel's radius) are processed in parallel (`threads` = 0 uses all hardware threads), the kernel computing
+// whole rows. Past the raster's edges, edge cells are replicated.
+template <ValidDataType DataType, uint16_t raster_number, DataType no_data_fallback, RowKernel Kernel>
+static void Apply(
+    const DEM<DataType, raster_number, no_data_fallback>& dem, const std::filesystem::path& destination_filepath,
+    const Kernel& kernel, size_t threads = 0
+) {
+    size_t size = kernel.size();
+    if (size % 2 == 0) {
+        throw std::runtime_error("kernel size must be odd");
+    }
+    size_t radius = size / 2;
+
+    GDALDataset *dataset = dem.get_dataset();
+    float nodata = static_cast<float>(dem.type.nodata);
+
+    BandReader<DataType, raster_number> reader(dataset);
+    std::vector<Window> strips = Strips(reader.shared());
+    size_t columns = reader.columns(), stride = columns + 2 * radius;
+
+    GDALDataset *output_dataset = Create(destination_filepath, dataset, GDT_Float32, nodata);
+
+    try {
+        BandWriter<float> writer(output_dataset);
+        ThreadPool pool(threads);
+
+        pool.parallel_for(strips.size(), [&] (size_t index, size_t) {
+            const Window& strip = strips[index];
+            std::vector<float> padded = detail::Padded(reader, strip, radius, dem.type.nodata);
+            std::vector<float> output(strip.size());
+            std::vector<const float*> rows(size);
+
+            for (size_t r = 0; r < strip.rows; r++) {
+                for (size_t i = 0; i < size; i++) {
+                    rows[i] = padded.data() + (r + i) * stride;
+                }
+
+                float *out = output.data() + r * columns;
+                kernel(rows.data(), out, columns);
+
+                for (size_t c = 0; c < columns; c++) {
+                    out[c] = out[c] == out[c] ? out[c] : nodata;
+                }
+            }
+
+            writer.write(strip, output.data());
+        });
+    } catch (...) {
+        GDALClose(output_dataset);
+        throw;
+    }
+
+    GDALClose(output_dataset);
+}
+
+}
+}
@@ -0,0 +1,209 @@
+/*
+GDEM : C++ wrapper over GDAL for working with DEM data.
+Copyright (C) 2024  Pritam Halder
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <https://www.gnu.org/licenses/>.
+
+Author : Pritam Halder
+Email : pritamhalder.portfolio@gmail.com
+*/
+
+#pragma once
+
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <filesystem>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+#include <gdal/gdal_priv.h>
+
+
+
+namespace GDEM {
+
+// Geoid model (e.g. EGM96 / EGM2008 undulation grids, as `.gtx` or GeoTiff) read fully into memory. Undulations
+// (ellipsoidal - orthometric height, metres) are interpolated bilinearly or bicubically, with the longitude
+// wrapped around for global grids.
+class Geoid {
+public:
+    enum class Interpolation {
+        Bilinear,
+        Bicubic
+    };
+
+private:
+    std::vector<float> grid;
+    size_t rows;
+    size_t columns;
+    double origin_latitude;     // latitude of the first row's cell centers
+    double origin_longitude;    // longitude of the first column's cell centers
+    double latitude_step;       // (negative for north-up grids)
+    double longitude_step;
+    bool global;                // whether the columns span the whole 360°
+    long period;                // columns per 360° of global grids (which may repeat the seam column)
+    Interpolation interpolation;
+
+    // value at (row, column), rows clamped & columns wrapped (global grids) or clamped
+    float at(long row, long column) const {
+        row = std::clamp<long>(row, 0, this->rows - 1);
+        if (this->global) {
+            column %= this->period;
+            if (column < 0) column += this->period;
+        } else {
+            column = std::clamp<long>(column, 0, this->columns - 1);
+        }
+        return this->grid[row * this->columns + column];
+    }
+
+    static double cubic(double p0, double p1, double p2, double p3, double t) {
+        // Catmull-Rom
+        return p1 + 0.5 * t * (p2 - p0 + t * (2 * p0 - 5 * p1 + 4 * p2 - p3 + t * (3 * (p1 - p2) + p3 - p0)));
+    }
+
+    // bilinear undulations of a batch, as `undulation` without its per point branches
+    template <bool global>
+    void bilinear(const double* latitudes, const double* longitudes, double* undulations, size_t count) const {
+        // Members in locals (`undulations` could otherwise alias them), with 32 bit indices (larger grids take the
+        // scalar path) and the clamping bounds already as doubles. Coordinates are clamped into the grid before being
+        // floored by truncation (std::floor doesn't vectorize), which leaves the border interpolations unchanged.
+        const float *grid = this->grid.data();
+        int columns = this->columns, period = this->period, last_row = this->rows - 1, last_column = this->columns - 1;
+        double bottom_row = this->rows - 1.0, right_column = global ? this->period : this->columns - 1.0;
+        double span = this->period;
+        double origin_latitude = this->origin_latitude, origin_longitude = this->origin_longitude;
+        double latitude_step = this->latitude_step, longitude_step = this->longitude_step;
+
+        for (size_t i = 0; i < count; i++) {
+            double y = std::min(std::max((latitudes[i] - origin_latitude) / latitude_step, 0.0), bottom_row);
+            double x = (longitudes[i] - origin_longitude) / longitude_step;
+            if constexpr (global) {
+                // into [0, span] by a whole number of periods, rounded by the 1.5 * 2^52 trick
+                x -= span * ((x / span - 0.5 + 0x1.8p52) - 0x1.8p52);
+            }
+            x = std::min(std::max(x, 0.0), right_column);
+
+            int r0 = static_cast<int>(y), r1 = std::min(r0 + 1, last_row);
+            int c0, c1;
+            if constexpr (global) {
+                c0 = std::min(static_cast<int>(x), period - 1);
+                c1 = c0 + 1 - period * (c0 + 1 == period);
+            } else {
+                c0 = static_cast<int>(x);
+                c1 = std::min(c0 + 1, last_column);
+            }
+            double ty = y - r0, tx = x - c0;
+
+            double top = grid[r0 * columns + c0] * (1 - tx) + grid[r0 * columns + c1] * tx;
+            double bottom = grid[r1 * columns + c0] * (1 - tx) + grid[r1 * columns + c1] * tx;
+            undulations[i] = top * (1 - ty) + bottom * ty;
+        }
+    }
+
+public:
+    Geoid(const std::filesystem::path& file_path, Interpolation interpolation = Interpolation::Bilinear)
+        : interpolation(interpolation)
+    {
+        if (!std::filesystem::exists(file_path)) {
+            throw std::runtime_error("file '" + file_path.string() + "' not found");
+        }
+
+        GDALAllRegister();
+
+        GDALDataset *dataset = static_cast<GDALDataset*>(GDALOpen(file_path.string().c_str(), GA_ReadOnly));
+        if (dataset == nullptr) {
+            throw std::runtime_error("failed to read geoid file");
+        }
+
+        double geotransform[6];
+        if (dataset->GetGeoTransform(geotransform) != CE_None || geotransform[2] != 0 || geotransform[4] != 0) {
+            GDALClose(dataset);
+            throw std::runtime_error("failed to read geoid transformations");
+        }
+
+        this->rows = dataset->GetRasterYSize();
+        this->columns = dataset->GetRasterXSize();
+        this->latitude_step = geotransform[5];
+        this->longitude_step = geotransform[1];
+        this->origin_latitude = geotransform[3] + 0.5 * geotransform[5];
+        this->origin_longitude = geotransform[0] + 0.5 * geotransform[1];
+        this->global = std::abs(this->columns * this->longitude_step) >= 360 - 1e-6;
+        this->period = std::min<long>(std::lround(360 / std::abs(this->longitude_step)), this->columns);
+
+        this->grid.resize(this->rows * this->columns);
+        if (dataset->GetRasterBand(1)->RasterIO(
+            GF_Read, 0, 0, this->columns, this->rows, this->grid.data(), this->columns, this->rows, GDT_Float32, 0, 0
+        ) != CE_None) {
+            GDALClose(dataset);
+            throw std::runtime_error("failed to read geoid grid");
+        }
+
+        GDALClose(dataset);
+    }
+
+    Geoid(const Geoid& o) = default;
+    Geoid& operator=(const Geoid& o) = default;
+    Geoid(Geoid&& o) noexcept = default;
+    Geoid& operator=(Geoid&& o) noexcept = default;
+    ~Geoid() = default;
+
+    // geoid undulation (metres) at the coordinates
+    double undulation(double latitude, double longitude) const {
+        double y = (latitude - this->origin_latitude) / this->latitude_step;
+        double x = (longitude - this->origin_longitude) / this->longitude_step;
+        if (this->global) {
+            x -= this->period * std::floor(x / this->period);
+        }
+
+        long r = static_cast<long>(std::floor(y)), c = static_cast<long>(std::floor(x));
+        double ty = y - r, tx = x - c;
+
+        if (this->interpolation == Interpolation::Bicubic) {
+            double values[4];
+            for (int i = 0; i < 4; i++) {
+                long row = r - 1 + i;
+                values[i] = cubic(this->at(row, c - 1), this->at(row, c), this->at(row, c + 1), this->at(row, c + 2), tx);
+            }
+            return cubic(values[0], values[1], values[2], values[3], ty);
+        }
+
+        double top = this->at(r, c) * (1 - tx) + this->at(r, c + 1) * tx;
+        double bottom = this->at(r + 1, c) * (1 - tx) + this->at(r + 1, c + 1) * tx;
+        return top * (1 - ty) + bottom * ty;
+    }
+
+    // Undulations of a batch of coordinates (`latitudes[i]`, `longitudes[i]`) into `undulations`. Bilinear batches
+    // run a branch free loop (specialized for global grids) which the compiler vectorizes, gathering the grid values.
+    void undulations(const double* latitudes, const double* longitudes, double* undulations, size_t count) const {
+        if (this->interpolation == Interpolation::Bicubic || this->grid.size() > static_cast<size_t>(INT32_MAX)) {
+            for (size_t i = 0; i < count; i++) {
+                undulations[i] = this->undulation(latitudes[i], longitudes[i]);
+            }
+        } else if (this->global) {
+            this->bilinear<true>(latitudes, longitudes, undulations, count);
+        } else {
+            this->bilinear<false>(latitudes, longitudes, undulations, count);
+        }
+    }
+
+    // ellipsoidal height of an orthometric height at the coordinates
+    double ellipsoidal(double orthometric, double latitude, double longitude) const {
+        return orthometric + this->undulation(latitude, longitude);
+    }
+};
+
+}
@@ -0,0 +1,555 @@
+/*
+GDEM : C++ wrapper over GDAL for working with DEM data.
+Copyright (C) 2024  Pritam Halder
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <https://www.gnu.org/licenses/>.
+
+Author : Pritam Halder
+Email : pritamhalder.portfolio@gmail.com
+*/
+
+#pragma once
+
+
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <cmath>
+#include <cstdint>
+#include <cstdio>
+#include <filesystem>
+#include <fstream>
+#include <limits>
+#include <memory>
+#include <random>
+#include <stdexcept>
+#include <string>
+#include <system_error>
+#include <vector>
+
+#include <gdal/cpl_conv.h>
+#include <gdal/gdal_grid.h>
+#include <gdal/gdal_priv.h>
+
+#include "GDEM/Block.hpp"
+#include "GDEM/Parallel.hpp"
+#include "GDEM/Type.hpp"
+
+
+
+namespace GDEM {
+namespace Gridding {
+
+enum class Method {
+    Minimum,    // binning : lowest point in the cell
+    Maximum,    // binning : highest point in the cell
+    Mean,       // binning : mean of the points in the cell
+    Count,      // binning : number of points in the cell
+    IDW,        // inverse distance weighting of the nearest points within a radius
+    TIN         // linear interpolation over the Delaunay triangulation of the points
+};
+
+
+// Points as a binary file of little endian float64 (x, y, z) triplets, read in chunks (never held in memory)
+class PointFile {
+private:
+    std::filesystem::path file_path;
+    size_t count;
+
+public:
+    PointFile(const std::filesystem::path& file_path)
+        : file_path(file_path)
+    {
+        if (!std::filesystem::exists(file_path)) {
+            throw std::runtime_error("file '" + file_path.string() + "' not found");
+        }
+        this->count = std::filesystem::file_size(file_path) / (3 * sizeof(double));
+    }
+
+    PointFile(const PointFile& o) = default;
+    PointFile& operator=(const PointFile& o) = default;
+    PointFile(PointFile&& o) noexcept = default;
+    PointFile& operator=(PointFile&& o) noexcept = default;
+    ~PointFile() = default;
+
+    size_t size() const {
+        return this->count;
+    }
+
+    // reads points [first, first + count) into `xyz` (thread safe)
+    void read(size_t first, size_t count, double* xyz) const {
+        std::ifstream file(this->file_path, std::ios::binary);
+        file.seekg(first * 3 * sizeof(double));
+        if (!file.read(reinterpret_cast<char*>(xyz), count * 3 * sizeof(double))) {
+            throw std::runtime_error("failed to read points from '" + this->file_path.string() + "'");
+        }
+    }
+};
+
+
+// Points held in memory (referenced, not copied)
+class PointArray {
+private:
+    const std::vector<std::array<double, 3>>& points;
+
+public:
+    PointArray(const std::vector<std::array<double, 3>>& points)
+        : points(points)
+    {}
+
+    size_t size() const {
+        return this->points.size();
+    }
+
+    void read(size_t first, size_t count, double* xyz) const {
+        for (size_t i = 0; i < count; i++) {
+            xyz[i * 3] = this->points[first + i][0];
+            xyz[i * 3 + 1] = this->points[first + i][1];
+            xyz[i * 3 + 2] = this->points[first + i][2];
+        }
+    }
+};
+
+
+// output raster, north up with square cells
+struct Grid {
+    double x_min;
+    double y_max;
+    double resolution;
+    size_t rows;
+    size_t columns;
+    std::string projection;     // of the output (points are expected in it)
+
+    Grid()
+        : x_min(0), y_max(0), resolution(1), rows(0), columns(0)
+    {};
+
+    Grid(double x_min, double y_max, double resolution, size_t rows, size_t columns, const std::string& projection = "")
+        : x_min(x_min),
+        y_max(y_max),
+        resolution(resolution),
+        rows(rows),
+        columns(columns),
+        projection(projection)
+    {
+        if (!(resolution > 0) || rows == 0 || columns == 0) {
+            throw std::runtime_error("invalid grid");
+        }
+    };
+
+    Grid(const Grid& o) = default;
+    Grid& operator=(const Grid& o) = default;
+    Grid(Grid&& o) noexcept = default;
+    Grid& operator=(Grid&& o) noexcept = default;
+    ~Grid() = default;
+};
+
+
+struct Options {
+    double power;           // IDW : power of the inverse distance
+    double radius;          // IDW : search radius (dataset units), 0 for the halo's width
+    size_t max_points;      // IDW : nearest points used per cell
+    size_t halo;            // IDW & TIN : cells around every block whose points the block sees
+    double nodata;          // value of cells without points (binning) or interpolation
+
+    Options(double power = 2, double radius = 0, size_t max_points = 12, size_t halo = 16, double nodata = -9999)
+        : power(power),
+        radius(radius),
+        max_points(max_points),
+        halo(halo),
+        nodata(nodata)
+    {};
+
+    Options(const Options& o) = default;
+    Options& operator=(const Options& o) = default;
+    Options(Options&& o) noexcept = default;
+    Options& operator=(Options&& o) noexcept = default;
+    ~Options() = default;
+};
+
+
+
+namespace detail {
+
+constexpr size_t chunk_size = size_t(1) << 22;
+
+
+// Temporary file of the points sorted by block, removed with it. Its name (random tag, clock & counter) is unique
+// across processes, and it is created exclusively, never reusing an existing file.
+struct Spill {
+    std::filesystem::path path;
+
+    Spill() {
+        static std::atomic<uint64_t> counter(0);
+        std::random_device random;
+
+        for (int attempt = 0; attempt < 16; attempt++) {
+            std::filesystem::path candidate = std::filesystem::temp_directory_path() / (
+                "gdem_gridding_" + std::to_string(random()) + "_"
+                + std::to_string(std::chrono::steady_clock::now().time_since_epoch().count()) + "_"
+                + std::to_string(counter++) + ".bin"
+            );
+
+            // ("x" fails on existing files)
+            if (std::FILE *file = std::fopen(candidate.string().c_str(), "wbx")) {
+                std::fclose(file);
+                this->path = candidate;
+                return;
+            }
+        }
+
+        throw std::runtime_error("failed to create spill file in '" + std::filesystem::temp_directory_path().string() + "'");
+    }
+
+    Spill(const Spill& o) = delete;
+    Spill& operator=(const Spill& o) = delete;
+    Spill(Spill&& o) noexcept = delete;
+    Spill& operator=(Spill&& o) noexcept = delete;
+
+    ~Spill() {
+        std::error_code error;
+        std::filesystem::remove(this->path, error);
+    }
+};
+
+
+// Regular grid of output blocks, points belong to the block of their cell (clamped, for the points in the halo
+// around the grid)
+struct Layout {
+    const Grid& grid;
+    long halo;
+    size_t block_rows;
+    size_t block_columns;
+    size_t grid_columns;
+    size_t count;
+
+    // cell (row, column) of a point, unclamped
+    std::pair<long, long> cell(double x, double y) const {
+        return {
+            static_cast<long>(std::floor((this->grid.y_max - y) / this->grid.resolution)),
+            static_cast<long>(std::floor((x - this->grid.x_min) / this->grid.resolution))
+        };
+    }
+
+    // block of a point, `count` for points outside the grid & its halo
+    size_t block(double x, double y) const {
+        if (!std::isfinite(x) || !std::isfinite(y)) {
+            return this->count;
+        }
+
+        auto [r, c] = this->cell(x, y);
+        if (
+            r < -this->halo || r >= static_cast<long>(this->grid.rows) + this->halo
+            || c < -this->halo || c >= static_cast<long>(this->grid.columns) + this->halo
+        ) {
+            return this->count;
+        }
+
+        size_t row = std::clamp<long>(r, 0, this->grid.rows - 1), column = std::clamp<long>(c, 0, this->grid.columns - 1);
+        return (row / this->block_rows) * this->grid_columns + column / this->block_columns;
+    }
+};
+
+
+// cell values of one block from its points (x, y, z triplets)
+template <ValidDataType DataType>
+static std::vector<DataType> Compute(const Grid& grid, const Window& window, const std::vector<double>& points, Method method, const Options& options) {
+    size_t count = points.size() / 3;
+    std::vector<DataType> values(window.size(), static_cast<DataType>(method == Method::Count ? 0 : options.nodata));
+
+    if (method == Method::IDW || method == Method::TIN) {
+        if (count < (method == Method::TIN ? 3 : 1)) {
+            return values;
+        }
+
+        std::vector<double> x(count), y(count), z(count);
+        for (size_t i = 0; i < count; i++) {
+            x[i] = points[i * 3];
+            y[i] = points[i * 3 + 1];
+            z[i] = points[i * 3 + 2];
+        }
+
+        std::string algorithm = method == Method::IDW
+            ? "invdistnn:power=" + std::to_string(options.power)
+                + ":radius=" + std::to_string(options.radius > 0 ? options.radius : options.halo * grid.resolution)
+                + ":max_points=" + std::to_string(options.max_points)
+                + ":nodata=" + std::to_string(options.nodata)
+            : "linear:radius=0:nodata=" + std::to_string(options.nodata);
+
+        GDALGridAlgorithm algorithm_type;
+        void *algorithm_options = nullptr;
+        if (GDALGridParseAlgorithmAndOptions(algorithm.c_str(), &algorithm_type, &algorithm_options) != CE_None) {
+            throw std::runtime_error("invalid gridding options");
+        }
+
+        // blocks are already processed in parallel
+        CPLSetThreadLocalConfigOption("GDAL_NUM_THREADS", "1");
+
+        // rows go from the first y (top) to the second (bottom)
+        CPLErr error = GDALGridCreate(
+            algorithm_type, algorithm_options, count, x.data(), y.data(), z.data(),
+            grid.x_min + window.column * grid.resolution, grid.x_min + (window.column + window.columns) * grid.resolution,
+            grid.y_max - window.row * grid.resolution, grid.y_max - (window.row + window.rows) * grid.resolution,
+            window.columns, window.rows, BufferType<DataType>(), values.data(), nullptr, nullptr
+        );
+        CPLFree(algorithm_options);
+
+        if (error != CE_None) {
+            throw std::runtime_error("failed to interpolate points");
+        }
+
+        return values;
+    }
+
+    std::vector<double> sums(method == Method::Mean ? window.size() : 0, 0);
+    std::vector<uint64_t> counts(window.size(), 0);
+
+    for (size_t i = 0; i < count; i++) {
+        double z = points[i * 3 + 2];
+        long r = static_cast<long>(std::floor((grid.y_max - points[i * 3 + 1]) / grid.resolution)) - static_cast<long>(window.row);
+        long c = static_cast<long>(std::floor((points[i * 3] - grid.x_min) / grid.resolution)) - static_cast<long>(window.column);
+        if (r < 0 || c < 0 || r >= static_cast<long>(window.rows) || c >= static_cast<long>(window.columns)) continue;
+
+        size_t cell = r * window.columns + c;
+        switch (method) {
+            case Method::Minimum:
+                values[cell] = counts[cell] == 0 ? static_cast<DataType>(z) : std::min(values[cell], static_cast<DataType>(z));
+                break;
+            case Method::Maximum:
+                values[cell] = counts[cell] == 0 ? static_cast<DataType>(z) : std::max(values[cell], static_cast<DataType>(z));
+                break;
+            case Method::Mean:
+                sums[cell] += z;
+                break;
+            default:
+                break;
+        }
+        counts[cell]++;
+    }
+
+    for (size_t cell = 0; cell < window.size(); cell++) {
+        if (method == Method::Mean && counts[cell] > 0) {
+            values[cell] = static_cast<DataType>(sums[cell] / counts[cell]);
+        } else if (method == Method::Count) {
+            values[cell] = static_cast<DataType>(counts[cell]);
+        }
+    }
+
+    return values;
+}
+
+}
+
+
+
+// Extent of the points, as a grid of `resolution` cells
+template <typename Source>
+static Grid Fit(const Source& source, double resolution, const std::string& projection = "", size_t threads = 0) {
+    size_t chunks = (source.size() + detail::chunk_size - 1) / detail::chunk_size;
+    std::vector<std::array<double, 4>> extents(chunks);
+
+    ThreadPool pool(threads);
+    pool.parallel_for(chunks, [&] (size_t chunk, size_t) {
+        size_t first = chunk * detail::chunk_size, count = std::min(detail::chunk_size, source.size() - first);
+        std::vector<double> xyz(count * 3);
+        source.read(first, count, xyz.data());
+
+        std::array<double, 4> extent = {
+            std::numeric_limits<double>::infinity(), std::numeric_limits<double>::infinity(),
+            -std::numeric_limits<double>::infinity(), -std::numeric_limits<double>::infinity()
+        };
+        for (size_t i = 0; i < count; i++) {
+            if (!std::isfinite(xyz[i * 3]) || !std::isfinite(xyz[i * 3 + 1])) continue;
+            extent[0] = std::min(extent[0], xyz[i * 3]);
+            extent[1] = std::min(extent[1], xyz[i * 3 + 1]);
+            extent[2] = std::max(extent[2], xyz[i * 3]);
+            extent[3] = std::max(extent[3], xyz[i * 3 + 1]);
+        }
+        extents[chunk] = extent;
+    });
+
+    std::array<double, 4> extent = {
+        std::numeric_limits<double>::infinity(), std::numeric_limits<double>::infinity(),
+        -std::numeric_limits<double>::infinity(), -std::numeric_limits<double>::infinity()
+    };
+    for (const auto& e : extents) {
+        extent = {std::min(extent[0], e[0]), std::min(extent[1], e[1]), std::max(extent[2], e[2]), std::max(extent[3], e[3])};
+    }
+
+    if (extent[0] > extent[2]) {
+        throw std::runtime_error("no points to grid");
+    }
+
+    double x_min = std::floor(extent[0] / resolution) * resolution, y_max = std::ceil(extent[3] / resolution) * resolution;
+    size_t columns = static_cast<size_t>(std::floor((extent[2] - x_min) / resolution)) + 1;
+    size_t rows = static_cast<size_t>(std::floor((y_max - extent[1]) / resolution)) + 1;
+
+    return Grid(x_min, y_max, resolution, rows, columns, projection);
+}
+
+
+// Grids scattered points (in the grid's coordinate system) into a tiled GeoTiff DEM, out of core :
+//     1. chunks of points are counted per output block (with its halo), in parallel
+//     2. chunks are counting sorted by block into a temporary file, every chunk writing its runs at offsets
+//        from the prefix sums of the counts
+//     3. blocks are computed in parallel from their own & their neighbours' points (within the halo),
+//        and written to the output as they complete
+// Only a chunk of points per thread & a block's points are ever in memory. `threads` = 0 uses all hardware threads.
+template <ValidDataType DataType = float, typename Source>
+static void Rasterize(
+    const Source& source, const Grid& grid, const std::filesystem::path& destination_filepath,
+    Method method = Method::Mean, const Options& options = Options(), size_t threads = 0
+) {
+    double geotransform[6] = {grid.x_min, grid.resolution, 0, grid.y_max, 0, -grid.resolution};
+    GDALDataset *output_dataset = Create(
+        destination_filepath, grid.rows, grid.columns, geotransform, grid.projection, BufferType<DataType>(), options.nodata
+    );
+
+    try {
+        BandWriter<DataType> writer(output_dataset);
+        std::vector<Window> windows = Blocks(output_dataset->GetRasterBand(1));
+
+        bool interpolated = method == Method::IDW || method == Method::TIN;
+        detail::Layout layout{
+            grid,
+            interpolated ? static_cast<long>(options.halo) : 0,
+            windows[0].rows,
+            windows[0].columns,
+            (grid.columns + windows[0].columns - 1) / windows[0].columns,
+            windows.size()
+        };
+
+        size_t chunks = (source.size() + detail::chunk_size - 1) / detail::chunk_size;
+        ThreadPool pool(threads);
+
+        // counts[chunk * blocks + block]
+        std::vector<uint32_t> counts(chunks * layout.count, 0);
+        pool.parallel_for(chunks, [&] (size_t chunk, size_t) {
+            size_t first = chunk * detail::chunk_size, count = std::min(detail::chunk_size, source.size() - first);
+            std::vector<double> xyz(count * 3);
+            source.read(first, count, xyz.data());
+
+            uint32_t *chunk_counts = counts.data() + chunk * layout.count;
+            for (size_t i = 0; i < count; i++) {
+                size_t block = layout.block(xyz[i * 3], xyz[i * 3 + 1]);
+                if (block < layout.count) chunk_counts[block]++;
+            }
+        });
+
+        // starts[block] in the spill file, offsets[chunk * blocks + block] of every chunk's run
+        std::vector<uint64_t> starts(layout.count + 1, 0), offsets(chunks * layout.count);
+        for (size_t block = 0; block < layout.count; block++) {
+            uint64_t offset = starts[block];
+            for (size_t chunk = 0; chunk < chunks; chunk++) {
+                offsets[chunk * layout.count + block] = offset;
+                offset += counts[chunk * layout.count + block];
+            }
+            starts[block + 1] = offset;
+        }
+
+        detail::Spill spill;
+        std::filesystem::resize_file(spill.path, starts[layout.count] * 3 * sizeof(double));
+
+        std::vector<std::unique_ptr<std::fstream>> files(pool.size());
+        auto file = [&] (size_t worker) -> std::fstream& {
+            if (!files[worker]) {
+                files[worker] = std::make_unique<std::fstream>(spill.path, std::ios::binary | std::ios::in | std::ios::out);
+                if (!*files[worker]) {
+                    throw std::runtime_error("failed to open file '" + spill.path.string() + "'");
+                }
+            }
+            return *files[worker];
+        };
+
+        pool.parallel_for(chunks, [&] (size_t chunk, size_t worker) {
+            size_t first = chunk * detail::chunk_size, count = std::min(detail::chunk_size, source.size() - first);
+            std::vector<double> xyz(count * 3);
+            source.read(first, count, xyz.data());
+
+            // counting sort of the chunk by block
+            const uint32_t *chunk_counts = counts.data() + chunk * layout.count;
+            std::vector<size_t> positions(layout.count + 1, 0);
+            for (size_t block = 0; block < layout.count; block++) {
+                positions[block + 1] = positions[block] + chunk_counts[block];
+            }
+
+            std::vector<double> sorted(positions[layout.count] * 3);
+            std::vector<size_t> next(positions.begin(), positions.end() - 1);
+            for (size_t i = 0; i < count; i++) {
+                size_t block = layout.block(xyz[i * 3], xyz[i * 3 + 1]);
+                if (block == layout.count) continue;
+                std::copy(xyz.begin() + i * 3, xyz.begin() + i * 3 + 3, sorted.begin() + next[block]++ * 3);
+            }
+
+            std::fstream& spilled = file(worker);
+            for (size_t block = 0; block < layout.count; block++) {
+                if (chunk_counts[block] == 0) continue;
+                spilled.seekp(offsets[chunk * layout.count + block] * 3 * sizeof(double));
+                spilled.write(reinterpret_cast<const char*>(sorted.data() + positions[block] * 3), chunk_counts[block] * 3 * sizeof(double));
+            }
+            if (!spilled) {
+                throw std::runtime_error("failed to write file '" + spill.path.string() + "'");
+            }
+        });
+
+        for (auto& spilled : files) {
+            if (spilled) spilled->flush();
+        }
+
+        pool.parallel_for(layout.count, [&] (size_t index, size_t worker) {
+            const Window& window = windows[index];
+            long halo = layout.halo;
+
+            // the block's cells & its halo, and the blocks holding their points
+            long r0 = static_cast<long>(window.row) - halo, r1 = static_cast<long>(window.row + window.rows) + halo;
+            long c0 = static_cast<long>(window.column) - halo, c1 = static_cast<long>(window.column + window.columns) + halo;
+            size_t br0 = std::clamp<long>(r0, 0, grid.rows - 1) / layout.block_rows, br1 = std::clamp<long>(r1 - 1, 0, grid.rows - 1) / layout.block_rows;
+            size_t bc0 = std::clamp<long>(c0, 0, grid.columns - 1) / layout.block_columns, bc1 = std::clamp<long>(c1 - 1, 0, grid.columns - 1) / layout.block_columns;
+
+            std::fstream& spilled = file(worker);
+            std::vector<double> points, bucket;
+            for (size_t br = br0; br <= br1; br++) {
+                for (size_t bc = bc0; bc <= bc1; bc++) {
+                    size_t block = br * layout.grid_columns + bc;
+                    size_t count = starts[block + 1] - starts[block];
+                    if (count == 0) continue;
+
+                    bucket.resize(count * 3);
+                    spilled.seekg(starts[block] * 3 * sizeof(double));
+                    if (!spilled.read(reinterpret_cast<char*>(bucket.data()), count * 3 * sizeof(double))) {
+                        throw std::runtime_error("failed to read file '" + spill.path.string() + "'");
+                    }
+
+                    for (size_t i = 0; i < count; i++) {
+                        auto [r, c] = layout.cell(bucket[i * 3], bucket[i * 3 + 1]);
+                        if (r >= r0 && r < r1 && c >= c0 && c < c1) {
+                            points.insert(points.end(), bucket.begin() + i * 3, bucket.begin() + i * 3 + 3);
+                        }
+                    }
+                }
+            }
+
+            writer.write(window, detail::Compute<DataType>(grid, window, points, method, options).data());
+        });
+    } catch (...) {
+        GDALClose(output_dataset);
+        throw;
+    }
+
+    GDALClose(output_dataset);
+}
+
+}
+}
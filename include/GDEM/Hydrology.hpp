@@ -0,0 +1,959 @@
+/*
+GDEM : C++ wrapper over GDAL for working with DEM data.
+Copyright (C) 2024  Pritam Halder
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <https://www.gnu.org/licenses/>.
+
+Author : Pritam Halder
+Email : pritamhalder.portfolio@gmail.com
+*/
+
+#pragma once
+
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <filesystem>
+#include <functional>
+#include <limits>
+#include <numbers>
+#include <queue>
+#include <tuple>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+#include <gdal/gdal_priv.h>
+
+#include "GDEM/Block.hpp"
+#include "GDEM/DEM.hpp"
+#include "GDEM/Parallel.hpp"
+
+
+
+namespace GDEM {
+namespace Hydrology {
+
+enum class Method {
+    D8,         // single steepest neighbour, ESRI codes (1 = E, 2 = SE, 4 = S, ... 128 = NE)
+    DInfinity   // steepest triangular facet (Tarboton), radians counter-clockwise from east
+};
+
+
+
+namespace detail {
+
+// neighbours in D8 order : E, SE, S, SW, W, NW, N, NE (the ESRI direction code of neighbour k is 1 << k)
+constexpr int dr[8] = {0, 1, 1, 1, 0, -1, -1, -1};
+constexpr int dc[8] = {1, 1, 0, -1, -1, -1, 0, 1};
+constexpr double distance[8] = {1, std::numbers::sqrt2, 1, std::numbers::sqrt2, 1, std::numbers::sqrt2, 1, std::numbers::sqrt2};
+
+constexpr uint8_t undefined = 8;
+constexpr uint8_t no_data = 9;
+
+
+// Square tiles of the DEM processed independently. The cells on a tile's perimeter are the only ones
+// interacting with other tiles, so they are indexed for the (DEM wide) graphs joining the tiles.
+struct Grid {
+    size_t rows;
+    size_t columns;
+    size_t tile_size;
+    size_t tile_rows;
+    size_t tile_columns;
+
+    Grid(size_t rows, size_t columns, size_t tile_size)
+        : rows(rows),
+        columns(columns),
+        tile_size(std::max<size_t>(tile_size, 2)),
+        tile_rows((rows + this->tile_size - 1) / this->tile_size),
+        tile_columns((columns + this->tile_size - 1) / this->tile_size)
+    {}
+
+    size_t size() const {
+        return this->tile_rows * this->tile_columns;
+    }
+
+    Window tile(size_t index) const {
+        size_t row = (index / this->tile_columns) * this->tile_size;
+        size_t column = (index % this->tile_columns) * this->tile_size;
+        return {row, column, std::min(this->tile_size, this->rows - row), std::min(this->tile_size, this->columns - column)};
+    }
+
+    size_t tile_of(size_t row, size_t column) const {
+        return (row / this->tile_size) * this->tile_columns + column / this->tile_size;
+    }
+
+    static size_t perimeter_size(const Window& tile) {
+        if (tile.rows == 1 || tile.columns == 1) return tile.size();
+        return 2 * (tile.rows + tile.columns) - 4;
+    }
+
+    // index of the cell (row, column) among the tile's perimeter cells, -1 for the tile's inner cells
+    static long perimeter_index(const Window& tile, size_t row, size_t column) {
+        size_t r = row - tile.row, c = column - tile.column;
+
+        if (r == 0) return c;
+        if (r == tile.rows - 1) return tile.columns + c;
+        if (c == 0) return 2 * tile.columns + (r - 1);
+        if (c == tile.columns - 1) return 2 * tile.columns + (tile.rows - 2) + (r - 1);
+        return -1;
+    }
+
+    // calls `f(row, column)` for every perimeter cell of the tile
+    template <typename F>
+    static void perimeter(const Window& tile, F&& f) {
+        for (size_t r = 0; r < tile.rows; r++) {
+            bool edge = r == 0 || r == tile.rows - 1;
+            for (size_t c = 0; c < tile.columns; c += (edge || tile.columns == 1) ? 1 : tile.columns - 1) {
+                f(tile.row + r, tile.column + c);
+            }
+        }
+    }
+};
+
+
+// a tile with a halo of the neighbouring tiles' cells around it
+template <ValidDataType DataType>
+struct Patch {
+    Window window;
+    Window tile;
+    std::vector<DataType> values;
+
+    bool contains(long row, long column) const {
+        return row >= static_cast<long>(this->window.row) && row < static_cast<long>(this->window.row + this->window.rows)
+            && column >= static_cast<long>(this->window.column) && column < static_cast<long>(this->window.column + this->window.columns);
+    }
+
+    DataType at(size_t row, size_t column) const {
+        return this->values[(row - this->window.row) * this->window.columns + (column - this->window.column)];
+    }
+};
+
+
+template <ValidDataType DataType, uint16_t raster_number>
+static Patch<DataType> Read(BandReader<DataType, raster_number>& reader, const Window& tile, size_t halo) {
+    size_t row = tile.row >= halo ? tile.row - halo : 0;
+    size_t column = tile.column >= halo ? tile.column - halo : 0;
+    size_t last_row = std::min(reader.rows(), tile.row + tile.rows + halo);
+    size_t last_column = std::min(reader.columns(), tile.column + tile.columns + halo);
+
+    Window window = {row, column, last_row - row, last_column - column};
+    return {window, tile, reader.read(window)};
+}
+
+
+
+template <ValidDataType DataType>
+struct Flood {
+    std::vector<DataType> values;                   // tile elevations, raised to the tile local spill elevations
+    std::vector<uint32_t> labels;                   // 0 = NODATA, 1 = drains off the DEM, 2... = watersheds of the tile's perimeter
+    uint32_t count;                                 // labels used (including 0 & 1)
+    std::unordered_map<uint64_t, double> spills;    // lowest spill elevation between 2 labels, keyed by (low << 32 | high)
+};
+
+
+static void Spill(std::unordered_map<uint64_t, double>& spills, uint32_t a, uint32_t b, double elevation) {
+    uint64_t key = (static_cast<uint64_t>(std::min(a, b)) << 32) | std::max(a, b);
+
+    auto [it, inserted] = spills.try_emplace(key, elevation);
+    if (!inserted && elevation < it->second) {
+        it->second = elevation;
+    }
+}
+
+
+// Priority-Flood (Barnes et al. 2014) of a tile from its perimeter (& cells next to the DEM's edge or NODATA).
+// Every perimeter cell starts a watershed which is flooded inwards, cells raised to their spill elevation go
+// through a plain queue instead of the priority queue (large flats & depressions are filled in linear time).
+// Where 2 watersheds meet their lowest spill elevation is recorded, for joining the tiles' watersheds later
+// (Barnes 2016, parallel Priority-Flood). The perimeter cells themselves are never raised.
+template <ValidDataType DataType>
+static Flood<DataType> Fill(const Patch<DataType>& patch, DataType nodata, size_t rows, size_t columns) {
+    const Window& tile = patch.tile;
+
+    Flood<DataType> flood;
+    flood.values.resize(tile.size());
+    flood.labels.assign(tile.size(), 0);
+
+    for (size_t r = 0; r < tile.rows; r++) {
+        for (size_t c = 0; c < tile.columns; c++) {
+            flood.values[r * tile.columns + c] = patch.at(tile.row + r, tile.column + c);
+        }
+    }
+
+    using Item = std::pair<DataType, uint32_t>;
+    std::priority_queue<Item, std::vector<Item>, std::greater<Item>> open;
+    std::queue<uint32_t> pit;
+
+    for (size_t r = 0; r < tile.rows; r++) {
+        for (size_t c = 0; c < tile.columns; c++) {
+            uint32_t i = r * tile.columns + c;
+            if (flood.values[i] == nodata) continue;
+
+            bool edge = false;
+            for (int k = 0; k < 8 && !edge; k++) {
+                long nr = static_cast<long>(tile.row + r) + dr[k], nc = static_cast<long>(tile.column + c) + dc[k];
+                edge = nr < 0 || nc < 0 || nr >= static_cast<long>(rows) || nc >= static_cast<long>(columns) || patch.at(nr, nc) == nodata;
+            }
+
+            if (edge) {
+                flood.labels[i] = 1;
+                open.push({flood.values[i], i});
+            } else if (r == 0 || c == 0 || r == tile.rows - 1 || c == tile.columns - 1) {
+                open.push({flood.values[i], i});
+            }
+        }
+    }
+
+    uint32_t next = 2;
+    while (!pit.empty() || !open.empty()) {
+        uint32_t i;
+        if (!pit.empty()) {
+            i = pit.front();
+            pit.pop();
+        } else {
+            i = open.top().second;
+            open.pop();
+        }
+
+        // unlabelled perimeter cells start their own watershed
+        if (flood.labels[i] == 0) {
+            flood.labels[i] = next++;
+        }
+
+        long r = i / tile.columns, c = i % tile.columns;
+        for (int k = 0; k < 8; k++) {
+            long nr = r + dr[k], nc = c + dc[k];
+            if (nr < 0 || nc < 0 || nr >= static_cast<long>(tile.rows) || nc >= static_cast<long>(tile.columns)) continue;
+
+            uint32_t j = nr * tile.columns + nc;
+            if (flood.values[j] == nodata) continue;
+
+            if (flood.labels[j] != 0) {
+                if (flood.labels[j] != flood.labels[i]) {
+                    Spill(flood.spills, flood.labels[i], flood.labels[j], std::max(flood.values[i], flood.values[j]));
+                }
+                continue;
+            }
+
+            flood.labels[j] = flood.labels[i];
+            if (flood.values[j] <= flood.values[i]) {
+                flood.values[j] = flood.values[i];
+                pit.push(j);
+            } else {
+                open.push({flood.values[j], j});
+            }
+        }
+    }
+
+    flood.count = next;
+    return flood;
+}
+
+
+
+constexpr uint32_t unreached = std::numeric_limits<uint32_t>::max();
+
+
+// D8 directions (0-7) of the tile's cells draining downwards (steepest drop), off the DEM's edge or into NODATA
+// (cells without a lower neighbour next to them), `undefined` for the others (flats), `no_data` for NODATA.
+template <ValidDataType DataType>
+static std::vector<uint8_t> Slopes(const Patch<DataType>& patch, DataType nodata, size_t rows, size_t columns) {
+    const Window& tile = patch.tile;
+    std::vector<uint8_t> slopes(tile.size(), undefined);
+
+    for (size_t r = 0; r < tile.rows; r++) {
+        for (size_t c = 0; c < tile.columns; c++) {
+            size_t row = tile.row + r, column = tile.column + c;
+            DataType z = patch.at(row, column);
+
+            if (z == nodata) {
+                slopes[r * tile.columns + c] = no_data;
+                continue;
+            }
+
+            int steepest = -1, outlet = -1;
+            double drop = 0;
+
+            for (int k = 0; k < 8; k++) {
+                long nr = static_cast<long>(row) + dr[k], nc = static_cast<long>(column) + dc[k];
+
+                if (nr < 0 || nc < 0 || nr >= static_cast<long>(rows) || nc >= static_cast<long>(columns)) {
+                    if (outlet < 0) outlet = k;
+                    continue;
+                }
+
+                DataType v = patch.at(nr, nc);
+                if (v == nodata) {
+                    if (outlet < 0) outlet = k;
+                    continue;
+                }
+
+                double d = (static_cast<double>(z) - v) / distance[k];
+                if (d > drop) {
+                    drop = d;
+                    steepest = k;
+                }
+            }
+
+            slopes[r * tile.columns + c] = steepest >= 0 ? steepest : outlet >= 0 ? outlet : undefined;
+        }
+    }
+
+    return slopes;
+}
+
+
+// Flat distances of the tile's cells : 0 for cells with a slope, for flat cells the number of steps through
+// cells of the same elevation to the nearest cell with a slope (`unreached` when there's none), where paths can
+// leave the tile through the cells around it, whose distances are `outside(row, column)` (their tiles' perimeters).
+template <ValidDataType DataType, typename Outside>
+static std::vector<uint32_t> Distances(const Patch<DataType>& patch, const std::vector<uint8_t>& slopes, Outside&& outside) {
+    const Window& tile = patch.tile;
+    std::vector<uint32_t> distances(tile.size(), unreached);
+
+    // breadth first from the cells with a slope, merged with the cells around the tile in order of distance
+    std::queue<size_t> queue;
+    for (size_t i = 0; i < tile.size(); i++) {
+        if (slopes[i] < 8) {
+            distances[i] = 0;
+            queue.push(i);
+        }
+    }
+
+    std::vector<std::tuple<uint32_t, long, long>> around;
+    long first_row = static_cast<long>(tile.row) - 1, last_row = static_cast<long>(tile.row + tile.rows);
+    long first_column = static_cast<long>(tile.column) - 1, last_column = static_cast<long>(tile.column + tile.columns);
+    for (long row = first_row; row <= last_row; row++) {
+        bool edge = row == first_row || row == last_row;
+        for (long column = first_column; column <= last_column; column += edge ? 1 : last_column - first_column) {
+            if (!patch.contains(row, column)) continue;
+
+            uint32_t d = outside(row, column);
+            if (d != unreached) around.emplace_back(d, row, column);
+        }
+    }
+    std::sort(around.begin(), around.end());
+
+    // relaxes the tile's flat neighbours of the cell (row, column) at distance `d`
+    auto relax = [&] (long row, long column, uint32_t d) {
+        DataType z = patch.at(row, column);
+        for (int k = 0; k < 8; k++) {
+            long nr = row + dr[k], nc = column + dc[k];
+            if (nr < static_cast<long>(tile.row) || nr >= static_cast<long>(tile.row + tile.rows)) continue;
+            if (nc < static_cast<long>(tile.column) || nc >= static_cast<long>(tile.column + tile.columns)) continue;
+
+            size_t j = (nr - tile.row) * tile.columns + (nc - tile.column);
+            if (slopes[j] != undefined || patch.at(nr, nc) != z || distances[j] <= d + 1) continue;
+
+            distances[j] = d + 1;
+            queue.push(j);
+        }
+    };
+
+    size_t next = 0;
+    while (!queue.empty() || next < around.size()) {
+        if (next < around.size() && (queue.empty() || std::get<0>(around[next]) <= distances[queue.front()])) {
+            auto [d, row, column] = around[next++];
+            relax(row, column, d);
+            continue;
+        }
+
+        size_t i = queue.front();
+        queue.pop();
+        relax(tile.row + i / tile.columns, tile.column + i % tile.columns, distances[i]);
+    }
+
+    return distances;
+}
+
+
+// Flat distances (see `Distances`) of every tile's perimeter cells, DEM wide. Tiles are resolved in parallel
+// with the distances of their neighbours' perimeters known so far, then again the tiles next to a changed
+// perimeter, until none changes : flats spanning many tiles (e.g. filled lakes) take as many rounds as tiles
+// they cross, so every flat cell drains towards its nearest outlet wherever it is.
+template <ValidDataType DataType, uint16_t raster_number>
+static std::vector<std::vector<uint32_t>> Flats(BandReader<DataType, raster_number>& reader, const Grid& grid, DataType nodata, ThreadPool& pool) {
+    size_t rows = reader.rows(), columns = reader.columns();
+
+    std::vector<std::vector<uint32_t>> perimeters(grid.size());
+    for (size_t index = 0; index < grid.size(); index++) {
+        perimeters[index].assign(Grid::perimeter_size(grid.tile(index)), unreached);
+    }
+
+    std::vector<size_t> active(grid.size());
+    for (size_t index = 0; index < grid.size(); index++) {
+        active[index] = index;
+    }
+
+    while (!active.empty()) {
+        std::vector<std::vector<uint32_t>> updated(active.size());
+        std::vector<uint8_t> changed(active.size(), 0);
+
+        pool.parallel_for(active.size(), [&] (size_t a, size_t) {
+            size_t index = active[a];
+            Window tile = grid.tile(index);
+            Patch<DataType> patch = Read(reader, tile, 1);
+
+            std::vector<uint32_t> distances = Distances(patch, Slopes(patch, nodata, rows, columns), [&] (long row, long column) {
+                size_t other = grid.tile_of(row, column);
+                return perimeters[other][Grid::perimeter_index(grid.tile(other), row, column)];
+            });
+
+            updated[a].resize(perimeters[index].size());
+            Grid::perimeter(tile, [&] (size_t row, size_t column) {
+                updated[a][Grid::perimeter_index(tile, row, column)] = distances[(row - tile.row) * tile.columns + (column - tile.column)];
+            });
+            changed[a] = updated[a] != perimeters[index];
+        });
+
+        std::vector<uint8_t> next(grid.size(), 0);
+        for (size_t a = 0; a < active.size(); a++) {
+            if (!changed[a]) continue;
+
+            size_t index = active[a];
+            perimeters[index] = std::move(updated[a]);
+
+            long tile_row = index / grid.tile_columns, tile_column = index % grid.tile_columns;
+            for (int k = 0; k < 8; k++) {
+                long r = tile_row + dr[k], c = tile_column + dc[k];
+                if (r < 0 || c < 0 || r >= static_cast<long>(grid.tile_rows) || c >= static_cast<long>(grid.tile_columns)) continue;
+                next[r * grid.tile_columns + c] = 1;
+            }
+        }
+
+        active.clear();
+        for (size_t index = 0; index < grid.size(); index++) {
+            if (next[index]) active.push_back(index);
+        }
+    }
+
+    return perimeters;
+}
+
+
+// D8 directions (0-7), `undefined` or `no_data` of the tile's cells, from a patch with a halo of 1 cell and the
+// DEM wide flat distances of the tiles' perimeters (`Flats`). Flat cells drain towards a neighbour of the same
+// elevation one step closer to an outlet, which may lie in another tile : flat distances strictly decrease along
+// flats, so there are no flow loops, within or across tiles. Flats without any outlet stay `undefined`.
+template <ValidDataType DataType>
+static std::vector<uint8_t> Directions(const Patch<DataType>& patch, DataType nodata, size_t rows, size_t columns, const Grid& grid, const std::vector<std::vector<uint32_t>>& perimeters) {
+    const Window& tile = patch.tile;
+
+    auto outside = [&] (long row, long column) {
+        size_t other = grid.tile_of(row, column);
+        return perimeters[other][Grid::perimeter_index(grid.tile(other), row, column)];
+    };
+
+    std::vector<uint8_t> directions = Slopes(patch, nodata, rows, columns);
+    std::vector<uint32_t> distances = Distances(patch, directions, outside);
+
+    for (size_t i = 0; i < tile.size(); i++) {
+        if (directions[i] != undefined || distances[i] == unreached) continue;
+
+        long row = tile.row + i / tile.columns, column = tile.column + i % tile.columns;
+        DataType z = patch.at(row, column);
+
+        for (int k = 0; k < 8; k++) {
+            long nr = row + dr[k], nc = column + dc[k];
+            if (!patch.contains(nr, nc) || patch.at(nr, nc) != z) continue;
+
+            bool inside = nr >= static_cast<long>(tile.row) && nr < static_cast<long>(tile.row + tile.rows)
+                && nc >= static_cast<long>(tile.column) && nc < static_cast<long>(tile.column + tile.columns);
+            uint32_t d = inside ? distances[(nr - tile.row) * tile.columns + (nc - tile.column)] : outside(nr, nc);
+
+            if (d + 1 == distances[i]) {
+                directions[i] = k;
+                break;
+            }
+        }
+    }
+
+    return directions;
+}
+
+
+// D-infinity flow angle of a cell (Tarboton 1997), NaN when none of its 8 triangular facets slopes down
+template <ValidDataType DataType>
+static double Angle(const Patch<DataType>& patch, DataType nodata, size_t row, size_t column, size_t rows, size_t columns) {
+    // facets as (cardinal neighbour, diagonal neighbour, ac, af), neighbours in D8 order
+    constexpr int facets[8][4] = {
+        {0, 7, 0, 1}, {6, 7, 1, -1}, {6, 5, 1, 1}, {4, 5, 2, -1},
+        {4, 3, 2, 1}, {2, 3, 3, -1}, {2, 1, 3, 1}, {0, 1, 4, -1}
+    };
+
+    auto elevation = [&] (int k, double& value) {
+        long nr = static_cast<long>(row) + dr[k], nc = static_cast<long>(column) + dc[k];
+        if (nr < 0 || nc < 0 || nr >= static_cast<long>(rows) || nc >= static_cast<long>(columns) || !patch.contains(nr, nc)) return false;
+
+        DataType v = patch.at(nr, nc);
+        value = v;
+        return v != nodata;
+    };
+
+    double e0 = patch.at(row, column);
+    double steepest = 0, angle = std::numeric_limits<double>::quiet_NaN();
+
+    for (const auto& facet : facets) {
+        double e1, e2;
+        if (!elevation(facet[0], e1) || !elevation(facet[1], e2)) continue;
+
+        double s1 = e0 - e1, s2 = e1 - e2;
+        double r = std::atan2(s2, s1), s = std::hypot(s1, s2);
+
+        if (r < 0) {
+            r = 0;
+            s = s1;
+        } else if (r > std::numbers::pi / 4) {
+            r = std::numbers::pi / 4;
+            s = (e0 - e2) / std::numbers::sqrt2;
+        }
+
+        if (s > steepest) {
+            steepest = s;
+            angle = facet[3] * r + facet[2] * std::numbers::pi / 2;
+        }
+    }
+
+    return angle >= 2 * std::numbers::pi ? angle - 2 * std::numbers::pi : angle;
+}
+
+
+
+// Accumulates D8 flow within the tile, `accumulation` holds every cell's own contribution (& its inflow from
+// other tiles) and receives the accumulated flow. Cells are visited in topological order (upstream first).
+static void Accumulate(const Window& tile, const std::vector<uint8_t>& directions, std::vector<double>& accumulation) {
+    auto target = [&] (size_t i) -> long {
+        if (directions[i] >= 8) return -1;
+
+        long r = static_cast<long>(i / tile.columns) + dr[directions[i]], c = static_cast<long>(i % tile.columns) + dc[directions[i]];
+        if (r < 0 || c < 0 || r >= static_cast<long>(tile.rows) || c >= static_cast<long>(tile.columns)) return -1;
+
+        long t = r * tile.columns + c;
+        return directions[t] == no_data ? -1 : t;
+    };
+
+    std::vector<uint8_t> dependencies(tile.size(), 0);
+    for (size_t i = 0; i < tile.size(); i++) {
+        long t = target(i);
+        if (t >= 0) dependencies[t]++;
+    }
+
+    std::queue<size_t> queue;
+    for (size_t i = 0; i < tile.size(); i++) {
+        if (dependencies[i] == 0 && directions[i] != no_data) queue.push(i);
+    }
+
+    while (!queue.empty()) {
+        size_t i = queue.front();
+        queue.pop();
+
+        long t = target(i);
+        if (t < 0) continue;
+
+        accumulation[t] += accumulation[i];
+        if (--dependencies[t] == 0) queue.push(t);
+    }
+}
+
+}
+
+
+
+// Fills the depressions of the DEM (Priority-Flood), so every cell drains off the DEM's edge or into NODATA,
+// and writes the filled DEM to a GeoTiff. Tiles of `tile_size` x `tile_size` cells are flooded in parallel
+// (`threads` = 0 uses all hardware threads), joined through a graph of their watersheds' spill elevations,
+// then flooded again & raised to their watersheds' final water levels, so only the tiles in flight are held
+// in memory (plus the tiles' perimeters & watershed graph), for DEMs far larger than memory.
+template <ValidDataType DataType, uint16_t raster_number, DataType no_data_fallback>
+static void FillDepressions(const DEM<DataType, raster_number, no_data_fallback>& dem, const std::filesystem::path& destination_filepath, size_t tile_size = 1024, size_t threads = 0) {
+    GDALDataset *dataset = dem.get_dataset();
+    DataType nodata = dem.type.nodata;
+
+    BandReader<DataType, raster_number> reader(dataset);
+    size_t rows = reader.rows(), columns = reader.columns();
+    detail::Grid grid(rows, columns, tile_size);
+    ThreadPool pool(threads);
+
+    // flood every tile, keeping its perimeter's labels & elevations and its watersheds' spills
+    std::vector<uint32_t> counts(grid.size());
+    std::vector<std::vector<uint32_t>> perimeter_labels(grid.size());
+    std::vector<std::vector<DataType>> perimeter_values(grid.size());
+    std::vector<std::unordered_map<uint64_t, double>> spills(grid.size());
+
+    pool.parallel_for(grid.size(), [&] (size_t index, size_t) {
+        Window tile = grid.tile(index);
+        detail::Flood<DataType> flood = detail::Fill(detail::Read(reader, tile, 1), nodata, rows, columns);
+
+        perimeter_labels[index].resize(detail::Grid::perimeter_size(tile));
+        perimeter_values[index].resize(detail::Grid::perimeter_size(tile));
+        detail::Grid::perimeter(tile, [&] (size_t row, size_t column) {
+            long p = detail::Grid::perimeter_index(tile, row, column);
+            size_t i = (row - tile.row) * tile.columns + (column - tile.column);
+            perimeter_labels[index][p] = flood.labels[i];
+            perimeter_values[index][p] = flood.values[i];
+        });
+
+        counts[index] = flood.count;
+        spills[index] = std::move(flood.spills);
+    });
+
+    // DEM wide labels, 0 & 1 are shared by all tiles
+    std::vector<uint64_t> offsets(grid.size());
+    uint64_t total = 2;
+    for (size_t index = 0; index < grid.size(); index++) {
+        offsets[index] = total - 2;
+        total += counts[index] - 2;
+    }
+
+    if (total > std::numeric_limits<uint32_t>::max()) {
+        throw std::runtime_error("too many watersheds, use a larger tile size");
+    }
+
+    auto label = [&] (size_t index, uint32_t l) -> uint32_t {
+        return l < 2 ? l : static_cast<uint32_t>(offsets[index] + l);
+    };
+
+    std::vector<std::vector<std::pair<uint32_t, double>>> graph(total);
+    auto connect = [&] (uint32_t a, uint32_t b, double elevation) {
+        graph[a].push_back({b, elevation});
+        graph[b].push_back({a, elevation});
+    };
+
+    for (size_t index = 0; index < grid.size(); index++) {
+        for (const auto& [key, elevation] : spills[index]) {
+            connect(label(index, key >> 32), label(index, key & 0xFFFFFFFF), elevation);
+        }
+        std::unordered_map<uint64_t, double>().swap(spills[index]);
+    }
+
+    // neighbouring perimeter cells of different tiles spill into each other
+    for (size_t index = 0; index < grid.size(); index++) {
+        Window tile = grid.tile(index);
+
+        detail::Grid::perimeter(tile, [&] (size_t row, size_t column) {
+            long p = detail::Grid::perimeter_index(tile, row, column);
+            if (perimeter_labels[index][p] == 0) return;
+
+            for (int k = 0; k < 8; k++) {
+                long nr = static_cast<long>(row) + detail::dr[k], nc = static_cast<long>(column) + detail::dc[k];
+                if (nr < 0 || nc < 0 || nr >= static_cast<long>(rows) || nc >= static_cast<long>(columns)) continue;
+
+                size_t other = grid.tile_of(nr, nc);
+                if (other <= index) continue;
+
+                long q = detail::Grid::perimeter_index(grid.tile(other), nr, nc);
+                if (perimeter_labels[other][q] == 0) continue;
+
+                connect(
+                    label(index, perimeter_labels[index][p]),
+                    label(other, perimeter_labels[other][q]),
+                    std::max(perimeter_values[index][p], perimeter_values[other][q])
+                );
+            }
+        });
+    }
+
+    perimeter_labels.clear();
+    perimeter_values.clear();
+
+    // water level of every watershed : its lowest path of spills to the DEM's edge
+    std::vector<double> levels(total, std::numeric_limits<double>::infinity());
+    using Item = std::pair<double, uint32_t>;
+    std::priority_queue<Item, std::vector<Item>, std::greater<Item>> open;
+    levels[1] = -std::numeric_limits<double>::infinity();
+    open.push({levels[1], 1});
+
+    while (!open.empty()) {
+        auto [level, l] = open.top();
+        open.pop();
+        if (level > levels[l]) continue;
+
+        for (const auto& [m, elevation] : graph[l]) {
+            double spill = std::max(level, elevation);
+            if (spill < levels[m]) {
+                levels[m] = spill;
+                open.push({spill, m});
+            }
+        }
+    }
+    graph.clear();
+
+    GDALDataset *output_dataset = Create(destination_filepath, dataset, BufferType<DataType>(), nodata);
+
+    try {
+        BandWriter<DataType> writer(output_dataset);
+
+        pool.parallel_for(grid.size(), [&] (size_t index, size_t) {
+            Window tile = grid.tile(index);
+            detail::Flood<DataType> flood = detail::Fill(detail::Read(reader, tile, 1), nodata, rows, columns);
+
+            for (size_t i = 0; i < tile.size(); i++) {
+                if (flood.labels[i] == 0) continue;
+
+                // watersheds never reaching the DEM's edge (closed by NODATA) are left as they are
+                double level = levels[label(index, flood.labels[i])];
+                if (std::isfinite(level) && level > flood.values[i]) {
+                    flood.values[i] = static_cast<DataType>(level);
+                }
+            }
+
+            writer.write(tile, flood.values.data());
+        });
+    } catch (...) {
+        GDALClose(output_dataset);
+        throw;
+    }
+
+    GDALClose(output_dataset);
+}
+
+
+
+// Writes the flow direction of every cell to a GeoTiff. D8 writes Byte ESRI codes (0 where the cell doesn't
+// drain, 255 for NODATA), D-infinity writes Float32 angles (-1 where the cell doesn't drain, -9999 for NODATA).
+// Flats drain towards their nearest outlets (across tiles), run on a depression filled DEM for continuous flow.
+template <ValidDataType DataType, uint16_t raster_number, DataType no_data_fallback>
+static void FlowDirection(const DEM<DataType, raster_number, no_data_fallback>& dem, const std::filesystem::path& destination_filepath, Method method = Method::D8, size_t tile_size = 1024, size_t threads = 0) {
+    GDALDataset *dataset = dem.get_dataset();
+    DataType nodata = dem.type.nodata;
+
+    BandReader<DataType, raster_number> reader(dataset);
+    size_t rows = reader.rows(), columns = reader.columns();
+    detail::Grid grid(rows, columns, tile_size);
+    ThreadPool pool(threads);
+    std::vector<std::vector<uint32_t>> flats = detail::Flats(reader, grid, nodata, pool);
+
+    if (method == Method::D8) {
+        GDALDataset *output_dataset = Create(destination_filepath, dataset, GDT_Byte, 255);
+
+        try {
+            BandWriter<uint8_t> writer(output_dataset);
+
+            pool.parallel_for(grid.size(), [&] (size_t index, size_t) {
+                Window tile = grid.tile(index);
+                std::vector<uint8_t> directions = detail::Directions(detail::Read(reader, tile, 1), nodata, rows, columns, grid, flats);
+
+                for (uint8_t& direction : directions) {
+                    direction = direction < 8 ? 1 << direction : direction == detail::no_data ? 255 : 0;
+                }
+
+                writer.write(tile, directions.data());
+            });
+        } catch (...) {
+            GDALClose(output_dataset);
+            throw;
+        }
+
+        GDALClose(output_dataset);
+        return;
+    }
+
+    GDALDataset *output_dataset = Create(destination_filepath, dataset, GDT_Float32, -9999);
+
+    try {
+        BandWriter<float> writer(output_dataset);
+
+        pool.parallel_for(grid.size(), [&] (size_t index, size_t) {
+            Window tile = grid.tile(index);
+            detail::Patch<DataType> patch = detail::Read(reader, tile, 1);
+            std::vector<uint8_t> directions = detail::Directions(patch, nodata, rows, columns, grid, flats);
+
+            std::vector<float> angles(tile.size());
+            for (size_t i = 0; i < tile.size(); i++) {
+                if (directions[i] == detail::no_data) {
+                    angles[i] = -9999;
+                    continue;
+                }
+
+                double angle = detail::Angle(patch, nodata, tile.row + i / tile.columns, tile.column + i % tile.columns, rows, columns);
+
+                // flats & outlets at the DEM's edge follow their D8 direction
+                if (std::isnan(angle)) {
+                    angle = directions[i] < 8 ? ((8 - directions[i]) % 8) * std::numbers::pi / 4 : -1;
+                }
+                angles[i] = static_cast<float>(angle);
+            }
+
+            writer.write(tile, angles.data());
+        });
+    } catch (...) {
+        GDALClose(output_dataset);
+        throw;
+    }
+
+    GDALClose(output_dataset);
+}
+
+
+
+// Writes the D8 flow accumulation (number of upstream cells, including the cell itself) of every cell to a
+// Float64 GeoTiff (-1 for NODATA), run on a depression filled DEM. Tiles are accumulated in parallel, the flow
+// crossing tile boundaries is propagated through a graph of the tiles' perimeter cells (where does the flow
+// entering a perimeter cell leave the tile), then every tile is accumulated again with its inflows.
+template <ValidDataType DataType, uint16_t raster_number, DataType no_data_fallback>
+static void FlowAccumulation(const DEM<DataType, raster_number, no_data_fallback>& dem, const std::filesystem::path& destination_filepath, size_t tile_size = 1024, size_t threads = 0) {
+    GDALDataset *dataset = dem.get_dataset();
+    DataType nodata = dem.type.nodata;
+
+    BandReader<DataType, raster_number> reader(dataset);
+    size_t rows = reader.rows(), columns = reader.columns();
+    detail::Grid grid(rows, columns, tile_size);
+    ThreadPool pool(threads);
+    std::vector<std::vector<uint32_t>> flats = detail::Flats(reader, grid, nodata, pool);
+
+    // graph nodes are the tiles' perimeter cells
+    std::vector<size_t> offsets(grid.size() + 1, 0);
+    for (size_t index = 0; index < grid.size(); index++) {
+        offsets[index + 1] = offsets[index] + detail::Grid::perimeter_size(grid.tile(index));
+    }
+
+    auto node = [&] (size_t row, size_t column) -> long {
+        size_t index = grid.tile_of(row, column);
+        return offsets[index] + detail::Grid::perimeter_index(grid.tile(index), row, column);
+    };
+
+    std::vector<long> exits(offsets.back(), -1);    // node where the flow through the node leaves its tile
+    std::vector<long> targets(offsets.back(), -1);  // node of the other tile receiving the node's outflow
+    std::vector<double> local(offsets.back(), 0);   // flow accumulated at the node within its tile
+
+    auto prepare = [&] (const Window& tile, const detail::Patch<DataType>& patch, std::vector<uint8_t>& directions, std::vector<double>& accumulation) {
+        directions = detail::Directions(patch, nodata, rows, columns, grid, flats);
+        accumulation.resize(tile.size());
+        for (size_t i = 0; i < tile.size(); i++) {
+            accumulation[i] = directions[i] == detail::no_data ? -1 : 1;
+        }
+    };
+
+    pool.parallel_for(grid.size(), [&] (size_t index, size_t) {
+        Window tile = grid.tile(index);
+        detail::Patch<DataType> patch = detail::Read(reader, tile, 1);
+
+        std::vector<uint8_t> directions;
+        std::vector<double> accumulation;
+        prepare(tile, patch, directions, accumulation);
+        detail::Accumulate(tile, directions, accumulation);
+
+        // global cell receiving the cell's flow from another tile, -1 when the flow stays or ends
+        auto outflow = [&] (size_t i, long& row, long& column) {
+            if (directions[i] >= 8) return false;
+
+            row = static_cast<long>(tile.row + i / tile.columns) + detail::dr[directions[i]];
+            column = static_cast<long>(tile.column + i % tile.columns) + detail::dc[directions[i]];
+            return row >= 0 && column >= 0 && row < static_cast<long>(rows) && column < static_cast<long>(columns) && patch.at(row, column) != nodata;
+        };
+
+        // following the flow from every perimeter cell, memoized along the paths
+        std::vector<long> memo(tile.size(), -2);
+        std::vector<size_t> path;
+
+        detail::Grid::perimeter(tile, [&] (size_t row, size_t column) {
+            size_t i = (row - tile.row) * tile.columns + (column - tile.column);
+            long result = -1;
+            path.clear();
+
+            while (true) {
+                if (memo[i] != -2) {
+                    result = memo[i];
+                    break;
+                }
+                path.push_back(i);
+
+                if (directions[i] >= 8) break;
+                long r, c;
+                bool receiving = outflow(i, r, c);
+
+                size_t cell_row = tile.row + i / tile.columns, cell_column = tile.column + i % tile.columns;
+                if (r < static_cast<long>(tile.row) || r >= static_cast<long>(tile.row + tile.rows) || c < static_cast<long>(tile.column) || c >= static_cast<long>(tile.column + tile.columns)) {
+                    if (receiving) {
+                        result = node(cell_row, cell_column);
+                        targets[result] = node(r, c);
+                        local[result] = accumulation[i];
+                    }
+                    break;
+                }
+
+                i = (r - tile.row) * tile.columns + (c - tile.column);
+            }
+
+            for (size_t j : path) {
+                memo[j] = result;
+            }
+            exits[node(row, column)] = result;
+        });
+    });
+
+    // flow leaving every exit node, exits upstream first (D8 flow has no loops)
+    std::vector<uint32_t> dependencies(offsets.back(), 0);
+    for (size_t e = 0; e < targets.size(); e++) {
+        if (targets[e] >= 0 && exits[targets[e]] >= 0) dependencies[exits[targets[e]]]++;
+    }
+
+    std::vector<double> inflows(offsets.back(), 0);
+    std::vector<double> through(offsets.back(), 0);
+    std::queue<size_t> queue;
+    for (size_t e = 0; e < targets.size(); e++) {
+        if (targets[e] >= 0 && dependencies[e] == 0) queue.push(e);
+    }
+
+    while (!queue.empty()) {
+        size_t e = queue.front();
+        queue.pop();
+
+        double outflow = local[e] + through[e];
+        long t = targets[e];
+        inflows[t] += outflow;
+
+        long x = exits[t];
+        if (x >= 0) {
+            through[x] += outflow;
+            if (--dependencies[x] == 0) queue.push(x);
+        }
+    }
+
+    std::vector<long>().swap(targets);
+    std::vector<double>().swap(local);
+    std::vector<double>().swap(through);
+
+    GDALDataset *output_dataset = Create(destination_filepath, dataset, GDT_Float64, -1);
+
+    try {
+        BandWriter<double> writer(output_dataset);
+
+        pool.parallel_for(grid.size(), [&] (size_t index, size_t) {
+            Window tile = grid.tile(index);
+
+            std::vector<uint8_t> directions;
+            std::vector<double> accumulation;
+            prepare(tile, detail::Read(reader, tile, 1), directions, accumulation);
+
+            detail::Grid::perimeter(tile, [&] (size_t row, size_t column) {
+                size_t i = (row - tile.row) * tile.columns + (column - tile.column);
+                if (directions[i] != detail::no_data) accumulation[i] += inflows[node(row, column)];
+            });
+
+            detail::Accumulate(tile, directions, accumulation);
+            writer.write(tile, accumulation.data());
+        });
+    } catch (...) {
+        GDALClose(output_dataset);
+        throw;
+    }
+
+    GDALClose(output_dataset);
+}
+
+}
+}
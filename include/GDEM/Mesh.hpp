@@ -0,0 +1,469 @@
+/*
+GDEM : C++ wrapper over GDAL for working with DEM data.
+Copyright (C) 2024  Pritam Halder
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <https://www.gnu.org/licenses/>.
+
+Author : Pritam Halder
+Email : pritamhalder.portfolio@gmail.com
+*/
+
+#pragma once
+
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <filesystem>
+#include <fstream>
+#include <limits>
+#include <sstream>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include <gdal/gdal_priv.h>
+
+#include "GDEM/Block.hpp"
+#include "GDEM/DEM.hpp"
+#include "GDEM/Parallel.hpp"
+#include "GDEM/Statistics.hpp"
+
+
+
+namespace GDEM {
+namespace Mesh {
+
+// indexed triangle mesh
+struct Geometry {
+    std::vector<double> vertices;       // x, y, z of every vertex (dataset's coordinate system, elevation units)
+    std::vector<uint32_t> triangles;    // 3 vertex indices per triangle, counter clockwise seen from above
+
+    size_t vertex_count() const {
+        return this->vertices.size() / 3;
+    }
+
+    size_t triangle_count() const {
+        return this->triangles.size() / 3;
+    }
+};
+
+
+
+namespace detail {
+
+// Right triangles of the RTIN hierarchy of a `size` x `size` tile (`size` a power of 2) as the (ax, ay, bx, by)
+// end points of their hypotenuses, parents before children (the numbering of Martini).
+static std::vector<uint16_t> Hierarchy(size_t size) {
+    size_t count = size * size * 2 - 2;
+    std::vector<uint16_t> coordinates(count * 4);
+
+    for (size_t i = 0; i < count; i++) {
+        size_t id = i + 2;
+        size_t ax = 0, ay = 0, bx = 0, by = 0, cx = 0, cy = 0;
+        if (id & 1) {
+            bx = by = cx = size;
+        } else {
+            ax = ay = cy = size;
+        }
+
+        while ((id >>= 1) > 1) {
+            size_t mx = (ax + bx) >> 1, my = (ay + by) >> 1;
+            if (id & 1) {
+                bx = ax; by = ay;
+                ax = cx; ay = cy;
+            } else {
+                ax = bx; ay = by;
+                bx = cx; by = cy;
+            }
+            cx = mx; cy = my;
+        }
+
+        coordinates[i * 4] = ax;
+        coordinates[i * 4 + 1] = ay;
+        coordinates[i * 4 + 2] = bx;
+        coordinates[i * 4 + 3] = by;
+    }
+
+    return coordinates;
+}
+
+
+// a tile of (size + 1) x (size + 1) samples, sharing its edges with its neighbours
+struct Tile {
+    size_t row;                 // sample of the dataset at the tile's origin
+    size_t column;
+    std::vector<float> heights; // NaN for NODATA (and past the region)
+    std::vector<float> errors;  // error pyramid, the error of leaving out every sample
+};
+
+
+// Error pyramid : every sample's error is the largest of its own (against its triangle's hypotenuse) and its
+// descendants', so that extracting at any threshold gives a conforming mesh. Triangles touching NODATA always split.
+// Only ever raises errors, so running it again propagates raised (shared edge) errors.
+static void Errors(Tile& tile, const std::vector<uint16_t>& hierarchy, size_t size) {
+    size_t stride = size + 1;
+    size_t count = hierarchy.size() / 4, parents = count - size * size;
+    const float *h = tile.heights.data();
+    float *errors = tile.errors.data();
+
+    for (size_t i = count; i-- > 0;) {
+        size_t ax = hierarchy[i * 4], ay = hierarchy[i * 4 + 1], bx = hierarchy[i * 4 + 2], by = hierarchy[i * 4 + 3];
+        size_t mx = (ax + bx) >> 1, my = (ay + by) >> 1;
+        size_t cx = mx + my - ay, cy = my + ax - mx;
+
+        float a = h[ay * stride + ax], b = h[by * stride + bx], m = h[my * stride + mx];
+        float error = std::isnan(a) || std::isnan(b) || std::isnan(m)
+            ? std::numeric_limits<float>::infinity()
+            : std::abs((a + b) / 2 - m);
+
+        size_t middle = my * stride + mx;
+        errors[middle] = std::max(errors[middle], error);
+
+        if (i < parents) {
+            size_t left = ((ay + cy) >> 1) * stride + ((ax + cx) >> 1);
+            size_t right = ((by + cy) >> 1) * stride + ((bx + cx) >> 1);
+            errors[middle] = std::max({errors[middle], errors[left], errors[right]});
+        }
+    }
+}
+
+
+// State of one tile's extraction, vertices are numbered in the order they are first used
+struct Extraction {
+    const Tile& tile;
+    size_t stride;
+    float max_error;
+    const double* geotransform;
+    std::vector<uint32_t> indices;  // vertex index + 1 of every sample, 0 if unused
+    Geometry geometry;
+    std::vector<uint64_t> samples;  // dataset sample (row * columns + column) of every vertex
+    size_t columns;                 // of the dataset
+
+    uint32_t vertex(size_t x, size_t y) {
+        size_t i = y * this->stride + x;
+        if (this->indices[i] == 0) {
+            size_t row = this->tile.row + y, column = this->tile.column + x;
+
+            double wx, wy;
+            GDALApplyGeoTransform(this->geotransform, column + 0.5, row + 0.5, &wx, &wy);
+            this->geometry.vertices.insert(this->geometry.vertices.end(), {wx, wy, static_cast<double>(this->tile.heights[i])});
+            this->samples.push_back(static_cast<uint64_t>(row) * this->columns + column);
+            this->indices[i] = this->geometry.vertex_count();
+        }
+        return this->indices[i] - 1;
+    }
+
+    void triangle(size_t ax, size_t ay, size_t bx, size_t by, size_t cx, size_t cy) {
+        const float *h = this->tile.heights.data();
+        if (std::isnan(h[ay * this->stride + ax]) || std::isnan(h[by * this->stride + bx]) || std::isnan(h[cy * this->stride + cx])) {
+            return;
+        }
+
+        uint32_t a = this->vertex(ax, ay), b = this->vertex(bx, by), c = this->vertex(cx, cy);
+
+        // counter clockwise in the dataset's coordinate system (pixel space is flipped for north up datasets)
+        const double *v = this->geometry.vertices.data();
+        double cross = (v[b * 3] - v[a * 3]) * (v[c * 3 + 1] - v[a * 3 + 1]) - (v[b * 3 + 1] - v[a * 3 + 1]) * (v[c * 3] - v[a * 3]);
+        if (cross < 0) std::swap(b, c);
+
+        this->geometry.triangles.insert(this->geometry.triangles.end(), {a, b, c});
+    }
+
+    // splits the right triangle (a, b, c) (hypotenuse a-b) while its hypotenuse's midpoint is above the error
+    void split(size_t ax, size_t ay, size_t bx, size_t by, size_t cx, size_t cy) {
+        size_t mx = (ax + bx) >> 1, my = (ay + by) >> 1;
+
+        if (
+            (ax > cx ? ax - cx : cx - ax) + (ay > cy ? ay - cy : cy - ay) > 1
+            && this->tile.errors[my * this->stride + mx] > this->max_error
+        ) {
+            this->split(cx, cy, ax, ay, mx, my);
+            this->split(bx, by, cx, cy, mx, my);
+        } else {
+            this->triangle(ax, ay, bx, by, cx, cy);
+        }
+    }
+};
+
+}
+
+
+
+// Terrain of a DEM region as a right triangulated irregular network (RTIN, as in Martini), split in tiles of
+// `tile_size` x `tile_size` cells (a power of 2) sharing their edge samples. The error pyramid of every tile is
+// computed once (in parallel), after which a mesh is extracted at any error threshold in time linear in its size.
+// Tiles agree on the errors of their shared edges, so meshes of neighbouring tiles meet without cracks.
+class Terrain {
+private:
+    size_t size;
+    size_t columns;                 // of the dataset
+    double geotransform[6];
+    std::vector<uint16_t> hierarchy;
+    std::vector<detail::Tile> tiles;
+    size_t tile_rows;
+    size_t tile_columns;
+    size_t threads;
+
+    std::vector<std::pair<Geometry, std::vector<uint64_t>>> extract(double max_error) const {
+        std::vector<std::pair<Geometry, std::vector<uint64_t>>> extracted(this->tiles.size());
+
+        ThreadPool pool(this->threads);
+        pool.parallel_for(this->tiles.size(), [&] (size_t index, size_t) {
+            size_t stride = this->size + 1;
+            detail::Extraction extraction{
+                this->tiles[index], stride, static_cast<float>(max_error), this->geotransform,
+                std::vector<uint32_t>(stride * stride, 0), Geometry(), {}, this->columns
+            };
+
+            size_t s = this->size;
+            extraction.split(0, 0, s, s, s, 0);
+            extraction.split(s, s, 0, 0, 0, s);
+
+            extracted[index] = {std::move(extraction.geometry), std::move(extraction.samples)};
+        });
+
+        return extracted;
+    }
+
+public:
+    // `region` in samples of the dataset (empty for the whole DEM), `threads` = 0 uses all hardware threads
+    template <ValidDataType DataType, uint16_t raster_number, DataType no_data_fallback>
+    Terrain(const DEM<DataType, raster_number, no_data_fallback>& dem, Window region = {0, 0, 0, 0}, size_t tile_size = 256, size_t threads = 0)
+        : size(tile_size),
+        columns(dem.type.columns),
+        threads(threads)
+    {
+        if (tile_size < 2 || tile_size > 4096 || (tile_size & (tile_size - 1)) != 0) {
+            throw std::runtime_error("tile size must be a power of 2 within [2, 4096]");
+        }
+
+        GDALDataset *dataset = dem.get_dataset();
+        if (dataset->GetGeoTransform(this->geotransform) != CE_None) {
+            throw std::runtime_error("failed to read dataset transformations");
+        }
+
+        if (region.size() == 0) {
+            region = {0, 0, dem.type.rows, dem.type.columns};
+        }
+        if (region.row + region.rows > dem.type.rows || region.column + region.columns > dem.type.columns || region.rows < 2 || region.columns < 2) {
+            throw std::runtime_error("invalid mesh region");
+        }
+
+        this->hierarchy = detail::Hierarchy(tile_size);
+        this->tile_rows = (region.rows - 1 + tile_size - 1) / tile_size;
+        this->tile_columns = (region.columns - 1 + tile_size - 1) / tile_size;
+        this->tiles.resize(this->tile_rows * this->tile_columns);
+
+        size_t stride = tile_size + 1;
+        BandReader<DataType, raster_number> reader(dataset);
+        ThreadPool pool(threads);
+
+        pool.parallel_for(this->tiles.size(), [&] (size_t index, size_t) {
+            detail::Tile& tile = this->tiles[index];
+            tile.row = region.row + (index / this->tile_columns) * tile_size;
+            tile.column = region.column + (index % this->tile_columns) * tile_size;
+            tile.heights.assign(stride * stride, std::numeric_limits<float>::quiet_NaN());
+            tile.errors.assign(stride * stride, 0);
+
+            Window window{
+                tile.row, tile.column,
+                std::min(stride, region.row + region.rows - tile.row),
+                std::min(stride, region.column + region.columns - tile.column)
+            };
+            std::vector<DataType> values = reader.read(window);
+
+            for (size_t r = 0; r < window.rows; r++) {
+                for (size_t c = 0; c < window.columns; c++) {
+                    DataType value = values[r * window.columns + c];
+                    if (Statistics::detail::valid(value, dem.type.nodata)) {
+                        tile.heights[r * stride + c] = static_cast<float>(value);
+                    }
+                }
+            }
+
+            detail::Errors(tile, this->hierarchy, tile_size);
+        });
+
+        // neighbours take the larger error of their shared edge samples, then propagate them up their pyramids
+        for (size_t tr = 0; tr < this->tile_rows; tr++) {
+            for (size_t tc = 0; tc < this->tile_columns; tc++) {
+                detail::Tile& tile = this->tiles[tr * this->tile_columns + tc];
+
+                if (tc + 1 < this->tile_columns) {
+                    detail::Tile& right = this->tiles[tr * this->tile_columns + tc + 1];
+                    for (size_t i = 0; i < stride; i++) {
+                        float& a = tile.errors[i * stride + tile_size];
+                        float& b = right.errors[i * stride];
+                        a = b = std::max(a, b);
+                    }
+                }
+                if (tr + 1 < this->tile_rows) {
+                    detail::Tile& below = this->tiles[(tr + 1) * this->tile_columns + tc];
+                    for (size_t i = 0; i < stride; i++) {
+                        float& a = tile.errors[tile_size * stride + i];
+                        float& b = below.errors[i];
+                        a = b = std::max(a, b);
+                    }
+                }
+            }
+        }
+
+        pool.parallel_for(this->tiles.size(), [&] (size_t index, size_t) {
+            detail::Errors(this->tiles[index], this->hierarchy, tile_size);
+        });
+    }
+
+    Terrain(const Terrain& o) = default;
+    Terrain& operator=(const Terrain& o) = default;
+    Terrain(Terrain&& o) noexcept = default;
+    Terrain& operator=(Terrain&& o) noexcept = default;
+    ~Terrain() = default;
+
+    // mesh of every tile (row major) with at most `max_error` (elevation units) of vertical error
+    std::vector<Geometry> tile_meshes(double max_error) const {
+        std::vector<Geometry> meshes;
+        for (auto& [geometry, samples] : this->extract(max_error)) {
+            meshes.push_back(std::move(geometry));
+        }
+        return meshes;
+    }
+
+    // one mesh of the whole region, tiles joined at their shared edge vertices
+    Geometry mesh(double max_error) const {
+        Geometry merged;
+        std::unordered_map<uint64_t, uint32_t> shared;
+
+        for (auto& [geometry, samples] : this->extract(max_error)) {
+            std::vector<uint32_t> remap(samples.size());
+
+            for (size_t i = 0; i < samples.size(); i++) {
+                size_t row = samples[i] / this->columns, column = samples[i] % this->columns;
+                size_t tile_row = this->tiles.front().row, tile_column = this->tiles.front().column;
+                bool edge = (row - tile_row) % this->size == 0 || (column - tile_column) % this->size == 0;
+
+                if (edge) {
+                    auto [it, inserted] = shared.emplace(samples[i], merged.vertex_count());
+                    if (!inserted) {
+                        remap[i] = it->second;
+                        continue;
+                    }
+                }
+
+                remap[i] = merged.vertex_count();
+                merged.vertices.insert(merged.vertices.end(), geometry.vertices.begin() + i * 3, geometry.vertices.begin() + i * 3 + 3);
+            }
+
+            for (uint32_t vertex : geometry.triangles) {
+                merged.triangles.push_back(remap[vertex]);
+            }
+        }
+
+        return merged;
+    }
+
+    size_t tile_count() const {
+        return this->tiles.size();
+    }
+};
+
+
+
+// Writes the mesh as binary glTF 2.0 (`.glb`). glTF is y up, so vertices are written as (x, z, -y) relative to the
+// mesh's center (float32), which is kept as the node's translation.
+static void WriteGLB(const Geometry& geometry, const std::filesystem::path& destination_filepath) {
+    if (geometry.vertex_count() == 0) {
+        throw std::runtime_error("empty mesh");
+    }
+
+    double minimum[3], maximum[3];
+    for (int k = 0; k < 3; k++) {
+        minimum[k] = std::numeric_limits<double>::infinity();
+        maximum[k] = -std::numeric_limits<double>::infinity();
+    }
+    for (size_t i = 0; i < geometry.vertex_count(); i++) {
+        for (int k = 0; k < 3; k++) {
+            minimum[k] = std::min(minimum[k], geometry.vertices[i * 3 + k]);
+            maximum[k] = std::max(maximum[k], geometry.vertices[i * 3 + k]);
+        }
+    }
+    double center[3] = {(minimum[0] + maximum[0]) / 2, (minimum[1] + maximum[1]) / 2, (minimum[2] + maximum[2]) / 2};
+
+    std::vector<float> positions(geometry.vertex_count() * 3);
+    float low[3] = {std::numeric_limits<float>::max(), std::numeric_limits<float>::max(), std::numeric_limits<float>::max()};
+    float high[3] = {-low[0], -low[1], -low[2]};
+    for (size_t i = 0; i < geometry.vertex_count(); i++) {
+        float p[3] = {
+            static_cast<float>(geometry.vertices[i * 3] - center[0]),
+            static_cast<float>(geometry.vertices[i * 3 + 2] - center[2]),
+            static_cast<float>(-(geometry.vertices[i * 3 + 1] - center[1]))
+        };
+        for (int k = 0; k < 3; k++) {
+            positions[i * 3 + k] = p[k];
+            low[k] = std::min(low[k], p[k]);
+            high[k] = std::max(high[k], p[k]);
+        }
+    }
+
+    size_t position_bytes = positions.size() * sizeof(float);
+    size_t index_bytes = geometry.triangles.size() * sizeof(uint32_t);
+    size_t binary_length = position_bytes + index_bytes;
+
+    std::ostringstream json;
+    json.precision(std::numeric_limits<double>::max_digits10);
+    json << "{\"asset\":{\"version\":\"2.0\",\"generator\":\"GDEM\"},\"scene\":0,\"scenes\":[{\"nodes\":[0]}],"
+        << "\"nodes\":[{\"mesh\":0,\"translation\":[" << center[0] << "," << center[2] << "," << -center[1] << "]}],"
+        << "\"meshes\":[{\"primitives\":[{\"attributes\":{\"POSITION\":0},\"indices\":1,\"mode\":4}]}],"
+        << "\"buffers\":[{\"byteLength\":" << binary_length << "}],"
+        << "\"bufferViews\":["
+        << "{\"buffer\":0,\"byteOffset\":0,\"byteLength\":" << position_bytes << ",\"target\":34962},"
+        << "{\"buffer\":0,\"byteOffset\":" << position_bytes << ",\"byteLength\":" << index_bytes << ",\"target\":34963}],"
+        << "\"accessors\":["
+        << "{\"bufferView\":0,\"componentType\":5126,\"count\":" << geometry.vertex_count() << ",\"type\":\"VEC3\","
+        << "\"min\":[" << low[0] << "," << low[1] << "," << low[2] << "],\"max\":[" << high[0] << "," << high[1] << "," << high[2] << "]},"
+        << "{\"bufferView\":1,\"componentType\":5125,\"count\":" << geometry.triangles.size() << ",\"type\":\"SCALAR\"}]}";
+
+    // chunks are 4 byte aligned, JSON padded with spaces
+    std::string header = json.str();
+    header.append((4 - header.size() % 4) % 4, ' ');
+
+    std::ofstream file(destination_filepath, std::ios::binary);
+    if (!file) {
+        throw std::runtime_error("failed to create file '" + destination_filepath.string() + "'");
+    }
+
+    auto put = [&file] (uint32_t value) {
+        file.write(reinterpret_cast<const char*>(&value), sizeof(value));
+    };
+
+    put(0x46546C67);    // "glTF"
+    put(2);
+    put(static_cast<uint32_t>(12 + 8 + header.size() + 8 + binary_length));
+
+    put(static_cast<uint32_t>(header.size()));
+    put(0x4E4F534A);    // "JSON"
+    file.write(header.data(), header.size());
+
+    put(static_cast<uint32_t>(binary_length));
+    put(0x004E4942);    // "BIN"
+    file.write(reinterpret_cast<const char*>(positions.data()), position_bytes);
+    file.write(reinterpret_cast<const char*>(geometry.triangles.data()), index_bytes);
+
+    if (!file) {
+        throw std::runtime_error("failed to write file '" + destination_filepath.string() + "'");
+    }
+}
+
+}
+}
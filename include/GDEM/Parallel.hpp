@@ -0,0 +1,159 @@
+/*
+GDEM : C++ wrapper over GDAL for working with DEM data.
+Copyright (C) 2024  Pritam Halder
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <https://www.gnu.org/licenses/>.
+
+Author : Pritam Halder
+Email : pritamhalder.portfolio@gmail.com
+*/
+
+#pragma once
+
+
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <exception>
+#include <functional>
+#include <future>
+#include <memory>
+#include <mutex>
+#include <queue>
+#include <thread>
+#include <type_traits>
+#include <vector>
+
+
+
+namespace GDEM {
+
+class ThreadPool {
+private:
+    std::vector<std::thread> workers;
+    std::queue<std::function<void()>> tasks;
+    std::mutex mutex;
+    std::condition_variable available;
+    bool stopping;
+
+    void work() {
+        while (true) {
+            std::function<void()> task;
+
+            {
+                std::unique_lock<std::mutex> lock(this->mutex);
+                this->available.wait(lock, [this] () { return this->stopping || !this->tasks.empty(); });
+
+                if (this->stopping && this->tasks.empty()) {
+                    return;
+                }
+
+                task = std::move(this->tasks.front());
+                this->tasks.pop();
+            }
+
+            task();
+        }
+    }
+
+public:
+    // `threads` = 0 uses all the available hardware threads
+    ThreadPool(size_t threads = 0)
+        : stopping(false)
+    {
+        if (threads == 0) {
+            threads = std::max(1u, std::thread::hardware_concurrency());
+        }
+
+        for (size_t i = 0; i < threads; i++) {
+            this->workers.emplace_back(&ThreadPool::work, this);
+        }
+    }
+
+    ThreadPool(const ThreadPool& o) = delete;
+    ThreadPool& operator=(const ThreadPool& o) = delete;
+    ThreadPool(ThreadPool&& o) noexcept = delete;
+    ThreadPool& operator=(ThreadPool&& o) noexcept = delete;
+
+    ~ThreadPool() {
+        {
+            std::lock_guard<std::mutex> lock(this->mutex);
+            this->stopping = true;
+        }
+
+        this->available.notify_all();
+        for (std::thread& worker : this->workers) {
+            worker.join();
+        }
+    }
+
+    size_t size() const {
+        return this->workers.size();
+    }
+
+    template <typename Task>
+    std::future<std::invoke_result_t<Task>> submit(Task&& task) {
+        using Result = std::invoke_result_t<Task>;
+
+        auto packaged = std::make_shared<std::packaged_task<Result()>>(std::forward<Task>(task));
+        std::future<Result> result = packaged->get_future();
+
+        {
+            std::lock_guard<std::mutex> lock(this->mutex);
+            this->tasks.emplace([packaged] () { (*packaged)(); });
+        }
+
+        this->available.notify_one();
+        return result;
+    }
+
+    // calls `body(index, worker)` for every index in [0, count), where `worker` is in [0, size())
+    // and is unique among the concurrently running calls (usable as a slot for per-thread state)
+    template <typename Body>
+    void parallel_for(size_t count, Body&& body) {
+        std::atomic<size_t> next = 0;
+        size_t workers = std::min(this->size(), count);
+
+        std::vector<std::future<void>> results;
+        for (size_t worker = 0; worker < workers; worker++) {
+            results.push_back(this->submit([&next, &body, count, worker] () {
+                try {
+                    for (size_t index = next++; index < count; index = next++) {
+                        body(index, worker);
+                    }
+                } catch (...) {
+                    // stop handing out indices to the other workers
+                    next = count;
+                    throw;
+                }
+            }));
+        }
+
+        // wait for every worker before rethrowing, `body` is referenced by all of them
+        std::exception_ptr error = nullptr;
+        for (std::future<void>& result : results) {
+            try {
+                result.get();
+            } catch (...) {
+                if (!error) error = std::current_exception();
+            }
+        }
+
+        if (error) {
+            std::rethrow_exception(error);
+        }
+    }
+};
+
+}
@@ -0,0 +1,453 @@
+/*
+GDEM : C++ wrapper over GDAL for working with DEM data.
+Copyright (C) 2024  Pritam Halder
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <https://www.gnu.org/licenses/>.
+
+Author : Pritam Halder
+Email : pritamhalder.portfolio@gmail.com
+*/
+
+#pragma once
+
+
+#include <algorithm>
+#include <cstdint>
+#include <filesystem>
+#include <limits>
+#include <mutex>
+#include <string>
+#include <system_error>
+#include <vector>
+
+#include <gdal/gdal.h>
+#include <gdal/gdal_priv.h>
+#include <gdal/gdal_utils.h>
+#include <gdal/vrtdataset.h>
+
+#include "GDEM/DEM.hpp"
+
+
+
+namespace GDEM {
+
+// Chains Utility like operations (clip, reproject, resample, merge) as lazy VRT stages.
+// No pixel is read until `write` is called, which then streams the blocks of the final
+// stage (and through it every previous stage) straight into the destination file.
+class Pipeline {
+private:
+    std::vector<GDALDataset*> opened;           // source datasets opened (and owned) by the pipeline
+    std::vector<GDALDataset*> intermediates;    // lazy VRT stages created by the pipeline
+    std::vector<GDALDataset*> branches;         // current (last) stage of every source
+
+
+    static CPLErr median_pixel_function(
+        void **sources, int source_count, void *data,
+        int x_size, int y_size,
+        GDALDataType source_type, GDALDataType buffer_type,
+        int pixel_space, int line_space,
+        const char* const* arguments
+    ) {
+        const char *nodata_argument = CSLFetchNameValue(arguments, "NoData");
+        bool has_nodata = nodata_argument != nullptr && !EQUAL(nodata_argument, "NaN");
+        double nodata = has_nodata ? CPLAtof(nodata_argument) : 0.0;
+
+        int source_type_size = GDALGetDataTypeSizeBytes(source_type);
+        std::vector<double> values;
+        values.reserve(source_count);
+
+        for (int y = 0; y < y_size; y++) {
+            for (int x = 0; x < x_size; x++) {
+                size_t offset = (static_cast<size_t>(y) * x_size + x) * source_type_size;
+
+                values.clear();
+                for (int i = 0; i < source_count; i++) {
+                    double value;
+                    GDALCopyWords(static_cast<GByte*>(sources[i]) + offset, source_type, 0, &value, GDT_Float64, 0, 1);
+
+                    if (!has_nodata || value != nodata) {
+                        values.push_back(value);
+                    }
+                }
+
+                // median of the available values, same as `Utility::Merge`
+                double median = nodata;
+                if (!values.empty()) {
+                    std::nth_element(values.begin(), values.begin() + values.size() / 2, values.end());
+                    median = values[values.size() / 2];
+                }
+
+                GDALCopyWords(
+                    &median, GDT_Float64, 0,
+                    static_cast<GByte*>(data) + static_cast<GSpacing>(line_space) * y + static_cast<GSpacing>(pixel_space) * x,
+                    buffer_type, pixel_space, 1
+                );
+            }
+        }
+
+        return CE_None;
+    }
+
+
+    static void register_pixel_functions() {
+        static std::once_flag registered;
+        std::call_once(registered, [] () {
+            GDALAddDerivedBandPixelFuncWithArgs(
+                "GDEM_median",
+                median_pixel_function,
+                "<PixelFunctionArgumentsList>"
+                    "<Argument type='builtin' value='NoData' />"
+                "</PixelFunctionArgumentsList>"
+            );
+        });
+    }
+
+
+    GDALDataset* stage(GDALDataset* dataset) {
+        if (dataset == nullptr) {
+            throw std::runtime_error("failed to create pipeline stage");
+        }
+
+        this->intermediates.push_back(dataset);
+        return dataset;
+    }
+
+
+    void release() {
+        // stages reference their inputs, so they are closed in the reverse order of creation
+        for (auto it = this->intermediates.rbegin(); it != this->intermediates.rend(); ++it) {
+            GDALClose(*it);
+        }
+        for (GDALDataset *dataset : this->opened) {
+            GDALClose(dataset);
+        }
+
+        this->intermediates.clear();
+        this->opened.clear();
+        this->branches.clear();
+    }
+
+
+    void open(const std::string& source_filepath) {
+        if (!std::filesystem::exists(source_filepath)) {
+            std::string e = "file (" + source_filepath + ") not found";
+            throw std::runtime_error(e);
+        }
+
+        GDALRegister_GTiff();
+
+        GDALDataset *dataset = static_cast<GDALDataset*>(GDALOpen(source_filepath.c_str(), GA_ReadOnly));
+        if (dataset == nullptr) {
+            throw std::runtime_error("failed to open source file");
+        }
+
+        this->opened.push_back(dataset);
+        this->branches.push_back(dataset);
+    }
+
+public:
+    Pipeline(GDALDataset* source_dataset) {
+        if (source_dataset == nullptr) {
+            throw std::runtime_error("dataset provided is NULL");
+        }
+
+        this->branches.push_back(source_dataset);
+    }
+
+    Pipeline(const std::string& source_filepath) {
+        this->open(source_filepath);
+    }
+
+    Pipeline(const std::filesystem::path& source_filepath) {
+        this->open(source_filepath.string());
+    }
+
+    Pipeline(const std::vector<GDALDataset*>& source_datasets) {
+        if (source_datasets.empty()) {
+            throw std::runtime_error("no input datasets provided");
+        }
+
+        for (GDALDataset *dataset : source_datasets) {
+            if (dataset == nullptr) {
+                throw std::runtime_error("dataset provided is NULL");
+            }
+            this->branches.push_back(dataset);
+        }
+    }
+
+    Pipeline(const std::vector<std::string>& source_filepaths) {
+        if (source_filepaths.empty()) {
+            throw std::runtime_error("no input file paths provided");
+        }
+
+        try {
+            for (const std::string& path : source_filepaths) this->open(path);
+        } catch (...) {
+            this->release();
+            throw;
+        }
+    }
+
+    Pipeline(const std::vector<std::filesystem::path>& source_filepaths) {
+        if (source_filepaths.empty()) {
+            throw std::runtime_error("no input file paths provided");
+        }
+
+        try {
+            for (const std::filesystem::path& path : source_filepaths) this->open(path.string());
+        } catch (...) {
+            this->release();
+            throw;
+        }
+    }
+
+    Pipeline(const Pipeline& o) = delete;
+    Pipeline& operator=(const Pipeline& o) = delete;
+
+    Pipeline(Pipeline&& o) noexcept
+        : opened(std::move(o.opened)),
+        intermediates(std::move(o.intermediates)),
+        branches(std::move(o.branches))
+    {
+        o.opened.clear();
+        o.intermediates.clear();
+        o.branches.clear();
+    }
+
+    Pipeline& operator=(Pipeline&& o) noexcept {
+        if (this != &o) {
+            this->release();
+
+            this->opened = std::move(o.opened);
+            this->intermediates = std::move(o.intermediates);
+            this->branches = std::move(o.branches);
+
+            o.opened.clear();
+            o.intermediates.clear();
+            o.branches.clear();
+        }
+
+        return *this;
+    }
+
+    ~Pipeline() {
+        this->release();
+    }
+
+
+    // lazily clips every branch to the bounding coordinates (see `Utility::Clip`)
+    Pipeline& clip(double top_left_x, double top_left_y, double bottom_right_x, double bottom_right_y) {
+        for (GDALDataset*& dataset : this->branches) {
+            double geotransform[6];
+            if (dataset->GetGeoTransform(geotransform) != CE_None) {
+                throw std::runtime_error("failed to get dataset transformations");
+            }
+
+            int source_x_size = dataset->GetRasterXSize();
+            int source_y_size = dataset->GetRasterYSize();
+
+            int start_x = static_cast<int>((top_left_x - geotransform[0]) / geotransform[1]);
+            int start_y = static_cast<int>((top_left_y - geotransform[3]) / geotransform[5]);
+            int end_x = static_cast<int>((bottom_right_x - geotransform[0]) / geotransform[1]);
+            int end_y = static_cast<int>((bottom_right_y - geotransform[3]) / geotransform[5]);
+
+            start_x = std::max(0, std::min(start_x, source_x_size));
+            start_y = std::max(0, std::min(start_y, source_y_size));
+            end_x = std::max(0, std::min(end_x, source_x_size));
+            end_y = std::max(0, std::min(end_y, source_y_size));
+
+            if (end_x - start_x <= 0 || end_y - start_y <= 0) {
+                throw std::runtime_error("invalid clipping coordinates");
+            }
+
+            CPLStringList arguments;
+            arguments.AddString("-of");
+            arguments.AddString("VRT");
+            arguments.AddString("-srcwin");
+            arguments.AddString(std::to_string(start_x).c_str());
+            arguments.AddString(std::to_string(start_y).c_str());
+            arguments.AddString(std::to_string(end_x - start_x).c_str());
+            arguments.AddString(std::to_string(end_y - start_y).c_str());
+
+            GDALTranslateOptions *options = GDALTranslateOptionsNew(arguments.List(), nullptr);
+            GDALDatasetH output = GDALTranslate("", GDALDataset::ToHandle(dataset), options, nullptr);
+            GDALTranslateOptionsFree(options);
+
+            dataset = this->stage(GDALDataset::FromHandle(output));
+        }
+
+        return *this;
+    }
+
+
+    // lazily warps every branch to `WGS84/EPSG:4326`
+    Pipeline& reproject(int16_t nodata_value) {
+        for (GDALDataset*& dataset : this->branches) {
+            CPLStringList arguments;
+            arguments.AddString("-of");
+            arguments.AddString("VRT");
+            arguments.AddString("-t_srs");
+            arguments.AddString("EPSG:4326");
+            arguments.AddString("-dstnodata");
+            arguments.AddString(std::to_string(nodata_value).c_str());
+
+            GDALWarpAppOptions *options = GDALWarpAppOptionsNew(arguments.List(), nullptr);
+            GDALDatasetH source = GDALDataset::ToHandle(dataset);
+            GDALDatasetH output = GDALWarp("", nullptr, 1, &source, options, nullptr);
+            GDALWarpAppOptionsFree(options);
+
+            dataset = this->stage(GDALDataset::FromHandle(output));
+        }
+
+        return *this;
+    }
+
+
+    // lazily resamples every branch to the given width & height with median resampling (see `Utility::Resample`)
+    Pipeline& resample(unsigned int output_width, unsigned int output_height) {
+        for (GDALDataset*& dataset : this->branches) {
+            CPLStringList arguments;
+            arguments.AddString("-of");
+            arguments.AddString("VRT");
+            arguments.AddString("-ts");
+            arguments.AddString(std::to_string(output_width).c_str());
+            arguments.AddString(std::to_string(output_height).c_str());
+            arguments.AddString("-r");
+            arguments.AddString("med");
+
+            GDALWarpAppOptions *options = GDALWarpAppOptionsNew(arguments.List(), nullptr);
+            GDALDatasetH source = GDALDataset::ToHandle(dataset);
+            GDALDatasetH output = GDALWarp("", nullptr, 1, &source, options, nullptr);
+            GDALWarpAppOptionsFree(options);
+
+            dataset = this->stage(GDALDataset::FromHandle(output));
+        }
+
+        return *this;
+    }
+
+
+    // lazily merges all branches into one with the median values approach (see `Utility::Merge`)
+    Pipeline& merge(int16_t nodata_value) {
+        register_pixel_functions();
+
+        // align every branch on the union grid, one band per branch
+        CPLStringList arguments;
+        arguments.AddString("-separate");
+        arguments.AddString("-b");
+        arguments.AddString("1");
+        arguments.AddString("-resolution");
+        arguments.AddString("lowest");
+        arguments.AddString("-vrtnodata");
+        arguments.AddString(std::to_string(nodata_value).c_str());
+
+        std::vector<GDALDatasetH> sources;
+        for (GDALDataset *dataset : this->branches) {
+            sources.push_back(GDALDataset::ToHandle(dataset));
+        }
+
+        GDALBuildVRTOptions *options = GDALBuildVRTOptionsNew(arguments.List(), nullptr);
+        GDALDatasetH aligned_handle = GDALBuildVRT("", static_cast<int>(sources.size()), sources.data(), nullptr, options, nullptr);
+        GDALBuildVRTOptionsFree(options);
+
+        GDALDataset *aligned = this->stage(GDALDataset::FromHandle(aligned_handle));
+
+        // reduce the aligned bands into a single band with the median pixel function
+        VRTDataset *merged = static_cast<VRTDataset*>(GDALDataset::FromHandle(
+            VRTCreate(aligned->GetRasterXSize(), aligned->GetRasterYSize())
+        ));
+        this->stage(merged);
+
+        double geotransform[6];
+        if (aligned->GetGeoTransform(geotransform) != CE_None) {
+            throw std::runtime_error("failed to get dataset transformations");
+        }
+        merged->SetGeoTransform(geotransform);
+        merged->SetProjection(aligned->GetProjectionRef());
+
+        CPLStringList band_options;
+        band_options.SetNameValue("subClass", "VRTDerivedRasterBand");
+        band_options.SetNameValue("PixelFunctionType", "GDEM_median");
+        if (merged->AddBand(this->branches[0]->GetRasterBand(1)->GetRasterDataType(), band_options.List()) != CE_None) {
+            throw std::runtime_error("failed to create merged band");
+        }
+
+        VRTDerivedRasterBand *band = static_cast<VRTDerivedRasterBand*>(merged->GetRasterBand(1));
+        band->SetNoDataValue(nodata_value);
+        for (int i = 1; i <= aligned->GetRasterCount(); i++) {
+            band->AddSimpleSource(aligned->GetRasterBand(i));
+        }
+
+        this->branches = {merged};
+
+        return *this;
+    }
+
+
+    // materializes the final stage into a (tiled) GeoTiff, streaming block by block through all stages
+    void write(const std::string& destination_filepath) {
+        if (this->branches.size() != 1) {
+            throw std::runtime_error("pipeline has " + std::to_string(this->branches.size()) + " branches, merge them before writing");
+        }
+
+        GDALRegister_GTiff();
+
+        CPLStringList options;
+        options.SetNameValue("TILED", "YES");
+
+        GDALDriver *driver = GetGDALDriverManager()->GetDriverByName("GTiff");
+        GDALDataset *output_dataset = driver->CreateCopy(
+            destination_filepath.c_str(),
+            this->branches[0],
+            FALSE,
+            options.List(),
+            nullptr,
+            nullptr
+        );
+
+        if (output_dataset == nullptr) {
+            throw std::runtime_error("failed to create output dataset");
+        }
+
+        // cleanup
+        GDALClose(output_dataset);
+    }
+
+
+    void write(const std::filesystem::path& destination_filepath) {
+        this->write(destination_filepath.string());
+    }
+
+
+    // materializes the final stage into a resident (in-memory) DEM
+    template <ValidDataType DataType, uint16_t raster_number = 1, DataType no_data_fallback = std::numeric_limits<DataType>::min()>
+    DEM<DataType, raster_number, no_data_fallback> write() {
+        if (this->branches.size() != 1) {
+            throw std::runtime_error("pipeline has " + std::to_string(this->branches.size()) + " branches, merge them before writing");
+        }
+
+        GDALRegister_MEM();
+
+        GDALDriver *driver = GetGDALDriverManager()->GetDriverByName("MEM");
+        GDALDataset *output_dataset = driver->CreateCopy("", this->branches[0], FALSE, nullptr, nullptr, nullptr);
+
+        if (output_dataset == nullptr) {
+            throw std::runtime_error("failed to create output dataset");
+        }
+
+        return DEM<DataType, raster_number, no_data_fallback>(output_dataset);
+    }
+};
+
+}
@@ -0,0 +1,313 @@
+/*
+GDEM : C++ wrapper over GDAL for working with DEM data.
+Copyright (C) 2024  Pritam Halder
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <https://www.gnu.org/licenses/>.
+
+Author : Pritam Halder
+Email : pritamhalder.portfolio@gmail.com
+*/
+
+#pragma once
+
+
+#include <algorithm>
+#include <cmath>
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <unordered_map>
+#include <utility>
+
+#include "GDEM/Cache.hpp"
+#include "GDEM/Type.hpp"
+
+
+
+namespace GDEM {
+
+// Speculative loading of the blocks ahead of a query stream moving steadily across the DEM (e.g. vehicle
+// tracking). Every query is `observe`d : the motion (direction & speed, in cells per query) is fitted by least
+// squares over the recent queries, and when the stream enters a new block, the blocks up to `depth` blocks ahead
+// along it are loaded into the cache by a background thread. Every prediction is scored, as useful when a later
+// query reaches its block or wasted when none does in time (twice its expected arrival), and the lookahead adapts
+// to the recent accuracy : raised while it stays high, halved when it drops, down to no loading at all, where
+// predictions are still made & scored (without loading) so that it resumes once the motion is steady again.
+template <ValidDataType DataType, uint16_t raster_number = 1>
+class Prefetcher {
+public:
+    // `history` recent queries fit the motion, at most `depth` blocks are loaded ahead, the lookahead is raised
+    // while the accuracy is at least `raise` and halved below `lower`
+    struct Options {
+        size_t history;
+        size_t depth;
+        double raise;
+        double lower;
+
+        Options()
+            : history(16),
+            depth(4),
+            raise(0.75),
+            lower(0.4)
+        {};
+
+        Options(size_t history, size_t depth, double raise = 0.75, double lower = 0.4)
+            : history(history),
+            depth(depth),
+            raise(raise),
+            lower(lower)
+        {};
+
+        Options(const Options& o) = default;
+        Options& operator=(const Options& o) = default;
+        Options(Options&& o) noexcept = default;
+        Options& operator=(Options&& o) noexcept = default;
+        ~Options() = default;
+    };
+
+    struct Report {
+        uint64_t queries;
+        uint64_t hits;              // queries whose block was in the cache's decoded tier
+        uint64_t prefetched_hits;   // of the `hits`, whose block was there because it was prefetched
+        uint64_t issued;            // blocks loaded ahead
+        uint64_t useful;            // predictions reached by a later query
+        uint64_t wasted;            // predictions not reached in time
+        double accuracy;            // recent useful / (useful + wasted)
+        size_t depth;               // current lookahead in blocks, 0 while throttled
+        double hit_rate;            // hits / queries
+        double baseline_hit_rate;   // (hits - prefetched_hits) / queries, the cache's without prefetching
+    };
+
+private:
+    struct Prediction {
+        uint64_t expires;           // query count after which it's wasted
+        bool loaded;                // false for predictions only scored (throttled)
+    };
+
+    std::shared_ptr<BlockCache<DataType, raster_number>> cache;
+    Options options;
+    double extent;                  // smallest block side, cells
+
+    std::deque<std::pair<double, double>> history;
+    std::unordered_map<size_t, Prediction> predictions;
+    size_t current;
+    size_t depth;
+    double accuracy;
+    uint64_t scored;
+
+    uint64_t query_count;
+    uint64_t hit_count;
+    uint64_t prefetched_hit_count;
+    uint64_t issued_count;
+    uint64_t useful_count;
+    uint64_t wasted_count;
+
+    std::deque<size_t> queue;
+    std::thread worker;
+    std::mutex mutex;
+    std::condition_variable available;
+    bool stopping;
+
+    void work() {
+        while (true) {
+            size_t block;
+
+            {
+                std::unique_lock<std::mutex> lock(this->mutex);
+                this->available.wait(lock, [this] () { return this->stopping || !this->queue.empty(); });
+
+                if (this->stopping) {
+                    return;
+                }
+
+                block = this->queue.front();
+                this->queue.pop_front();
+            }
+
+            // a failed prefetch only leaves the block to be read (& fail) by its query
+            try {
+                this->cache->prefetch(block);
+            } catch (...) {}
+        }
+    }
+
+    void score(bool useful) {
+        this->accuracy += ((useful ? 1.0 : 0.0) - this->accuracy) / 16;
+        (useful ? this->useful_count : this->wasted_count)++;
+
+        if (++this->scored % 8 != 0) return;
+
+        if (this->accuracy >= this->options.raise && this->depth < this->options.depth) {
+            this->depth++;
+        } else if (this->accuracy < this->options.lower && this->depth > 0) {
+            this->depth /= 2;
+        }
+    }
+
+    void predict(double row, double column) {
+        for (auto it = this->predictions.begin(); it != this->predictions.end();) {
+            if (it->second.expires < this->query_count) {
+                this->score(false);
+                it = this->predictions.erase(it);
+            } else {
+                it++;
+            }
+        }
+
+        // least squares motion over the recent queries, in cells per query
+        size_t n = this->history.size();
+        if (n < 3) return;
+
+        double mean_i = (n - 1) / 2.0, mean_r = 0, mean_c = 0;
+        for (const auto& [r, c] : this->history) {
+            mean_r += r;
+            mean_c += c;
+        }
+        mean_r /= n;
+        mean_c /= n;
+
+        double sii = 0, sir = 0, sic = 0;
+        for (size_t i = 0; i < n; i++) {
+            double di = i - mean_i;
+            sii += di * di;
+            sir += di * (this->history[i].first - mean_r);
+            sic += di * (this->history[i].second - mean_c);
+        }
+
+        double velocity_r = sir / sii, velocity_c = sic / sii;
+        double speed = std::hypot(velocity_r, velocity_c);
+        if (!(speed > 1e-9)) return;
+
+        double rows = this->cache->rows(), columns = this->cache->columns();
+        double distance = std::max<size_t>(this->depth, 1) * this->extent;
+        double step = this->extent / 2;
+        bool issued = false;
+
+        for (double d = step; d <= distance; d += step) {
+            double r = row + velocity_r / speed * d, c = column + velocity_c / speed * d;
+            if (r < 0 || c < 0 || r >= rows || c >= columns) break;
+
+            size_t block = this->cache->block_of(static_cast<size_t>(r), static_cast<size_t>(c));
+            if (block == this->current || this->predictions.contains(block)) continue;
+
+            bool load = this->depth > 0;
+            if (load && this->cache->contains(block)) continue;
+
+            uint64_t arrival = static_cast<uint64_t>(d / speed);
+            this->predictions[block] = {this->query_count + 2 * arrival + this->options.history, load};
+
+            if (load) {
+                this->queue.push_back(block);
+                this->issued_count++;
+                issued = true;
+            }
+        }
+
+        // stale loads are dropped when the loader falls behind
+        while (this->queue.size() > 2 * this->options.depth) {
+            this->queue.pop_front();
+        }
+
+        if (issued) {
+            this->available.notify_one();
+        }
+    }
+
+public:
+    Prefetcher(std::shared_ptr<BlockCache<DataType, raster_number>> cache, const Options& options = Options())
+        : cache(std::move(cache)),
+        options(options),
+        current(static_cast<size_t>(-1)),
+        depth(std::min<size_t>(1, options.depth)),
+        accuracy(0.5),
+        scored(0),
+        query_count(0),
+        hit_count(0),
+        prefetched_hit_count(0),
+        issued_count(0),
+        useful_count(0),
+        wasted_count(0),
+        stopping(false)
+    {
+        if (this->cache == nullptr) {
+            throw std::runtime_error("prefetching requires a block cache");
+        }
+
+        const Window& w = this->cache->window(0);
+        this->extent = std::max<size_t>(1, std::min(w.rows, w.columns));
+        this->options.history = std::max<size_t>(3, this->options.history);
+        this->worker = std::thread(&Prefetcher::work, this);
+    }
+
+    Prefetcher(const Prefetcher& o) = delete;
+    Prefetcher& operator=(const Prefetcher& o) = delete;
+    Prefetcher(Prefetcher&& o) noexcept = delete;
+    Prefetcher& operator=(Prefetcher&& o) noexcept = delete;
+
+    ~Prefetcher() {
+        {
+            std::lock_guard<std::mutex> lock(this->mutex);
+            this->stopping = true;
+        }
+
+        this->available.notify_all();
+        this->worker.join();
+    }
+
+    // records a query of the cell, before it's read through the cache
+    void observe(size_t row, size_t column) {
+        std::lock_guard<std::mutex> lock(this->mutex);
+
+        this->query_count++;
+        size_t block = this->cache->block_of(row, column);
+
+        // the previous query just read the current block
+        bool moved = block != this->current;
+        bool resident = !moved || this->cache->contains(block);
+        this->hit_count += resident;
+
+        auto it = this->predictions.find(block);
+        if (it != this->predictions.end()) {
+            this->prefetched_hit_count += resident && it->second.loaded;
+            this->score(true);
+            this->predictions.erase(it);
+        }
+
+        this->history.emplace_back(row, column);
+        if (this->history.size() > this->options.history) {
+            this->history.pop_front();
+        }
+
+        this->current = block;
+        if (moved || this->query_count % this->options.history == 0) {
+            this->predict(row, column);
+        }
+    }
+
+    Report report() {
+        std::lock_guard<std::mutex> lock(this->mutex);
+
+        double queries = std::max<uint64_t>(1, this->query_count);
+        return {
+            this->query_count, this->hit_count, this->prefetched_hit_count, this->issued_count, this->useful_count,
+            this->wasted_count, this->accuracy, this->depth, this->hit_count / queries,
+            (this->hit_count - this->prefetched_hit_count) / queries
+        };
+    }
+};
+
+}
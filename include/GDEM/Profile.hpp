@@ -0,0 +1,314 @@
+/*
+GDEM : C++ wrapper over GDAL for working with DEM data.
+Copyright (C) 2024  Pritam Halder
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <https://www.gnu.org/licenses/>.
+
+Author : Pritam Halder
+Email : pritamhalder.portfolio@gmail.com
+*/
+
+#pragma once
+
+
+#include <algorithm>
+#include <array>
+#include <cmath>
+#include <cstdint>
+#include <limits>
+#include <numbers>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include <gdal/gdal_priv.h>
+#include <gdal/ogr_spatialref.h>
+
+#include "GDEM/Cache.hpp"
+#include "GDEM/DEM.hpp"
+#include "GDEM/Parallel.hpp"
+#include "GDEM/Statistics.hpp"
+#include "GDEM/Transform.hpp"
+
+
+
+namespace GDEM {
+namespace Profile {
+
+// radio link between a transmitter & a receiver, antenna heights in metres above the ground, frequency in Hz
+struct Link {
+    Coordinate transmitter;
+    Coordinate receiver;
+    double transmitter_height;
+    double receiver_height;
+    double frequency;
+
+    Link()
+        : transmitter_height(0),
+        receiver_height(0),
+        frequency(1e9)
+    {};
+
+    Link(const Coordinate& transmitter, double transmitter_height, const Coordinate& receiver, double receiver_height, double frequency)
+        : transmitter(transmitter),
+        receiver(receiver),
+        transmitter_height(transmitter_height),
+        receiver_height(receiver_height),
+        frequency(frequency)
+    {};
+
+    Link(const Link& o) = default;
+    Link& operator=(const Link& o) = default;
+    Link(Link&& o) noexcept = default;
+    Link& operator=(Link&& o) noexcept = default;
+    ~Link() = default;
+};
+
+
+// `k_factor` is the effective earth radius factor of refraction (4/3 for standard atmosphere), a link is clear
+// when the line of sight stays `clearance` times the first Fresnel zone radius above the terrain everywhere,
+// `profiles` keeps every link's samples (only the summaries otherwise)
+struct Options {
+    double k_factor;
+    double clearance;
+    bool profiles;
+
+    Options()
+        : k_factor(4.0 / 3.0),
+        clearance(0.6),
+        profiles(false)
+    {};
+
+    Options(double k_factor, double clearance = 0.6, bool profiles = false)
+        : k_factor(k_factor),
+        clearance(clearance),
+        profiles(profiles)
+    {};
+
+    Options(const Options& o) = default;
+    Options& operator=(const Options& o) = default;
+    Options(Options&& o) noexcept = default;
+    Options& operator=(Options&& o) noexcept = default;
+    ~Options() = default;
+};
+
+
+// one DEM cell crossed by the link, at `distance` metres from the transmitter
+struct Sample {
+    double distance;
+    float elevation;
+    double bulge;               // earth curvature correction added to the elevation
+    double line_of_sight;       // height of the line of sight
+    double fresnel_radius;      // first Fresnel zone radius
+};
+
+
+struct Result {
+    bool valid;                 // whether both ends lie on valid cells
+    double length;              // metres
+    double minimum_clearance;   // lowest height of the line of sight above the (curvature corrected) terrain
+    double minimum_ratio;       // lowest clearance over the first Fresnel zone radius
+    double worst_distance;      // distance from the transmitter where `minimum_ratio` is reached
+    float worst_elevation;
+    bool line_of_sight;         // `minimum_clearance` >= 0
+    bool clear;                 // `minimum_ratio` >= the required clearance
+    std::vector<Sample> profile;
+
+    Result()
+        : valid(false),
+        length(0),
+        minimum_clearance(std::numeric_limits<double>::infinity()),
+        minimum_ratio(std::numeric_limits<double>::infinity()),
+        worst_distance(0),
+        worst_elevation(0),
+        line_of_sight(false),
+        clear(false)
+    {};
+
+    Result(const Result& o) = default;
+    Result& operator=(const Result& o) = default;
+    Result(Result&& o) noexcept = default;
+    Result& operator=(Result&& o) noexcept = default;
+    ~Result() = default;
+};
+
+
+
+namespace detail {
+
+constexpr double earth_radius = 6371008.8;
+constexpr double speed_of_light = 299792458.0;
+
+
+// Visits the cells crossed by the segment (u0, v0) - (u1, v1) in grid coordinates (cell (r, c) covering
+// [c, c + 1) x [r, r + 1)) in order (Amanatides & Woo), as `visit(row, column, t)` with `t` in [0, 1] the
+// segment's parameter at the middle of its crossing of the cell
+template <typename Visit>
+static void Traverse(double u0, double v0, double u1, double v1, Visit&& visit) {
+    double du = u1 - u0, dv = v1 - v0;
+    long c = static_cast<long>(std::floor(u0)), r = static_cast<long>(std::floor(v0));
+    long last_c = static_cast<long>(std::floor(u1)), last_r = static_cast<long>(std::floor(v1));
+
+    long step_c = du > 0 ? 1 : -1, step_r = dv > 0 ? 1 : -1;
+    double infinity = std::numeric_limits<double>::infinity();
+    double delta_c = du != 0 ? std::abs(1 / du) : infinity, delta_r = dv != 0 ? std::abs(1 / dv) : infinity;
+    double next_c = du != 0 ? ((du > 0 ? c + 1 : c) - u0) / du : infinity;
+    double next_r = dv != 0 ? ((dv > 0 ? r + 1 : r) - v0) / dv : infinity;
+
+    double t = 0;
+    size_t steps = std::abs(last_c - c) + std::abs(last_r - r);
+    for (size_t i = 0; i <= steps; i++) {
+        double exit = std::min({next_c, next_r, 1.0});
+        visit(r, c, (t + exit) / 2);
+        t = exit;
+
+        if (next_c < next_r) {
+            c += step_c;
+            next_c += delta_c;
+        } else {
+            r += step_r;
+            next_r += delta_r;
+        }
+    }
+}
+
+}
+
+
+
+// Terrain profiles & first Fresnel zone clearance of radio links, in parallel (`threads` = 0 uses all hardware
+// threads). Every link walks the cells it crosses (DDA) through the shared block cache and is checked as it
+// goes : the terrain is raised by the earth's bulge d1 * d2 / (2 k R) and compared with the straight line of sight
+// between the antennas and with the first Fresnel zone radius sqrt(lambda d1 d2 / d). Only the summaries are
+// returned unless `options.profiles` is set. NODATA cells don't obstruct.
+template <ValidDataType DataType, uint16_t raster_number, DataType no_data_fallback>
+static std::vector<Result> Links(
+    const DEM<DataType, raster_number, no_data_fallback>& dem,
+    BlockCache<DataType, raster_number>& cache,
+    const std::vector<Link>& links,
+    const Options& options = Options(),
+    size_t threads = 0
+) {
+    GDALDataset *dataset = dem.get_dataset();
+    DataType nodata = dem.type.nodata;
+
+    double geotransform[6];
+    if (dataset->GetGeoTransform(geotransform) != CE_None) {
+        throw std::runtime_error("failed to read dataset transformations");
+    }
+
+    OGRSpatialReference srs;
+    std::string projection = dem.type.projection;
+    bool projected = !projection.empty()
+        && srs.SetFromUserInput(projection.c_str()) == OGRERR_NONE
+        && srs.IsProjected();
+    size_t source = Transform::detail::WGS84(), target = Transform::detail::Intern(projection);
+
+    long rows = cache.rows(), columns = cache.columns();
+    double effective_radius = options.k_factor * detail::earth_radius;
+
+    std::vector<Result> results(links.size());
+    ThreadPool pool(threads);
+
+    pool.parallel_for(links.size(), [&] (size_t index, size_t) {
+        const Link& link = links[index];
+        Result& result = results[index];
+
+        // grid coordinates & length
+        std::array<double, 2> x = {link.transmitter.longitude, link.receiver.longitude};
+        std::array<double, 2> y = {link.transmitter.latitude, link.receiver.latitude};
+        double length;
+        if (projected) {
+            Transform::detail::Exact(Transform::detail::Get(source, target), x.data(), y.data(), 2);
+            length = std::hypot(x[1] - x[0], y[1] - y[0]);
+        } else {
+            double phi0 = y[0] * std::numbers::pi / 180, phi1 = y[1] * std::numbers::pi / 180;
+            double dphi = phi1 - phi0, dlambda = (x[1] - x[0]) * std::numbers::pi / 180;
+            double h = std::sin(dphi / 2) * std::sin(dphi / 2) + std::cos(phi0) * std::cos(phi1) * std::sin(dlambda / 2) * std::sin(dlambda / 2);
+            length = 2 * detail::earth_radius * std::asin(std::min(1.0, std::sqrt(h)));
+        }
+
+        double u0 = (x[0] - geotransform[0]) / geotransform[1], v0 = (y[0] - geotransform[3]) / geotransform[5];
+        double u1 = (x[1] - geotransform[0]) / geotransform[1], v1 = (y[1] - geotransform[3]) / geotransform[5];
+        result.length = length;
+
+        RecentBlocks<DataType, raster_number> recent(cache);
+        auto elevation = [&] (long r, long c) -> DataType {
+            if (r < 0 || c < 0 || r >= rows || c >= columns) return nodata;
+            return recent.value(r, c);
+        };
+
+        if (!(u0 == u0 && u1 == u1 && v0 == v0 && v1 == v1)) {
+            return;
+        }
+
+        DataType ground0 = elevation(static_cast<long>(std::floor(v0)), static_cast<long>(std::floor(u0)));
+        DataType ground1 = elevation(static_cast<long>(std::floor(v1)), static_cast<long>(std::floor(u1)));
+        if (!Statistics::detail::valid(ground0, nodata) || !Statistics::detail::valid(ground1, nodata)) {
+            return;
+        }
+        result.valid = true;
+
+        double height0 = ground0 + link.transmitter_height, height1 = ground1 + link.receiver_height;
+        double wavelength = detail::speed_of_light / link.frequency;
+
+        detail::Traverse(u0, v0, u1, v1, [&] (long r, long c, double t) {
+            DataType value = elevation(r, c);
+            if (!Statistics::detail::valid(value, nodata)) return;
+
+            double d1 = t * length, d2 = length - d1;
+            double bulge = d1 * d2 / (2 * effective_radius);
+            double line_of_sight = height0 + (height1 - height0) * t;
+            double radius = length > 0 ? std::sqrt(wavelength * d1 * d2 / length) : 0;
+
+            double clearance = line_of_sight - (value + bulge);
+            result.minimum_clearance = std::min(result.minimum_clearance, clearance);
+
+            if (radius > 0) {
+                double ratio = clearance / radius;
+                if (ratio < result.minimum_ratio) {
+                    result.minimum_ratio = ratio;
+                    result.worst_distance = d1;
+                    result.worst_elevation = value;
+                }
+            }
+
+            if (options.profiles) {
+                result.profile.push_back({d1, static_cast<float>(value), bulge, line_of_sight, radius});
+            }
+        });
+
+        result.line_of_sight = result.minimum_clearance >= 0;
+        result.clear = result.minimum_ratio >= options.clearance;
+    });
+
+    return results;
+}
+
+
+// radio links with their own block cache (of `cache_size` bytes)
+template <ValidDataType DataType, uint16_t raster_number, DataType no_data_fallback>
+static std::vector<Result> Links(
+    const DEM<DataType, raster_number, no_data_fallback>& dem,
+    const std::vector<Link>& links,
+    const Options& options = Options(),
+    size_t threads = 0,
+    size_t cache_size = size_t(256) << 20
+) {
+    BlockCache<DataType, raster_number> cache(dem.get_dataset(), cache_size);
+    return Links(dem, cache, links, options, threads);
+}
+
+}
+}
@@ -0,0 +1,428 @@
+/*
+GDEM : C++ wrapper over GDAL for working with DEM data.
+Copyright (C) 2024  Pritam Halder
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <https://www.gnu.org/licenses/>.
+
+Author : Pritam Halder
+Email : pritamhalder.portfolio@gmail.com
+*/
+
+#pragma once
+
+
+#include <algorithm>
+#include <array>
+#include <bit>
+#include <cmath>
+#include <cstdint>
+#include <filesystem>
+#include <fstream>
+#include <limits>
+#include <string>
+#include <vector>
+
+#include <gdal/gdal_priv.h>
+
+#include "GDEM/Block.hpp"
+#include "GDEM/DEM.hpp"
+#include "GDEM/Parallel.hpp"
+#include "GDEM/Statistics.hpp"
+
+
+
+namespace GDEM {
+
+// Precomputed min / max index of a DEM for rectangle queries. Holds a min / max mipmap (every level's cell the
+// min / max of its 2 x 2 cells on the finer level, level 0 the DEM as float) and a 2D sparse table over the level
+// `table_level` cells (16 x 16 DEM cells), which answers the block aligned interior of a rectangle in 4 lookups;
+// the rest of the rectangle (less than a block deep on every side) is peeled through the finer mipmap levels, so a
+// query is O(width + height) : up to one row / column per side and level, fewer than 4 * (width + height) cells.
+// NODATA is ignored (all NODATA rectangles give NaN). The mipmap can be saved to & loaded from a sidecar file.
+class RangeIndex {
+public:
+    static constexpr size_t table_level = 4;
+
+    struct Extreme {
+        float value;    // NaN when the rectangle only has NODATA
+        size_t row;
+        size_t column;
+    };
+
+private:
+    struct Level {
+        size_t rows;
+        size_t columns;
+        std::vector<float> minimum;
+        std::vector<float> maximum;     // (level 0 only holds `maximum`, the values themselves)
+    };
+
+    // sparse table : `maximum[kr * column_orders + kc]` covers 2^kr x 2^kc level `table_level` cells from every cell
+    struct Table {
+        size_t row_orders;
+        size_t column_orders;
+        std::vector<std::vector<float>> minimum;
+        std::vector<std::vector<float>> maximum;
+    };
+
+    std::array<double, 6> geotransform;
+    std::vector<Level> levels;
+    Table table;
+
+    static float lower(float a, float b) {
+        return a < b || b != b ? a : b;
+    }
+
+    static float higher(float a, float b) {
+        return a > b || b != b ? a : b;
+    }
+
+    const std::vector<float>& values(size_t level, bool maximum) const {
+        return level == 0 || maximum ? this->levels[level].maximum : this->levels[level].minimum;
+    }
+
+    void build_levels(size_t threads) {
+        ThreadPool pool(threads);
+
+        while (this->levels.back().rows > 1 || this->levels.back().columns > 1) {
+            const Level& fine = this->levels.back();
+            Level coarse{(fine.rows + 1) / 2, (fine.columns + 1) / 2, {}, {}};
+            coarse.minimum.resize(coarse.rows * coarse.columns);
+            coarse.maximum.resize(coarse.rows * coarse.columns);
+
+            bool finest = this->levels.size() == 1;
+            const std::vector<float>& fine_minimum = finest ? fine.maximum : fine.minimum;
+
+            pool.parallel_for(coarse.rows, [&] (size_t r, size_t) {
+                for (size_t c = 0; c < coarse.columns; c++) {
+                    float low = std::numeric_limits<float>::quiet_NaN(), high = low;
+                    for (size_t i = 2 * r; i < std::min(2 * r + 2, fine.rows); i++) {
+                        for (size_t j = 2 * c; j < std::min(2 * c + 2, fine.columns); j++) {
+                            low = lower(fine_minimum[i * fine.columns + j], low);
+                            high = higher(fine.maximum[i * fine.columns + j], high);
+                        }
+                    }
+                    coarse.minimum[r * coarse.columns + c] = low;
+                    coarse.maximum[r * coarse.columns + c] = high;
+                }
+            });
+
+            this->levels.push_back(std::move(coarse));
+        }
+    }
+
+    void build_table(size_t threads) {
+        const Level& base = this->levels[std::min(table_level, this->levels.size() - 1)];
+        Table& t = this->table;
+        t.row_orders = std::bit_width(base.rows);
+        t.column_orders = std::bit_width(base.columns);
+        t.minimum.assign(t.row_orders * t.column_orders, {});
+        t.maximum.assign(t.row_orders * t.column_orders, {});
+
+        ThreadPool pool(threads);
+        for (size_t kr = 0; kr < t.row_orders; kr++) {
+            for (size_t kc = 0; kc < t.column_orders; kc++) {
+                size_t rows = base.rows - (size_t(1) << kr) + 1, columns = base.columns - (size_t(1) << kc) + 1;
+                std::vector<float>& low = t.minimum[kr * t.column_orders + kc];
+                std::vector<float>& high = t.maximum[kr * t.column_orders + kc];
+                low.resize(rows * columns);
+                high.resize(rows * columns);
+
+                if (kr == 0 && kc == 0) {
+                    const std::vector<float>& base_minimum = this->values(std::min(table_level, this->levels.size() - 1), false);
+                    std::copy(base_minimum.begin(), base_minimum.end(), low.begin());
+                    std::copy(base.maximum.begin(), base.maximum.end(), high.begin());
+                    continue;
+                }
+
+                // from the halves along rows (kr > 0) or columns
+                bool along_rows = kr > 0;
+                size_t previous = along_rows ? (kr - 1) * t.column_orders + kc : kr * t.column_orders + kc - 1;
+                size_t previous_columns = base.columns - (size_t(1) << (along_rows ? kc : kc - 1)) + 1;
+                size_t offset = along_rows ? (size_t(1) << (kr - 1)) * previous_columns : (size_t(1) << (kc - 1));
+                const std::vector<float>& previous_low = t.minimum[previous];
+                const std::vector<float>& previous_high = t.maximum[previous];
+
+                pool.parallel_for(rows, [&] (size_t r, size_t) {
+                    for (size_t c = 0; c < columns; c++) {
+                        size_t i = r * previous_columns + c;
+                        low[r * columns + c] = lower(previous_low[i], previous_low[i + offset]);
+                        high[r * columns + c] = higher(previous_high[i], previous_high[i + offset]);
+                    }
+                });
+            }
+        }
+    }
+
+    // descends from a level `level` cell to a level 0 cell holding `value`
+    Extreme descend(size_t level, size_t row, size_t column, float value, bool maximum) const {
+        while (level > 0) {
+            const Level& fine = this->levels[level - 1];
+            const std::vector<float>& fine_values = this->values(level - 1, maximum);
+
+            bool found = false;
+            for (size_t i = 2 * row; i < std::min(2 * row + 2, fine.rows) && !found; i++) {
+                for (size_t j = 2 * column; j < std::min(2 * column + 2, fine.columns) && !found; j++) {
+                    if (fine_values[i * fine.columns + j] == value) {
+                        row = i;
+                        column = j;
+                        found = true;
+                    }
+                }
+            }
+            level--;
+        }
+        return {value, row, column};
+    }
+
+    Extreme query(Window window, bool maximum) const {
+        // whether `value` beats `best` (anything beats NaN, NaN beats nothing)
+        auto improves = [maximum] (float value, float best) {
+            return maximum ? value > best || (best != best && value == value) : value < best || (best != best && value == value);
+        };
+
+        size_t r0 = window.row, c0 = window.column;
+        size_t r1 = std::min(window.row + window.rows, this->levels[0].rows), c1 = std::min(window.column + window.columns, this->levels[0].columns);
+
+        float best = std::numeric_limits<float>::quiet_NaN();
+        size_t best_level = 0, best_row = 0, best_column = 0;
+        auto consider = [&] (size_t level, size_t r, size_t c) {
+            float value = this->values(level, maximum)[r * this->levels[level].columns + c];
+            if (improves(value, best)) {
+                best = value;
+                best_level = level;
+                best_row = r;
+                best_column = c;
+            }
+        };
+
+        // peel the rows & columns not aligned to the next level (the O(width + height) part of the query)
+        size_t top = std::min(table_level, this->levels.size() - 1);
+        for (size_t level = 0; level < top && r0 < r1 && c0 < c1; level++) {
+            if (r0 & 1) {
+                for (size_t c = c0; c < c1; c++) consider(level, r0, c);
+                r0++;
+            }
+            if (r1 & 1 && r0 < r1) {
+                r1--;
+                for (size_t c = c0; c < c1; c++) consider(level, r1, c);
+            }
+            if (c0 & 1) {
+                for (size_t r = r0; r < r1; r++) consider(level, r, c0);
+                c0++;
+            }
+            if (c1 & 1 && c0 < c1) {
+                c1--;
+                for (size_t r = r0; r < r1; r++) consider(level, r, c1);
+            }
+
+            r0 /= 2; r1 /= 2; c0 /= 2; c1 /= 2;
+        }
+
+        // the aligned interior from the sparse table (4 overlapping rectangles)
+        if (r0 < r1 && c0 < c1) {
+            const Table& t = this->table;
+            size_t kr = std::bit_width(r1 - r0) - 1, kc = std::bit_width(c1 - c0) - 1;
+            size_t k = kr * t.column_orders + kc;
+            size_t columns = this->levels[top].columns - (size_t(1) << kc) + 1;
+            const std::vector<float>& entries = maximum ? t.maximum[k] : t.minimum[k];
+
+            for (size_t r : {r0, r1 - (size_t(1) << kr)}) {
+                for (size_t c : {c0, c1 - (size_t(1) << kc)}) {
+                    float value = entries[r * columns + c];
+                    if (improves(value, best)) {
+                        best = value;
+                        best_level = top + 1;   // marks a table entry, located below
+                        best_row = r;
+                        best_column = c;
+                    }
+                }
+            }
+
+            // narrow the table entry down to one level `table_level` cell holding the value
+            if (best_level == top + 1) {
+                while (kr > 0 || kc > 0) {
+                    bool along_rows = kr > 0;
+                    size_t half = size_t(1) << ((along_rows ? kr : kc) - 1);
+                    size_t previous = along_rows ? (kr - 1) * t.column_orders + kc : kr * t.column_orders + kc - 1;
+                    size_t previous_columns = this->levels[top].columns - (size_t(1) << (along_rows ? kc : kc - 1)) + 1;
+                    const std::vector<float>& previous_entries = maximum ? t.maximum[previous] : t.minimum[previous];
+
+                    if (previous_entries[best_row * previous_columns + best_column] != best) {
+                        (along_rows ? best_row : best_column) += half;
+                    }
+                    (along_rows ? kr : kc)--;
+                }
+                best_level = top;
+            }
+        }
+
+        if (best != best) {
+            return {best, window.row, window.column};
+        }
+        return this->descend(best_level, best_row, best_column, best, maximum);
+    }
+
+public:
+    // builds the index over the whole DEM, `threads` = 0 uses all hardware threads
+    template <ValidDataType DataType, uint16_t raster_number, DataType no_data_fallback>
+    RangeIndex(const DEM<DataType, raster_number, no_data_fallback>& dem, size_t threads = 0) {
+        GDALDataset *dataset = dem.get_dataset();
+        if (dataset->GetGeoTransform(this->geotransform.data()) != CE_None) {
+            throw std::runtime_error("failed to read dataset transformations");
+        }
+
+        Level base{dem.type.rows, dem.type.columns, {}, std::vector<float>(dem.type.rows * dem.type.columns)};
+
+        BandReader<DataType, raster_number> reader(dataset);
+        std::vector<Window> windows = Blocks(reader.shared());
+        ThreadPool pool(threads);
+
+        pool.parallel_for(windows.size(), [&] (size_t index, size_t) {
+            const Window& window = windows[index];
+            std::vector<DataType> values = reader.read(window);
+
+            for (size_t r = 0; r < window.rows; r++) {
+                for (size_t c = 0; c < window.columns; c++) {
+                    DataType value = values[r * window.columns + c];
+                    base.maximum[(window.row + r) * base.columns + window.column + c] = Statistics::detail::valid(value, dem.type.nodata)
+                        ? static_cast<float>(value)
+                        : std::numeric_limits<float>::quiet_NaN();
+                }
+            }
+        });
+
+        this->levels.push_back(std::move(base));
+        this->build_levels(threads);
+        this->build_table(threads);
+    }
+
+    // loads an index saved with `save` (the sparse table is rebuilt)
+    RangeIndex(const std::filesystem::path& sidecar_filepath, size_t threads = 0) {
+        std::ifstream file(sidecar_filepath, std::ios::binary);
+        if (!file) {
+            throw std::runtime_error("file '" + sidecar_filepath.string() + "' not found");
+        }
+
+        char magic[8];
+        uint64_t count;
+        file.read(magic, 8);
+        file.read(reinterpret_cast<char*>(this->geotransform.data()), sizeof(double) * 6);
+        file.read(reinterpret_cast<char*>(&count), sizeof(count));
+        if (!file || std::string(magic, 8) != "GDEMRNG1") {
+            throw std::runtime_error("invalid range index file '" + sidecar_filepath.string() + "'");
+        }
+
+        for (uint64_t level = 0; level < count; level++) {
+            uint64_t rows, columns;
+            file.read(reinterpret_cast<char*>(&rows), sizeof(rows));
+            file.read(reinterpret_cast<char*>(&columns), sizeof(columns));
+            if (!file) break;
+
+            Level l{rows, columns, std::vector<float>(level == 0 ? 0 : rows * columns), std::vector<float>(rows * columns)};
+            file.read(reinterpret_cast<char*>(l.minimum.data()), l.minimum.size() * sizeof(float));
+            file.read(reinterpret_cast<char*>(l.maximum.data()), l.maximum.size() * sizeof(float));
+            this->levels.push_back(std::move(l));
+        }
+
+        if (!file || this->levels.empty()) {
+            throw std::runtime_error("invalid range index file '" + sidecar_filepath.string() + "'");
+        }
+
+        this->build_table(threads);
+    }
+
+    RangeIndex(const RangeIndex& o) = default;
+    RangeIndex& operator=(const RangeIndex& o) = default;
+    RangeIndex(RangeIndex&& o) noexcept = default;
+    RangeIndex& operator=(RangeIndex&& o) noexcept = default;
+    ~RangeIndex() = default;
+
+    // Writes the mipmap as a sidecar (little endian) : "GDEMRNG1", float64 geotransform[6], uint64 level count,
+    // then for every level uint64 rows & columns, float32 minimums (not on level 0) & maximums, row major
+    void save(const std::filesystem::path& sidecar_filepath) const {
+        std::ofstream file(sidecar_filepath, std::ios::binary);
+        if (!file) {
+            throw std::runtime_error("failed to create file '" + sidecar_filepath.string() + "'");
+        }
+
+        uint64_t count = this->levels.size();
+        file.write("GDEMRNG1", 8);
+        file.write(reinterpret_cast<const char*>(this->geotransform.data()), sizeof(double) * 6);
+        file.write(reinterpret_cast<const char*>(&count), sizeof(count));
+
+        for (const Level& level : this->levels) {
+            uint64_t rows = level.rows, columns = level.columns;
+            file.write(reinterpret_cast<const char*>(&rows), sizeof(rows));
+            file.write(reinterpret_cast<const char*>(&columns), sizeof(columns));
+            file.write(reinterpret_cast<const char*>(level.minimum.data()), level.minimum.size() * sizeof(float));
+            file.write(reinterpret_cast<const char*>(level.maximum.data()), level.maximum.size() * sizeof(float));
+        }
+
+        if (!file) {
+            throw std::runtime_error("failed to write file '" + sidecar_filepath.string() + "'");
+        }
+    }
+
+    // highest cell of the window (in DEM cells) and where it is
+    Extreme maximum(const Window& window) const {
+        return this->query(window, true);
+    }
+
+    // lowest cell of the window (in DEM cells) and where it is
+    Extreme minimum(const Window& window) const {
+        return this->query(window, false);
+    }
+
+    // DEM cells intersecting the rectangle (in the dataset's coordinate system, e.g. longitudes & latitudes)
+    Window window(double x_min, double y_min, double x_max, double y_max) const {
+        double c0 = (x_min - this->geotransform[0]) / this->geotransform[1], c1 = (x_max - this->geotransform[0]) / this->geotransform[1];
+        double r0 = (y_max - this->geotransform[3]) / this->geotransform[5], r1 = (y_min - this->geotransform[3]) / this->geotransform[5];
+        if (c0 > c1) std::swap(c0, c1);
+        if (r0 > r1) std::swap(r0, r1);
+
+        double rows = this->levels[0].rows, columns = this->levels[0].columns;
+        size_t first_row = std::clamp(std::floor(r0), 0.0, rows), last_row = std::clamp(std::ceil(r1), 0.0, rows);
+        size_t first_column = std::clamp(std::floor(c0), 0.0, columns), last_column = std::clamp(std::ceil(c1), 0.0, columns);
+        return {first_row, first_column, last_row - first_row, last_column - first_column};
+    }
+
+    size_t level_count() const {
+        return this->levels.size();
+    }
+
+    size_t rows(size_t level = 0) const {
+        return this->levels[level].rows;
+    }
+
+    size_t columns(size_t level = 0) const {
+        return this->levels[level].columns;
+    }
+
+    // maximum of a level `level` cell (covering 2^level x 2^level DEM cells), NaN for NODATA only
+    float maximum_at(size_t level, size_t row, size_t column) const {
+        return this->levels[level].maximum[row * this->levels[level].columns + column];
+    }
+
+    // minimum of a level `level` cell
+    float minimum_at(size_t level, size_t row, size_t column) const {
+        return this->values(level, false)[row * this->levels[level].columns + column];
+    }
+
+    const std::array<double, 6>& transform() const {
+        return this->geotransform;
+    }
+};
+
+}
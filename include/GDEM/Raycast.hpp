@@ -0,0 +1,375 @@
+/*
+GDEM : C++ wrapper over GDAL for working with DEM data.
+Copyright (C) 2024  Pritam Halder
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <https://www.gnu.org/licenses/>.
+
+Author : Pritam Halder
+Email : pritamhalder.portfolio@gmail.com
+*/
+
+#pragma once
+
+
+#include <algorithm>
+#include <array>
+#include <cmath>
+#include <cstdint>
+#include <limits>
+#include <memory>
+#include <numbers>
+#include <string>
+#include <vector>
+
+#include <gdal/gdal_priv.h>
+#include <gdal/ogr_spatialref.h>
+
+#include "GDEM/DEM.hpp"
+#include "GDEM/Geoid.hpp"
+#include "GDEM/Parallel.hpp"
+#include "GDEM/Range.hpp"
+#include "GDEM/Transform.hpp"
+
+
+
+namespace GDEM {
+namespace Raycast {
+
+// ray in ECEF (WGS84, metres), `direction` needn't be normalized
+struct Ray {
+    std::array<double, 3> origin;
+    std::array<double, 3> direction;
+};
+
+
+struct Hit {
+    bool hit;
+    double range;                   // metres from the ray's origin
+    std::array<double, 3> point;    // ECEF
+    double latitude;
+    double longitude;
+    double altitude;                // above the ellipsoid
+};
+
+
+
+namespace detail {
+
+constexpr double a = 6378137.0;
+constexpr double f = 1 / 298.257223563;
+constexpr double e2 = f * (2 - f);
+constexpr double b = a * (1 - f);
+
+
+static std::array<double, 3> ECEF(double latitude, double longitude, double altitude) {
+    double phi = latitude * std::numbers::pi / 180, lambda = longitude * std::numbers::pi / 180;
+    double n = a / std::sqrt(1 - e2 * std::sin(phi) * std::sin(phi));
+    return {
+        (n + altitude) * std::cos(phi) * std::cos(lambda),
+        (n + altitude) * std::cos(phi) * std::sin(lambda),
+        (n * (1 - e2) + altitude) * std::sin(phi)
+    };
+}
+
+
+// latitude, longitude (degrees) & ellipsoidal altitude of an ECEF point
+static std::array<double, 3> Geodetic(const std::array<double, 3>& p) {
+    double lambda = std::atan2(p[1], p[0]);
+    double r = std::hypot(p[0], p[1]);
+    double phi = std::atan2(p[2], r * (1 - e2));
+
+    for (int i = 0; i < 4; i++) {
+        double s = std::sin(phi);
+        double n = a / std::sqrt(1 - e2 * s * s);
+        phi = std::atan2(p[2] + e2 * n * s, r);
+    }
+
+    double s = std::sin(phi), c = std::cos(phi);
+    double altitude = r * c + p[2] * s - a * std::sqrt(1 - e2 * s * s);
+    return {phi * 180 / std::numbers::pi, lambda * 180 / std::numbers::pi, altitude};
+}
+
+
+// point of the ray in DEM grid coordinates (cell (r, c) at v = r, u = c, as DEM interpolation) & orthometric height
+struct Sample {
+    double t;
+    double u;
+    double v;
+    double height;
+};
+
+}
+
+
+
+// Casts rays against a DEM. The terrain is the DEM's bilinear surface (the same as `interpolated_altitude`) over
+// its valid cells, NODATA cells leave holes. Intervals of a ray are split recursively and skipped whenever the
+// ray stays above the max-height mipmap of a `RangeIndex` over the cells below them, intersections being solved
+// exactly on the bilinear cells left. DEM values are orthometric when a geoid is given, ellipsoidal otherwise.
+class Caster {
+private:
+    std::shared_ptr<const RangeIndex> index;
+    std::shared_ptr<const Geoid> geoid;
+    size_t projection;      // interned coordinate system (`Transform::detail::Intern`)
+    bool projected;
+    double ceiling;     // radius (from the earth's center) above which rays clear the terrain
+
+    // longest interval checked at once, so the footprint of a chord stays close to its endpoints' box
+    static constexpr double chunk = 50000;
+
+    detail::Sample sample(const Ray& ray, double t) const {
+        std::array<double, 3> p = {ray.origin[0] + t * ray.direction[0], ray.origin[1] + t * ray.direction[1], ray.origin[2] + t * ray.direction[2]};
+        std::array<double, 3> g = detail::Geodetic(p);
+
+        double x = g[1], y = g[0];
+        if (this->projected) {
+            Transform::detail::Exact(Transform::detail::Get(Transform::detail::WGS84(), this->projection), &x, &y, 1);
+        }
+
+        const std::array<double, 6>& geotransform = this->index->transform();
+        double height = this->geoid != nullptr ? g[2] - this->geoid->undulation(g[0], g[1]) : g[2];
+        return {t, (x - geotransform[0]) / geotransform[1], (y - geotransform[3]) / geotransform[5], height};
+    }
+
+    // highest terrain which can lie below the interval (-inf for none, or outside the DEM's coordinate system)
+    double ceiling_below(const detail::Sample& s0, const detail::Sample& s1, const detail::Sample& middle) const {
+        double u_min = std::min({s0.u, s1.u, middle.u}), u_max = std::max({s0.u, s1.u, middle.u});
+        double v_min = std::min({s0.v, s1.v, middle.v}), v_max = std::max({s0.v, s1.v, middle.v});
+        if (!(u_min == u_min && v_min == v_min && u_max == u_max && v_max == v_max)) {
+            return -std::numeric_limits<double>::infinity();
+        }
+
+        double pad = 1 + 0.01 * std::max(u_max - u_min, v_max - v_min);
+        double rows = this->index->rows(), columns = this->index->columns();
+        if (u_max + pad < 0 || v_max + pad < 0 || u_min - pad > columns - 1 || v_min - pad > rows - 1) {
+            return -std::numeric_limits<double>::infinity();
+        }
+
+        size_t c0 = std::clamp(std::floor(u_min - pad), 0.0, columns - 1), c1 = std::clamp(std::ceil(u_max + pad), 0.0, columns - 1);
+        size_t r0 = std::clamp(std::floor(v_min - pad), 0.0, rows - 1), r1 = std::clamp(std::ceil(v_max + pad), 0.0, rows - 1);
+
+        size_t level = 0;
+        while ((c1 >> level) - (c0 >> level) > 1 || (r1 >> level) - (r0 >> level) > 1) {
+            level++;
+        }
+
+        double highest = -std::numeric_limits<double>::infinity();
+        for (size_t r = r0 >> level; r <= r1 >> level; r++) {
+            for (size_t c = c0 >> level; c <= c1 >> level; c++) {
+                float value = this->index->maximum_at(level, r, c);
+                highest = value == value ? std::max<double>(highest, value) : highest;
+            }
+        }
+        return highest;
+    }
+
+    // first intersection with the bilinear cells along a short interval, taken as straight in grid space
+    bool intersect(const detail::Sample& s0, const detail::Sample& s1, double& t) const {
+        double du = s1.u - s0.u, dv = s1.v - s0.v, dh = s1.height - s0.height;
+        double rows = this->index->rows(), columns = this->index->columns();
+
+        // split where the interval crosses cell lines
+        std::vector<double> taus = {0, 1};
+        for (double k = std::ceil(std::min(s0.u, s1.u)); k < std::max(s0.u, s1.u); k++) taus.push_back((k - s0.u) / du);
+        for (double k = std::ceil(std::min(s0.v, s1.v)); k < std::max(s0.v, s1.v); k++) taus.push_back((k - s0.v) / dv);
+        std::sort(taus.begin(), taus.end());
+
+        for (size_t i = 0; i + 1 < taus.size(); i++) {
+            double ta = taus[i], tb = taus[i + 1];
+            if (tb <= ta) continue;
+
+            double tm = (ta + tb) / 2;
+            double um = s0.u + tm * du, vm = s0.v + tm * dv;
+            if (um < 0 || vm < 0 || um > columns - 1 || vm > rows - 1) continue;
+
+            size_t r = std::min<size_t>(vm, rows - 1), c = std::min<size_t>(um, columns - 1);
+            size_t next_r = std::min<size_t>(r + 1, rows - 1), next_c = std::min<size_t>(c + 1, columns - 1);
+            float z00 = this->index->maximum_at(0, r, c), z01 = this->index->maximum_at(0, r, next_c);
+            float z10 = this->index->maximum_at(0, next_r, c), z11 = this->index->maximum_at(0, next_r, next_c);
+            if (z00 != z00 || z01 != z01 || z10 != z10 || z11 != z11) continue;
+
+            // height above the surface along the interval : A tau^2 + B tau + C
+            double au = s0.u - c, av = s0.v - r;
+            double p = z01 - z00, q = z10 - z00, s = z00 - z01 - z10 + z11;
+            double A = -s * du * dv;
+            double B = dh - (p * du + q * dv + s * (au * dv + av * du));
+            double C = s0.height - (z00 + p * au + q * av + s * au * av);
+
+            auto above = [&] (double tau) { return (A * tau + B) * tau + C; };
+            if (above(ta) <= 0) {
+                t = s0.t + ta * (s1.t - s0.t);
+                return true;
+            }
+
+            double root = std::numeric_limits<double>::infinity();
+            if (std::abs(A) < 1e-12 * std::max(1.0, std::abs(B))) {
+                if (B != 0) root = -C / B;
+            } else {
+                double discriminant = B * B - 4 * A * C;
+                if (discriminant >= 0) {
+                    double sq = std::sqrt(discriminant);
+                    double q0 = -0.5 * (B + (B < 0 ? -sq : sq));
+                    double x0 = q0 / A, x1 = q0 != 0 ? C / q0 : x0;
+                    for (double x : {std::min(x0, x1), std::max(x0, x1)}) {
+                        if (x >= ta && x <= tb) {
+                            root = x;
+                            break;
+                        }
+                    }
+                }
+            }
+
+            if (root >= ta && root <= tb) {
+                t = s0.t + root * (s1.t - s0.t);
+                return true;
+            }
+        }
+
+        return false;
+    }
+
+    bool trace(const Ray& ray, const detail::Sample& s0, const detail::Sample& s1, double& t) const {
+        double length = s1.t - s0.t;
+        detail::Sample middle = this->sample(ray, (s0.t + s1.t) / 2);
+
+        // the chord sags below its endpoints by at most length^2 / 8R, the geoid tilts by well under a metre per km
+        double lowest = std::min(s0.height, s1.height) - length * length / (8 * detail::b) - 0.001 * length;
+        if (lowest > this->ceiling_below(s0, s1, middle)) {
+            return false;
+        }
+
+        if ((std::abs(s1.u - s0.u) <= 2 && std::abs(s1.v - s0.v) <= 2) || length < 0.01) {
+            return this->intersect(s0, s1, t);
+        }
+
+        return this->trace(ray, s0, middle, t) || this->trace(ray, middle, s1, t);
+    }
+
+public:
+    // `index` built over the DEM (built here when `nullptr`), `geoid` when the DEM holds orthometric altitudes
+    template <ValidDataType DataType, uint16_t raster_number, DataType no_data_fallback>
+    Caster(
+        const DEM<DataType, raster_number, no_data_fallback>& dem,
+        std::shared_ptr<const RangeIndex> index = nullptr, std::shared_ptr<const Geoid> geoid = nullptr
+    )
+        : index(index != nullptr ? std::move(index) : std::make_shared<const RangeIndex>(dem)),
+        geoid(std::move(geoid)),
+        projection(Transform::detail::Intern(dem.type.projection))
+    {
+        if (this->index->rows() != dem.type.rows || this->index->columns() != dem.type.columns) {
+            throw std::runtime_error("range index doesn't match the DEM");
+        }
+
+        OGRSpatialReference srs;
+        this->projected = !dem.type.projection.empty()
+            && srs.SetFromUserInput(dem.type.projection.c_str()) == OGRERR_NONE
+            && srs.IsProjected();
+
+        float highest = this->index->maximum_at(this->index->level_count() - 1, 0, 0);
+        double undulation = this->geoid != nullptr ? 150 : 0;
+        this->ceiling = highest == highest ? detail::a + highest + undulation + 100 : -1;
+    }
+
+    Caster(const Caster& o) = default;
+    Caster& operator=(const Caster& o) = default;
+    Caster(Caster&& o) noexcept = default;
+    Caster& operator=(Caster&& o) noexcept = default;
+    ~Caster() = default;
+
+    // first intersection of the ray with the terrain, within `max_range` metres (0 for unlimited)
+    Hit cast(const Ray& ray, double max_range = 0) const {
+        Hit miss{false, std::numeric_limits<double>::quiet_NaN(), {}, 0, 0, 0};
+
+        double length = std::hypot(ray.direction[0], ray.direction[1], ray.direction[2]);
+        if (!(length > 0) || this->ceiling < 0) {
+            return miss;
+        }
+        Ray unit{ray.origin, {ray.direction[0] / length, ray.direction[1] / length, ray.direction[2] / length}};
+
+        // part of the ray inside the sphere the terrain lies in
+        const std::array<double, 3>& o = unit.origin;
+        const std::array<double, 3>& d = unit.direction;
+        double half_b = o[0] * d[0] + o[1] * d[1] + o[2] * d[2];
+        double c = o[0] * o[0] + o[1] * o[1] + o[2] * o[2] - this->ceiling * this->ceiling;
+        double discriminant = half_b * half_b - c;
+        if (discriminant < 0) {
+            return miss;
+        }
+
+        double start = std::max(0.0, -half_b - std::sqrt(discriminant)), end = -half_b + std::sqrt(discriminant);
+        if (max_range > 0) {
+            end = std::min(end, max_range);
+        }
+        if (end <= start) {
+            return miss;
+        }
+
+        detail::Sample s0 = this->sample(unit, start);
+        for (double t0 = start; t0 < end; t0 += chunk) {
+            detail::Sample s1 = this->sample(unit, std::min(t0 + chunk, end));
+
+            double t;
+            if (this->trace(unit, s0, s1, t)) {
+                Hit hit{true, t, {o[0] + t * d[0], o[1] + t * d[1], o[2] + t * d[2]}, 0, 0, 0};
+                std::array<double, 3> g = detail::Geodetic(hit.point);
+                hit.latitude = g[0];
+                hit.longitude = g[1];
+                hit.altitude = g[2];
+                return hit;
+            }
+            s0 = s1;
+        }
+
+        return miss;
+    }
+
+    // casts a batch of rays in parallel (`threads` = 0 uses all hardware threads)
+    std::vector<Hit> cast(const std::vector<Ray>& rays, double max_range = 0, size_t threads = 0) const {
+        std::vector<Hit> hits(rays.size());
+        ThreadPool pool(threads);
+        pool.parallel_for(rays.size(), [&] (size_t i, size_t) {
+            hits[i] = this->cast(rays[i], max_range);
+        });
+        return hits;
+    }
+};
+
+
+
+// ECEF point of latitude, longitude (degrees) & ellipsoidal altitude
+static std::array<double, 3> ECEF(double latitude, double longitude, double altitude) {
+    return detail::ECEF(latitude, longitude, altitude);
+}
+
+
+// ray given in the local east, north, up frame at latitude, longitude & ellipsoidal altitude, as an ECEF ray
+static Ray FromENU(double latitude, double longitude, double altitude, const std::array<double, 3>& origin, const std::array<double, 3>& direction) {
+    double phi = latitude * std::numbers::pi / 180, lambda = longitude * std::numbers::pi / 180;
+    double sp = std::sin(phi), cp = std::cos(phi), sl = std::sin(lambda), cl = std::cos(lambda);
+
+    auto rotate = [&] (const std::array<double, 3>& e) -> std::array<double, 3> {
+        return {
+            -sl * e[0] - sp * cl * e[1] + cp * cl * e[2],
+            cl * e[0] - sp * sl * e[1] + cp * sl * e[2],
+            cp * e[1] + sp * e[2]
+        };
+    };
+
+    std::array<double, 3> reference = detail::ECEF(latitude, longitude, altitude);
+    std::array<double, 3> offset = rotate(origin);
+    return {{reference[0] + offset[0], reference[1] + offset[1], reference[2] + offset[2]}, rotate(direction)};
+}
+
+}
+}
@@ -0,0 +1,381 @@
+/*
+GDEM : C++ wrapper over GDAL for working with DEM data.
+Copyright (C) 2024  Pritam Halder
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <https://www.gnu.org/licenses/>.
+
+Author : Pritam Halder
+Email : pritamhalder.portfolio@gmail.com
+*/
+
+#pragma once
+
+
+#include <algorithm>
+#include <array>
+#include <bit>
+#include <cmath>
+#include <cstdint>
+#include <limits>
+#include <numbers>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+#include <gdal/gdal_priv.h>
+#include <gdal/ogr_spatialref.h>
+
+#include "GDEM/Cache.hpp"
+#include "GDEM/DEM.hpp"
+#include "GDEM/Statistics.hpp"
+#include "GDEM/Transform.hpp"
+
+
+
+namespace GDEM {
+namespace Routing {
+
+// Cost of moving between neighbouring cells, `distance` being their horizontal distance (metres for
+// geographic DEMs) and `from` & `to` their elevations. Moves steeper than `max_slope` (rise / run) are
+// impassable, climbing & descending add `uphill` & `downhill` times the elevation change to the distance.
+// Any functor with the same call signature is usable, with an optional `minimum()` giving the lowest
+// cost per unit of distance (which turns the search into A*, Dijkstra otherwise).
+struct SlopeCost {
+    double max_slope;
+    double uphill;
+    double downhill;
+
+    SlopeCost()
+        : max_slope(std::numeric_limits<double>::infinity()),
+        uphill(1),
+        downhill(0)
+    {};
+
+    // `uphill` & `downhill` can't be negative (moves would cost less than their distance, or nothing)
+    SlopeCost(double max_slope, double uphill = 1, double downhill = 0)
+        : max_slope(max_slope),
+        uphill(uphill),
+        downhill(downhill)
+    {
+        if (!(uphill >= 0) || !(downhill >= 0)) {
+            throw std::runtime_error("slope costs must not be negative");
+        }
+    };
+
+    SlopeCost(const SlopeCost& o) = default;
+    SlopeCost& operator=(const SlopeCost& o) = default;
+    SlopeCost(SlopeCost&& o) noexcept = default;
+    SlopeCost& operator=(SlopeCost&& o) noexcept = default;
+    ~SlopeCost() = default;
+
+    double operator()(double distance, double from, double to) const {
+        double rise = to - from;
+        if (std::abs(rise) > this->max_slope * distance) {
+            return std::numeric_limits<double>::infinity();
+        }
+        return distance + (rise > 0 ? this->uphill * rise : -this->downhill * rise);
+    }
+
+    double minimum() const {
+        return 1;
+    }
+};
+
+
+
+struct Path {
+    std::vector<Coordinate> points;     // cell centers from start to goal, empty when the goal is unreachable
+    double cost;                        // total cost, infinity when the goal is unreachable
+    double distance;                    // horizontal length
+
+    Path()
+        : cost(std::numeric_limits<double>::infinity()),
+        distance(0)
+    {};
+
+    Path(const Path& o) = default;
+    Path& operator=(const Path& o) = default;
+    Path(Path&& o) noexcept = default;
+    Path& operator=(Path&& o) noexcept = default;
+    ~Path() = default;
+};
+
+
+
+namespace detail {
+
+// Monotone priority queue over non-negative keys (their IEEE-754 bits order like the values). Elements are
+// kept in buckets by the highest bit differing from the last popped key, so every element moves down at most
+// 64 times : amortized O(log C) without the comparisons & cache misses of a binary heap.
+template <typename Value>
+class RadixHeap {
+private:
+    std::array<std::vector<std::pair<uint64_t, Value>>, 65> buckets;
+    uint64_t last;
+    size_t count;
+
+    static size_t bucket(uint64_t key, uint64_t last) {
+        return key == last ? 0 : 64 - std::countl_zero(key ^ last);
+    }
+
+public:
+    RadixHeap()
+        : last(0),
+        count(0)
+    {}
+
+    bool empty() const {
+        return this->count == 0;
+    }
+
+    // keys below the last popped key (rounding of consistent heuristics) are raised to it
+    void push(double key, Value value) {
+        uint64_t k = std::max(std::bit_cast<uint64_t>(std::max(key, 0.0)), this->last);
+        this->buckets[bucket(k, this->last)].push_back({k, value});
+        this->count++;
+    }
+
+    std::pair<double, Value> pop() {
+        if (this->buckets[0].empty()) {
+            size_t i = 1;
+            while (this->buckets[i].empty()) i++;
+
+            uint64_t minimum = std::numeric_limits<uint64_t>::max();
+            for (const auto& element : this->buckets[i]) {
+                minimum = std::min(minimum, element.first);
+            }
+
+            this->last = minimum;
+            for (const auto& element : this->buckets[i]) {
+                this->buckets[bucket(element.first, this->last)].push_back(element);
+            }
+            this->buckets[i].clear();
+        }
+
+        auto element = this->buckets[0].back();
+        this->buckets[0].pop_back();
+        this->count--;
+
+        return {std::bit_cast<double>(element.first), element.second};
+    }
+};
+
+
+// neighbours : E, SE, S, SW, W, NW, N, NE
+constexpr int dr[8] = {0, 1, 1, 1, 0, -1, -1, -1};
+constexpr int dc[8] = {1, 1, 0, -1, -1, -1, 0, 1};
+
+}
+
+
+
+// Least cost path between 2 coordinates over the 8-connected cell graph, with A* (Dijkstra for cost functors
+// without `minimum()`) on a radix heap. Elevations are read lazily through the block cache (shareable across
+// searches) and edge costs are computed when cells are expanded; `Cost` is a template parameter so its call
+// inlines. A `corridor` > 0 restricts the search to the cells within that many cells of the straight line
+// between start & goal, bounding long searches.
+template <ValidDataType DataType, uint16_t raster_number, DataType no_data_fallback, typename Cost = SlopeCost>
+static Path Route(
+    const DEM<DataType, raster_number, no_data_fallback>& dem,
+    BlockCache<DataType, raster_number>& cache,
+    const Coordinate& start,
+    const Coordinate& goal,
+    const Cost& cost = Cost(),
+    double corridor = 0
+) {
+    GDALDataset *dataset = dem.get_dataset();
+    DataType nodata = dem.type.nodata;
+
+    double geotransform[6];
+    if (dataset->GetGeoTransform(geotransform) != CE_None) {
+        throw std::runtime_error("failed to read dataset transformations");
+    }
+
+    long rows = cache.rows(), columns = cache.columns();
+
+    // start & goal (WGS84) are transformed to the DEM's coordinate system when it's projected, and back for the path
+    OGRSpatialReference reference;
+    std::string projection = dem.type.projection;
+    bool projected = !projection.empty()
+        && reference.SetFromUserInput(projection.c_str()) == OGRERR_NONE
+        && reference.IsProjected();
+    size_t wgs84 = Transform::detail::WGS84(), crs = Transform::detail::Intern(projection);
+
+    auto cell = [&] (const Coordinate& c) -> std::pair<long, long> {
+        double x = c.longitude, y = c.latitude;
+        if (projected) {
+            Transform::detail::Exact(Transform::detail::Get(wgs84, crs), &x, &y, 1);
+        }
+
+        double v = std::floor((y - geotransform[3]) / geotransform[5]), u = std::floor((x - geotransform[0]) / geotransform[1]);
+        if (!(v >= 0 && u >= 0 && v < rows && u < columns)) {
+            throw std::runtime_error("coordinates outside the DEM");
+        }
+
+        return {static_cast<long>(v), static_cast<long>(u)};
+    };
+
+    auto [start_row, start_column] = cell(start);
+    auto [goal_row, goal_column] = cell(goal);
+
+    // horizontal cell spacing, per row for geographic DEMs (metres on the WGS84 ellipsoid, approximately)
+    const OGRSpatialReference *srs = dataset->GetSpatialRef();
+    bool geographic = srs != nullptr && srs->IsGeographic();
+    double dy = geographic ? std::abs(geotransform[5]) * 110574.0 : std::abs(geotransform[5]);
+    double dx_minimum = std::numeric_limits<double>::infinity();
+
+    std::vector<double> dx(rows);
+    for (long r = 0; r < rows; r++) {
+        double latitude = geotransform[3] + (r + 0.5) * geotransform[5];
+        dx[r] = geographic ? std::abs(geotransform[1]) * 111320.0 * std::cos(latitude * std::numbers::pi / 180) : std::abs(geotransform[1]);
+        dx_minimum = std::min(dx_minimum, dx[r]);
+    }
+
+    double minimum = 0;
+    if constexpr (requires { cost.minimum(); }) {
+        minimum = cost.minimum();
+    }
+
+    // admissible heuristic : straight line distance with the narrowest cell spacing
+    auto heuristic = [&] (long r, long c) {
+        double x = (c - goal_column) * dx_minimum, y = (r - goal_row) * dy;
+        return minimum * std::sqrt(x * x + y * y);
+    };
+
+    // distance from the start-goal line, in cells
+    double line_r = goal_row - start_row, line_c = goal_column - start_column;
+    double line_length = std::hypot(line_r, line_c);
+    auto inside = [&] (long r, long c) {
+        if (corridor <= 0) return true;
+        if (line_length == 0) return std::hypot(r - start_row, c - start_column) <= corridor;
+
+        double t = std::clamp(((r - start_row) * line_r + (c - start_column) * line_c) / (line_length * line_length), 0.0, 1.0);
+        return std::hypot(r - (start_row + t * line_r), c - (start_column + t * line_c)) <= corridor;
+    };
+
+    RecentBlocks<DataType, raster_number, 16> recent(cache);
+    auto elevation = [&] (long r, long c) -> DataType {
+        return recent.value(r, c);
+    };
+
+    if (!Statistics::detail::valid(elevation(start_row, start_column), nodata) || !Statistics::detail::valid(elevation(goal_row, goal_column), nodata)) {
+        return Path();
+    }
+
+    struct Node {
+        double g;
+        uint64_t parent;
+        bool closed;
+    };
+
+    std::unordered_map<uint64_t, Node> nodes;
+    detail::RadixHeap<uint64_t> open;
+
+    uint64_t source = static_cast<uint64_t>(start_row) * columns + start_column;
+    uint64_t target = static_cast<uint64_t>(goal_row) * columns + goal_column;
+
+    nodes[source] = {0, source, false};
+    open.push(heuristic(start_row, start_column), source);
+
+    while (!open.empty()) {
+        uint64_t id = open.pop().second;
+        Node& node = nodes[id];
+        if (node.closed) continue;
+        node.closed = true;
+
+        if (id == target) break;
+
+        long r = id / columns, c = id % columns;
+        double g = node.g;
+        double z = elevation(r, c);
+
+        for (int k = 0; k < 8; k++) {
+            long nr = r + detail::dr[k], nc = c + detail::dc[k];
+            if (nr < 0 || nc < 0 || nr >= rows || nc >= columns || !inside(nr, nc)) continue;
+
+            DataType to = elevation(nr, nc);
+            if (!Statistics::detail::valid(to, nodata)) continue;
+
+            double horizontal = k % 2 == 0
+                ? (detail::dr[k] == 0 ? (dx[r] + dx[nr]) / 2 : dy)
+                : std::hypot((dx[r] + dx[nr]) / 2, dy);
+
+            double step = cost(horizontal, z, static_cast<double>(to));
+            if (!std::isfinite(step)) continue;
+
+            uint64_t next = static_cast<uint64_t>(nr) * columns + nc;
+            auto [it, inserted] = nodes.try_emplace(next, Node{std::numeric_limits<double>::infinity(), id, false});
+            if (it->second.closed || g + step >= it->second.g) continue;
+
+            it->second.g = g + step;
+            it->second.parent = id;
+            open.push(g + step + heuristic(nr, nc), next);
+        }
+    }
+
+    auto reached = nodes.find(target);
+    if (reached == nodes.end() || !reached->second.closed) {
+        return Path();
+    }
+
+    Path path;
+    path.cost = reached->second.g;
+
+    std::vector<uint64_t> cells;
+    for (uint64_t id = target; ; id = nodes[id].parent) {
+        cells.push_back(id);
+        if (id == source) break;
+    }
+    std::reverse(cells.begin(), cells.end());
+
+    std::vector<double> xs(cells.size()), ys(cells.size());
+    for (size_t i = 0; i < cells.size(); i++) {
+        long r = cells[i] / columns, c = cells[i] % columns;
+        xs[i] = geotransform[0] + (c + 0.5) * geotransform[1];
+        ys[i] = geotransform[3] + (r + 0.5) * geotransform[5];
+    }
+    if (projected) {
+        Transform::detail::Exact(Transform::detail::Get(crs, wgs84), xs.data(), ys.data(), cells.size());
+    }
+
+    for (size_t i = 0; i < cells.size(); i++) {
+        long r = cells[i] / columns, c = cells[i] % columns;
+        path.points.push_back(Coordinate(static_cast<float>(ys[i]), static_cast<float>(xs[i])));
+
+        if (i > 0) {
+            long pr = cells[i - 1] / columns, pc = cells[i - 1] % columns;
+            path.distance += std::hypot((c - pc) * (dx[r] + dx[pr]) / 2, (r - pr) * dy);
+        }
+    }
+
+    return path;
+}
+
+
+// least cost path with its own block cache (of `cache_size` bytes)
+template <ValidDataType DataType, uint16_t raster_number, DataType no_data_fallback, typename Cost = SlopeCost>
+static Path Route(
+    const DEM<DataType, raster_number, no_data_fallback>& dem,
+    const Coordinate& start,
+    const Coordinate& goal,
+    const Cost& cost = Cost(),
+    double corridor = 0,
+    size_t cache_size = size_t(256) << 20
+) {
+    BlockCache<DataType, raster_number> cache(dem.get_dataset(), cache_size);
+    return Route(dem, cache, start, goal, cost, corridor);
+}
+
+}
+}
@@ -0,0 +1,564 @@
+/*
+GDEM : C++ wrapper over GDAL for working with DEM data.
+Copyright (C) 2024  Pritam Halder
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <https://www.gnu.org/licenses/>.
+
+Author : Pritam Halder
+Email : pritamhalder.portfolio@gmail.com
+*/
+
+#pragma once
+
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <filesystem>
+#include <fstream>
+#include <iostream>
+#include <limits>
+#include <map>
+#include <string>
+#include <system_error>
+#include <vector>
+
+#include <gdal/gdal_priv.h>
+
+#include "GDEM/Block.hpp"
+#include "GDEM/DEM.hpp"
+#include "GDEM/Parallel.hpp"
+#include "GDEM/Type.hpp"
+
+
+
+namespace GDEM {
+namespace Statistics {
+
+struct Histogram {
+    double minimum;                 // lower edge of the first bin
+    double maximum;                 // upper edge of the last bin (inclusive)
+    std::vector<uint64_t> counts;   // no. of values in every bin
+
+    Histogram()
+        : minimum(0),
+        maximum(0)
+    {};
+
+    Histogram(double minimum, double maximum, size_t bins)
+        : minimum(minimum),
+        maximum(maximum),
+        counts(bins, 0)
+    {};
+
+    Histogram(const Histogram& o) = default;
+    Histogram& operator=(const Histogram& o) = default;
+    Histogram(Histogram&& o) noexcept = default;
+    Histogram& operator=(Histogram&& o) noexcept = default;
+    ~Histogram() = default;
+
+    double width() const {
+        return this->maximum > this->minimum ? (this->maximum - this->minimum) / this->counts.size() : 1.0;
+    }
+
+    size_t bin(double value) const {
+        double b = (value - this->minimum) / this->width();
+        return std::min(static_cast<size_t>(std::max(b, 0.0)), this->counts.size() - 1);
+    }
+
+    uint64_t total() const {
+        uint64_t total = 0;
+        for (uint64_t count : this->counts) total += count;
+        return total;
+    }
+
+    // partial histograms (of different blocks, threads or datasets) over the same bins are merged by adding them
+    Histogram& merge(const Histogram& o) {
+        if (o.counts.size() != this->counts.size() || o.minimum != this->minimum || o.maximum != this->maximum) {
+            throw std::runtime_error("histograms with different bins can't be merged");
+        }
+
+        for (size_t i = 0; i < this->counts.size(); i++) {
+            this->counts[i] += o.counts[i];
+        }
+
+        return *this;
+    }
+
+    // percentile (0 - 100) linearly interpolated within the bin it falls in
+    double percentile(double p) const {
+        uint64_t total = this->total();
+        if (total == 0) {
+            return std::numeric_limits<double>::quiet_NaN();
+        }
+
+        double rank = std::clamp(p, 0.0, 100.0) / 100.0 * total;
+        uint64_t cumulative = 0;
+
+        for (size_t i = 0; i < this->counts.size(); i++) {
+            if (this->counts[i] > 0 && cumulative + this->counts[i] >= rank) {
+                double fraction = (rank - cumulative) / this->counts[i];
+                return this->minimum + (i + fraction) * this->width();
+            }
+            cumulative += this->counts[i];
+        }
+
+        return this->maximum;
+    }
+};
+
+
+
+struct Summary {
+    uint64_t count;                         // no. of valid values
+    uint64_t nodata_count;                  // no. of NODATA values
+    double minimum;
+    double maximum;
+    double sum;
+    double mean;
+    double stddev;                          // population standard deviation
+    std::map<double, double> percentiles;   // percentile (0 - 100) -> value
+    Histogram histogram;
+
+    Summary()
+        : count(0),
+        nodata_count(0),
+        minimum(std::numeric_limits<double>::quiet_NaN()),
+        maximum(std::numeric_limits<double>::quiet_NaN()),
+        sum(0),
+        mean(std::numeric_limits<double>::quiet_NaN()),
+        stddev(std::numeric_limits<double>::quiet_NaN())
+    {};
+
+    Summary(const Summary& o) = default;
+    Summary& operator=(const Summary& o) = default;
+    Summary(Summary&& o) noexcept = default;
+    Summary& operator=(Summary&& o) noexcept = default;
+    ~Summary() = default;
+
+    friend std::ostream& operator<<(std::ostream& os, const Summary& o) {
+        os
+            << "Count : " << o.count << "\n"
+            << "No Data Count : " << o.nodata_count << "\n"
+            << "Minimum : " << o.minimum << "\n"
+            << "Maximum : " << o.maximum << "\n"
+            << "Sum : " << o.sum << "\n"
+            << "Mean : " << o.mean << "\n"
+            << "Standard Deviation : " << o.stddev;
+
+        for (const auto& [p, value] : o.percentiles) {
+            os << "\n" << "Percentile (" << p << ") : " << value;
+        }
+
+        return os;
+    }
+};
+
+
+
+namespace detail {
+
+// count, mean & sum of squared deviations, merged with Chan et al.'s parallel variance formula
+struct Moments {
+    uint64_t count = 0;
+    uint64_t nodata_count = 0;
+    double mean = 0;
+    double m2 = 0;
+    double minimum = std::numeric_limits<double>::infinity();
+    double maximum = -std::numeric_limits<double>::infinity();
+
+    void merge(const Moments& o) {
+        this->nodata_count += o.nodata_count;
+        if (o.count == 0) return;
+
+        if (this->count == 0) {
+            uint64_t nodata_count = this->nodata_count;
+            *this = o;
+            this->nodata_count = nodata_count;
+            return;
+        }
+
+        double n = this->count + o.count;
+        double delta = o.mean - this->mean;
+
+        this->mean += delta * o.count / n;
+        this->m2 += o.m2 + delta * delta * (static_cast<double>(this->count) * o.count / n);
+        this->count += o.count;
+        this->minimum = std::min(this->minimum, o.minimum);
+        this->maximum = std::max(this->maximum, o.maximum);
+    }
+};
+
+
+template <ValidDataType DataType>
+static bool valid(DataType value, DataType nodata) {
+    if constexpr (std::is_floating_point_v<DataType>) {
+        return value == value && value != nodata;
+    } else {
+        return value != nodata;
+    }
+}
+
+
+// Nodata aware reduction of a block. The loops are branchless and accumulate into independent lanes
+// so that the compiler vectorizes them (floating point sums are not reassociated otherwise).
+template <ValidDataType DataType>
+static Moments Reduce(const DataType* values, size_t size, DataType nodata) {
+    constexpr size_t lanes = 8;
+
+    uint64_t counts[lanes] = {};
+    double sums[lanes] = {};
+    double minimums[lanes], maximums[lanes];
+    std::fill(minimums, minimums + lanes, std::numeric_limits<double>::infinity());
+    std::fill(maximums, maximums + lanes, -std::numeric_limits<double>::infinity());
+
+    size_t vectorized = size - size % lanes;
+
+    for (size_t i = 0; i < vectorized; i += lanes) {
+        for (size_t l = 0; l < lanes; l++) {
+            double value = values[i + l];
+            bool is_valid = valid(values[i + l], nodata);
+
+            counts[l] += is_valid;
+            sums[l] += is_valid ? value : 0.0;
+            minimums[l] = is_valid ? std::min(minimums[l], value) : minimums[l];
+            maximums[l] = is_valid ? std::max(maximums[l], value) : maximums[l];
+        }
+    }
+
+    for (size_t i = vectorized; i < size; i++) {
+        double value = values[i];
+        bool is_valid = valid(values[i], nodata);
+
+        counts[0] += is_valid;
+        sums[0] += is_valid ? value : 0.0;
+        minimums[0] = is_valid ? std::min(minimums[0], value) : minimums[0];
+        maximums[0] = is_valid ? std::max(maximums[0], value) : maximums[0];
+    }
+
+    Moments moments;
+    double sum = 0;
+    for (size_t l = 0; l < lanes; l++) {
+        moments.count += counts[l];
+        sum += sums[l];
+        moments.minimum = std::min(moments.minimum, minimums[l]);
+        moments.maximum = std::max(moments.maximum, maximums[l]);
+    }
+
+    moments.nodata_count = size - moments.count;
+    if (moments.count == 0) {
+        return moments;
+    }
+
+    // second pass over the (cached) block for the squared deviations, numerically stable
+    moments.mean = sum / moments.count;
+
+    double m2s[lanes] = {};
+    for (size_t i = 0; i < vectorized; i += lanes) {
+        for (size_t l = 0; l < lanes; l++) {
+            double deviation = valid(values[i + l], nodata) ? values[i + l] - moments.mean : 0.0;
+            m2s[l] += deviation * deviation;
+        }
+    }
+    for (size_t i = vectorized; i < size; i++) {
+        double deviation = valid(values[i], nodata) ? values[i] - moments.mean : 0.0;
+        m2s[0] += deviation * deviation;
+    }
+    for (size_t l = 0; l < lanes; l++) {
+        moments.m2 += m2s[l];
+    }
+
+    return moments;
+}
+
+
+static std::filesystem::path Sidecar(const std::filesystem::path& source_path) {
+    return std::filesystem::path(source_path.string() + ".gdem.stats");
+}
+
+
+static bool Load(
+    const std::filesystem::path& source_path, uint16_t raster_number, size_t bins,
+    const std::vector<double>& percentiles, Summary& summary
+) {
+    std::ifstream file(Sidecar(source_path));
+    if (!file) {
+        return false;
+    }
+
+    std::string header, key;
+    uintmax_t size;
+    long long time;
+    uint16_t raster;
+    size_t histogram_bins, percentile_count;
+
+    std::getline(file, header);
+    file >> key >> size >> key >> time >> key >> raster;
+    if (
+        !file
+        || header != "GDEM statistics"
+        || size != std::filesystem::file_size(source_path)
+        || time != std::filesystem::last_write_time(source_path).time_since_epoch().count()
+        || raster != raster_number
+    ) {
+        return false;
+    }
+
+    Summary loaded;
+    file
+        >> key >> loaded.count
+        >> key >> loaded.nodata_count
+        >> key >> loaded.minimum
+        >> key >> loaded.maximum
+        >> key >> loaded.mean
+        >> key >> loaded.stddev
+        >> key >> percentile_count;
+
+    for (size_t i = 0; i < percentile_count && file; i++) {
+        double p, value;
+        file >> p >> value;
+        loaded.percentiles[p] = value;
+    }
+
+    file >> key >> loaded.histogram.minimum >> loaded.histogram.maximum >> histogram_bins;
+    loaded.histogram.counts.resize(histogram_bins);
+    for (uint64_t& count : loaded.histogram.counts) {
+        file >> count;
+    }
+
+    if (!file || histogram_bins != bins) {
+        return false;
+    }
+    loaded.sum = loaded.count > 0 ? loaded.mean * loaded.count : 0;
+    for (double p : percentiles) {
+        if (!loaded.percentiles.contains(p)) return false;
+    }
+
+    summary = std::move(loaded);
+    return true;
+}
+
+
+static void Save(const std::filesystem::path& source_path, uint16_t raster_number, const Summary& summary) {
+    std::ofstream file(Sidecar(source_path));
+    if (!file) {
+        throw std::runtime_error("failed to write statistics sidecar '" + Sidecar(source_path).string() + "'");
+    }
+
+    file.precision(std::numeric_limits<double>::max_digits10);
+    file
+        << "GDEM statistics\n"
+        << "size " << std::filesystem::file_size(source_path) << "\n"
+        << "time " << std::filesystem::last_write_time(source_path).time_since_epoch().count() << "\n"
+        << "raster " << raster_number << "\n"
+        << "count " << summary.count << "\n"
+        << "nodata_count " << summary.nodata_count << "\n"
+        << "minimum " << summary.minimum << "\n"
+        << "maximum " << summary.maximum << "\n"
+        << "mean " << summary.mean << "\n"
+        << "stddev " << summary.stddev << "\n"
+        << "percentiles " << summary.percentiles.size() << "\n";
+
+    for (const auto& [p, value] : summary.percentiles) {
+        file << p << " " << value << "\n";
+    }
+
+    file << "histogram " << summary.histogram.minimum << " " << summary.histogram.maximum << " " << summary.histogram.counts.size() << "\n";
+    for (uint64_t count : summary.histogram.counts) {
+        file << count << " ";
+    }
+    file << "\n";
+}
+
+}
+
+
+
+// Computes the band statistics, histogram (of `bins` bins over [minimum, maximum]) and the requested
+// percentiles (0 - 100) by reducing the band's natural blocks across `threads` threads (0 = all).
+// 16 bit integer bands are reduced in a single pass into an exact per-value histogram, from which
+// the moments & exact percentiles are derived. Other bands take a moments pass and a histogram pass,
+// with percentiles interpolated from a fine (65536 bins) histogram.
+// With `sidecar`, results are persisted next to the dataset's file (`<file>.gdem.stats`) and reused
+// as long as the file is unchanged.
+template <ValidDataType DataType, uint16_t raster_number, DataType no_data_fallback>
+static Summary Compute(
+    const DEM<DataType, raster_number, no_data_fallback>& dem,
+    size_t bins = 256,
+    const std::vector<double>& percentiles = {25, 50, 75},
+    bool sidecar = false,
+    size_t threads = 0
+) {
+    if (bins == 0) {
+        throw std::runtime_error("histogram requires at least 1 bin");
+    }
+
+    GDALDataset *dataset = dem.get_dataset();
+    std::filesystem::path source_path = SourcePath(dataset);
+    sidecar = sidecar && !source_path.empty();
+
+    Summary summary;
+    summary.histogram = Histogram(0, 0, bins);
+    if (sidecar && detail::Load(source_path, raster_number, bins, percentiles, summary)) {
+        return summary;
+    }
+
+    BandReader<DataType, raster_number> reader(dataset);
+    std::vector<Window> windows = Blocks(reader.shared());
+    ThreadPool pool(threads);
+
+    DataType nodata = dem.type.nodata;
+
+    if constexpr (std::is_integral_v<DataType> && sizeof(DataType) <= 2) {
+        // exact single pass: one bin per representable value
+        constexpr size_t values = size_t(1) << (8 * sizeof(DataType));
+        constexpr double lowest = std::numeric_limits<DataType>::lowest();
+
+        std::vector<std::vector<uint64_t>> partials(pool.size(), std::vector<uint64_t>(values, 0));
+        std::vector<uint64_t> nodata_counts(pool.size(), 0);
+        std::vector<std::vector<DataType>> buffers(pool.size());
+
+        pool.parallel_for(windows.size(), [&] (size_t index, size_t worker) {
+            std::vector<DataType>& buffer = buffers[worker];
+            buffer.resize(windows[index].size());
+            reader.read(windows[index], buffer.data());
+
+            uint64_t *counts = partials[worker].data();
+            for (DataType value : buffer) {
+                counts[static_cast<size_t>(value - std::numeric_limits<DataType>::lowest())]++;
+            }
+        });
+
+        Histogram exact(lowest, lowest + values, values);
+        for (size_t worker = 0; worker < pool.size(); worker++) {
+            for (size_t i = 0; i < values; i++) {
+                exact.counts[i] += partials[worker][i];
+            }
+        }
+
+        size_t nodata_bin = static_cast<size_t>(nodata - std::numeric_limits<DataType>::lowest());
+        summary.nodata_count = exact.counts[nodata_bin];
+        exact.counts[nodata_bin] = 0;
+
+        double sum = 0;
+        for (size_t i = 0; i < values; i++) {
+            if (exact.counts[i] == 0) continue;
+
+            double value = lowest + i;
+            summary.count += exact.counts[i];
+            sum += value * exact.counts[i];
+            summary.minimum = summary.count == exact.counts[i] ? value : summary.minimum;
+            summary.maximum = value;
+        }
+
+        if (summary.count > 0) {
+            summary.sum = sum;
+            summary.mean = sum / summary.count;
+
+            double m2 = 0;
+            for (size_t i = 0; i < values; i++) {
+                double deviation = lowest + i - summary.mean;
+                m2 += deviation * deviation * exact.counts[i];
+            }
+            summary.stddev = std::sqrt(m2 / summary.count);
+
+            for (double p : percentiles) {
+                // nearest rank, exact for discrete values
+                uint64_t rank = std::max<uint64_t>(1, static_cast<uint64_t>(std::ceil(std::clamp(p, 0.0, 100.0) / 100.0 * summary.count)));
+                uint64_t cumulative = 0;
+                for (size_t i = 0; i < values; i++) {
+                    cumulative += exact.counts[i];
+                    if (cumulative >= rank) {
+                        summary.percentiles[p] = lowest + i;
+                        break;
+                    }
+                }
+            }
+
+            summary.histogram = Histogram(summary.minimum, summary.maximum, bins);
+            for (size_t i = 0; i < values; i++) {
+                if (exact.counts[i] > 0) {
+                    summary.histogram.counts[summary.histogram.bin(lowest + i)] += exact.counts[i];
+                }
+            }
+        }
+    } else {
+        // moments pass
+        std::vector<detail::Moments> moments(pool.size());
+        std::vector<std::vector<DataType>> buffers(pool.size());
+
+        pool.parallel_for(windows.size(), [&] (size_t index, size_t worker) {
+            std::vector<DataType>& buffer = buffers[worker];
+            buffer.resize(windows[index].size());
+            reader.read(windows[index], buffer.data());
+
+            moments[worker].merge(detail::Reduce(buffer.data(), buffer.size(), nodata));
+        });
+
+        detail::Moments total;
+        for (const detail::Moments& partial : moments) {
+            total.merge(partial);
+        }
+
+        summary.count = total.count;
+        summary.nodata_count = total.nodata_count;
+
+        if (summary.count > 0) {
+            summary.minimum = total.minimum;
+            summary.maximum = total.maximum;
+            summary.mean = total.mean;
+            summary.sum = total.mean * total.count;
+            summary.stddev = std::sqrt(total.m2 / total.count);
+
+            // histogram pass, the fine histogram is only used for the percentiles
+            constexpr size_t fine_bins = 65536;
+            std::vector<Histogram> coarse(pool.size(), Histogram(summary.minimum, summary.maximum, bins));
+            std::vector<Histogram> fine(pool.size(), Histogram(summary.minimum, summary.maximum, percentiles.empty() ? 1 : fine_bins));
+
+            pool.parallel_for(windows.size(), [&] (size_t index, size_t worker) {
+                std::vector<DataType>& buffer = buffers[worker];
+                buffer.resize(windows[index].size());
+                reader.read(windows[index], buffer.data());
+
+                Histogram& c = coarse[worker];
+                Histogram& f = fine[worker];
+                for (DataType value : buffer) {
+                    if (detail::valid(value, nodata)) {
+                        c.counts[c.bin(value)]++;
+                        f.counts[f.bin(value)]++;
+                    }
+                }
+            });
+
+            summary.histogram = coarse[0];
+            for (size_t worker = 1; worker < pool.size(); worker++) {
+                summary.histogram.merge(coarse[worker]);
+                fine[0].merge(fine[worker]);
+            }
+
+            for (double p : percentiles) {
+                summary.percentiles[p] = fine[0].percentile(p);
+            }
+        }
+    }
+
+    if (sidecar) {
+        detail::Save(source_path, raster_number, summary);
+    }
+
+    return summary;
+}
+
+}
+}
@@ -0,0 +1,518 @@
+/*
+GDEM : C++ wrapper over GDAL for working with DEM data.
+Copyright (C) 2024  Pritam Halder
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <https://www.gnu.org/licenses/>.
+
+Author : Pritam Halder
+Email : pritamhalder.portfolio@gmail.com
+*/
+
+#pragma once
+
+
+#include <algorithm>
+#include <array>
+#include <cmath>
+#include <cstdint>
+#include <filesystem>
+#include <limits>
+#include <map>
+#include <memory>
+#include <string>
+#include <system_error>
+#include <utility>
+#include <vector>
+
+#include <gdal/cpl_vsi.h>
+#include <gdal/gdal_priv.h>
+#include <gdal/gdal_utils.h>
+#include <gdal/ogr_spatialref.h>
+
+#include "GDEM/Block.hpp"
+#include "GDEM/DEM.hpp"
+#include "GDEM/Parallel.hpp"
+
+
+
+namespace GDEM {
+namespace Tiles {
+
+namespace detail {
+
+constexpr double origin = 20037508.342789244;  // half of the Web Mercator world extent (in meters)
+constexpr size_t grid = 16;                     // no. of exactly transformed cells (per axis) of a tile
+
+
+struct Tile {
+    int z;
+    int x;
+    int y;
+
+    Tile child(int dx, int dy) const {
+        return {this->z + 1, 2 * this->x + dx, 2 * this->y + dy};
+    }
+};
+
+
+// Renders the z/x/y Terrain-RGB pyramid of a raster band. Tiles of the maximum zoom are sampled from the
+// source, every lower zoom is downsampled from its (in-memory) children instead of re-reading the source.
+template <uint16_t raster_number>
+class Pyramid {
+private:
+    GDALDataset *dataset;
+    BandReader<float, raster_number> reader;
+    std::filesystem::path directory;
+    int min_zoom;
+    int max_zoom;
+    size_t tile_size;
+
+    double inverse_geotransform[6];
+    float nodata;
+    bool has_nodata;
+
+    OGRSpatialReference source_srs;
+    OGRSpatialReference mercator_srs;
+    std::vector<std::unique_ptr<OGRCoordinateTransformation, void(*)(OGRCoordinateTransformation*)>> transformations;
+
+    double min_x, min_y, max_x, max_y;  // source extent in Web Mercator
+
+    static double span(int z) {
+        return 2 * origin / static_cast<double>(1 << z);
+    }
+
+    // transformation from Web Mercator to the source, one per worker as they are not thread safe
+    OGRCoordinateTransformation* transformation(size_t worker) {
+        if (!this->transformations[worker]) {
+            this->transformations[worker].reset(OGRCreateCoordinateTransformation(&this->mercator_srs, &this->source_srs));
+            if (!this->transformations[worker]) {
+                throw std::runtime_error("failed to create coordinate transformations");
+            }
+        }
+
+        return this->transformations[worker].get();
+    }
+
+    std::vector<float> render(const Tile& tile, size_t worker) {
+        size_t n = this->tile_size;
+        double tile_span = span(tile.z);
+        double left = -origin + tile.x * tile_span;
+        double top = origin - tile.y * tile_span;
+
+        // exact transformation of a coarse grid only, pixels are interpolated in between
+        std::vector<double> xs, ys;
+        std::vector<int> success((grid + 1) * (grid + 1));
+        for (size_t gy = 0; gy <= grid; gy++) {
+            for (size_t gx = 0; gx <= grid; gx++) {
+                xs.push_back(left + tile_span * gx / grid);
+                ys.push_back(top - tile_span * gy / grid);
+            }
+        }
+
+        this->transformation(worker)->Transform(xs.size(), xs.data(), ys.data(), nullptr, success.data());
+
+        double window_min_x = std::numeric_limits<double>::max(), window_min_y = std::numeric_limits<double>::max();
+        double window_max_x = std::numeric_limits<double>::lowest(), window_max_y = std::numeric_limits<double>::lowest();
+        for (size_t i = 0; i < xs.size(); i++) {
+            if (!success[i]) {
+                return {};
+            }
+
+            double px, py;
+            GDALApplyGeoTransform(this->inverse_geotransform, xs[i], ys[i], &px, &py);
+            xs[i] = px;
+            ys[i] = py;
+
+            window_min_x = std::min(window_min_x, px);
+            window_min_y = std::min(window_min_y, py);
+            window_max_x = std::max(window_max_x, px);
+            window_max_y = std::max(window_max_y, py);
+        }
+
+        // source window under the tile, read at most at twice the tile's resolution
+        double columns = this->reader.columns(), rows = this->reader.rows();
+        window_min_x = std::clamp(std::floor(window_min_x) - 1, 0.0, columns);
+        window_min_y = std::clamp(std::floor(window_min_y) - 1, 0.0, rows);
+        window_max_x = std::clamp(std::ceil(window_max_x) + 1, 0.0, columns);
+        window_max_y = std::clamp(std::ceil(window_max_y) + 1, 0.0, rows);
+
+        if (window_max_x <= window_min_x || window_max_y <= window_min_y) {
+            return {};
+        }
+
+        Window window = {
+            static_cast<size_t>(window_min_y),
+            static_cast<size_t>(window_min_x),
+            static_cast<size_t>(window_max_y - window_min_y),
+            static_cast<size_t>(window_max_x - window_min_x)
+        };
+        size_t buffer_rows = std::min(window.rows, 2 * n);
+        size_t buffer_columns = std::min(window.columns, 2 * n);
+        double scale_y = static_cast<double>(buffer_rows) / window.rows;
+        double scale_x = static_cast<double>(buffer_columns) / window.columns;
+
+        std::vector<float> source(buffer_rows * buffer_columns);
+        this->reader.read(window, source.data(), buffer_rows, buffer_columns);
+        if (this->has_nodata) {
+            for (float& value : source) {
+                if (value == this->nodata) value = std::numeric_limits<float>::quiet_NaN();
+            }
+        }
+
+        auto at = [&] (long r, long c) -> float {
+            r = std::clamp<long>(r, 0, buffer_rows - 1);
+            c = std::clamp<long>(c, 0, buffer_columns - 1);
+            return source[r * buffer_columns + c];
+        };
+
+        std::vector<float> elevation(n * n, std::numeric_limits<float>::quiet_NaN());
+        for (size_t y = 0; y < n; y++) {
+            double gy = (y + 0.5) * grid / n;
+            size_t gy0 = std::min(static_cast<size_t>(gy), grid - 1);
+            double fy = gy - gy0;
+
+            for (size_t x = 0; x < n; x++) {
+                double gx = (x + 0.5) * grid / n;
+                size_t gx0 = std::min(static_cast<size_t>(gx), grid - 1);
+                double fx = gx - gx0;
+
+                size_t g = gy0 * (grid + 1) + gx0;
+                double px = (1 - fy) * ((1 - fx) * xs[g] + fx * xs[g + 1]) + fy * ((1 - fx) * xs[g + grid + 1] + fx * xs[g + grid + 2]);
+                double py = (1 - fy) * ((1 - fx) * ys[g] + fx * ys[g + 1]) + fy * ((1 - fx) * ys[g + grid + 1] + fx * ys[g + grid + 2]);
+
+                if (px < 0 || py < 0 || px >= columns || py >= rows) {
+                    continue;
+                }
+
+                // bilinear sample in the (decimated) source buffer
+                double sx = (px - window.column) * scale_x - 0.5;
+                double sy = (py - window.row) * scale_y - 0.5;
+                long c = static_cast<long>(std::floor(sx));
+                long r = static_cast<long>(std::floor(sy));
+                double dx = sx - c, dy = sy - r;
+
+                float m = at(r, c), o = at(r, c + 1), p = at(r + 1, c), q = at(r + 1, c + 1);
+                float value = (1 - dy) * ((1 - dx) * m + dx * o) + dy * ((1 - dx) * p + dx * q);
+
+                // fall back to the nearest value next to NODATA
+                elevation[y * n + x] = std::isnan(value) ? at(std::lround(sy), std::lround(sx)) : value;
+            }
+        }
+
+        return elevation;
+    }
+
+    std::vector<float> downsample(const std::array<std::vector<float>, 4>& children) const {
+        size_t n = this->tile_size, h = n / 2;
+        bool empty = true;
+        std::vector<float> elevation(n * n, std::numeric_limits<float>::quiet_NaN());
+
+        for (int dy = 0; dy < 2; dy++) {
+            for (int dx = 0; dx < 2; dx++) {
+                const std::vector<float>& child = children[dy * 2 + dx];
+                if (child.empty()) continue;
+                empty = false;
+
+                for (size_t y = 0; y < h; y++) {
+                    for (size_t x = 0; x < h; x++) {
+                        float sum = 0;
+                        int count = 0;
+                        for (size_t i = 0; i < 2; i++) {
+                            for (size_t j = 0; j < 2; j++) {
+                                float value = child[(2 * y + i) * n + 2 * x + j];
+                                if (!std::isnan(value)) {
+                                    sum += value;
+                                    count++;
+                                }
+                            }
+                        }
+
+                        if (count > 0) {
+                            elevation[(dy * h + y) * n + dx * h + x] = sum / count;
+                        }
+                    }
+                }
+            }
+        }
+
+        return empty ? std::vector<float>() : elevation;
+    }
+
+    // Mapbox Terrain-RGB : height = -10000 + (R * 256 * 256 + G * 256 + B) * 0.1, NODATA is encoded as 0
+    void write(const Tile& tile, const std::vector<float>& elevation) const {
+        if (std::all_of(elevation.begin(), elevation.end(), [] (float value) { return std::isnan(value); })) {
+            return;
+        }
+
+        size_t n = this->tile_size, size = n * n;
+        std::vector<GByte> rgb(3 * size);
+        for (size_t i = 0; i < size; i++) {
+            double height = std::isnan(elevation[i]) ? 0.0 : elevation[i];
+            uint32_t value = static_cast<uint32_t>(std::clamp(std::round((height + 10000.0) * 10.0), 0.0, 16777215.0));
+
+            rgb[i] = (value >> 16) & 0xFF;
+            rgb[size + i] = (value >> 8) & 0xFF;
+            rgb[2 * size + i] = value & 0xFF;
+        }
+
+        std::filesystem::path path = this->directory / std::to_string(tile.z) / std::to_string(tile.x);
+        std::error_code error;
+        std::filesystem::create_directories(path, error);
+        path /= std::to_string(tile.y) + ".png";
+
+        GDALDriverManager *manager = GetGDALDriverManager();
+        GDALDataset *memory = manager->GetDriverByName("MEM")->Create("", n, n, 3, GDT_Byte, nullptr);
+        if (memory == nullptr) {
+            throw std::runtime_error("failed to create tile dataset");
+        }
+
+        if (memory->RasterIO(GF_Write, 0, 0, n, n, rgb.data(), n, n, GDT_Byte, 3, nullptr, 1, n, size) != CE_None) {
+            GDALClose(memory);
+            throw std::runtime_error("failed to write tile data");
+        }
+
+        GDALDataset *png = manager->GetDriverByName("PNG")->CreateCopy(path.string().c_str(), memory, FALSE, nullptr, nullptr, nullptr);
+        GDALClose(memory);
+
+        if (png == nullptr) {
+            throw std::runtime_error("failed to write tile '" + path.string() + "'");
+        }
+        GDALClose(png);
+    }
+
+public:
+    Pyramid(GDALDataset* dataset, const std::filesystem::path& directory, int min_zoom, int max_zoom, size_t tile_size, size_t workers)
+        : dataset(dataset),
+        reader(dataset),
+        directory(directory),
+        min_zoom(min_zoom),
+        max_zoom(max_zoom),
+        tile_size(tile_size)
+    {
+        if (min_zoom < 0 || max_zoom > 24 || min_zoom > max_zoom) {
+            throw std::runtime_error("invalid zoom levels " + std::to_string(min_zoom) + " - " + std::to_string(max_zoom));
+        }
+        if (tile_size < 2 || tile_size % 2 != 0) {
+            throw std::runtime_error("invalid tile size " + std::to_string(tile_size));
+        }
+
+        double geotransform[6];
+        if (dataset->GetGeoTransform(geotransform) != CE_None || !GDALInvGeoTransform(geotransform, this->inverse_geotransform)) {
+            throw std::runtime_error("failed to read dataset transformations");
+        }
+
+        int success = 0;
+        this->nodata = dataset->GetRasterBand(raster_number)->GetNoDataValue(&success);
+        this->has_nodata = success;
+
+        // sources without a spatial reference are taken as WGS84
+        const OGRSpatialReference *srs = dataset->GetSpatialRef();
+        if (srs != nullptr) {
+            this->source_srs = *srs;
+        } else {
+            this->source_srs.importFromEPSG(4326);
+        }
+        this->mercator_srs.importFromEPSG(3857);
+        this->source_srs.SetAxisMappingStrategy(OAMS_TRADITIONAL_GIS_ORDER);
+        this->mercator_srs.SetAxisMappingStrategy(OAMS_TRADITIONAL_GIS_ORDER);
+
+        for (size_t i = 0; i < workers; i++) {
+            this->transformations.emplace_back(nullptr, OGRCoordinateTransformation::DestroyCT);
+        }
+
+        // Web Mercator extent from points sampled along the source's edges
+        OGRCoordinateTransformation *forward = OGRCreateCoordinateTransformation(&this->source_srs, &this->mercator_srs);
+        if (forward == nullptr) {
+            throw std::runtime_error("failed to create coordinate transformations");
+        }
+
+        std::vector<double> xs, ys;
+        constexpr int samples = 32;
+        double columns = dataset->GetRasterXSize(), rows = dataset->GetRasterYSize();
+        for (int i = 0; i <= samples; i++) {
+            double t = static_cast<double>(i) / samples;
+            for (auto [px, py] : {std::pair{t * columns, 0.0}, {t * columns, rows}, {0.0, t * rows}, {columns, t * rows}}) {
+                double x, y;
+                GDALApplyGeoTransform(geotransform, px, py, &x, &y);
+                if (this->source_srs.IsGeographic()) {
+                    y = std::clamp(y, -85.0511287798, 85.0511287798);
+                }
+                xs.push_back(x);
+                ys.push_back(y);
+            }
+        }
+
+        std::vector<int> transformed(xs.size());
+        forward->Transform(xs.size(), xs.data(), ys.data(), nullptr, transformed.data());
+        OGRCoordinateTransformation::DestroyCT(forward);
+
+        this->min_x = this->min_y = std::numeric_limits<double>::max();
+        this->max_x = this->max_y = std::numeric_limits<double>::lowest();
+        for (size_t i = 0; i < xs.size(); i++) {
+            if (!transformed[i]) continue;
+            this->min_x = std::min(this->min_x, xs[i]);
+            this->min_y = std::min(this->min_y, ys[i]);
+            this->max_x = std::max(this->max_x, xs[i]);
+            this->max_y = std::max(this->max_y, ys[i]);
+        }
+
+        if (this->min_x > this->max_x) {
+            throw std::runtime_error("dataset extent can't be represented in Web Mercator");
+        }
+    }
+
+    // tiles of the zoom level covering the source extent
+    std::vector<Tile> tiles(int z) const {
+        double tile_span = span(z);
+        int last = (1 << z) - 1;
+
+        int x0 = std::clamp(static_cast<int>(std::floor((this->min_x + origin) / tile_span)), 0, last);
+        int x1 = std::clamp(static_cast<int>(std::floor((this->max_x + origin) / tile_span)), 0, last);
+        int y0 = std::clamp(static_cast<int>(std::floor((origin - this->max_y) / tile_span)), 0, last);
+        int y1 = std::clamp(static_cast<int>(std::floor((origin - this->min_y) / tile_span)), 0, last);
+
+        std::vector<Tile> tiles;
+        for (int y = y0; y <= y1; y++) {
+            for (int x = x0; x <= x1; x++) {
+                tiles.push_back({z, x, y});
+            }
+        }
+
+        return tiles;
+    }
+
+    bool covers(const Tile& tile) const {
+        double tile_span = span(tile.z);
+        double left = -origin + tile.x * tile_span;
+        double top = origin - tile.y * tile_span;
+
+        return left <= this->max_x && left + tile_span >= this->min_x && top >= this->min_y && top - tile_span <= this->max_y;
+    }
+
+    // renders & writes the tile and its whole subtree, returns the tile's elevations (empty if NODATA only)
+    std::vector<float> build(const Tile& tile, size_t worker) {
+        if (!this->covers(tile)) {
+            return {};
+        }
+
+        std::vector<float> elevation;
+        if (tile.z == this->max_zoom) {
+            elevation = this->render(tile, worker);
+        } else {
+            std::array<std::vector<float>, 4> children;
+            for (int i = 0; i < 4; i++) {
+                children[i] = this->build(tile.child(i % 2, i / 2), worker);
+            }
+            elevation = this->downsample(children);
+        }
+
+        if (!elevation.empty()) {
+            this->write(tile, elevation);
+        }
+
+        return elevation;
+    }
+
+    // builds the tile from its already built children
+    std::vector<float> build(const Tile& tile, const std::map<std::pair<int, int>, std::vector<float>>& built) {
+        std::array<std::vector<float>, 4> children;
+        for (int i = 0; i < 4; i++) {
+            Tile child = tile.child(i % 2, i / 2);
+            auto it = built.find({child.x, child.y});
+            if (it != built.end()) children[i] = it->second;
+        }
+
+        std::vector<float> elevation = this->downsample(children);
+        if (!elevation.empty()) {
+            this->write(tile, elevation);
+        }
+
+        return elevation;
+    }
+};
+
+}
+
+
+
+// Exports the DEM as a z/x/y pyramid of Mapbox Terrain-RGB PNG tiles (`<directory>/<z>/<x>/<y>.png`) in
+// Web Mercator. Subtrees of tiles are built in parallel on a work queue of `threads` threads (0 = all),
+// every subtree samples the source only at `max_zoom` and downsamples the lower zoom levels from it.
+template <uint16_t raster_number = 1>
+static void Export(GDALDataset* dataset, const std::filesystem::path& directory, int min_zoom, int max_zoom, size_t threads = 0, size_t tile_size = 256) {
+    if (dataset == nullptr) {
+        throw std::runtime_error("dataset provided is NULL");
+    }
+
+    GDALRegister_MEM();
+    GDALRegister_PNG();
+
+    ThreadPool pool(threads);
+    detail::Pyramid<raster_number> pyramid(dataset, directory, min_zoom, max_zoom, tile_size, pool.size());
+
+    // subtrees are split at the first zoom level with enough tiles to keep every thread busy
+    int split = min_zoom;
+    while (split < max_zoom && pyramid.tiles(split).size() < 4 * pool.size()) {
+        split++;
+    }
+
+    std::vector<detail::Tile> roots = pyramid.tiles(split);
+    std::vector<std::vector<float>> elevations(roots.size());
+    pool.parallel_for(roots.size(), [&] (size_t index, size_t worker) {
+        elevations[index] = pyramid.build(roots[index], worker);
+    });
+
+    // the few zoom levels above the split are built from the subtrees' roots
+    std::map<std::pair<int, int>, std::vector<float>> built;
+    if (split > min_zoom) {
+        for (size_t i = 0; i < roots.size(); i++) {
+            if (!elevations[i].empty()) built[{roots[i].x, roots[i].y}] = std::move(elevations[i]);
+        }
+    }
+
+    for (int z = split - 1; z >= min_zoom; z--) {
+        std::map<std::pair<int, int>, std::vector<float>> parents;
+        for (const detail::Tile& tile : pyramid.tiles(z)) {
+            std::vector<float> elevation = pyramid.build(tile, built);
+            if (!elevation.empty()) parents[{tile.x, tile.y}] = std::move(elevation);
+        }
+        built = std::move(parents);
+    }
+}
+
+
+template <ValidDataType DataType, uint16_t raster_number, DataType no_data_fallback>
+static void Export(const DEM<DataType, raster_number, no_data_fallback>& dem, const std::filesystem::path& directory, int min_zoom, int max_zoom, size_t threads = 0, size_t tile_size = 256) {
+    Export<raster_number>(dem.get_dataset(), directory, min_zoom, max_zoom, threads, tile_size);
+}
+
+
+// exports the mosaic of the DEM files (later files take priority where they overlap)
+static void Export(const std::vector<std::string>& source_filepaths, const std::filesystem::path& directory, int min_zoom, int max_zoom, size_t threads = 0, size_t tile_size = 256) {
+    Mosaic mosaic(source_filepaths);
+    Export(mosaic.get_dataset(), directory, min_zoom, max_zoom, threads, tile_size);
+}
+
+
+static void Export(const std::vector<std::filesystem::path>& source_filepaths, const std::filesystem::path& directory, int min_zoom, int max_zoom, size_t threads = 0, size_t tile_size = 256) {
+    std::vector<std::string> source_filepaths_s;
+    for (const std::filesystem::path& path : source_filepaths) {
+        source_filepaths_s.push_back(path.string());
+    }
+
+    Export(source_filepaths_s, directory, min_zoom, max_zoom, threads, tile_size);
+}
+
+}
+}
@@ -0,0 +1,426 @@
+/*
+GDEM : C++ wrapper over GDAL for working with DEM data.
+Copyright (C) 2024  Pritam Halder
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <https://www.gnu.org/licenses/>.
+
+Author : Pritam Halder
+Email : pritamhalder.portfolio@gmail.com
+*/
+
+#pragma once
+
+
+#include <algorithm>
+#include <array>
+#include <cmath>
+#include <cstdint>
+#include <deque>
+#include <limits>
+#include <memory>
+#include <mutex>
+#include <stdexcept>
+#include <string>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+#include <gdal/gdal.h>
+#include <gdal/ogr_spatialref.h>
+
+
+
+namespace GDEM {
+namespace Transform {
+
+namespace detail {
+
+struct Destroy {
+    void operator()(OGRCoordinateTransformation* transformation) const {
+        OGRCoordinateTransformation::DestroyCT(transformation);
+    }
+};
+
+
+// coordinate system definitions by id
+struct Registry {
+    std::mutex mutex;
+    std::unordered_map<std::string, size_t> ids;
+    std::deque<std::string> definitions;
+};
+
+// (`inline` so that every translation unit shares the registry)
+inline Registry& Definitions() {
+    static Registry registry;
+    return registry;
+}
+
+
+// Id of a coordinate system definition, the same for equal definitions. Transformations are cached by ids rather
+// than by the definitions (which can be kilobytes of WKT), objects transforming repeatedly intern theirs once.
+inline size_t Intern(const std::string& definition) {
+    Registry& registry = Definitions();
+    std::lock_guard<std::mutex> lock(registry.mutex);
+
+    auto [it, inserted] = registry.ids.try_emplace(definition, registry.definitions.size());
+    if (inserted) {
+        registry.definitions.push_back(definition);
+    }
+    return it->second;
+}
+
+
+// id of "EPSG:4326"
+inline size_t WGS84() {
+    static const size_t id = Intern("EPSG:4326");
+    return id;
+}
+
+
+// One transformation per (source, target) pair of interned coordinate systems, created once per thread
+// (transformations aren't thread safe). Coordinate systems are anything `OGRSpatialReference::SetFromUserInput`
+// accepts (e.g. "EPSG:32643", WKT), always in (x, y) / (longitude, latitude) order.
+inline OGRCoordinateTransformation* Get(size_t source, size_t target) {
+    thread_local std::unordered_map<uint64_t, std::unique_ptr<OGRCoordinateTransformation, Destroy>> cache;
+
+    uint64_t key = (static_cast<uint64_t>(source) << 32) | target;
+    auto it = cache.find(key);
+    if (it != cache.end()) {
+        return it->second.get();
+    }
+
+    std::string source_definition, target_definition;
+    {
+        Registry& registry = Definitions();
+        std::lock_guard<std::mutex> lock(registry.mutex);
+        source_definition = registry.definitions.at(source);
+        target_definition = registry.definitions.at(target);
+    }
+
+    OGRSpatialReference source_srs, target_srs;
+    if (
+        source_srs.SetFromUserInput(source_definition.c_str()) != OGRERR_NONE
+        || target_srs.SetFromUserInput(target_definition.c_str()) != OGRERR_NONE
+    ) {
+        throw std::runtime_error("invalid coordinate system");
+    }
+    source_srs.SetAxisMappingStrategy(OAMS_TRADITIONAL_GIS_ORDER);
+    target_srs.SetAxisMappingStrategy(OAMS_TRADITIONAL_GIS_ORDER);
+
+    OGRCoordinateTransformation *transformation = OGRCreateCoordinateTransformation(&source_srs, &target_srs);
+    if (transformation == nullptr) {
+        throw std::runtime_error("failed to create coordinate transformation");
+    }
+
+    cache.emplace(key, std::unique_ptr<OGRCoordinateTransformation, Destroy>(transformation));
+    return transformation;
+}
+
+
+// transformation between coordinate systems given by their definitions, interned on every call
+static OGRCoordinateTransformation* Get(const std::string& source, const std::string& target) {
+    return Get(Intern(source), Intern(target));
+}
+
+
+// exact transformation in place, failed points become NaN
+static void Exact(OGRCoordinateTransformation* transformation, double* xs, double* ys, size_t count) {
+    std::vector<int> success(count, FALSE);
+    transformation->Transform(count, xs, ys, nullptr, success.data());
+
+    for (size_t i = 0; i < count; i++) {
+        if (!success[i]) {
+            xs[i] = ys[i] = std::numeric_limits<double>::quiet_NaN();
+        }
+    }
+}
+
+
+// Regular (n + 1) x (n + 1) grid of nodes over [min_x, min_x + n * step_x] x [min_y, min_y + n * step_y] holding
+// transformed coordinates (`u`, `v`) of its nodes, bilinearly interpolated in between (clamped to the grid).
+struct Grid {
+    size_t n;
+    double min_x;
+    double min_y;
+    double step_x;
+    double step_y;
+    std::vector<double> u;
+    std::vector<double> v;
+
+    Grid()
+        : n(0), min_x(0), min_y(0), step_x(1), step_y(1)
+    {};
+
+    Grid(size_t n, double min_x, double min_y, double max_x, double max_y)
+        : n(n),
+        min_x(min_x),
+        min_y(min_y),
+        step_x(max_x > min_x ? (max_x - min_x) / n : 1),
+        step_y(max_y > min_y ? (max_y - min_y) / n : 1),
+        u((n + 1) * (n + 1)),
+        v((n + 1) * (n + 1))
+    {};
+
+    Grid(const Grid& o) = default;
+    Grid& operator=(const Grid& o) = default;
+    Grid(Grid&& o) noexcept = default;
+    Grid& operator=(Grid&& o) noexcept = default;
+    ~Grid() = default;
+
+    double x(double column) const {
+        return this->min_x + column * this->step_x;
+    }
+
+    double y(double row) const {
+        return this->min_y + row * this->step_y;
+    }
+
+    void interpolate(double x, double y, double& u, double& v) const {
+        double fx = std::clamp((x - this->min_x) / this->step_x, 0.0, static_cast<double>(this->n));
+        double fy = std::clamp((y - this->min_y) / this->step_y, 0.0, static_cast<double>(this->n));
+        size_t c = std::min(static_cast<size_t>(fx), this->n - 1), r = std::min(static_cast<size_t>(fy), this->n - 1);
+        double tx = fx - c, ty = fy - r;
+
+        size_t a = r * (this->n + 1) + c, b = a + 1, d = a + this->n + 1, e = d + 1;
+        u = (this->u[a] * (1 - tx) + this->u[b] * tx) * (1 - ty) + (this->u[d] * (1 - tx) + this->u[e] * tx) * ty;
+        v = (this->v[a] * (1 - tx) + this->v[b] * tx) * (1 - ty) + (this->v[d] * (1 - tx) + this->v[e] * tx) * ty;
+    }
+};
+
+
+// Interpolation errors are sampled, not bounded : grids are accepted once the largest error measured is within
+// the allowed error divided by this, covering the error peaking between the sampled points.
+static constexpr double error_margin = 2;
+
+
+// Builds `grid` from `transform(xs, ys, count)` (in place) at its nodes and returns the largest interpolation error
+// at the grid cells' centers & edge midpoints, among the points accepted by `checked(exact u, exact v, interpolated u,
+// interpolated v)`. A point transforming to NaN on one side only counts as an infinite error.
+template <typename Function, typename Check>
+static double Build(Grid& grid, Function&& transform, Check&& checked) {
+    size_t n = grid.n;
+
+    for (size_t r = 0; r <= n; r++) {
+        for (size_t c = 0; c <= n; c++) {
+            grid.u[r * (n + 1) + c] = grid.x(c);
+            grid.v[r * (n + 1) + c] = grid.y(r);
+        }
+    }
+    transform(grid.u.data(), grid.v.data(), grid.u.size());
+
+    // every point of the half cell lattice but the nodes (interpolated exactly)
+    std::vector<double> sx, sy, eu, ev;
+    for (size_t i = 0; i <= 2 * n; i++) {
+        for (size_t j = i % 2 == 0 ? 1 : 0; j <= 2 * n; j += i % 2 == 0 ? 2 : 1) {
+            sx.push_back(grid.x(j / 2.0));
+            sy.push_back(grid.y(i / 2.0));
+        }
+    }
+    eu = sx;
+    ev = sy;
+    transform(eu.data(), ev.data(), eu.size());
+
+    double error = 0;
+    for (size_t k = 0; k < sx.size(); k++) {
+        double u, v;
+        grid.interpolate(sx[k], sy[k], u, v);
+
+        bool exact = std::isfinite(eu[k]) && std::isfinite(ev[k]), interpolated = std::isfinite(u) && std::isfinite(v);
+        if (!exact && !interpolated) continue;
+        if (!checked(eu[k], ev[k], u, v)) continue;
+        error = exact != interpolated ? std::numeric_limits<double>::infinity() : std::max(error, std::hypot(u - eu[k], v - ev[k]));
+    }
+
+    return error;
+}
+
+
+// Approximate transformation in place : exact transformations on a grid over the points' extent, bilinearly
+// interpolated in between. The grid is refined until its sampled error is within half of `tolerance` (target units),
+// falls back to exact when it never is (or there are too few points for a grid to pay off).
+static void Approximate(OGRCoordinateTransformation* transformation, double* xs, double* ys, size_t count, double tolerance) {
+    double min_x = std::numeric_limits<double>::infinity(), max_x = -min_x, min_y = min_x, max_y = -min_x;
+    for (size_t i = 0; i < count; i++) {
+        if (!std::isfinite(xs[i]) || !std::isfinite(ys[i])) continue;
+        min_x = std::min(min_x, xs[i]);
+        max_x = std::max(max_x, xs[i]);
+        min_y = std::min(min_y, ys[i]);
+        max_y = std::max(max_y, ys[i]);
+    }
+
+    auto exact = [transformation] (double* u, double* v, size_t size) {
+        Exact(transformation, u, v, size);
+    };
+    auto all = [] (double, double, double, double) {
+        return true;
+    };
+
+    for (size_t n = 16; n <= 256 && min_x <= max_x && count >= 4 * (n + 1) * (n + 1); n *= 2) {
+        Grid grid(n, min_x, min_y, max_x, max_y);
+        if (Build(grid, exact, all) * error_margin <= tolerance) {
+            for (size_t i = 0; i < count; i++) {
+                if (!std::isfinite(xs[i]) || !std::isfinite(ys[i])) continue;
+                grid.interpolate(xs[i], ys[i], xs[i], ys[i]);
+            }
+            return;
+        }
+    }
+
+    Exact(transformation, xs, ys, count);
+}
+
+
+// geographic extent {min longitude, min latitude, max longitude, max latitude} of a raster in `projection`,
+// from its edges (sampled at every `rows / 64`, `columns / 64` pixels) transformed to WGS84
+static std::array<double, 4> Extent(const std::string& projection, const std::array<double, 6>& geotransform, size_t rows, size_t columns) {
+    std::vector<double> xs, ys;
+    auto add = [&] (double row, double column) {
+        xs.push_back(geotransform[0] + column * geotransform[1] + row * geotransform[2]);
+        ys.push_back(geotransform[3] + column * geotransform[4] + row * geotransform[5]);
+    };
+    for (size_t i = 0; i <= 64; i++) {
+        add(0, columns * i / 64.0);
+        add(rows, columns * i / 64.0);
+        add(rows * i / 64.0, 0);
+        add(rows * i / 64.0, columns);
+    }
+
+    Exact(Get(projection, "EPSG:4326"), xs.data(), ys.data(), xs.size());
+
+    std::array<double, 4> extent = {
+        std::numeric_limits<double>::infinity(), std::numeric_limits<double>::infinity(),
+        -std::numeric_limits<double>::infinity(), -std::numeric_limits<double>::infinity()
+    };
+    for (size_t i = 0; i < xs.size(); i++) {
+        if (!std::isfinite(xs[i]) || !std::isfinite(ys[i])) continue;
+        extent[0] = std::min(extent[0], xs[i]);
+        extent[1] = std::min(extent[1], ys[i]);
+        extent[2] = std::max(extent[2], xs[i]);
+        extent[3] = std::max(extent[3], ys[i]);
+    }
+
+    if (extent[0] > extent[2]) {
+        throw std::runtime_error("failed to compute geographic extent");
+    }
+
+    return extent;
+}
+
+}
+
+
+
+// Transforms the points (`xs[i]`, `ys[i]`) in place from the `source` to the `target` coordinate system, with
+// `tolerance` > 0 allowing an approximate (interpolated) transformation with errors up to `tolerance` target units.
+// Points failing to transform become NaN.
+static void Points(const std::string& source, const std::string& target, std::vector<double>& xs, std::vector<double>& ys, double tolerance = 0) {
+    if (xs.size() != ys.size()) {
+        throw std::runtime_error("coordinate arrays of different sizes");
+    }
+
+    OGRCoordinateTransformation *transformation = detail::Get(source, target);
+
+    if (tolerance > 0) {
+        detail::Approximate(transformation, xs.data(), ys.data(), xs.size(), tolerance);
+    } else {
+        detail::Exact(transformation, xs.data(), ys.data(), xs.size());
+    }
+}
+
+
+
+// Precomputed WGS84 (latitude, longitude) to pixel (row, column) lookup of a raster in a projected coordinate system:
+// exact transformations on a grid over the raster's geographic extent, bilinearly interpolated in between. The grid
+// is refined (up to `max_size` cells a side) until the pixel error measured at its cells' centers & edge midpoints is
+// within half of `max_error`, otherwise construction fails. The error is sampled, not bounded in between.
+class Lookup {
+private:
+    detail::Grid grid;          // (longitude, latitude) -> (column, row)
+    size_t rows;
+    size_t columns;
+    double measured_error;
+
+public:
+    Lookup(const std::string& projection, const std::array<double, 6>& geotransform, size_t rows, size_t columns, double max_error = 0.125, size_t max_size = 1024)
+        : rows(rows),
+        columns(columns),
+        measured_error(std::numeric_limits<double>::infinity())
+    {
+        std::array<double, 6> inverse;
+        if (!GDALInvGeoTransform(geotransform.data(), inverse.data())) {
+            throw std::runtime_error("failed to invert dataset transformations");
+        }
+
+        std::array<double, 4> extent = detail::Extent(projection, geotransform, rows, columns);
+        OGRCoordinateTransformation *transformation = detail::Get("EPSG:4326", projection);
+
+        auto pixels = [&] (double* u, double* v, size_t size) {
+            detail::Exact(transformation, u, v, size);
+            for (size_t i = 0; i < size; i++) {
+                double x = u[i], y = v[i];
+                u[i] = inverse[0] + x * inverse[1] + y * inverse[2];
+                v[i] = inverse[3] + x * inverse[4] + y * inverse[5];
+            }
+        };
+        // only the error over the raster (and a pixel around it) matters
+        auto inside = [rows, columns] (double ec, double er, double c, double r) {
+            auto within = [rows, columns] (double c, double r) {
+                return c >= -1 && c <= columns + 1.0 && r >= -1 && r <= rows + 1.0;
+            };
+            return within(ec, er) || within(c, r);
+        };
+
+        for (size_t n = 8; n <= max_size; n *= 2) {
+            this->grid = detail::Grid(n, extent[0], extent[1], extent[2], extent[3]);
+            this->measured_error = detail::Build(this->grid, pixels, inside);
+            if (this->measured_error * detail::error_margin <= max_error) {
+                return;
+            }
+        }
+
+        throw std::runtime_error("lookup grid exceeds the maximum pixel error");
+    }
+
+    Lookup(const Lookup& o) = default;
+    Lookup& operator=(const Lookup& o) = default;
+    Lookup(Lookup&& o) noexcept = default;
+    Lookup& operator=(Lookup&& o) noexcept = default;
+    ~Lookup() = default;
+
+    // pixel (row, column) of the coordinates, false outside the raster
+    bool pixel(double latitude, double longitude, double& row, double& column) const {
+        if (
+            !(longitude >= this->grid.x(0) && longitude <= this->grid.x(this->grid.n)
+            && latitude >= this->grid.y(0) && latitude <= this->grid.y(this->grid.n))
+        ) {
+            return false;
+        }
+
+        this->grid.interpolate(longitude, latitude, column, row);
+        return row >= 0 && row <= this->rows && column >= 0 && column <= this->columns;
+    }
+
+    // largest pixel error measured while building the grid
+    double error() const {
+        return this->measured_error;
+    }
+
+    // grid cells a side
+    size_t size() const {
+        return this->grid.n;
+    }
+};
+
+}
+}
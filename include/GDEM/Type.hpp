@@ -49,6 +49,21 @@ concept ValidDataType =
 
 namespace GDEM {
 
+// GDAL data type of a buffer holding `DataType` values (used as the buffer type of raster IO)
+template <typename DataType> requires std::is_arithmetic_v<DataType>
+constexpr GDALDataType BufferType() {
+    if constexpr (std::is_floating_point_v<DataType>) {
+        static_assert(sizeof(DataType) == 4 || sizeof(DataType) == 8, "unsupported floating point type");
+        return sizeof(DataType) == 4 ? GDT_Float32 : GDT_Float64;
+    } else if constexpr (std::is_signed_v<DataType>) {
+        return sizeof(DataType) == 1 ? GDT_Int8 : sizeof(DataType) == 2 ? GDT_Int16 : sizeof(DataType) == 4 ? GDT_Int32 : GDT_Int64;
+    } else {
+        return sizeof(DataType) == 1 ? GDT_Byte : sizeof(DataType) == 2 ? GDT_UInt16 : sizeof(DataType) == 4 ? GDT_UInt32 : GDT_UInt64;
+    }
+}
+
+
+
 template <
     ValidDataType DataType,
     uint16_t raster_number = 1,
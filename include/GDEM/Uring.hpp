@@ -0,0 +1,306 @@
+/*
+GDEM : C++ wrapper over GDAL for working with DEM data.
+Copyright (C) 2024  Pritam Halder
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <https://www.gnu.org/licenses/>.
+
+Author : Pritam Halder
+Email : pritamhalder.portfolio@gmail.com
+*/
+
+#pragma once
+
+// only with the `GDEM_WITH_IO_URING` CMake option (Linux, liburing)
+#ifdef GDEM_WITH_IO_URING
+
+
+#include <algorithm>
+#include <cerrno>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <future>
+#include <mutex>
+#include <stdexcept>
+#include <string>
+#include <thread>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+#include <fcntl.h>
+#include <liburing.h>
+#include <unistd.h>
+
+
+
+namespace GDEM {
+namespace detail {
+
+// read of `length` bytes at `offset` of a file into `destination`
+struct Segment {
+    uint64_t offset;
+    size_t length;
+    void *destination;
+};
+
+
+// Batched asynchronous file reads over io_uring. Reads requested from any number of threads queue up while the
+// previous batch is in flight and are then submitted together by the ring's thread (a ring's worth of reads per
+// submission), which resolves every request's future once all its segments completed. Reads land in buffers owned by
+// the ring and are copied to their destinations once complete, so that a failing ring never leaves the kernel
+// writing into memory its caller already released. With `direct`, files are opened with O_DIRECT (buffered where the
+// file system doesn't support it) and the buffers are aligned.
+class Uring {
+private:
+    static constexpr size_t alignment = 4096;
+    static constexpr int max_refusals = 10;        // backed off submissions (out of kernel resources) before failing
+
+    struct Request {
+        std::string path;
+        bool keep;                          // keeps the file open for later requests
+        std::vector<Segment> segments;
+        std::promise<bool> done;
+    };
+
+    struct Read {
+        size_t request;
+        const Segment *segment;
+        int descriptor;
+        uint64_t start;                     // aligned down from the segment's offset with O_DIRECT
+        size_t length;
+        void *buffer;                       // owned by the ring (aligned with O_DIRECT), leaked while the kernel has it
+        int result;
+        bool pending;                       // submitted (or about to be) and not reaped yet
+    };
+
+    io_uring ring;
+    unsigned entries;
+    bool direct;
+    bool broken;                            // a submission or wait failed for good, later reads fail right away
+    std::unordered_map<std::string, int> files;
+
+    std::vector<Request> queue;
+    std::thread worker;
+    std::mutex mutex;
+    std::condition_variable available;
+    bool stopping;
+
+    int open(const std::string& path, bool keep) {
+        auto it = keep ? this->files.find(path) : this->files.end();
+        if (it != this->files.end()) {
+            return it->second;
+        }
+
+        int descriptor = -1;
+        if (this->direct) {
+            descriptor = ::open(path.c_str(), O_RDONLY | O_CLOEXEC | O_DIRECT);
+        }
+        if (descriptor < 0) {
+            descriptor = ::open(path.c_str(), O_RDONLY | O_CLOEXEC);
+        }
+
+        if (keep && descriptor >= 0) {
+            this->files.emplace(path, descriptor);
+        }
+        return descriptor;
+    }
+
+    void process(std::vector<Request>& batch) {
+        std::vector<int> descriptors(batch.size());
+        std::vector<bool> succeeded(batch.size(), true);
+        std::vector<Read> reads;
+
+        for (size_t i = 0; i < batch.size(); i++) {
+            descriptors[i] = this->broken ? -1 : this->open(batch[i].path, batch[i].keep);
+            if (descriptors[i] < 0) {
+                succeeded[i] = false;
+                continue;
+            }
+
+            for (const Segment& segment : batch[i].segments) {
+                Read read = {i, &segment, descriptors[i], segment.offset, segment.length, nullptr, -1, false};
+                if (this->direct) {
+                    read.start = segment.offset / alignment * alignment;
+                    read.length = (segment.offset + segment.length - read.start + alignment - 1) / alignment * alignment;
+                    read.buffer = std::aligned_alloc(alignment, read.length);
+                } else {
+                    read.buffer = std::malloc(std::max<size_t>(1, read.length));
+                }
+                reads.push_back(read);
+            }
+        }
+
+        for (size_t first = 0; first < reads.size() && !this->broken; first += this->entries) {
+            size_t last = std::min<size_t>(reads.size(), first + this->entries);
+
+            size_t prepared = 0;
+            for (size_t k = first; k < last; k++) {
+                io_uring_sqe *sqe = io_uring_get_sqe(&this->ring);
+                if (sqe == nullptr || reads[k].buffer == nullptr) continue;
+
+                io_uring_prep_read(sqe, reads[k].descriptor, reads[k].buffer, reads[k].length, reads[k].start);
+                io_uring_sqe_set_data64(sqe, k);
+                reads[k].pending = true;
+                prepared++;
+            }
+
+            // Every read is reaped before its buffer is freed, the kernel writing into it until then. Interrupted
+            // submissions & waits are retried; refused ones (out of kernel resources) are retried after reaping the
+            // reads in flight, or with nothing in flight after a growing back off, `max_refusals` times. Any other
+            // failure (or nothing submitted with nothing in flight) leaves the ring unusable : its unreaped reads fail
+            // and their buffers are never freed.
+            size_t submitted = 0, reaped = 0;
+            int refusals = 0;
+            auto back_off = [&refusals] () {
+                if (refusals >= max_refusals) return false;
+                std::this_thread::sleep_for(std::chrono::microseconds(100) * (1 << refusals++));
+                return true;
+            };
+
+            while (reaped < prepared) {
+                if (submitted < prepared) {
+                    int result = io_uring_submit(&this->ring);
+                    bool refused = result == -EAGAIN || result == -EBUSY || result == 0;
+
+                    if (result > 0) {
+                        submitted += result;
+                        refusals = 0;
+                    } else if (result == -EINTR || (refused && reaped < submitted)) {
+                        // retried (after a wait, when reads are in flight)
+                    } else if (result != 0 && refused && back_off()) {
+                        continue;
+                    } else {
+                        this->broken = true;
+                        break;
+                    }
+                }
+                if (reaped == submitted) continue;
+
+                io_uring_cqe *cqe;
+                int error = io_uring_wait_cqe(&this->ring, &cqe);
+                if (error == -EINTR || (error == -EAGAIN && back_off())) continue;
+                if (error < 0) {
+                    this->broken = true;
+                    break;
+                }
+
+                Read& read = reads[io_uring_cqe_get_data64(cqe)];
+                read.result = cqe->res;
+                read.pending = false;
+                io_uring_cqe_seen(&this->ring, cqe);
+                reaped++;
+                refusals = 0;
+            }
+        }
+
+        for (Read& read : reads) {
+            uint64_t skip = read.segment->offset - read.start;
+            bool complete = !read.pending && read.result >= 0 && static_cast<uint64_t>(read.result) >= skip + read.segment->length;
+            succeeded[read.request] = succeeded[read.request] && complete;
+
+            // (pending reads keep their buffers, but never their destinations)
+            if (read.buffer != nullptr && !read.pending) {
+                if (complete) {
+                    std::memcpy(read.segment->destination, static_cast<char*>(read.buffer) + skip, read.segment->length);
+                }
+                std::free(read.buffer);
+            }
+        }
+
+        for (size_t i = 0; i < batch.size(); i++) {
+            if (descriptors[i] >= 0 && !batch[i].keep) {
+                ::close(descriptors[i]);
+            }
+            batch[i].done.set_value(succeeded[i]);
+        }
+    }
+
+    void work() {
+        while (true) {
+            std::vector<Request> batch;
+
+            {
+                std::unique_lock<std::mutex> lock(this->mutex);
+                this->available.wait(lock, [this] () { return this->stopping || !this->queue.empty(); });
+
+                if (this->stopping && this->queue.empty()) {
+                    return;
+                }
+
+                std::swap(batch, this->queue);
+            }
+
+            this->process(batch);
+        }
+    }
+
+public:
+    // `entries` reads in flight at most (the submission queue size)
+    Uring(unsigned entries = 256, bool direct = false)
+        : entries(std::max(1u, entries)),
+        direct(direct),
+        broken(false),
+        stopping(false)
+    {
+        if (io_uring_queue_init(this->entries, &this->ring, 0) < 0) {
+            throw std::runtime_error("failed to set up io_uring");
+        }
+
+        this->worker = std::thread(&Uring::work, this);
+    }
+
+    Uring(const Uring& o) = delete;
+    Uring& operator=(const Uring& o) = delete;
+    Uring(Uring&& o) noexcept = delete;
+    Uring& operator=(Uring&& o) noexcept = delete;
+
+    ~Uring() {
+        {
+            std::lock_guard<std::mutex> lock(this->mutex);
+            this->stopping = true;
+        }
+
+        this->available.notify_all();
+        this->worker.join();
+
+        for (auto& [path, descriptor] : this->files) {
+            ::close(descriptor);
+        }
+        io_uring_queue_exit(&this->ring);
+    }
+
+    // Reads the segments of the file (kept open for later reads with `keep`), resolved to whether all of them were
+    // read whole. The destinations must stay valid until then.
+    std::future<bool> read(const std::string& path, std::vector<Segment> segments, bool keep = false) {
+        std::promise<bool> done;
+        std::future<bool> result = done.get_future();
+
+        {
+            std::lock_guard<std::mutex> lock(this->mutex);
+            this->queue.push_back({path, keep, std::move(segments), std::move(done)});
+        }
+
+        this->available.notify_one();
+        return result;
+    }
+};
+
+}
+}
+
+
+#endif
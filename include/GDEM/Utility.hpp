@@ -35,6 +35,8 @@ Email : pritamhalder.portfolio@gmail.com
 #include <gdal/gdalwarper.h>
 #include <gdal/ogr_spatialref.h>
 
+#include "GDEM/DEM.hpp"
+
 
 
 namespace GDEM {
@@ -96,9 +98,38 @@ static void Metadata(const std::filesystem::path& file_path) {
 }
 
 
-static void Reproject(GDALDataset* source_dataset, const std::string& destination_filepath, int16_t nodata_value) {
+namespace detail {
+
+static GDALDataset* Open(const std::string& source_filepath) {
+    if (!std::filesystem::exists(source_filepath)) {
+        std::string e = "file (" + source_filepath + ") not found";
+        throw std::runtime_error(e);
+    }
+
+    GDALRegister_GTiff();
+
+    GDALDataset *source_dataset = (GDALDataset *) GDALOpen(source_filepath.c_str(), GA_ReadOnly);
+    if (source_dataset == nullptr) {
+        throw std::runtime_error("failed to open source file");
+    }
+
+    return source_dataset;
+}
+
+
+static GDALDriver* FileDriver() {
     GDALRegister_GTiff();
+    return GetGDALDriverManager()->GetDriverByName("GTiff");
+}
+
+
+static GDALDriver* MemoryDriver() {
+    GDALRegister_MEM();
+    return GetGDALDriverManager()->GetDriverByName("MEM");
+}
+
 
+static GDALDataset* Reproject(GDALDataset* source_dataset, GDALDriver* driver, const std::string& destination_filepath, int16_t nodata_value) {
     // get source projection systerm
     const OGRSpatialReference *source_srs = source_dataset->GetSpatialRef();
 
@@ -112,8 +143,7 @@ static void Reproject(GDALDataset* source_dataset, const std::string& destinatio
         throw std::runtime_error("failed to create coordinate transformations");
     }
 
-    // create target file
-    GDALDriver *driver = GetGDALDriverManager()->GetDriverByName("GTiff");
+    // create target dataset
     GDALDataset *output_dataset = driver->Create(
         destination_filepath.c_str(),
         source_dataset->GetRasterXSize(),
@@ -185,7 +215,15 @@ static void Reproject(GDALDataset* source_dataset, const std::string& destinatio
     // cleanup
     delete[] buffer;
     OGRCoordinateTransformation::DestroyCT(srs_transformations);
-    GDALClose(output_dataset);
+
+    return output_dataset;
+}
+
+}
+
+
+static void Reproject(GDALDataset* source_dataset, const std::string& destination_filepath, int16_t nodata_value) {
+    GDALClose(detail::Reproject(source_dataset, detail::FileDriver(), destination_filepath, nodata_value));
 }
 
 
@@ -225,10 +263,36 @@ static void Reproject(const std::filesystem::path& source_filepath, const std::f
 }
 
 
+template <ValidDataType DataType, uint16_t raster_number = 1, DataType no_data_fallback = std::numeric_limits<DataType>::min()>
+static DEM<DataType, raster_number, no_data_fallback> Reproject(GDALDataset* source_dataset, int16_t nodata_value) {
+    return DEM<DataType, raster_number, no_data_fallback>(detail::Reproject(source_dataset, detail::MemoryDriver(), "", nodata_value));
+}
+
+
+template <ValidDataType DataType, uint16_t raster_number = 1, DataType no_data_fallback = std::numeric_limits<DataType>::min()>
+static DEM<DataType, raster_number, no_data_fallback> Reproject(const std::string& source_filepath, int16_t nodata_value) {
+    GDALDataset *source_dataset = detail::Open(source_filepath);
+
+    try {
+        DEM<DataType, raster_number, no_data_fallback> output = Reproject<DataType, raster_number, no_data_fallback>(source_dataset, nodata_value);
+        GDALClose(source_dataset);
+        return output;
+    } catch (...) {
+        GDALClose(source_dataset);
+        throw;
+    }
+}
 
-static void Merge(const std::vector<GDALDataset*>& source_datasets, const std::string& destination_filepath, int16_t nodata_value) {
-    GDALRegister_GTiff();
 
+template <ValidDataType DataType, uint16_t raster_number = 1, DataType no_data_fallback = std::numeric_limits<DataType>::min()>
+static DEM<DataType, raster_number, no_data_fallback> Reproject(const std::filesystem::path& source_filepath, int16_t nodata_value) {
+    return Reproject<DataType, raster_number, no_data_fallback>(source_filepath.string(), nodata_value);
+}
+
+
+namespace detail {
+
+static GDALDataset* Merge(const std::vector<GDALDataset*>& source_datasets, GDALDriver* driver, const std::string& destination_filepath, int16_t nodata_value) {
     if (source_datasets.empty()) {
         throw std::runtime_error("no input datasets provided");
     }
@@ -255,8 +319,7 @@ static void Merge(const std::vector<GDALDataset*>& source_datasets, const std::s
         cellsize_y = std::max(cellsize_y, std::abs(geotransform[5]));
     }
 
-    // create output file
-    GDALDriver *driver = GetGDALDriverManager()->GetDriverByName("GTiff");
+    // create output dataset
     GDALDataset *output_dataset = driver->Create(
         destination_filepath.c_str(),
         static_cast<int>((max_x - min_x) / cellsize_x),
@@ -265,6 +328,11 @@ static void Merge(const std::vector<GDALDataset*>& source_datasets, const std::s
         GDT_Int16,
         nullptr
     );
+
+    if (output_dataset == nullptr) {
+        throw std::runtime_error("failed to create output dataset");
+    }
+
     output_dataset->GetRasterBand(1)->SetNoDataValue(nodata_value);
 
     double output_geotransform[6] = {min_x, cellsize_x, 0, max_y, 0, -cellsize_y};
@@ -322,8 +390,14 @@ static void Merge(const std::vector<GDALDataset*>& source_datasets, const std::s
         }
     }
 
-    // cleanup
-    GDALClose(output_dataset);
+    return output_dataset;
+}
+
+}
+
+
+static void Merge(const std::vector<GDALDataset*>& source_datasets, const std::string& destination_filepath, int16_t nodata_value) {
+    GDALClose(detail::Merge(source_datasets, detail::FileDriver(), destination_filepath, nodata_value));
 }
 
 
@@ -383,9 +457,48 @@ static void Merge(const std::vector<std::string>& source_filepaths, const std::f
 }
 
 
-static void Clip(GDALDataset* source_dataset, const std::string& destination_filepath, double top_left_x, double top_left_y, double bottom_right_x, double bottom_right_y) {
-    GDALRegister_GTiff();
+template <ValidDataType DataType, uint16_t raster_number = 1, DataType no_data_fallback = std::numeric_limits<DataType>::min()>
+static DEM<DataType, raster_number, no_data_fallback> Merge(const std::vector<GDALDataset*>& source_datasets, int16_t nodata_value) {
+    return DEM<DataType, raster_number, no_data_fallback>(detail::Merge(source_datasets, detail::MemoryDriver(), "", nodata_value));
+}
+
 
+template <ValidDataType DataType, uint16_t raster_number = 1, DataType no_data_fallback = std::numeric_limits<DataType>::min()>
+static DEM<DataType, raster_number, no_data_fallback> Merge(const std::vector<std::string>& source_filepaths, int16_t nodata_value) {
+    if (source_filepaths.empty()) {
+        throw std::runtime_error("no input file paths provided");
+    }
+
+    std::vector<GDALDataset*> datasets;
+    try {
+        for (const std::string& path : source_filepaths) {
+            datasets.push_back(detail::Open(path));
+        }
+
+        DEM<DataType, raster_number, no_data_fallback> output = Merge<DataType, raster_number, no_data_fallback>(datasets, nodata_value);
+        for (GDALDataset *dataset : datasets) GDALClose(dataset);
+        return output;
+    } catch (...) {
+        for (GDALDataset *dataset : datasets) GDALClose(dataset);
+        throw;
+    }
+}
+
+
+template <ValidDataType DataType, uint16_t raster_number = 1, DataType no_data_fallback = std::numeric_limits<DataType>::min()>
+static DEM<DataType, raster_number, no_data_fallback> Merge(const std::vector<std::filesystem::path>& source_filepaths, int16_t nodata_value) {
+    std::vector<std::string> source_filepaths_s;
+    for (const std::filesystem::path& path : source_filepaths) {
+        source_filepaths_s.push_back(path.string());
+    }
+
+    return Merge<DataType, raster_number, no_data_fallback>(source_filepaths_s, nodata_value);
+}
+
+
+namespace detail {
+
+static GDALDataset* Clip(GDALDataset* source_dataset, GDALDriver* driver, const std::string& destination_filepath, double top_left_x, double top_left_y, double bottom_right_x, double bottom_right_y) {
     double geotransform[6];
     if (source_dataset->GetGeoTransform(geotransform) != CE_None) {
         throw std::runtime_error("failed to get dataset transformations");
@@ -414,7 +527,6 @@ static void Clip(GDALDataset* source_dataset, const std::string& destination_fil
     }
 
     // create output dataset
-    GDALDriver *driver = GetGDALDriverManager()->GetDriverByName("GTiff");
     GDALDataset *output_dataset = driver->Create(
         destination_filepath.c_str(),
         output_x_size,
@@ -445,7 +557,7 @@ static void Clip(GDALDataset* source_dataset, const std::string& destination_fil
 
     int data_type_size = GDALGetDataTypeSizeBytes(source_band->GetRasterDataType());
     int buffer_size = output_x_size * output_y_size * data_type_size;
-    static void *buffer = CPLMalloc(buffer_size);
+    void *buffer = CPLMalloc(buffer_size);
 
     if (source_band->RasterIO(GF_Read, start_x, start_y, output_x_size, output_y_size, buffer, output_x_size, output_y_size, source_band->GetRasterDataType(), 0, 0) != CE_None) {
         CPLFree(buffer);
@@ -461,7 +573,15 @@ static void Clip(GDALDataset* source_dataset, const std::string& destination_fil
 
     // cleanup
     CPLFree(buffer);
-    GDALClose(output_dataset);
+
+    return output_dataset;
+}
+
+}
+
+
+static void Clip(GDALDataset* source_dataset, const std::string& destination_filepath, double top_left_x, double top_left_y, double bottom_right_x, double bottom_right_y) {
+    GDALClose(detail::Clip(source_dataset, detail::FileDriver(), destination_filepath, top_left_x, top_left_y, bottom_right_x, bottom_right_y));
 }
 
 
@@ -501,16 +621,42 @@ static void Clip(const std::filesystem::path& source_filepath, const std::filesy
 }
 
 
-static void Resample(GDALDataset* source_dataset, const std::string& destination_filepath, unsigned int output_width, unsigned int output_height) {
-    GDALRegister_GTiff();
+template <ValidDataType DataType, uint16_t raster_number = 1, DataType no_data_fallback = std::numeric_limits<DataType>::min()>
+static DEM<DataType, raster_number, no_data_fallback> Clip(GDALDataset* source_dataset, double top_left_x, double top_left_y, double bottom_right_x, double bottom_right_y) {
+    return DEM<DataType, raster_number, no_data_fallback>(detail::Clip(source_dataset, detail::MemoryDriver(), "", top_left_x, top_left_y, bottom_right_x, bottom_right_y));
+}
+
+
+template <ValidDataType DataType, uint16_t raster_number = 1, DataType no_data_fallback = std::numeric_limits<DataType>::min()>
+static DEM<DataType, raster_number, no_data_fallback> Clip(const std::string& source_filepath, double top_left_x, double top_left_y, double bottom_right_x, double bottom_right_y) {
+    GDALDataset *source_dataset = detail::Open(source_filepath);
+
+    try {
+        DEM<DataType, raster_number, no_data_fallback> output = Clip<DataType, raster_number, no_data_fallback>(source_dataset, top_left_x, top_left_y, bottom_right_x, bottom_right_y);
+        GDALClose(source_dataset);
+        return output;
+    } catch (...) {
+        GDALClose(source_dataset);
+        throw;
+    }
+}
 
+
+template <ValidDataType DataType, uint16_t raster_number = 1, DataType no_data_fallback = std::numeric_limits<DataType>::min()>
+static DEM<DataType, raster_number, no_data_fallback> Clip(const std::filesystem::path& source_filepath, double top_left_x, double top_left_y, double bottom_right_x, double bottom_right_y) {
+    return Clip<DataType, raster_number, no_data_fallback>(source_filepath.string(), top_left_x, top_left_y, bottom_right_x, bottom_right_y);
+}
+
+
+namespace detail {
+
+static GDALDataset* Resample(GDALDataset* source_dataset, GDALDriver* driver, const std::string& destination_filepath, unsigned int output_width, unsigned int output_height) {
     double geotransform[6];
     if (source_dataset->GetGeoTransform(geotransform) != CE_None) {
         throw std::runtime_error("failed to get dataset transformations");
     }
 
     // create output dataset
-    GDALDriver *driver = GetGDALDriverManager()->GetDriverByName("GTiff");
     GDALDataset *output_dataset = driver->Create(
         destination_filepath.c_str(),
         output_width,
@@ -542,8 +688,14 @@ static void Resample(GDALDataset* source_dataset, const std::string& destination
         throw std::runtime_error("failed to resample dataset");
     }
 
-    // cleanup
-    GDALClose(output_dataset);
+    return output_dataset;
+}
+
+}
+
+
+static void Resample(GDALDataset* source_dataset, const std::string& destination_filepath, unsigned int output_width, unsigned int output_height) {
+    GDALClose(detail::Resample(source_dataset, detail::FileDriver(), destination_filepath, output_width, output_height));
 }
 
 
@@ -583,6 +735,33 @@ static void Resample(const std::filesystem::path& source_filepath, const std::fi
 }
 
 
+template <ValidDataType DataType, uint16_t raster_number = 1, DataType no_data_fallback = std::numeric_limits<DataType>::min()>
+static DEM<DataType, raster_number, no_data_fallback> Resample(GDALDataset* source_dataset, unsigned int output_width, unsigned int output_height) {
+    return DEM<DataType, raster_number, no_data_fallback>(detail::Resample(source_dataset, detail::MemoryDriver(), "", output_width, output_height));
+}
+
+
+template <ValidDataType DataType, uint16_t raster_number = 1, DataType no_data_fallback = std::numeric_limits<DataType>::min()>
+static DEM<DataType, raster_number, no_data_fallback> Resample(const std::string& source_filepath, unsigned int output_width, unsigned int output_height) {
+    GDALDataset *source_dataset = detail::Open(source_filepath);
+
+    try {
+        DEM<DataType, raster_number, no_data_fallback> output = Resample<DataType, raster_number, no_data_fallback>(source_dataset, output_width, output_height);
+        GDALClose(source_dataset);
+        return output;
+    } catch (...) {
+        GDALClose(source_dataset);
+        throw;
+    }
+}
+
+
+template <ValidDataType DataType, uint16_t raster_number = 1, DataType no_data_fallback = std::numeric_limits<DataType>::min()>
+static DEM<DataType, raster_number, no_data_fallback> Resample(const std::filesystem::path& source_filepath, unsigned int output_width, unsigned int output_height) {
+    return Resample<DataType, raster_number, no_data_fallback>(source_filepath.string(), output_width, output_height);
+}
+
+
 static std::vector<std::filesystem::path> Coverage(const std::vector<std::string>& filepaths, double top_left_x, double top_left_y, double bottom_right_x, double bottom_right_y) {
     GDALRegister_GTiff();
     std::vector<std::filesystem::path> results;
@@ -0,0 +1,507 @@
+/*
+GDEM : C++ wrapper over GDAL for working with DEM data.
+Copyright (C) 2024  Pritam Halder
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <https://www.gnu.org/licenses/>.
+
+Author : Pritam Halder
+Email : pritamhalder.portfolio@gmail.com
+*/
+
+#pragma once
+
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <filesystem>
+#include <mutex>
+#include <numbers>
+#include <numeric>
+#include <utility>
+#include <vector>
+
+#include <gdal/gdal_priv.h>
+
+#include "GDEM/Block.hpp"
+#include "GDEM/DEM.hpp"
+#include "GDEM/Parallel.hpp"
+#include "GDEM/Statistics.hpp"
+
+
+
+namespace GDEM {
+namespace Void {
+
+enum class Method {
+    IDW,        // inverse distance (squared) weighting of the cells around the hole
+    Laplacian   // smoothest surface through the cells around the hole (harmonic interpolation)
+};
+
+
+
+namespace detail {
+
+// a hole (4-connected NODATA cells), or a piece of one within a block
+struct Hole {
+    uint64_t size;
+    size_t row_min;
+    size_t column_min;
+    size_t row_max;
+    size_t column_max;
+    size_t seed_row;        // one of its cells
+    size_t seed_column;
+    bool edge;              // touches the raster's edge (not enclosed, never filled)
+};
+
+
+// pieces of holes within a block, with the piece (index + 1, 0 for valid cells) on every cell of its edges
+struct Pieces {
+    std::vector<Hole> holes;
+    std::vector<uint32_t> top;
+    std::vector<uint32_t> bottom;
+    std::vector<uint32_t> left;
+    std::vector<uint32_t> right;
+};
+
+
+// connected component labelling of a block's NODATA cells
+template <ValidDataType DataType>
+static Pieces Label(const std::vector<DataType>& values, const Window& window, DataType nodata, size_t rows, size_t columns) {
+    Pieces pieces;
+    std::vector<uint32_t> labels(window.size(), 0);
+    std::vector<size_t> stack;
+
+    for (size_t start = 0; start < window.size(); start++) {
+        if (labels[start] != 0 || Statistics::detail::valid(values[start], nodata)) continue;
+
+        uint32_t label = pieces.holes.size() + 1;
+        size_t sr = window.row + start / window.columns, sc = window.column + start % window.columns;
+        Hole hole{0, sr, sc, sr, sc, sr, sc, false};
+
+        labels[start] = label;
+        stack.push_back(start);
+        while (!stack.empty()) {
+            size_t i = stack.back();
+            stack.pop_back();
+
+            size_t r = i / window.columns, c = i % window.columns;
+            size_t gr = window.row + r, gc = window.column + c;
+            hole.size++;
+            hole.row_min = std::min(hole.row_min, gr);
+            hole.row_max = std::max(hole.row_max, gr);
+            hole.column_min = std::min(hole.column_min, gc);
+            hole.column_max = std::max(hole.column_max, gc);
+            hole.edge = hole.edge || gr == 0 || gc == 0 || gr == rows - 1 || gc == columns - 1;
+
+            auto visit = [&] (size_t j) {
+                if (labels[j] == 0 && !Statistics::detail::valid(values[j], nodata)) {
+                    labels[j] = label;
+                    stack.push_back(j);
+                }
+            };
+            if (r > 0) visit(i - window.columns);
+            if (r + 1 < window.rows) visit(i + window.columns);
+            if (c > 0) visit(i - 1);
+            if (c + 1 < window.columns) visit(i + 1);
+        }
+
+        pieces.holes.push_back(hole);
+    }
+
+    for (size_t c = 0; c < window.columns; c++) {
+        pieces.top.push_back(labels[c]);
+        pieces.bottom.push_back(labels[(window.rows - 1) * window.columns + c]);
+    }
+    for (size_t r = 0; r < window.rows; r++) {
+        pieces.left.push_back(labels[r * window.columns]);
+        pieces.right.push_back(labels[r * window.columns + window.columns - 1]);
+    }
+
+    return pieces;
+}
+
+
+class UnionFind {
+private:
+    std::vector<size_t> parents;
+
+public:
+    UnionFind(size_t count)
+        : parents(count)
+    {
+        std::iota(this->parents.begin(), this->parents.end(), 0);
+    }
+
+    size_t find(size_t i) {
+        while (this->parents[i] != i) {
+            this->parents[i] = this->parents[this->parents[i]];
+            i = this->parents[i];
+        }
+        return i;
+    }
+
+    void unite(size_t a, size_t b) {
+        a = this->find(a);
+        b = this->find(b);
+        if (a != b) this->parents[std::max(a, b)] = std::min(a, b);
+    }
+};
+
+
+constexpr uint8_t known = 0;
+constexpr uint8_t unknown = 1;
+constexpr uint8_t excluded = 2;     // NODATA cells of other holes
+
+
+// Solves the Laplace equation over the unknown cells, known cells as boundary values (excluded cells are left out).
+// Coarse to fine : every level starts from the solution of the coarser one, then relaxes with red-black SOR.
+static void Laplace(std::vector<double>& z, const std::vector<uint8_t>& state, size_t rows, size_t columns) {
+    if (rows > 16 && columns > 16) {
+        size_t coarse_rows = (rows + 1) / 2, coarse_columns = (columns + 1) / 2;
+        std::vector<double> coarse(coarse_rows * coarse_columns, 0);
+        std::vector<uint8_t> coarse_state(coarse_rows * coarse_columns, excluded);
+
+        for (size_t r = 0; r < coarse_rows; r++) {
+            for (size_t c = 0; c < coarse_columns; c++) {
+                double sum = 0;
+                size_t count = 0;
+                bool open = false;
+                for (size_t i = 2 * r; i < std::min(2 * r + 2, rows); i++) {
+                    for (size_t j = 2 * c; j < std::min(2 * c + 2, columns); j++) {
+                        if (state[i * columns + j] == known) {
+                            sum += z[i * columns + j];
+                            count++;
+                        }
+                        open = open || state[i * columns + j] == unknown;
+                    }
+                }
+                size_t k = r * coarse_columns + c;
+                if (count > 0) {
+                    coarse[k] = sum / count;
+                    coarse_state[k] = known;
+                } else if (open) {
+                    coarse_state[k] = unknown;
+                }
+            }
+        }
+
+        Laplace(coarse, coarse_state, coarse_rows, coarse_columns);
+
+        for (size_t r = 0; r < rows; r++) {
+            for (size_t c = 0; c < columns; c++) {
+                if (state[r * columns + c] == unknown) {
+                    z[r * columns + c] = coarse[(r / 2) * coarse_columns + c / 2];
+                }
+            }
+        }
+    } else {
+        double sum = 0;
+        size_t count = 0;
+        for (size_t i = 0; i < z.size(); i++) {
+            if (state[i] == known) {
+                sum += z[i];
+                count++;
+            }
+        }
+        for (size_t i = 0; i < z.size(); i++) {
+            if (state[i] == unknown) z[i] = count > 0 ? sum / count : 0;
+        }
+    }
+
+    double omega = 2 / (1 + std::sin(std::numbers::pi / std::max(rows, columns)));
+    size_t iterations = std::min<size_t>(1000, 2 * std::max(rows, columns));
+
+    for (size_t iteration = 0; iteration < iterations; iteration++) {
+        double change = 0;
+
+        for (size_t parity = 0; parity < 2; parity++) {
+            for (size_t r = 0; r < rows; r++) {
+                for (size_t c = (r + parity) % 2; c < columns; c += 2) {
+                    size_t i = r * columns + c;
+                    if (state[i] != unknown) continue;
+
+                    double sum = 0;
+                    size_t count = 0;
+                    auto add = [&] (size_t j) {
+                        if (state[j] != excluded) {
+                            sum += z[j];
+                            count++;
+                        }
+                    };
+                    if (r > 0) add(i - columns);
+                    if (r + 1 < rows) add(i + columns);
+                    if (c > 0) add(i - 1);
+                    if (c + 1 < columns) add(i + 1);
+                    if (count == 0) continue;
+
+                    double delta = omega * (sum / count - z[i]);
+                    z[i] += delta;
+                    change = std::max(change, std::abs(delta));
+                }
+            }
+        }
+
+        if (change < 1e-4) break;
+    }
+}
+
+
+// Fills a hole within `values` (its bounding box and a cell around it), returning the (index in the window, value)
+// of its cells
+template <ValidDataType DataType>
+static std::vector<std::pair<size_t, DataType>> Fill(
+    const std::vector<DataType>& values, const Window& window, const Hole& hole, DataType nodata, Method method
+) {
+    std::vector<uint8_t> state(window.size(), known);
+    for (size_t i = 0; i < window.size(); i++) {
+        if (!Statistics::detail::valid(values[i], nodata)) state[i] = excluded;
+    }
+
+    // the hole's own cells, from its seed
+    std::vector<size_t> cells, stack = {(hole.seed_row - window.row) * window.columns + (hole.seed_column - window.column)};
+    state[stack[0]] = unknown;
+    while (!stack.empty()) {
+        size_t i = stack.back();
+        stack.pop_back();
+        cells.push_back(i);
+
+        size_t r = i / window.columns, c = i % window.columns;
+        auto visit = [&] (size_t j) {
+            if (state[j] == excluded) {
+                state[j] = unknown;
+                stack.push_back(j);
+            }
+        };
+        if (r > 0) visit(i - window.columns);
+        if (r + 1 < window.rows) visit(i + window.columns);
+        if (c > 0) visit(i - 1);
+        if (c + 1 < window.columns) visit(i + 1);
+    }
+    std::sort(cells.begin(), cells.end());
+
+    std::vector<double> z(window.size(), 0);
+    for (size_t i = 0; i < window.size(); i++) {
+        if (state[i] == known) z[i] = values[i];
+    }
+
+    if (method == Method::Laplacian) {
+        Laplace(z, state, window.rows, window.columns);
+    } else {
+        // the known cells around the hole (8-connected), thinned out for large holes
+        std::vector<size_t> ring;
+        for (size_t i = 0; i < window.size(); i++) {
+            if (state[i] != known) continue;
+            long r = i / window.columns, c = i % window.columns;
+            bool around = false;
+            for (long dr = -1; dr <= 1 && !around; dr++) {
+                for (long dc = -1; dc <= 1 && !around; dc++) {
+                    long nr = r + dr, nc = c + dc;
+                    around = nr >= 0 && nc >= 0 && nr < static_cast<long>(window.rows) && nc < static_cast<long>(window.columns)
+                        && state[nr * window.columns + nc] == unknown;
+                }
+            }
+            if (around) ring.push_back(i);
+        }
+        size_t stride = std::max<size_t>(1, ring.size() / 2048);
+
+        for (size_t i : cells) {
+            double r = i / window.columns, c = i % window.columns, sum = 0, weights = 0;
+            for (size_t k = 0; k < ring.size(); k += stride) {
+                double dr = r - ring[k] / window.columns, dc = c - ring[k] % window.columns;
+                double weight = 1 / (dr * dr + dc * dc);
+                sum += weight * z[ring[k]];
+                weights += weight;
+            }
+            z[i] = weights > 0 ? sum / weights : z[i];
+        }
+    }
+
+    std::vector<std::pair<size_t, DataType>> filled;
+    filled.reserve(cells.size());
+    for (size_t i : cells) {
+        double value = z[i];
+        if constexpr (std::is_integral_v<DataType>) {
+            value = std::round(value);
+        }
+        filled.push_back({i, static_cast<DataType>(value)});
+    }
+
+    return filled;
+}
+
+}
+
+
+
+// Fills the NODATA holes of the DEM, writing the filled DEM to `destination_filepath` (tiled GeoTiff). Holes are
+// found by connected component labelling (4-connected, blocks labelled in parallel & joined across their edges),
+// then every hole of at most `max_hole_size` cells (0 for any size) is filled independently in parallel, top to
+// bottom. The output is streamed block by block : a block is written as soon as the holes overlapping it are filled,
+// and their cells in it released, so only the fills of the blocks still waiting are held. Holes touching the
+// raster's edge aren't enclosed and stay NODATA. `threads` = 0 uses all hardware threads.
+template <ValidDataType DataType, uint16_t raster_number, DataType no_data_fallback>
+static void Fill(
+    const DEM<DataType, raster_number, no_data_fallback>& dem, const std::filesystem::path& destination_filepath,
+    Method method = Method::Laplacian, size_t max_hole_size = 0, size_t threads = 0
+) {
+    GDALDataset *dataset = dem.get_dataset();
+    DataType nodata = dem.type.nodata;
+    size_t rows = dem.type.rows, columns = dem.type.columns;
+
+    BandReader<DataType, raster_number> reader(dataset);
+    std::vector<Window> windows = Blocks(reader.shared());
+    size_t block_rows = windows[0].rows, block_columns = windows[0].columns;
+    size_t grid_columns = (columns + block_columns - 1) / block_columns;
+    ThreadPool pool(threads);
+
+    std::vector<detail::Pieces> pieces(windows.size());
+    pool.parallel_for(windows.size(), [&] (size_t index, size_t) {
+        pieces[index] = detail::Label(reader.read(windows[index]), windows[index], nodata, rows, columns);
+    });
+
+    // join the pieces across block edges
+    std::vector<size_t> bases(windows.size() + 1, 0);
+    for (size_t i = 0; i < windows.size(); i++) {
+        bases[i + 1] = bases[i] + pieces[i].holes.size();
+    }
+
+    detail::UnionFind sets(bases.back());
+    for (size_t i = 0; i < windows.size(); i++) {
+        size_t right = i + 1, below = i + grid_columns;
+
+        if ((i + 1) % grid_columns != 0 && right < windows.size()) {
+            for (size_t r = 0; r < windows[i].rows; r++) {
+                uint32_t a = pieces[i].right[r], b = pieces[right].left[r];
+                if (a != 0 && b != 0) sets.unite(bases[i] + a - 1, bases[right] + b - 1);
+            }
+        }
+        if (below < windows.size()) {
+            for (size_t c = 0; c < windows[i].columns; c++) {
+                uint32_t a = pieces[i].bottom[c], b = pieces[below].top[c];
+                if (a != 0 && b != 0) sets.unite(bases[i] + a - 1, bases[below] + b - 1);
+            }
+        }
+    }
+
+    std::vector<detail::Hole> holes;
+    {
+        std::vector<long> index_of(bases.back(), -1);
+        for (size_t i = 0; i < windows.size(); i++) {
+            for (size_t k = 0; k < pieces[i].holes.size(); k++) {
+                size_t root = sets.find(bases[i] + k);
+                const detail::Hole& piece = pieces[i].holes[k];
+
+                if (index_of[root] < 0) {
+                    index_of[root] = holes.size();
+                    holes.push_back(piece);
+                } else {
+                    detail::Hole& hole = holes[index_of[root]];
+                    hole.size += piece.size;
+                    hole.row_min = std::min(hole.row_min, piece.row_min);
+                    hole.row_max = std::max(hole.row_max, piece.row_max);
+                    hole.column_min = std::min(hole.column_min, piece.column_min);
+                    hole.column_max = std::max(hole.column_max, piece.column_max);
+                    hole.edge = hole.edge || piece.edge;
+                }
+            }
+        }
+    }
+    pieces.clear();
+
+    holes.erase(std::remove_if(holes.begin(), holes.end(), [max_hole_size] (const detail::Hole& hole) {
+        return hole.edge || (max_hole_size > 0 && hole.size > max_hole_size);
+    }), holes.end());
+
+    // top to bottom, so that the output blocks are completed (& written) in about raster order
+    std::sort(holes.begin(), holes.end(), [] (const detail::Hole& a, const detail::Hole& b) {
+        return std::pair(a.row_min, a.column_min) < std::pair(b.row_min, b.column_min);
+    });
+
+    // holes left to fill in every output block, and the filled cells (index in the block, value) it's waiting with
+    std::vector<size_t> remaining(windows.size(), 0);
+    for (const detail::Hole& hole : holes) {
+        for (size_t br = hole.row_min / block_rows; br <= hole.row_max / block_rows; br++) {
+            for (size_t bc = hole.column_min / block_columns; bc <= hole.column_max / block_columns; bc++) {
+                remaining[br * grid_columns + bc]++;
+            }
+        }
+    }
+    std::vector<std::vector<std::pair<size_t, DataType>>> pending(windows.size());
+    std::mutex mutex;
+
+    GDALDataset *output_dataset = Create(destination_filepath, dataset, BufferType<DataType>(), nodata);
+
+    try {
+        BandWriter<DataType> writer(output_dataset);
+
+        // writes a block with its filled cells, which are released
+        auto write = [&] (size_t index) {
+            std::vector<DataType> values = reader.read(windows[index]);
+            for (const auto& [i, value] : pending[index]) {
+                values[i] = value;
+            }
+            std::vector<std::pair<size_t, DataType>>().swap(pending[index]);
+
+            writer.write(windows[index], values.data());
+        };
+
+        std::vector<size_t> untouched;
+        for (size_t index = 0; index < windows.size(); index++) {
+            if (remaining[index] == 0) untouched.push_back(index);
+        }
+        pool.parallel_for(untouched.size(), [&] (size_t k, size_t) {
+            write(untouched[k]);
+        });
+
+        // Fills every hole within its bounding box & a cell around it (never past the raster, holes don't touch its
+        // edge), hands its cells over to their blocks and writes the blocks it completed, so only the fills of the
+        // blocks still waiting for a hole are held.
+        pool.parallel_for(holes.size(), [&] (size_t index, size_t) {
+            const detail::Hole& hole = holes[index];
+            Window box = {hole.row_min - 1, hole.column_min - 1, hole.row_max - hole.row_min + 3, hole.column_max - hole.column_min + 3};
+            std::vector<std::pair<size_t, DataType>> filled = detail::Fill(reader.read(box), box, hole, nodata, method);
+
+            std::vector<size_t> completed;
+            {
+                std::lock_guard<std::mutex> lock(mutex);
+
+                for (const auto& [i, value] : filled) {
+                    size_t r = box.row + i / box.columns, c = box.column + i % box.columns;
+                    size_t block = (r / block_rows) * grid_columns + c / block_columns;
+                    const Window& w = windows[block];
+                    pending[block].emplace_back((r - w.row) * w.columns + (c - w.column), value);
+                }
+
+                for (size_t br = hole.row_min / block_rows; br <= hole.row_max / block_rows; br++) {
+                    for (size_t bc = hole.column_min / block_columns; bc <= hole.column_max / block_columns; bc++) {
+                        if (--remaining[br * grid_columns + bc] == 0) completed.push_back(br * grid_columns + bc);
+                    }
+                }
+            }
+
+            for (size_t block : completed) {
+                write(block);
+            }
+        });
+    } catch (...) {
+        GDALClose(output_dataset);
+        throw;
+    }
+
+    GDALClose(output_dataset);
+}
+
+}
+}
@@ -0,0 +1,406 @@
+/*
+GDEM : C++ wrapper over GDAL for working with DEM data.
+Copyright (C) 2024  Pritam Halder
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <https://www.gnu.org/licenses/>.
+
+Author : Pritam Halder
+Email : pritamhalder.portfolio@gmail.com
+*/
+
+#pragma once
+
+
+#include <algorithm>
+#include <array>
+#include <cmath>
+#include <cstdint>
+#include <limits>
+#include <memory>
+#include <mutex>
+#include <ostream>
+#include <vector>
+
+#include <gdal/gdal_priv.h>
+
+#include "GDEM/Block.hpp"
+#include "GDEM/Change.hpp"
+#include "GDEM/DEM.hpp"
+#include "GDEM/Parallel.hpp"
+#include "GDEM/Statistics.hpp"
+#include "GDEM/Zonal.hpp"
+
+
+
+namespace GDEM {
+namespace Volume {
+
+// design plane, z = elevation + slope_x * (x - origin_x) + slope_y * (y - origin_y) in the dataset's coordinate system
+struct Plane {
+    double elevation;
+    double slope_x;
+    double slope_y;
+    double origin_x;
+    double origin_y;
+
+    Plane()
+        : elevation(0),
+        slope_x(0),
+        slope_y(0),
+        origin_x(0),
+        origin_y(0)
+    {};
+
+    Plane(double elevation, double slope_x = 0, double slope_y = 0, double origin_x = 0, double origin_y = 0)
+        : elevation(elevation),
+        slope_x(slope_x),
+        slope_y(slope_y),
+        origin_x(origin_x),
+        origin_y(origin_y)
+    {};
+
+    Plane(const Plane& o) = default;
+    Plane& operator=(const Plane& o) = default;
+    Plane(Plane&& o) noexcept = default;
+    Plane& operator=(Plane&& o) noexcept = default;
+    ~Plane() = default;
+
+    double at(double x, double y) const {
+        return this->elevation + this->slope_x * (x - this->origin_x) + this->slope_y * (y - this->origin_y);
+    }
+};
+
+
+
+// triangulated design surface, vertices as (x, y, z) in the dataset's coordinate system
+struct TIN {
+    std::vector<std::array<double, 3>> vertices;
+    std::vector<std::array<uint32_t, 3>> triangles;
+};
+
+
+
+// volumes are in (coordinate units)² x elevation units, areas in (coordinate units)² (use a projected DEM)
+struct Result {
+    double cut;             // volume of the DEM above the reference (to be removed)
+    double fill;            // volume of the DEM below the reference (to be filled)
+    double cut_area;
+    double fill_area;
+    double area;            // area of the compared cells
+    uint64_t count;         // no. of compared cells (valid in both the DEM & the reference)
+    uint64_t nodata_count;  // no. of cells in the zone without a DEM or reference value
+
+    Result()
+        : cut(0),
+        fill(0),
+        cut_area(0),
+        fill_area(0),
+        area(0),
+        count(0),
+        nodata_count(0)
+    {};
+
+    Result(const Result& o) = default;
+    Result& operator=(const Result& o) = default;
+    Result(Result&& o) noexcept = default;
+    Result& operator=(Result&& o) noexcept = default;
+    ~Result() = default;
+
+    double net() const {
+        return this->cut - this->fill;
+    }
+
+    friend std::ostream& operator<<(std::ostream& os, const Result& o) {
+        os
+            << "Cut : " << o.cut << "\n"
+            << "Fill : " << o.fill << "\n"
+            << "Net : " << o.net() << "\n"
+            << "Cut Area : " << o.cut_area << "\n"
+            << "Fill Area : " << o.fill_area << "\n"
+            << "Area : " << o.area << "\n"
+            << "Count : " << o.count << "\n"
+            << "No Data Count : " << o.nodata_count;
+
+        return os;
+    }
+};
+
+
+
+namespace detail {
+
+// Neumaier (improved Kahan) compensated sum
+struct Sum {
+    double sum = 0;
+    double compensation = 0;
+
+    void add(double value) {
+        double t = this->sum + value;
+        if (std::abs(this->sum) >= std::abs(value)) {
+            this->compensation += (this->sum - t) + value;
+        } else {
+            this->compensation += (value - t) + this->sum;
+        }
+        this->sum = t;
+    }
+
+    double value() const {
+        return this->sum + this->compensation;
+    }
+};
+
+
+struct Zone {
+    Sum cut;
+    Sum fill;
+    uint64_t cut_count = 0;
+    uint64_t fill_count = 0;
+    uint64_t count = 0;
+    uint64_t nodata_count = 0;
+    std::mutex mutex;
+};
+
+
+// Streams the DEM's blocks in parallel, and for every polygon touching a block accumulates the differences
+// between the DEM & the reference over the polygon's scanline spans. `reference(window, buffer)` fills the
+// reference elevations of a window (NaN where undefined), only for blocks touched by a polygon. Every block's
+// sums are compensated, then added (compensated) to their zones, keeping the error independent of the size.
+template <ValidDataType DataType, uint16_t raster_number, typename Reference>
+static std::vector<Result> Compute(
+    GDALDataset* dataset, DataType nodata, const std::vector<Zonal::Polygon>& polygons, Reference&& reference, size_t threads
+) {
+    double geotransform[6], inverse[6];
+    if (dataset->GetGeoTransform(geotransform) != CE_None || !GDALInvGeoTransform(geotransform, inverse)) {
+        throw std::runtime_error("failed to read dataset transformations");
+    }
+    double cell_area = std::abs(geotransform[1] * geotransform[5] - geotransform[2] * geotransform[4]);
+
+    BandReader<DataType, raster_number> reader(dataset);
+    std::vector<Window> windows = Blocks(reader.shared());
+    ThreadPool pool(threads);
+
+    std::vector<Zonal::detail::Shape> shapes(polygons.size());
+    for (size_t p = 0; p < polygons.size(); p++) {
+        shapes[p] = Zonal::detail::Project(polygons[p], inverse);
+    }
+
+    std::vector<std::vector<uint32_t>> touching = Zonal::detail::Touching(windows, reader.rows(), reader.columns(), shapes.size(), [&] (size_t p) {
+        return std::array<long, 4>{shapes[p].first_row, shapes[p].last_row, shapes[p].first_column, shapes[p].last_column};
+    });
+
+    std::vector<Zone> zones(polygons.size());
+
+    struct Scratch {
+        std::vector<DataType> buffer;
+        std::vector<double> reference;
+        std::vector<const Zonal::detail::Edge*> active;
+        std::vector<double> crossings;
+    };
+    std::vector<Scratch> scratches(pool.size());
+
+    pool.parallel_for(windows.size(), [&] (size_t index, size_t worker) {
+        if (touching[index].empty()) return;
+
+        const Window& window = windows[index];
+        Scratch& scratch = scratches[worker];
+        scratch.buffer.resize(window.size());
+        scratch.reference.resize(window.size());
+        reader.read(window, scratch.buffer.data());
+        reference(window, scratch.reference.data());
+
+        for (uint32_t p : touching[index]) {
+            Sum cut, fill;
+            uint64_t cut_count = 0, fill_count = 0, count = 0, nodata_count = 0;
+
+            Zonal::detail::Scan(shapes[p], window, scratch.active, scratch.crossings, [&] (long row, long first, long last) {
+                size_t offset = (row - window.row) * window.columns;
+                for (long column = first; column <= last; column++) {
+                    size_t i = offset + (column - window.column);
+                    double z = scratch.buffer[i], r = scratch.reference[i];
+
+                    if (!Statistics::detail::valid(scratch.buffer[i], nodata) || std::isnan(r)) {
+                        nodata_count++;
+                        continue;
+                    }
+
+                    double d = z - r;
+                    count++;
+                    if (d > 0) {
+                        cut.add(d);
+                        cut_count++;
+                    } else if (d < 0) {
+                        fill.add(-d);
+                        fill_count++;
+                    }
+                }
+            });
+
+            std::lock_guard<std::mutex> lock(zones[p].mutex);
+            zones[p].cut.add(cut.value());
+            zones[p].fill.add(fill.value());
+            zones[p].cut_count += cut_count;
+            zones[p].fill_count += fill_count;
+            zones[p].count += count;
+            zones[p].nodata_count += nodata_count;
+        }
+    });
+
+    std::vector<Result> results(polygons.size());
+    for (size_t p = 0; p < polygons.size(); p++) {
+        results[p].cut = zones[p].cut.value() * cell_area;
+        results[p].fill = zones[p].fill.value() * cell_area;
+        results[p].cut_area = zones[p].cut_count * cell_area;
+        results[p].fill_area = zones[p].fill_count * cell_area;
+        results[p].area = zones[p].count * cell_area;
+        results[p].count = zones[p].count;
+        results[p].nodata_count = zones[p].nodata_count;
+    }
+
+    return results;
+}
+
+}
+
+
+
+// Cut & fill volumes of the DEM against a design plane, inside every polygon. Blocks are processed in parallel
+// (`threads` = 0 uses all hardware threads), only the blocks in flight are held in memory.
+template <ValidDataType DataType, uint16_t raster_number, DataType no_data_fallback>
+static std::vector<Result> Compute(
+    const DEM<DataType, raster_number, no_data_fallback>& dem, const std::vector<Zonal::Polygon>& polygons, const Plane& reference, size_t threads = 0
+) {
+    double geotransform[6];
+    if (dem.get_dataset()->GetGeoTransform(geotransform) != CE_None) {
+        throw std::runtime_error("failed to read dataset transformations");
+    }
+
+    return detail::Compute<DataType, raster_number>(dem.get_dataset(), dem.type.nodata, polygons, [&] (const Window& window, double* buffer) {
+        for (size_t r = 0; r < window.rows; r++) {
+            for (size_t c = 0; c < window.columns; c++) {
+                double column = window.column + c + 0.5, row = window.row + r + 0.5;
+                double x = geotransform[0] + column * geotransform[1] + row * geotransform[2];
+                double y = geotransform[3] + column * geotransform[4] + row * geotransform[5];
+                buffer[r * window.columns + c] = reference.at(x, y);
+            }
+        }
+    }, threads);
+}
+
+
+// Cut & fill volumes of the DEM against another (design) DEM, resampled onto the DEM's grid when they differ
+template <
+    ValidDataType DataType, uint16_t raster_number, DataType no_data_fallback,
+    ValidDataType ReferenceType, uint16_t reference_raster, ReferenceType reference_fallback
+>
+static std::vector<Result> Compute(
+    const DEM<DataType, raster_number, no_data_fallback>& dem, const std::vector<Zonal::Polygon>& polygons,
+    const DEM<ReferenceType, reference_raster, reference_fallback>& reference, size_t threads = 0
+) {
+    std::shared_ptr<GDALDataset> aligned;
+    GDALDataset *surface = reference.get_dataset();
+    if (!Change::detail::Aligned(dem.get_dataset(), surface)) {
+        aligned = Change::detail::Align(surface, dem.get_dataset(), reference.type.nodata);
+        surface = aligned.get();
+    }
+
+    BandReader<ReferenceType, reference_raster> reader(surface);
+    ReferenceType nodata = reference.type.nodata;
+
+    return detail::Compute<DataType, raster_number>(dem.get_dataset(), dem.type.nodata, polygons, [&] (const Window& window, double* buffer) {
+        std::vector<ReferenceType> values = reader.read(window);
+        for (size_t i = 0; i < values.size(); i++) {
+            buffer[i] = Statistics::detail::valid(values[i], nodata) ? static_cast<double>(values[i]) : std::numeric_limits<double>::quiet_NaN();
+        }
+    }, threads);
+}
+
+
+// Cut & fill volumes of the DEM against a TIN, linearly interpolated within its triangles (undefined outside)
+template <ValidDataType DataType, uint16_t raster_number, DataType no_data_fallback>
+static std::vector<Result> Compute(
+    const DEM<DataType, raster_number, no_data_fallback>& dem, const std::vector<Zonal::Polygon>& polygons, const TIN& reference, size_t threads = 0
+) {
+    GDALDataset *dataset = dem.get_dataset();
+
+    double geotransform[6], inverse[6];
+    if (dataset->GetGeoTransform(geotransform) != CE_None || !GDALInvGeoTransform(geotransform, inverse)) {
+        throw std::runtime_error("failed to read dataset transformations");
+    }
+
+    // vertices in pixel space
+    std::vector<std::array<double, 3>> vertices(reference.vertices.size());
+    for (size_t i = 0; i < vertices.size(); i++) {
+        const auto& [x, y, z] = reference.vertices[i];
+        vertices[i] = {inverse[0] + inverse[1] * x + inverse[2] * y, inverse[3] + inverse[4] * x + inverse[5] * y, z};
+    }
+
+    for (const auto& triangle : reference.triangles) {
+        for (uint32_t v : triangle) {
+            if (v >= vertices.size()) throw std::runtime_error("invalid TIN vertex index " + std::to_string(v));
+        }
+    }
+
+    // triangles are rasterized per block, only those touching it
+    std::vector<Window> windows = Blocks(dataset->GetRasterBand(raster_number));
+    std::vector<std::vector<uint32_t>> touching = Zonal::detail::Touching(
+        windows, dataset->GetRasterYSize(), dataset->GetRasterXSize(), reference.triangles.size(), [&] (size_t t) {
+            const auto& [a, b, c] = reference.triangles[t];
+            double min_x = std::min({vertices[a][0], vertices[b][0], vertices[c][0]}), max_x = std::max({vertices[a][0], vertices[b][0], vertices[c][0]});
+            double min_y = std::min({vertices[a][1], vertices[b][1], vertices[c][1]}), max_y = std::max({vertices[a][1], vertices[b][1], vertices[c][1]});
+            return std::array<long, 4>{
+                static_cast<long>(std::ceil(min_y - 0.5)), static_cast<long>(std::floor(max_y - 0.5)),
+                static_cast<long>(std::ceil(min_x - 0.5)), static_cast<long>(std::floor(max_x - 0.5))
+            };
+        }
+    );
+
+    // block index of a window, the windows form a regular grid
+    size_t block_rows = windows[0].rows, block_columns = windows[0].columns;
+    size_t grid_columns = (dataset->GetRasterXSize() + block_columns - 1) / block_columns;
+
+    return detail::Compute<DataType, raster_number>(dataset, dem.type.nodata, polygons, [&] (const Window& window, double* buffer) {
+        std::fill(buffer, buffer + window.size(), std::numeric_limits<double>::quiet_NaN());
+
+        for (uint32_t t : touching[(window.row / block_rows) * grid_columns + window.column / block_columns]) {
+            const auto& a = vertices[reference.triangles[t][0]];
+            const auto& b = vertices[reference.triangles[t][1]];
+            const auto& c = vertices[reference.triangles[t][2]];
+
+            double area = (b[0] - a[0]) * (c[1] - a[1]) - (c[0] - a[0]) * (b[1] - a[1]);
+            if (area == 0) continue;
+
+            long first_row = std::max<long>(window.row, std::ceil(std::min({a[1], b[1], c[1]}) - 0.5));
+            long last_row = std::min<long>(window.row + window.rows - 1, std::floor(std::max({a[1], b[1], c[1]}) - 0.5));
+            long first_column = std::max<long>(window.column, std::ceil(std::min({a[0], b[0], c[0]}) - 0.5));
+            long last_column = std::min<long>(window.column + window.columns - 1, std::floor(std::max({a[0], b[0], c[0]}) - 0.5));
+
+            for (long row = first_row; row <= last_row; row++) {
+                for (long column = first_column; column <= last_column; column++) {
+                    double x = column + 0.5, y = row + 0.5;
+
+                    // barycentric weights, cells on shared edges take either triangle's (equal) value
+                    double wa = ((b[0] - x) * (c[1] - y) - (c[0] - x) * (b[1] - y)) / area;
+                    double wb = ((c[0] - x) * (a[1] - y) - (a[0] - x) * (c[1] - y)) / area;
+                    double wc = 1 - wa - wb;
+                    if (wa < -1e-12 || wb < -1e-12 || wc < -1e-12) continue;
+
+                    buffer[(row - window.row) * window.columns + (column - window.column)] = wa * a[2] + wb * b[2] + wc * c[2];
+                }
+            }
+        }
+    }, threads);
+}
+
+}
+}
@@ -0,0 +1,449 @@
+/*
+GDEM : C++ wrapper over GDAL for working with DEM data.
+Copyright (C) 2024  Pritam Halder
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <https://www.gnu.org/licenses/>.
+
+Author : Pritam Halder
+Email : pritamhalder.portfolio@gmail.com
+*/
+
+#pragma once
+
+
+#include <algorithm>
+#include <array>
+#include <cmath>
+#include <cstdint>
+#include <filesystem>
+#include <limits>
+#include <map>
+#include <mutex>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include <gdal/gdal_priv.h>
+#include <gdal/gdal_utils.h>
+#include <gdal/ogrsf_frmts.h>
+
+#include "GDEM/Block.hpp"
+#include "GDEM/DEM.hpp"
+#include "GDEM/Parallel.hpp"
+#include "GDEM/Statistics.hpp"
+
+
+
+namespace GDEM {
+namespace Zonal {
+
+// Rings of (x, y) in the dataset's coordinate system, filled with the even-odd rule : the exterior ring
+// followed by its holes (the parts of a multipolygon are added as more rings).
+struct Polygon {
+    std::vector<std::vector<std::pair<double, double>>> rings;
+};
+
+
+
+namespace detail {
+
+// polygon edge in pixel space, from (x0, y0) to (x1, y1) with y0 < y1
+struct Edge {
+    double x0;
+    double y0;
+    double x1;
+    double y1;
+};
+
+
+// polygon in pixel space, with the range of cells whose centers may lie inside it
+struct Shape {
+    std::vector<Edge> edges;
+    long first_row;
+    long last_row;
+    long first_column;
+    long last_column;
+};
+
+
+static Shape Project(const Polygon& polygon, const double* inverse) {
+    Shape shape;
+    double min_x = std::numeric_limits<double>::infinity(), max_x = -min_x;
+    double min_y = min_x, max_y = -min_x;
+
+    for (const auto& ring : polygon.rings) {
+        for (size_t i = 0; i < ring.size(); i++) {
+            const auto& [ax, ay] = ring[i];
+            const auto& [bx, by] = ring[(i + 1) % ring.size()];
+
+            double px0 = inverse[0] + inverse[1] * ax + inverse[2] * ay;
+            double py0 = inverse[3] + inverse[4] * ax + inverse[5] * ay;
+            double px1 = inverse[0] + inverse[1] * bx + inverse[2] * by;
+            double py1 = inverse[3] + inverse[4] * bx + inverse[5] * by;
+
+            min_x = std::min(min_x, px0);
+            max_x = std::max(max_x, px0);
+            min_y = std::min(min_y, py0);
+            max_y = std::max(max_y, py0);
+
+            // horizontal edges never cross a scanline
+            if (py0 == py1) continue;
+            shape.edges.push_back(py0 < py1 ? Edge{px0, py0, px1, py1} : Edge{px1, py1, px0, py0});
+        }
+    }
+
+    if (shape.edges.empty()) {
+        shape.first_row = shape.first_column = 0;
+        shape.last_row = shape.last_column = -1;
+        return shape;
+    }
+
+    // cells are inside when their centers (c + 0.5, r + 0.5) are
+    shape.first_row = static_cast<long>(std::ceil(min_y - 0.5));
+    shape.last_row = static_cast<long>(std::floor(max_y - 0.5));
+    shape.first_column = static_cast<long>(std::ceil(min_x - 0.5));
+    shape.last_column = static_cast<long>(std::floor(max_x - 0.5));
+
+    std::sort(shape.edges.begin(), shape.edges.end(), [] (const Edge& a, const Edge& b) { return a.y0 < b.y0; });
+    return shape;
+}
+
+
+// Scanline rasterization of the shape within the window, calling `span(row, first, last)` for every run of
+// window cells (global columns [first, last]) inside it. Edges enter & leave an active list as the scanline
+// moves down, so every row only intersects the edges crossing it.
+template <typename Span>
+static void Scan(const Shape& shape, const Window& window, std::vector<const Edge*>& active, std::vector<double>& crossings, Span&& span) {
+    long first_row = std::max(shape.first_row, static_cast<long>(window.row));
+    long last_row = std::min(shape.last_row, static_cast<long>(window.row + window.rows) - 1);
+    long first_column = std::max(shape.first_column, static_cast<long>(window.column));
+    long last_column = std::min(shape.last_column, static_cast<long>(window.column + window.columns) - 1);
+    if (first_row > last_row || first_column > last_column) return;
+
+    active.clear();
+    auto next = shape.edges.begin();
+
+    for (long row = first_row; row <= last_row; row++) {
+        double y = row + 0.5;
+
+        for (; next != shape.edges.end() && next->y0 <= y; next++) {
+            active.push_back(&*next);
+        }
+        active.erase(std::remove_if(active.begin(), active.end(), [y] (const Edge* e) { return e->y1 <= y; }), active.end());
+
+        crossings.clear();
+        for (const Edge* e : active) {
+            crossings.push_back(e->x0 + (y - e->y0) * (e->x1 - e->x0) / (e->y1 - e->y0));
+        }
+        std::sort(crossings.begin(), crossings.end());
+
+        for (size_t i = 0; i + 1 < crossings.size(); i += 2) {
+            long first = std::max(first_column, static_cast<long>(std::ceil(crossings[i] - 0.5)));
+            long last = std::min(last_column, static_cast<long>(std::ceil(crossings[i + 1] - 0.5)) - 1);
+            if (first <= last) span(row, first, last);
+        }
+    }
+}
+
+
+// Lists, for every window of a band's (regular) block grid, the items whose cell bounds touch it, where
+// `bounds(i)` gives item i's {first row, last row, first column, last column} (possibly outside the band).
+template <typename Bounds>
+static std::vector<std::vector<uint32_t>> Touching(const std::vector<Window>& windows, size_t rows, size_t columns, size_t count, Bounds&& bounds) {
+    size_t block_rows = windows[0].rows, block_columns = windows[0].columns;
+    size_t grid_columns = (columns + block_columns - 1) / block_columns;
+
+    std::vector<std::vector<uint32_t>> touching(windows.size());
+    for (size_t i = 0; i < count; i++) {
+        std::array<long, 4> b = bounds(i);
+
+        long first_row = std::max(b[0], 0L), last_row = std::min(b[1], static_cast<long>(rows) - 1);
+        long first_column = std::max(b[2], 0L), last_column = std::min(b[3], static_cast<long>(columns) - 1);
+        if (first_row > last_row || first_column > last_column) continue;
+
+        for (size_t r = first_row / block_rows; r <= static_cast<size_t>(last_row) / block_rows; r++) {
+            for (size_t c = first_column / block_columns; c <= static_cast<size_t>(last_column) / block_columns; c++) {
+                touching[r * grid_columns + c].push_back(i);
+            }
+        }
+    }
+
+    return touching;
+}
+
+
+// a zone's partial statistics, with its values counted per bin for the percentiles
+struct Accumulator {
+    Statistics::detail::Moments moments;
+    std::map<int64_t, uint64_t> counts;
+    std::mutex mutex;
+};
+
+
+// Statistics of every polygon over the dataset, in a single pass over the band's natural blocks (in parallel)
+// where each block is scanned for every polygon touching it. Integer values are counted exactly, floating
+// point values in bins of `resolution` for the percentiles.
+template <ValidDataType DataType, uint16_t raster_number>
+static std::vector<Statistics::Summary> Compute(
+    GDALDataset* dataset, DataType nodata, const std::vector<Polygon>& polygons,
+    const std::vector<double>& percentiles, double resolution, size_t bins, size_t threads
+) {
+    if (bins == 0) {
+        throw std::runtime_error("histogram requires at least 1 bin");
+    }
+
+    if (!(resolution > 0)) {
+        throw std::runtime_error("resolution must be positive");
+    }
+
+    double geotransform[6], inverse[6];
+    if (dataset->GetGeoTransform(geotransform) != CE_None || !GDALInvGeoTransform(geotransform, inverse)) {
+        throw std::runtime_error("failed to read dataset transformations");
+    }
+
+    BandReader<DataType, raster_number> reader(dataset);
+    std::vector<Window> windows = Blocks(reader.shared());
+    ThreadPool pool(threads);
+
+    std::vector<Shape> shapes(polygons.size());
+    for (size_t p = 0; p < polygons.size(); p++) {
+        shapes[p] = Project(polygons[p], inverse);
+    }
+
+    std::vector<std::vector<uint32_t>> touching = Touching(windows, reader.rows(), reader.columns(), shapes.size(), [&] (size_t p) {
+        return std::array<long, 4>{shapes[p].first_row, shapes[p].last_row, shapes[p].first_column, shapes[p].last_column};
+    });
+
+    auto key = [resolution] (DataType value) -> int64_t {
+        if constexpr (std::is_integral_v<DataType>) return value;
+        else return static_cast<int64_t>(std::floor(value / resolution));
+    };
+
+    std::vector<Accumulator> zones(polygons.size());
+
+    struct Scratch {
+        std::vector<DataType> buffer;
+        std::vector<DataType> values;
+        std::vector<const Edge*> active;
+        std::vector<double> crossings;
+    };
+    std::vector<Scratch> scratches(pool.size());
+
+    pool.parallel_for(windows.size(), [&] (size_t index, size_t worker) {
+        if (touching[index].empty()) return;
+
+        const Window& window = windows[index];
+        Scratch& scratch = scratches[worker];
+        scratch.buffer.resize(window.size());
+        reader.read(window, scratch.buffer.data());
+
+        for (uint32_t p : touching[index]) {
+            scratch.values.clear();
+            Scan(shapes[p], window, scratch.active, scratch.crossings, [&] (long row, long first, long last) {
+                const DataType *values = scratch.buffer.data() + (row - window.row) * window.columns;
+                scratch.values.insert(scratch.values.end(), values + (first - window.column), values + (last - window.column) + 1);
+            });
+            if (scratch.values.empty()) continue;
+
+            Statistics::detail::Moments moments = Statistics::detail::Reduce(scratch.values.data(), scratch.values.size(), nodata);
+
+            // runs of equal keys of the sorted valid values
+            auto end = std::remove_if(scratch.values.begin(), scratch.values.end(), [nodata] (DataType v) { return !Statistics::detail::valid(v, nodata); });
+            std::sort(scratch.values.begin(), end);
+
+            std::lock_guard<std::mutex> lock(zones[p].mutex);
+            zones[p].moments.merge(moments);
+            for (auto it = scratch.values.begin(); it != end;) {
+                int64_t k = key(*it);
+                auto run = it;
+                while (run != end && key(*run) == k) run++;
+                zones[p].counts[k] += run - it;
+                it = run;
+            }
+        }
+    });
+
+    std::vector<Statistics::Summary> summaries(polygons.size());
+
+    pool.parallel_for(polygons.size(), [&] (size_t p, size_t) {
+        const Statistics::detail::Moments& moments = zones[p].moments;
+        Statistics::Summary& summary = summaries[p];
+
+        summary.count = moments.count;
+        summary.nodata_count = moments.nodata_count;
+        summary.histogram = Statistics::Histogram(0, 0, bins);
+        if (moments.count == 0) return;
+
+        summary.minimum = moments.minimum;
+        summary.maximum = moments.maximum;
+        summary.mean = moments.mean;
+        summary.sum = moments.mean * moments.count;
+        summary.stddev = std::sqrt(moments.m2 / moments.count);
+
+        auto value = [&] (int64_t k) -> double {
+            if constexpr (std::is_integral_v<DataType>) return k;
+            else return std::clamp((k + 0.5) * resolution, summary.minimum, summary.maximum);
+        };
+
+        for (double percentile : percentiles) {
+            // nearest rank, exact for integer values
+            uint64_t rank = std::max<uint64_t>(1, static_cast<uint64_t>(std::ceil(std::clamp(percentile, 0.0, 100.0) / 100.0 * summary.count)));
+            uint64_t cumulative = 0;
+            for (const auto& [k, count] : zones[p].counts) {
+                cumulative += count;
+                if (cumulative >= rank) {
+                    summary.percentiles[percentile] = value(k);
+                    break;
+                }
+            }
+        }
+
+        summary.histogram = Statistics::Histogram(summary.minimum, summary.maximum, bins);
+        for (const auto& [k, count] : zones[p].counts) {
+            summary.histogram.counts[summary.histogram.bin(value(k))] += count;
+        }
+
+        std::map<int64_t, uint64_t>().swap(zones[p].counts);
+    });
+
+    return summaries;
+}
+
+}
+
+
+
+// Reads the polygons (& multipolygons) of a vector file's layer, in the order of its features. Features
+// without a polygon geometry give empty polygons, so results stay aligned with the features.
+static std::vector<Polygon> Read(const std::filesystem::path& source_filepath, int layer_index = 0) {
+    GDALAllRegister();
+
+    GDALDataset *dataset = GDALDataset::FromHandle(GDALOpenEx(source_filepath.string().c_str(), GDAL_OF_VECTOR | GDAL_OF_READONLY, nullptr, nullptr, nullptr));
+    if (dataset == nullptr) {
+        throw std::runtime_error("failed to open vector dataset '" + source_filepath.string() + "'");
+    }
+
+    OGRLayer *layer = layer_index < dataset->GetLayerCount() ? dataset->GetLayer(layer_index) : nullptr;
+    if (layer == nullptr) {
+        GDALClose(dataset);
+        throw std::runtime_error("invalid layer " + std::to_string(layer_index));
+    }
+
+    auto add = [] (Polygon& polygon, OGRLinearRing* ring) {
+        if (ring == nullptr) return;
+
+        std::vector<std::pair<double, double>> points;
+        for (int i = 0; i < ring->getNumPoints(); i++) {
+            points.push_back({ring->getX(i), ring->getY(i)});
+        }
+        polygon.rings.push_back(std::move(points));
+    };
+
+    auto add_polygon = [&add] (Polygon& polygon, OGRPolygon* part) {
+        add(polygon, part->getExteriorRing());
+        for (int i = 0; i < part->getNumInteriorRings(); i++) {
+            add(polygon, part->getInteriorRing(i));
+        }
+    };
+
+    std::vector<Polygon> polygons;
+    layer->ResetReading();
+
+    OGRFeature *feature;
+    while ((feature = layer->GetNextFeature()) != nullptr) {
+        Polygon polygon;
+        OGRGeometry *geometry = feature->GetGeometryRef();
+
+        if (geometry != nullptr) {
+            OGRwkbGeometryType type = wkbFlatten(geometry->getGeometryType());
+
+            if (type == wkbPolygon) {
+                add_polygon(polygon, static_cast<OGRPolygon*>(geometry));
+            } else if (type == wkbMultiPolygon) {
+                OGRMultiPolygon *parts = static_cast<OGRMultiPolygon*>(geometry);
+                for (int i = 0; i < parts->getNumGeometries(); i++) {
+                    add_polygon(polygon, parts->getGeometryRef(i));
+                }
+            }
+        }
+
+        polygons.push_back(std::move(polygon));
+        OGRFeature::DestroyFeature(feature);
+    }
+
+    GDALClose(dataset);
+    return polygons;
+}
+
+
+
+// Statistics (count, NODATA count, minimum, maximum, sum, mean, standard deviation, percentiles & histogram)
+// of the DEM's cells whose centers lie inside every polygon, in a single parallel pass over the DEM's blocks
+// (`threads` = 0 uses all hardware threads). Percentiles are exact for integer DEMs, floating point values are
+// binned at `resolution` elevation units.
+template <ValidDataType DataType, uint16_t raster_number, DataType no_data_fallback>
+static std::vector<Statistics::Summary> Compute(
+    const DEM<DataType, raster_number, no_data_fallback>& dem,
+    const std::vector<Polygon>& polygons,
+    const std::vector<double>& percentiles = {25, 50, 75},
+    double resolution = 0.01,
+    size_t bins = 256,
+    size_t threads = 0
+) {
+    return detail::Compute<DataType, raster_number>(dem.get_dataset(), dem.type.nodata, polygons, percentiles, resolution, bins, threads);
+}
+
+
+// statistics over the mosaic of the DEM files (later files take priority where they overlap)
+template <ValidDataType DataType, uint16_t raster_number = 1>
+static std::vector<Statistics::Summary> Compute(
+    const std::vector<std::string>& source_filepaths,
+    const std::vector<Polygon>& polygons,
+    const std::vector<double>& percentiles = {25, 50, 75},
+    double resolution = 0.01,
+    size_t bins = 256,
+    size_t threads = 0
+) {
+    Mosaic mosaic(source_filepaths);
+    GDALDataset *dataset = mosaic.get_dataset();
+
+    int has_nodata = 0;
+    double nodata = dataset->GetRasterBand(raster_number)->GetNoDataValue(&has_nodata);
+
+    return detail::Compute<DataType, raster_number>(
+        dataset, has_nodata ? static_cast<DataType>(nodata) : std::numeric_limits<DataType>::lowest(),
+        polygons, percentiles, resolution, bins, threads
+    );
+}
+
+
+template <ValidDataType DataType, uint16_t raster_number = 1>
+static std::vector<Statistics::Summary> Compute(
+    const std::vector<std::filesystem::path>& source_filepaths,
+    const std::vector<Polygon>& polygons,
+    const std::vector<double>& percentiles = {25, 50, 75},
+    double resolution = 0.01,
+    size_t bins = 256,
+    size_t threads = 0
+) {
+    std::vector<std::string> source_filepaths_s;
+    for (const std::filesystem::path& path : source_filepaths) {
+        source_filepaths_s.push_back(path.string());
+    }
+
+    return Compute<DataType, raster_number>(source_filepaths_s, polygons, percentiles, resolution, bins, threads);
+}
+
+}
+}